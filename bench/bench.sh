@@ -0,0 +1,290 @@
+#!/bin/bash
+
+# Benchmarks of ./noname. Every case generates its input in a scratch directory
+# and prints the best wall clock time of a few runs of each variant, in seconds.
+#
+#   ./bench/bench.sh                 all the cases
+#   ./bench/bench.sh itlb ...        only these
+#   ./bench/bench.sh --runs=5 ...    best of 5 runs (3 by default)
+
+noname=$(pwd)/noname
+runs=3
+cases=()
+
+for i in "$@"; do
+  key="$1"
+  case $key in
+      --runs=*)
+      runs="${key#*=}"
+      shift
+      ;;
+      --noname=*)
+      noname="${key#*=}"
+      shift
+      ;;
+      "")
+      shift
+      ;;
+      *)
+      cases+=("$key")
+      shift
+      ;;
+  esac
+done
+
+if [ ! -x $noname ]; then
+  echo "$noname not found, run make first"
+  exit 1
+fi
+
+work=$(mktemp -d)
+trap "rm -rf $work" EXIT
+
+# best wall clock time of $runs runs of the command, stdin from $input
+best_time() {
+  local best=""
+  for run in $(seq $runs); do
+    local start=$(date +%s.%N)
+    "$@" < $input > /dev/null 2>&1
+    local end=$(date +%s.%N)
+    best=$(awk -v start=$start -v end=$end -v best=$best \
+      'BEGIN { elapsed = end - start; if (best == "" || elapsed < best) best = elapsed; printf "%.3f", best }')
+  done
+  echo $best
+}
+
+# prints the best time of a variant: report <label> <command...>
+report() {
+  local label=$1
+  shift
+  printf "  %-40s %ss\n" "$label" $(best_time "$@")
+}
+
+# prints the noname statistics of a group for one run: stats <group> <command...>
+stats() {
+  local group=$1
+  shift
+  "$@" -noname-stats < $input 2>&1 | grep "$group" | sed 's/^/    /'
+}
+
+# iTLB pressure of code spread over many modules: 2,000 functions, each defined
+# on its own line and so compiled in its own module, calling each other in a
+# chain that a loop runs 10,000 times
+bench_itlb() {
+  echo "itlb: 2,000 modules calling each other, 20M calls"
+  input=$work/itlb.nn
+  echo "def f1999(x) { return x + 1; }" > $input
+  for k in $(seq 1998 -1 0); do
+    echo "def f$k(x) { return f$((k + 1))(x) + 1; }" >> $input
+  done
+  cat >> $input <<'NN'
+def drive(n) {
+  let total = 0;
+  let i = 0;
+  while (i < n) {
+    total = total + f0(i);
+    i = i + 1;
+  }
+  return total;
+}
+drive(10000);
+NN
+
+  report "slabs" $noname -tier=jit -q
+  report "slabs, huge pages" $noname -tier=jit -q -jit-huge-pages
+  stats jit-memory $noname -tier=jit -q
+
+  if command -v perf > /dev/null; then
+    for flags in "" "-jit-huge-pages"; do
+      echo "    perf stat $flags:"
+      perf stat -x, -e iTLB-loads,iTLB-load-misses $noname -tier=jit -q $flags < $input 2>&1 > /dev/null |
+        grep iTLB | sed 's/^/      /'
+    done
+  fi
+}
+
+# call overhead: the same loop, 10M times, calling a one line function defined
+# on a line of its own (so compiled in another module and never inlined) and
+# doing the same work in place
+bench_calls() {
+  echo "calls: 10M calls of a function of another module"
+  input=$work/calls.nn
+  cat > $input <<'NN'
+def inc(x) { return x + 1; }
+def drive(n) {
+  let x = 0;
+  let i = 0;
+  while (i < n) {
+    x = inc(x);
+    i = i + 1;
+  }
+  return x;
+}
+drive(10000000);
+NN
+  report "calls" $noname -tier=jit -q -fold-fuel=0
+
+  input=$work/calls-inline.nn
+  cat > $input <<'NN'
+def drive(n) {
+  let x = 0;
+  let i = 0;
+  while (i < n) {
+    x = x + 1;
+    i = i + 1;
+  }
+  return x;
+}
+drive(10000000);
+NN
+  report "no calls" $noname -tier=jit -q -fold-fuel=0
+}
+
+# exact integers: factorial(10000) goes through bigints from 21! on, while a
+# sum of 10^8 small ints never leaves the long fast path; the same sum on
+# doubles, with no overflow check, is what that path should cost
+bench_bigint() {
+  echo "bigint: factorial(10000), sums over 10^8 small numbers"
+  input=$work/factorial.nn
+  cat > $input <<'NN'
+def factorial(n) {
+  let result = 1;
+  let i = 2;
+  while (i <= n) {
+    result = result * i;
+    i = i + 1;
+  }
+  return result;
+}
+factorial(10000);
+NN
+  report "factorial(10000)" $noname -tier=jit -q -fold-fuel=0
+
+  input=$work/sum-long.nn
+  cat > $input <<'NN'
+def sum_small(n) {
+  let total = 0;
+  let i = 0;
+  while (i < n) {
+    total = total + i;
+    i = i + 1;
+  }
+  return total;
+}
+sum_small(100000000);
+NN
+  report "sum of 10^8 longs" $noname -tier=jit -q -fold-fuel=0
+
+  input=$work/sum-double.nn
+  cat > $input <<'NN'
+def sum_small(n) {
+  let total = 0.0;
+  let i = 0.0;
+  while (i < n) {
+    total = total + i;
+    i = i + 1.0;
+  }
+  return total;
+}
+sum_small(100000000.0);
+NN
+  report "sum of 10^8 doubles" $noname -tier=jit -q -fold-fuel=0
+}
+
+# startup: the statements of test.nn run by the JIT and by the bytecode VM.
+# The 10^8 deep recursion is left out, it measures the run and not the start
+bench_startup() {
+  echo "startup: test.nn, JIT against bytecode"
+  input=$work/startup.nn
+  grep -v "^sum_to(100000000" test.nn > $input
+
+  report "-tier=jit" $noname -tier=jit -q
+  report "-tier=bytecode" $noname -tier=bytecode -q
+  stats bytecode $noname -tier=bytecode -q
+}
+
+# the precompiled prelude: time to the first prompt (no input at all) and to
+# the first result calling it, against noname-stage0 (the same binary without
+# the prelude) compiling lib/prelude.nn from source
+bench_prelude() {
+  echo "prelude: time to the first prompt and to the first result"
+  input=/dev/null
+  report "first prompt" $noname -q
+
+  input=$work/first.nn
+  echo "fact(10);" > $input
+  report "first result" $noname -q
+
+  if [ -x $(dirname $noname)/noname-stage0 ]; then
+    input=$work/first-stage0.nn
+    echo "#import \"$(pwd)/lib/prelude.nn\";" > $input
+    echo "fact(10);" >> $input
+    report "first result, prelude from source" $(dirname $noname)/noname-stage0 -q
+  fi
+}
+
+# session snapshots: restoring 1,000 compiled functions against compiling
+# them again from source
+bench_restore() {
+  echo "restore: a session of 1,000 functions"
+  source=$work/session.nn
+  > $source
+  for k in $(seq 1000); do
+    echo "def f$k(x) { return x * $k + 1; }" >> $source
+  done
+
+  input=$work/save.nn
+  cat $source > $input
+  echo ":save $work/session.nns" >> $input
+  $noname -tier=jit -q < $input > /dev/null 2>&1
+
+  input=/dev/null
+  report "-restore" $noname -q -restore=$work/session.nns
+  input=$source
+  report "from source" $noname -tier=jit -q
+}
+
+# parallel compilation: a file of 2,000 functions compiled by 1, 2, 4, ...
+# threads, up to one per core
+bench_jobs() {
+  echo "jobs: a file of 2,000 functions"
+  input=$work/jobs.nn
+  > $input
+  for k in $(seq 2000); do
+    cat >> $input <<NN
+def g$k(n) {
+  let total = 0;
+  let i = 0;
+  while (i < n) {
+    total = total + i * $k - (i + $k) * 2;
+    i = i + 1;
+  }
+  return total;
+}
+NN
+  done
+
+  cores=$(nproc 2> /dev/null || echo 1)
+  threads=1
+  while [ $threads -le $cores ]; do
+    report "-jobs=$threads" $noname -tier=jit -q -jobs=$threads
+    threads=$((threads * 2))
+  done
+  if [ $((threads / 2)) -ne $cores ]; then
+    report "-jobs=$cores" $noname -tier=jit -q -jobs=$cores
+  fi
+}
+
+all_cases="itlb calls bigint startup prelude restore jobs"
+if [ ${#cases[@]} -eq 0 ]; then
+  cases=($all_cases)
+fi
+
+for name in "${cases[@]}"; do
+  if ! declare -f bench_$name > /dev/null; then
+    echo "unknown case $name, one of: $all_cases"
+    exit 1
+  fi
+  bench_$name
+  echo
+done
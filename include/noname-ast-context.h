@@ -103,6 +103,10 @@ class ASTContext {
   std::string getName() const { return name; }
   ASTContext* getParent() const { return parent; }
 
+  // of this context only, not of its parents
+  const std::map<std::string, FunctionSignature*>& getFunctionSignatures() const { return mFunctionSignatures; }
+  const std::map<std::string, NodeValue*>& getVariables() const { return mVariables; }
+
   // Functions
   FunctionSignature* getFunctionSignature(const std::string& name);
   bool storeFunctionSignature(const std::string name, FunctionSignature* function_signature);
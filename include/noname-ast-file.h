@@ -0,0 +1,50 @@
+#ifndef _NONAME_AST_FILE_H
+#define _NONAME_AST_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace noname {
+
+class ASTNode;
+
+/**
+ * Serialized AST files.
+ *
+ * With -emit-ast=<file> every top level statement parsed from the input is
+ * recorded, and the file is written on exit: a header (magic, version, hash of
+ * the payload and of the source it was parsed from), then an array of fixed
+ * size nodes, the lists of child nodes and the interned symbol table. The
+ * nodes refer to each other, to lists and to symbols by index, so the file is
+ * mmap-ed and read in place.
+ *
+ * -load-ast=<file> runs the statements of such a file before the input, without
+ * lexing or parsing anything. An `#import "lib.nn"` picks up lib.nn.ast in the
+ * same way when it was emitted from the very same lib.nn:
+ *
+ *   $ ./noname -emit-ast=lib.nn.ast < lib.nn
+ */
+extern std::string emit_ast_file;
+extern std::string load_ast_file;
+
+// Called by noname_read when it starts reading the input, after the bootstrap
+// code ran: starts the recording of -emit-ast and runs -load-ast
+void ast_file_begin_input();
+// Bytes read from the input, hashed as the source of -emit-ast
+void ast_file_input(const char* buf, size_t size);
+
+// Records a top level statement as it was parsed (before pre_process)
+void ast_file_record(ASTNode* node);
+bool write_ast_file(const std::string& file_path);
+
+// Hash of the contents of a source file, as -emit-ast records it
+bool hash_source_file(const std::string& file_path, uint64_t& hash);
+
+// Builds the statements of an AST file and evaluates them one by one, as if
+// they were parsed. False, with nothing run, when the file does not exist, is
+// not valid or (unless source_hash is 0) was emitted from another source.
+bool run_ast_file(const std::string& file_path, uint64_t source_hash = 0);
+}
+
+#endif
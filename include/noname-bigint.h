@@ -0,0 +1,56 @@
+#ifndef _NONAME_BIGINT_H
+#define _NONAME_BIGINT_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace noname {
+
+/**
+ * Arbitrary precision integer behind TYPE_BIGINT.
+ *
+ * Integers are longs as long as they fit: the arithmetic on longs checks for
+ * overflow and only then moves to a BigInt, and every BigInt result that fits
+ * in a long goes back to being a long (see fitsLong). User code never sees the
+ * difference.
+ *
+ * The magnitude is kept in 32 bit limbs, least significant first, without
+ * leading zero limbs; zero has no limbs and is never negative.
+ */
+class BigInt {
+ private:
+  bool negative;
+  std::vector<uint32_t> limbs;
+
+ public:
+  BigInt() : negative(false) {}
+  explicit BigInt(long value);
+  // leading zero limbs are dropped
+  BigInt(bool negative, std::vector<uint32_t>&& limbs);
+
+  bool isZero() const { return limbs.empty(); }
+  bool isNegative() const { return negative; }
+  const std::vector<uint32_t>& getLimbs() const { return limbs; }
+
+  bool fitsLong() const;
+  long toLong() const;
+  double toDouble() const;
+  std::string toString() const;
+
+  // <0, 0 or >0 like strcmp
+  int compare(const BigInt& other) const;
+
+  BigInt operator-() const;
+  BigInt operator+(const BigInt& other) const;
+  BigInt operator-(const BigInt& other) const;
+  BigInt operator*(const BigInt& other) const;
+  // truncated towards zero like the division of longs; other must not be zero
+  BigInt operator/(const BigInt& other) const;
+
+  // exponent >= 0
+  BigInt pow(long exponent) const;
+};
+}
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef _NONAME_BYTECODE_H
+#define _NONAME_BYTECODE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace noname {
+
+class CallExpNode;
+class FunctionDefNode;
+class TaggedValue;
+
+/**
+ * Bytecode execution tier.
+ *
+ * Compiling a function with LLVM (module, pass manager, instruction selection,
+ * linking) costs far more than running it once, which is what most statements
+ * of a script or of a REPL session do. With -tier=bytecode functions are
+ * compiled to a register based bytecode instead, and top level calls run on a
+ * threaded VM over it.
+ *
+ * A function is compiled to bytecode when it only uses what the VM runs:
+ * arithmetic, comparisons, variables, if, loops and calls to other bytecode
+ * functions. Anything else (inner functions, calls to a function the JIT
+ * compiled) is compiled by the JIT as before. Before the JIT compiles anything
+ * the functions that only exist as bytecode are compiled too, so JIT code can
+ * always call them.
+ *
+ * With the JIT, functions are compiled to bytecode too, only to evaluate calls
+ * at compile time. A function is pure when neither it nor anything it may call
+ * reads a variable of the top level: the VM runs no I/O and writes no global
+ * anyway. A call of a pure function whose arguments are all literals (or
+ * defaults), e.g. `f3(11, 22)`, is run on the VM when the call is compiled, and
+ * its number becomes a constant of the caller; a top level call like that is
+ * printed without compiling anything. Every evaluation has -fold-fuel jumps and
+ * calls to run, so a loop or a recursion that does not end cannot hang the
+ * compilation: the call is compiled as usual once the fuel ran out. So is a
+ * call that would divide by zero (or the minimum of a type by -1): the call may
+ * never run, and its error belongs to run time.
+ */
+enum ExecutionTier { TIER_AUTO, TIER_JIT, TIER_BYTECODE };
+
+extern ExecutionTier execution_tier;
+// jumps and calls an evaluation at compile time may run, 0 to evaluate nothing
+extern uint64_t bytecode_fold_fuel;
+
+// Compiles the function to bytecode; false when it uses something the VM does
+// not run and it has to go to the JIT. With jit_compiled the JIT compiles it as
+// well, and the bytecode is only used to evaluate calls at compile time.
+bool bytecode_compile_function(FunctionDefNode* function_def_node, bool jit_compiled = false);
+
+// Runs a top level call on the VM and prints its value. False, with nothing
+// run, when the call cannot be compiled to bytecode.
+bool bytecode_run_top_level(CallExpNode* call_exp_node);
+
+// JIT compiles the functions that so far only exist as bytecode; must be called
+// before compiling code that may call them
+void bytecode_tier_up();
+
+// Whether the function compiled to bytecode last under name is pure; when it
+// is, self_calls gets the number of calls to itself not in tail position
+bool bytecode_is_pure(const std::string& name, int* self_calls = nullptr);
+// The value of a call of the pure function callee with constant arguments,
+// computed on the VM with at most -fold-fuel to burn; false when callee is not
+// pure, ran out of fuel, would trap on a division or computed nothing
+bool bytecode_evaluate_call(const std::string& callee, const std::vector<TaggedValue>& args, TaggedValue& result);
+// Evaluates and prints a top level call of a pure function with constant
+// arguments; false, with nothing printed, when it is not one
+bool bytecode_evaluate_top_level(CallExpNode* call_exp_node);
+}
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef _NONAME_DEDUPE_H
+#define _NONAME_DEDUPE_H
+
+#include "llvm/IR/Type.h"
+#include "noname-jit.h"
+#include <cstdint>
+#include <set>
+#include <string>
+
+namespace noname {
+
+class CallExpNode;
+class FunctionDefNode;
+class TopLevelExpNode;
+
+/**
+ * Deduplication of compiled code.
+ *
+ * Every function name has a version, bumped whenever code is generated for it
+ * (a definition, a recompilation after a top level variable was reassigned, a
+ * tier up). The code of a function or of a top level expression is identified
+ * by its AST, looked up by structural hash and compared by canonical
+ * serialization, together with the versions of the functions it called when
+ * it was generated: its calls are bound to that code, and nothing else goes
+ * into it.
+ *
+ * A top level expression identical to one run before (`qux_int();` again) runs
+ * the code compiled for it, without compiling anything: the last
+ * -dedupe-expressions of them keep their modules linked.
+ *
+ * A function definition identical to the last definition of another function
+ * compiles to a tail call to it, so both share its machine code; an identical
+ * definition of the same function compiles to nothing.
+ */
+extern unsigned dedupe_expressions;
+
+// Called whenever code is generated for the function name
+void dedupe_function_generated(const std::string& name);
+// Records a call made by the code being generated
+void dedupe_function_call(const std::string& callee);
+
+// While it lives, the functions called by the code generated are recorded
+class DedupeRecording {
+ public:
+  DedupeRecording();
+  ~DedupeRecording();
+
+  const std::set<std::string>& getCallees() const { return callees; }
+
+ private:
+  std::set<std::string> callees;
+};
+
+// Defines the function with the code of an identical definition, if there is
+// one; false when it has to be compiled
+bool dedupe_function_definition(FunctionDefNode* function_def_node);
+// Records the code just generated for the function
+void dedupe_function_compiled(const FunctionDefNode* function_def_node, const std::set<std::string>& callees);
+
+// Runs and prints the top level expression with the code of an identical one;
+// false, with nothing run, when there is none
+bool dedupe_run_top_level(const CallExpNode* call_exp_node);
+// Keeps the module of the top level expression just run for the identical ones
+// that follow; false when it is not kept and can be removed
+bool dedupe_keep_top_level(const TopLevelExpNode* top_level_exp_node, llvm::orc::NonameJIT::ModuleHandleT module_handle,
+                           uint64_t address, llvm::Type* result_type);
+}
+
+#endif
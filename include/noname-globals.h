@@ -0,0 +1,61 @@
+#ifndef _NONAME_GLOBALS_H
+#define _NONAME_GLOBALS_H
+
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Value.h"
+#include <set>
+#include <string>
+
+namespace noname {
+
+class NodeValue;
+class FunctionDefNode;
+
+/**
+ * Top level variables in compiled code.
+ *
+ * The variables of the root context (`let PI = 3.143;` at the prompt) are
+ * stored by the interpreter. Each of them also gets a datatype_t slot in the
+ * host, kept up to date by the root context and exported by name
+ * (noname_global_<name>), so compiled functions read it with a load instead of
+ * a lookup in the context.
+ *
+ * A variable never reassigned since it was declared is not even loaded: its
+ * value is emitted as a constant of the module, which the optimizer folds into
+ * the function. The first reassignment makes it mutable, and the functions that
+ * folded it are compiled again, with every function calling them (the calls of
+ * the old callers are bound to the old code), in a new module.
+ *
+ * Strings and bigints are always read from the slot, and so are the variables
+ * read by top level expressions, whose modules are removed once they ran.
+ */
+
+// Called by the root context whenever one of its variables is stored
+void global_variable_stored(const std::string& name, NodeValue* node_value);
+
+// The datatype_t of the top level variable name for the function being
+// compiled; nullptr when there is no such variable
+llvm::Value* global_variable_codegen(const std::string& name, llvm::BasicBlock* bb);
+
+// Records a call of the function being compiled to callee
+void global_function_call(const std::string& callee);
+
+// What a snapshot keeps of a variable besides its value: whether it was
+// reassigned and the functions that folded it
+void global_variable_saved_state(const std::string& name, bool& reassigned, std::set<std::string>& dependents);
+// Called once the root context stored a variable restored from a snapshot.
+// The restored code of dependents cannot be compiled again, so a variable they
+// folded is frozen: the root context refuses to reassign it
+void global_variable_restored(const std::string& name, bool reassigned, const std::set<std::string>& dependents);
+bool global_variable_frozen(const std::string& name);
+
+// While it lives, the constants folded and the calls made are recorded for the
+// outermost function being compiled (nested definitions belong to it)
+class GlobalDependencyScope {
+ public:
+  explicit GlobalDependencyScope(FunctionDefNode* function_def_node);
+  ~GlobalDependencyScope();
+};
+}
+
+#endif
@@ -0,0 +1,126 @@
+//===----- noname-jit-memory-manager.h - Slab memory for the noname JIT ----*- C++ -*-===//
+//
+// Every module handed to NonameJIT used to get its own SectionMemoryManager,
+// which maps at least one fresh page per section kind. A REPL session ends up
+// with thousands of tiny functions scattered over thousands of pages.
+//
+// NonameJITSlabAllocator owns a few large slabs shared by the whole session and
+// NonameJITMemoryManager is the cheap per-module view over it: the sections of a
+// module are packed next to each other, its page protections are flipped in one
+// batch when it is finalized and the memory goes back to the slabs when the
+// module is removed from the JIT.
+//
+// Modules are finalized one at a time and in any order (lazily linked objects,
+// parallel parts), so two modules never share a page of code or read only data:
+// finalizing one must neither seal the other before its relocations are applied
+// nor reopen a page the other runs from. A module starts on a fresh page, and a
+// region freed by a removed module is only reused when its pages are all free.
+//
+// Code is split in three pools by section name: functions the profile found
+// hot (.text.hot) are packed next to each other, functions it found cold
+// (.text.unlikely) are kept out of their way and everything else goes to the
+// regular code pool.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_EXECUTIONENGINE_ORC_NONAME_MEMORY_MANAGER_H
+#define LLVM_EXECUTIONENGINE_ORC_NONAME_MEMORY_MANAGER_H
+
+#include "llvm/ExecutionEngine/RTDyldMemoryManager.h"
+#include "llvm/Support/Memory.h"
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace llvm {
+namespace orc {
+
+class NonameJITSlabAllocator {
+ public:
+  enum SectionKind {
+    SECTION_CODE = 0,
+    SECTION_HOT_CODE,
+    SECTION_COLD_CODE,
+    SECTION_RODATA,
+    SECTION_RWDATA,
+    SECTION_KIND_COUNT
+  };
+
+  static bool isCode(SectionKind kind) { return kind <= SECTION_COLD_CODE; }
+
+  explicit NonameJITSlabAllocator(bool use_huge_pages);
+  ~NonameJITSlabAllocator();
+
+  // Sections are allocated for an owner, the memory manager of their module
+  uint8_t *allocate(SectionKind kind, uintptr_t size, unsigned alignment, const void *owner);
+  void release(SectionKind kind, uint8_t *address, uintptr_t size);
+
+  // Applies the final protections to the pages of the owner written since the
+  // last call, one mprotect per run of adjacent pages. On error the pages not
+  // sealed are kept for the next call.
+  bool finalize(const void *owner, std::string *error_msg);
+  // Forgets the pages of the owner still to be sealed, before its sections are
+  // released
+  void forget(const void *owner);
+
+ private:
+  struct Slab {
+    sys::MemoryBlock block;
+    uintptr_t used;      // bump pointer offset
+    uintptr_t live;      // bytes currently handed out
+  };
+
+  struct Pool {
+    std::vector<Slab> slabs;
+    std::map<uint8_t *, uintptr_t> free_regions;  // address -> size, coalesced
+    // page ranges to seal on finalize, by owner
+    std::map<const void *, std::vector<sys::MemoryBlock>> pending;
+    // owner of the last page bump allocated, while it is still writable
+    const void *tail_owner = nullptr;
+  };
+
+  Slab *findSlab(Pool &pool, uint8_t *address);
+  Slab *newSlab(SectionKind kind, uintptr_t min_size);
+  void reopen(SectionKind kind, uint8_t *page_begin, uint8_t *page_end, const void *owner);
+  unsigned finalPermissions(SectionKind kind);
+
+  bool UseHugePages;
+  uintptr_t PageSize;
+  Pool Pools[SECTION_KIND_COUNT];
+};
+
+class NonameJITMemoryManager : public RTDyldMemoryManager {
+ public:
+  explicit NonameJITMemoryManager(NonameJITSlabAllocator &slabs);
+  ~NonameJITMemoryManager() override;
+
+  uint8_t *allocateCodeSection(uintptr_t Size, unsigned Alignment, unsigned SectionID, StringRef SectionName) override;
+  uint8_t *allocateDataSection(uintptr_t Size, unsigned Alignment, unsigned SectionID, StringRef SectionName,
+                               bool IsReadOnly) override;
+  bool finalizeMemory(std::string *ErrMsg = nullptr) override;
+
+  void registerEHFrames(uint8_t *Addr, uint64_t LoadAddr, size_t Size) override;
+
+ private:
+  struct Allocation {
+    NonameJITSlabAllocator::SectionKind kind;
+    uint8_t *address;
+    uintptr_t size;
+  };
+
+  struct EHFrame {
+    uint8_t *address;
+    uint64_t load_address;
+    size_t size;
+  };
+
+  NonameJITSlabAllocator &Slabs;
+  std::vector<Allocation> Allocations;
+  std::vector<EHFrame> EHFrames;
+};
+
+}  // end namespace orc
+}  // end namespace llvm
+
+#endif  // LLVM_EXECUTIONENGINE_ORC_NONAME_MEMORY_MANAGER_H
@@ -15,6 +15,7 @@
 #include "llvm/ADT/STLExtras.h"
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
 #include "llvm/ExecutionEngine/JITSymbolFlags.h"
+#include "llvm/ExecutionEngine/ObjectCache.h"
 #include "llvm/ExecutionEngine/RTDyldMemoryManager.h"
 #include "llvm/ExecutionEngine/RuntimeDyld.h"
 #include "llvm/ExecutionEngine/SectionMemoryManager.h"
@@ -26,11 +27,14 @@
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/Mangler.h"
 #include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/Host.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Target/TargetMachine.h"
 #include "llvm-c/BitWriter.h"
 #include "llvm/Bitcode/ReaderWriter.h"
 #include "llvm/Support/raw_ostream.h"
+#include "noname-jit-memory-manager.h"
+#include "noname-opt-level.h"
 #include <stdio.h>
 #include <algorithm>
 #include <memory>
@@ -47,10 +51,26 @@ class NonameJIT;
 
 namespace noname {
 extern std::unique_ptr<llvm::orc::NonameJIT> TheJIT;
+extern bool jit_huge_pages;
+extern std::string jit_mcpu;
+extern std::string jit_mattr;
 }
 
 namespace llvm {
 namespace orc {
+
+// Keeps a copy of the object of the last module compiled, which the JIT records
+// for the session snapshots. Never provides objects itself.
+class NonameJITObjectRecorder : public ObjectCache {
+ public:
+  void notifyObjectCompiled(const Module *module, MemoryBufferRef object) override {
+    LastObject = MemoryBuffer::getMemBufferCopy(object.getBuffer(), object.getBufferIdentifier());
+  }
+  std::unique_ptr<MemoryBuffer> getObject(const Module *module) override { return nullptr; }
+
+  std::unique_ptr<MemoryBuffer> LastObject;
+};
+
 class NonameJIT {
  public:
   typedef ObjectLinkingLayer<> ObjLayerT;
@@ -61,14 +81,35 @@ class NonameJIT {
   virtual ~NonameJIT();
 
   TargetMachine &getTargetMachine();
+  // A target machine of its own, set up like the one of the JIT, for compiling
+  // on another thread
+  std::unique_ptr<TargetMachine> createTargetMachine();
+  // Sets the code generator options of target_machine for module: FP
+  // contraction and the level of its functions; returns that level
+  static noname::OptLevel configureTargetMachine(TargetMachine &target_machine, const Module &module);
 
   CompileLayerT::ModuleSetHandleT addModule(std::unique_ptr<Module> module);
+  // Links an object compiled ahead of time for this target; false when the
+  // buffer is not an object file. A session object (one restored from a
+  // snapshot) is recorded like the compiled modules; host_addresses tells that
+  // its code points into this process (see noname::embeds_host_addresses).
+  bool addObject(std::unique_ptr<MemoryBuffer> object_buffer, bool session_object = false, bool host_addresses = false);
 
   void removeModule(ModuleHandleT module_handle);
 
   JITSymbol findSymbol(const std::string Name);
   llvm::Function* getFunction(const std::string Name);
 
+  // Objects of the modules still linked and of the session objects, in the
+  // order they were added
+  std::vector<MemoryBufferRef> getSessionObjects() const;
+  // Whether the code of a session object points into this process: it would
+  // not run in another one
+  bool hasHostAddresses() const { return !HostAddressModules.empty(); }
+  // The module stays linked, but it is not part of the session objects: a
+  // snapshot does not restore it
+  void dropSessionObject(ModuleHandleT module_handle);
+
   void writeToFile(const Module *mod);
   void writeToFile();
   void release();
@@ -80,9 +121,18 @@ class NonameJIT {
   static std::vector<T> singletonSet(T t);
 
   JITSymbol findMangledSymbol(const std::string &symbol_name);
+  std::unique_ptr<RuntimeDyld::SymbolResolver> createResolver();
 
   std::unique_ptr<TargetMachine> TM;
   const DataLayout DL;
+  // must outlive ObjectLayer: the memory managers of the linked modules give
+  // their sections back to the slabs when they are destroyed
+  std::unique_ptr<NonameJITSlabAllocator> Slabs;
+  // must outlive ObjectLayer too: the session objects are linked in place
+  NonameJITObjectRecorder ObjectRecorder;
+  std::vector<std::pair<ModuleHandleT, std::unique_ptr<MemoryBuffer>>> SessionObjects;
+  // the session objects embedding addresses of this process
+  std::vector<ModuleHandleT> HostAddressModules;
   ObjLayerT ObjectLayer;
   CompileLayerT CompileLayer;
   std::vector<ModuleHandleT> ModuleHandles;
@@ -0,0 +1,62 @@
+#ifndef _NONAME_MEMO_H
+#define _NONAME_MEMO_H
+
+#include "llvm/IR/Function.h"
+#include "noname-types.h"
+#include "noname-utils.h"
+#include <stdio.h>
+#include <string>
+
+namespace noname {
+
+class FunctionDefNode;
+
+/**
+ * Memoization of pure functions.
+ *
+ * A function annotated `@memo` (or, with -memo=auto, any function calling
+ * itself more than once, like `fib`) remembers the values it returned by the
+ * numbers it was called with. Only pure functions (see noname-bytecode.h) are
+ * memoized: their value depends on nothing but their arguments.
+ *
+ * The body is compiled as <name>.memo, internal to the module, and the function
+ * itself becomes a wrapper looking the arguments up in the cache of the host
+ * first; the recursive calls of the body call the wrapper, so they hit the
+ * cache too. The cache is found by name and hash of the definition, so every
+ * module compiling the same definition (a recompilation, a snapshot) shares it.
+ *
+ * Each cache holds -memo-capacity results in an open addressing table. A key
+ * is only probed for in a short window of slots from its hash, and when the
+ * window is full a clock hand sweeps it: the results hit since the last sweep
+ * get another chance, the first one that was not is replaced. Results are kept
+ * by value and boxed again on every hit. Calls passing anything but numbers, or
+ * more than 8 arguments, are not cached.
+ *
+ * Memoized functions never run on the VM with -tier=bytecode.
+ */
+enum MemoMode { MEMO_NONE, MEMO_ANNOTATED, MEMO_AUTO };
+
+extern MemoMode memo_mode;
+// results cached per function, rounded up to a power of two
+extern unsigned memo_capacity;
+
+// Whether the annotations of the function ask for memoization, pure or not
+bool memo_requested(const FunctionDefNode* function_def_node);
+// Whether the function is memoized: requested and pure
+bool memo_function(const FunctionDefNode* function_def_node);
+
+// Turns function into the wrapper calling body on a cache miss
+llvm::Function* memo_wrapper_codegen(const FunctionDefNode* function_def_node, llvm::Function* function,
+                                     llvm::Function* body);
+
+// Hits and misses of every cache
+void print_memo_statistics(FILE* file);
+
+// The cache of the function named cache_name, created on the first call
+extern "C" DLLEXPORT void* noname_memo_cache(const char* cache_name, int arity);
+// Copies the cached result of args (arity datatype_t) to result; 0 on a miss
+extern "C" DLLEXPORT int noname_memo_lookup(void* cache, const datatype_t* args, datatype_t* result);
+extern "C" DLLEXPORT void noname_memo_store(void* cache, const datatype_t* args, int result_type, void* result_v);
+}
+
+#endif
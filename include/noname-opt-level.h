@@ -0,0 +1,82 @@
+#ifndef _NONAME_OPT_LEVEL_H
+#define _NONAME_OPT_LEVEL_H
+
+#include "llvm/IR/Function.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Target/TargetMachine.h"
+#include <cstdint>
+#include <stdio.h>
+
+namespace noname {
+
+class FunctionDefNode;
+
+/**
+ * Optimization level per function.
+ *
+ * Optimizing and compiling a function costs about the same whether it runs
+ * once or a million times. Unless -opt-full is given, every function gets a
+ * level from its size and from how it is used:
+ *
+ *   none    top level expressions, which run once: no IR passes, and their
+ *           modules go through the code generator at O0 with FastISel
+ *   full    every other function: the whole pass pipeline, then the small
+ *           functions are inlined into their callers of the same module, and
+ *           the code generator runs at O2
+ *   capped  functions of more than -opt-huge-size instructions (generated
+ *           code): SROA, mem2reg, early CSE and CFG simplification only, and
+ *           the code generator at O1
+ *
+ * A capped function counts its calls. Once it was called -opt-hot-calls times
+ * it is compiled again at full, in a new module, before the next top level
+ * expression is; the callers compiled before keep calling the capped code.
+ *
+ * The level is recorded as the noname-opt-level attribute of the function, and
+ * a module goes through the code generator at the highest level of its
+ * functions. -noname-stats prints the time spent at every level and an
+ * estimate of the time saved, from the cost per instruction at full.
+ *
+ * With -jobs above 1 the passes only run when the module goes to the JIT,
+ * possibly on another thread (see noname-parallel.h).
+ */
+enum OptLevel { OPT_LEVEL_NONE, OPT_LEVEL_CAPPED, OPT_LEVEL_FULL };
+
+// false with -opt-full: everything is compiled at full
+extern bool adaptive_opt_level;
+extern unsigned opt_huge_size;
+// calls after which a capped function is compiled at full, 0 never
+extern unsigned opt_hot_calls;
+
+// Adds the IR passes of level to fpm
+void add_function_passes(llvm::legacy::FunctionPassManager& fpm, OptLevel level, llvm::TargetMachine& target_machine);
+
+// Runs the passes of the level of the function just generated for
+// function_def_node (nullptr for code generated otherwise), or leaves them
+// pending with -jobs
+void optimize_function(llvm::Function* function, FunctionDefNode* function_def_node);
+// Runs the passes left pending in the functions of module; may be called on any
+// thread, for a module of any context
+void run_pending_passes(llvm::Module& module, llvm::TargetMachine& target_machine);
+
+// Inlines the small functions of the module into their callers; called before
+// the module goes to the JIT
+void opt_level_optimize_module(llvm::Module& module);
+
+// The highest level of the functions defined in module, full when none of them
+// has one
+OptLevel get_module_opt_level(const llvm::Module& module);
+// Records the time the code generator took on a module of the given level
+void opt_level_module_compiled(OptLevel level, uint64_t instructions, uint64_t microseconds);
+
+size_t count_instructions(const llvm::Function& function);
+size_t count_instructions(const llvm::Module& module);
+
+// Compiles the hot capped functions again at full
+void opt_level_tier_up();
+
+// Time spent at every level and the time saved
+void print_opt_level_statistics(FILE* file);
+}
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef _NONAME_PARALLEL_H
+#define _NONAME_PARALLEL_H
+
+#include "llvm/IR/Module.h"
+#include <memory>
+
+namespace noname {
+
+/**
+ * Parallel compilation of the functions of a script.
+ *
+ * Generating the IR of a function uses the context, the module and the builder
+ * of the whole process, so it stays on the main thread; what costs the most is
+ * what follows: the IR passes and the code generator. With -jobs above 1 the
+ * passes of a function are left pending when it is generated (see
+ * noname-opt-level.h), and the module of the functions defined so far, once it
+ * goes to the JIT before the next top level expression, is split into -jobs
+ * parts by function.
+ *
+ * Every part is handed over as bitcode to a thread of its own, which reads it
+ * back into a context of its own, runs the pending passes, inlines what it can
+ * and links the runtime, then generates its object with a target machine of its
+ * own. The context, the target machine and the runtime parsed into that context
+ * are kept from a module to the next. The objects are linked by the JIT in order, and the calls from one part
+ * to another are resolved by name at link time, like the calls between modules.
+ * The symbols internal to the module (clones, caches) become globals named
+ * after it, so that the other parts reach them and nothing else binds to them;
+ * functions are only inlined into callers of the same part.
+ *
+ * A module of a single function or of little code is compiled on the main
+ * thread, and so is a part whose thread failed. -jobs=0 uses a thread per core
+ * when the input is not a terminal (a whole file is read at once), 1 otherwise.
+ */
+extern unsigned compile_jobs;
+
+// Compiles the functions of module on compile_jobs threads and links their
+// objects; false, with module left as it is, when it is not worth it
+bool parallel_add_module(std::unique_ptr<llvm::Module>& module);
+}
+
+#endif
@@ -134,7 +134,10 @@ enum yytokentype {
   STR_CONST = 299,
   DOUBLE_TOK = 300,
   LONG_TOK = 301,
-  NEG_TOK = 316
+  GE_TOK = 302,
+  EQ_TOK = 303,
+  NE_TOK = 304,
+  NEG_TOK = 319
 };
 #endif
 /* Tokens.  */
@@ -182,7 +185,10 @@ enum yytokentype {
 #define STR_CONST 299
 #define DOUBLE_TOK 300
 #define LONG_TOK 301
-#define NEG_TOK 316
+#define GE_TOK 302
+#define EQ_TOK 303
+#define NE_TOK 304
+#define NEG_TOK 319
 
 /* Value type.  */
 #if !defined YYSTYPE && !defined YYSTYPE_IS_DECLARED
@@ -0,0 +1,52 @@
+#ifndef _NONAME_PRELUDE_H
+#define _NONAME_PRELUDE_H
+
+#include "llvm/IR/Module.h"
+#include <string>
+
+namespace noname {
+
+class ASTContext;
+
+/**
+ * Precompiled prelude.
+ *
+ * The standard library (lib/prelude.nn) is compiled when noname is built: a
+ * noname built without it (noname-stage0) runs the prelude with -emit-bitcode
+ * and -emit-object, and both files are embedded in the binary
+ * (noname-prelude-data.cc). At startup the object is linked into the JIT as is
+ * and the signatures of its functions are read from the bitcode, whose bodies
+ * are never materialized: nothing is lexed, parsed or compiled.
+ *
+ * The prelude must only define functions; default values of their arguments
+ * are not kept. Its object runs in another process than the one that compiled
+ * it, so its code refers to everything by name (see host_function_codegen) and
+ * keeps its literals in globals of its own: write_module_object refuses a
+ * module pointing to addresses of the process, and the build fails instead of
+ * embedding it.
+ *
+ * The object is compiled once, for -mcpu=generic, and is deliberately not
+ * multiversioned: picking a clone per cpu at startup would need a dispatch the
+ * JIT linker does not resolve (ifuncs), and the prelude is scalar code that
+ * gains nothing from the vector units of a newer cpu. Only the code compiled
+ * at run time is tuned for the host (-mcpu, -mattr).
+ */
+extern const unsigned char noname_prelude_bitcode[];
+extern const unsigned int noname_prelude_bitcode_size;
+extern const unsigned char noname_prelude_object[];
+extern const unsigned int noname_prelude_object_size;
+
+extern std::string emit_bitcode_file;
+extern std::string emit_object_file;
+
+// Links the embedded prelude into the JIT and declares its functions in
+// context; false when the binary has no prelude or it could not be loaded
+bool load_prelude(ASTContext* context);
+
+// Write the functions defined in module, as bitcode or as an object of the JIT
+// target. The object is written by running the code generator on module.
+bool write_module_bitcode(const llvm::Module& module, const std::string& file_path);
+bool write_module_object(llvm::Module& module, const std::string& file_path);
+}
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef _NONAME_PROFILE_H
+#define _NONAME_PROFILE_H
+
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace noname {
+
+/**
+ * Profile guided optimization.
+ *
+ * With -profile-generate every user function is compiled with counters: one for
+ * the function entry, one per case of the type dispatch in BinaryExpNode and one
+ * per call site. The counters live in host memory and are written to
+ * -profile-file when noname exits.
+ *
+ * With -profile-use the counters are read back and turned into function entry
+ * counts, branch weights and hot/cold attributes, which the inliner and the
+ * block placement of the code generator pick up.
+ *
+ * Counters are numbered in codegen order, so a recorded profile is only applied
+ * to a function with the same name and the same structural hash
+ * (ASTNode::hash); editing one function does not invalidate the others.
+ *
+ * Hot and cold functions are also moved to the .text.hot and .text.unlikely
+ * sections, which the JIT memory manager packs in separate pools. Inside a
+ * function that ran, the code dominated by an arm of a branch that never did
+ * (or that is known to be unlikely) is split out to a function of its own,
+ * <name>.cold, in .text.unlikely, when it is large enough to be worth a call.
+ */
+enum ProfileMode { PROFILE_NONE, PROFILE_GENERATE, PROFILE_USE };
+
+extern ProfileMode profile_mode;
+extern std::string profile_file;
+
+// Weight of the likely successor of a branch we know to be biased without a
+// profile (e.g. the error arm of the type dispatch); the other one gets 1
+const uint64_t LIKELY_BRANCH_WEIGHT = 2000;
+
+// Must be called before any counter of function is created
+void profile_begin_function(llvm::Function* function, const std::string& name, uint64_t hash);
+
+// Allocates the next counter of the function owning bb. With -profile-generate
+// the code bumping it is appended to bb. Returns -1 if the function is not
+// profiled.
+int profile_counter_codegen(llvm::BasicBlock* bb);
+
+// Recorded value of a counter, false if there is no matching profile
+bool profile_get_count(const llvm::Function* function, int counter, uint64_t& count);
+
+void profile_set_branch_weights(llvm::BranchInst* branch_inst, uint64_t true_count, uint64_t false_count);
+// counts of the default destination first, then of every case in order
+void profile_set_switch_weights(llvm::SwitchInst* switch_inst, const std::vector<uint64_t>& counts);
+void profile_set_call_hotness(llvm::CallInst* call_inst, int counter);
+
+// Runs the inliner over a module whose functions got hints from the profile,
+// then splits the cold regions out of its functions. Only calls inside the same
+// module can be inlined.
+void profile_optimize_module(llvm::Module& module);
+
+bool load_profile(const std::string& file_path);
+bool write_profile(const std::string& file_path);
+}
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef _NONAME_RUNTIME_H
+#define _NONAME_RUNTIME_H
+
+#include "llvm/IR/Module.h"
+
+namespace noname {
+
+/**
+ * Runtime bitcode.
+ *
+ * The helpers JIT code calls (noname_pow_long, printd, ...) and the constants
+ * it points to (noname_compare_false_value, ...) live in src/noname-runtime.cc,
+ * which is also compiled to bitcode when noname is built and embedded in the
+ * binary (noname-runtime-data.cc). Before a module is compiled, the runtime
+ * definitions it refers to are linked into it as available_externally and
+ * inlined: the calls to tiny helpers disappear and the loads of the constants
+ * fold, while whatever is not inlined still calls the one copy of the host.
+ */
+extern const unsigned char noname_runtime_bitcode[];
+extern const unsigned int noname_runtime_bitcode_size;
+
+// Links into module the runtime definitions it uses, and inlines the functions;
+// false when it uses none. The runtime is parsed once, in TheContext
+bool link_runtime(llvm::Module& module);
+// Same with a runtime of the context of module (see noname-parallel.h)
+bool link_runtime(llvm::Module& module, const llvm::Module& runtime);
+
+// The runtime parsed into context, with the data layout of the JIT; nullptr
+// when the binary has none
+std::unique_ptr<llvm::Module> load_runtime_module(llvm::LLVMContext& context, const llvm::DataLayout& data_layout);
+}
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef _NONAME_SNAPSHOT_H
+#define _NONAME_SNAPSHOT_H
+
+#include <string>
+
+namespace noname {
+
+class ASTContext;
+
+/**
+ * Session snapshots.
+ *
+ * `:save <file>` typed at the prompt writes the state of the session to a
+ * snapshot: the signatures of the functions and the global variables of the
+ * root context, and the objects of every module still linked in the JIT, as
+ * the JIT compiled them. -restore=<file> links those objects back into the JIT
+ * and declares the functions and variables again before reading the input;
+ * nothing is parsed or compiled:
+ *
+ *   > :save session.nns
+ *   $ ./noname -restore=session.nns
+ *
+ * A snapshot only restores on the target (triple, cpu and features) it was
+ * saved on. A session whose code points into the process that compiled it (an
+ * inttoptr of a host address, see embeds_host_addresses) cannot be saved: the
+ * counters of -profile-generate are the case, and any other address that ever
+ * makes it into the IR is refused the same way, whatever put it there.
+ */
+extern std::string restore_snapshot_file;
+
+bool save_snapshot(const std::string& file_path, ASTContext* context);
+// False, with nothing restored, when the file does not exist, is not valid or
+// was saved on another target
+bool restore_snapshot(const std::string& file_path, ASTContext* context);
+
+// Runs a line read from the prompt when it is a session command (`:save
+// <file>`); false when it is code
+bool run_session_command(const char* line, int size);
+}
+
+#endif
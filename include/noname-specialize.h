@@ -0,0 +1,39 @@
+#ifndef _NONAME_SPECIALIZE_H
+#define _NONAME_SPECIALIZE_H
+
+#include "llvm/IR/Function.h"
+#include <string>
+#include <vector>
+
+namespace noname {
+
+class ExpNode;
+class FunctionDefNode;
+
+/**
+ * Call site specialization.
+ *
+ * A call passing numbers known at compile time, literals or the defaults of
+ * the arguments left out (`def scale(x, factor = 2)` called as `scale(y)`),
+ * calls a clone of the function with those numbers folded in instead of the
+ * function itself. Clones are generated from the definition into the module of
+ * the caller, internal to it, and every call of that module with the same
+ * constant pattern reuses the clone. The optimizer folds the constants (the
+ * type dispatch of the arithmetic on them disappears) and may inline it.
+ *
+ * At most -specialize-limit patterns are specialized per function (0 turns
+ * specialization off); calls with any other pattern call the function itself.
+ */
+extern unsigned specialize_limit;
+
+// Definitions calls are specialized from: the last one of every name
+void specialize_register_function(FunctionDefNode* function_def_node);
+
+// The clone to call instead of callee, without the arguments of arg_nodes
+// that are folded into it (folded_args tells which); nullptr when the call is
+// not specialized
+llvm::Function* specialize_call(const std::string& callee, const std::vector<ExpNode*>& arg_nodes,
+                                std::vector<bool>& folded_args);
+}
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef _NONAME_STATS_H
+#define _NONAME_STATS_H
+
+#include <stdio.h>
+#include <atomic>
+#include <cstdint>
+
+namespace noname {
+
+extern bool print_stats;
+
+/**
+ * A named counter that is reported at exit when noname runs with -noname-stats.
+ *
+ * Statistics register themselves when constructed, so they must be defined at
+ * namespace scope (usually as a static in the translation unit that bumps them).
+ */
+class Statistic {
+ private:
+  const char *group;
+  const char *name;
+  const char *desc;
+  std::atomic<int64_t> value;
+  Statistic *next;
+
+ public:
+  Statistic(const char *group, const char *name, const char *desc);
+
+  const char *getGroup() const { return group; }
+  const char *getName() const { return name; }
+  const char *getDesc() const { return desc; }
+  int64_t getValue() const { return value.load(std::memory_order_relaxed); }
+  Statistic *getNext() const { return next; }
+
+  Statistic &operator++() {
+    value.fetch_add(1, std::memory_order_relaxed);
+    return *this;
+  }
+  Statistic &operator+=(int64_t v) {
+    value.fetch_add(v, std::memory_order_relaxed);
+    return *this;
+  }
+  Statistic &operator-=(int64_t v) {
+    value.fetch_sub(v, std::memory_order_relaxed);
+    return *this;
+  }
+  Statistic &operator=(int64_t v) {
+    value.store(v, std::memory_order_relaxed);
+    return *this;
+  }
+  // keeps the maximum value ever assigned; handy for high-water marks
+  void updateMax(int64_t v) {
+    int64_t current = getValue();
+    while (v > current && !value.compare_exchange_weak(current, v, std::memory_order_relaxed)) {
+    }
+  }
+};
+
+void print_statistics(FILE *file);
+}
+
+#endif
@@ -24,6 +24,7 @@
 #include "llvm/Transforms/Scalar/GVN.h"
 
 #include "noname-ast-context.h"
+#include "noname-bigint.h"
 #include "noname-utils.h"
 #include "noname-error.h"
 #include "lexer-utilities.h"
@@ -36,8 +37,10 @@
 #include <cstdlib>
 #include <map>
 #include <memory>
+#include <set>
 #include <string>
 #include <stack>
+#include <type_traits>
 #include <vector>
 
 extern void yyerror(const char* error_msg);
@@ -62,9 +65,15 @@ enum yytokentype {
   TYPE_LONG = 40,
   TYPE_DOUBLE = 41,
   TYPE_STRING = 42,
+  TYPE_BIGINT = 43,
 };
 #endif
 
+// The numeric types are contiguous, from the narrowest to the widest; a bigint
+// is an integer too, but only ever the result of a long that overflowed
+const int NUMERIC_TYPES_COUNT = TYPE_DOUBLE - TYPE_CHAR + 1;
+inline bool is_numeric_type(int type) { return type >= TYPE_CHAR && type <= TYPE_DOUBLE; }
+
 class ASTNode;
 class ASTContext;
 class ErrorNode;
@@ -82,6 +91,10 @@ class FunctionDefNode;
 class DeclarationNode;
 class AssignmentNode;
 class DeclarationAssignmentNode;
+class CompareExpNode;
+class IfExpNode;
+class LoopNode;
+class BreakNode;
 
 class ProcessorStrategy;
 class ASTNodeProcessorStrategy;
@@ -91,6 +104,7 @@ class FunctionDefNodeProcessorStrategy;
 class AssignmentNodeProcessorStrategy;
 class CallExpNodeProcessorStrategy;
 class ImportNodeProcessorStrategy;
+class LoopNodeProcessorStrategy;
 
 extern ProcessorStrategy* astNodeProcessorStrategy;
 extern ProcessorStrategy* expNodeProcessorStrategy;
@@ -99,6 +113,7 @@ extern ProcessorStrategy* functionDefNodeProcessorStrategy;
 extern ProcessorStrategy* assignmentNodeProcessorStrategy;
 extern ProcessorStrategy* callNodeProcessorStrategy;
 extern ProcessorStrategy* importNodeProcessorStrategy;
+extern ProcessorStrategy* loopNodeProcessorStrategy;
 
 extern Type* VoidTy;
 extern PointerType* PointerTy_32;
@@ -128,9 +143,8 @@ typedef struct BinaryExpNode_Data_t {
   GetElementPtrInst* get_elem_ptr_rarg_v;
   GetElementPtrInst* get_elem_ptr_rarg_type;
 
-  BasicBlock* label_if_then_double;
-  BasicBlock* label_else_if;
-  BasicBlock* label_else_if_then_long;
+  // arithmetic of every numeric type, indexed by type - TYPE_CHAR
+  BasicBlock* label_if_then_type[NUMERIC_TYPES_COUNT];
   BasicBlock* label_if_default;
   BasicBlock* label_if_end;
 
@@ -172,6 +186,7 @@ extern ConstantInt* const_int64_8;
 extern ConstantInt* const_int64_9;
 
 extern int debug;
+extern FPMode fp_mode;
 extern ASTContext* context;
 extern std::vector<std::string> imported_files;
 extern std::stack<ASTContext*> context_stack;
@@ -189,6 +204,17 @@ typedef struct datatype_t {
   int type;
   void* v;
 } datatype_t;
+/// noname_binary_op - lhs op rhs of two boxed values, computed like the
+/// interpreter does; the slow path of the compiled arithmetic.
+extern "C" DLLEXPORT void noname_binary_op(int op, int lhs_type, void* lhs_v, int rhs_type, void* rhs_v, datatype_t* result);
+/// noname_compare_op - lhs op rhs (a CompareExpNode::CompareOp) of two boxed
+/// values, 1 or 0; the slow path of the compiled comparisons.
+extern "C" DLLEXPORT int noname_compare_op(int op, int lhs_type, void* lhs_v, int rhs_type, void* rhs_v);
+/// Boxed results of every comparison. Values are never modified in place, so
+/// all the comparisons can point to the same two longs instead of allocating.
+/// Constants of the runtime, so the JIT folds the loads of them.
+extern "C" DLLEXPORT const long noname_compare_false_value;
+extern "C" DLLEXPORT const long noname_compare_true_value;
 typedef struct stmtlist_node_t {
   ASTNode* node;
   stmtlist_node_t* next;
@@ -250,6 +276,8 @@ class ASTNode {
     AST_NODE_TYPE_STRING,
     AST_NODE_TYPE_UNARY_EXP,
     AST_NODE_TYPE_BINARY,
+    AST_NODE_TYPE_COMPARE_EXP,
+    AST_NODE_TYPE_IF_EXP,
     AST_NODE_TYPE_CALL_EXP,
     AST_NODE_TYPE_TOP_LEVEL_EXP_NODE,
 
@@ -262,6 +290,8 @@ class ASTNode {
     AST_NODE_TYPE_DECLARATION,
     AST_NODE_TYPE_DEF_FUNCTION,
     AST_NODE_TYPE_IMPORT,
+    AST_NODE_TYPE_LOOP,
+    AST_NODE_TYPE_BREAK,
 
     AST_NODE_TYPE_AST_NODE_LAST,
   };
@@ -296,6 +326,26 @@ class ASTNode {
   virtual std::vector<Value*> codegen_elements(Error& error, llvm::BasicBlock* bb = nullptr) const { return codegen_elements_vector; }
 
   virtual ASTNode* check() const { return nullptr; };
+
+  // Canonical serialization of the node and its children: two nodes with the
+  // same one are the same code.
+  virtual void canonicalize(std::string& out) const { canonical_append(out, (uint64_t)kind); }
+  std::string canonical() const {
+    std::string out;
+    canonicalize(out);
+    return out;
+  }
+  // Structural hash of the node and its children, that of its canonical
+  // serialization. It is stable across runs, so it can identify a piece of code
+  // on disk (e.g. in a profile).
+  uint64_t hash() const { return stable_hash(STABLE_HASH_SEED, canonical()); }
+  // A child that may be missing
+  static void canonicalize(std::string& out, const ASTNode* node) {
+    canonical_append(out, (uint64_t)(node != nullptr));
+    if (node) {
+      node->canonicalize(out);
+    }
+  }
   virtual ProcessorStrategy* getProcessorStrategy() { return astNodeProcessorStrategy; };
 
   ASTContext* getContext() const { return context; };
@@ -324,6 +374,8 @@ class ASTNode {
       AST_NODE_KIND_PROCESS_VAL(ASTNode::AST_NODE_TYPE_STRING)
       AST_NODE_KIND_PROCESS_VAL(ASTNode::AST_NODE_TYPE_UNARY_EXP)
       AST_NODE_KIND_PROCESS_VAL(ASTNode::AST_NODE_TYPE_BINARY)
+      AST_NODE_KIND_PROCESS_VAL(ASTNode::AST_NODE_TYPE_COMPARE_EXP)
+      AST_NODE_KIND_PROCESS_VAL(ASTNode::AST_NODE_TYPE_IF_EXP)
       AST_NODE_KIND_PROCESS_VAL(ASTNode::AST_NODE_TYPE_CALL_EXP)
       AST_NODE_KIND_PROCESS_VAL(ASTNode::AST_NODE_TYPE_DEF_FUNCTION)
       AST_NODE_KIND_PROCESS_VAL(ASTNode::AST_NODE_TYPE_ASSIGNMENT)
@@ -331,6 +383,8 @@ class ASTNode {
       AST_NODE_KIND_PROCESS_VAL(ASTNode::AST_NODE_TYPE_DECLARATION_ASSIGNMENT)
       AST_NODE_KIND_PROCESS_VAL(ASTNode::AST_NODE_TYPE_ASSIGNMENT_LAST)
       AST_NODE_KIND_PROCESS_VAL(ASTNode::AST_NODE_TYPE_IMPORT)
+      AST_NODE_KIND_PROCESS_VAL(ASTNode::AST_NODE_TYPE_LOOP)
+      AST_NODE_KIND_PROCESS_VAL(ASTNode::AST_NODE_TYPE_BREAK)
     }
 
 #undef AST_NODE_KIND_PROCESS_VAL
@@ -391,14 +445,89 @@ class NodeValue {
   NodeValue(char value);
   NodeValue(double value);
   NodeValue(float value);
+  NodeValue(const BigInt& value);
   virtual ~NodeValue();
 
   int getType() { return type; }
   void* getRawValue() { return value; }
   Value* constant_codegen(llvm::BasicBlock* bb = nullptr);
-  void* getValue(int as_type) const;
 };
 
+/**
+ * A value of the interpreter, passed around by value.
+ *
+ * Numbers are held inline, so evaluating an expression of numbers allocates
+ * nothing. Strings and bigints are pointed to: borrowed from whatever outlives
+ * the value (a literal, a variable, a boxed datatype_t) or owned when the
+ * value was computed.
+ */
+class TaggedValue {
+  int type;
+  union {
+    char c;
+    short s;
+    int i;
+    float f;
+    long l;
+    double d;
+    const void* p;
+  };
+  std::shared_ptr<const void> owner;
+
+ public:
+  // undefined, e.g. after an error
+  TaggedValue() : type(TYPE_VOID), l(0) {}
+  explicit TaggedValue(char value) : type(TYPE_CHAR), c(value) {}
+  explicit TaggedValue(short value) : type(TYPE_SHORT), s(value) {}
+  explicit TaggedValue(int value) : type(TYPE_INT), i(value) {}
+  explicit TaggedValue(float value) : type(TYPE_FLOAT), f(value) {}
+  explicit TaggedValue(long value) : type(TYPE_LONG), l(value) {}
+  explicit TaggedValue(double value) : type(TYPE_DOUBLE), d(value) {}
+  explicit TaggedValue(const std::string& value);
+  explicit TaggedValue(const BigInt& value);
+
+  // the value pointed to by a boxed raw_value; strings and bigints are not
+  // copied, raw_value must outlive the TaggedValue
+  static TaggedValue borrowed(int type, const void* raw_value);
+
+  int getType() const { return type; }
+  bool isDefined() const { return type != TYPE_VOID; }
+
+  // the number converted to T, like a C cast
+  template <typename T>
+  T as() const {
+    switch (type) {
+      case TYPE_CHAR:
+        return (T)c;
+      case TYPE_SHORT:
+        return (T)s;
+      case TYPE_INT:
+        return (T)i;
+      case TYPE_FLOAT:
+        return (T)f;
+      case TYPE_LONG:
+        return (T)l;
+      case TYPE_DOUBLE:
+        return (T)d;
+      case TYPE_BIGINT:
+        return std::is_floating_point<T>::value ? (T)((const BigInt*)p)->toDouble() : (T)((const BigInt*)p)->toLong();
+      default:
+        return (T)0;
+    }
+  }
+  BigInt asBigInt() const;
+  const std::string& asString() const { return *(const std::string*)p; }
+
+  // heap copies, for what outlives the evaluation: a NodeValue (nullptr when
+  // undefined) or the v of a datatype_t
+  NodeValue* toNodeValue() const;
+  void* box() const;
+};
+
+// A datatype_t constant holding a number, boxed in a read only global of
+// TheModule so the loads of it fold; nullptr for anything but a number
+llvm::Constant* constant_datatype_codegen(const TaggedValue& value, const std::string& name);
+
 class ExpNode : public ASTNode {
  public:
   ExpNode(ASTContext* context) : ASTNode(context, AST_NODE_TYPE_EXP_NODE) {}
@@ -411,6 +540,9 @@ class ExpNode : public ASTNode {
   };
 
   virtual std::unique_ptr<NodeValue> getValue() const = 0;
+  // Same value without boxing it; the interpreter evaluates expressions with
+  // this one. By default it is a copy of getValue()
+  virtual TaggedValue getTaggedValue() const;
 
   ProcessorStrategy* getProcessorStrategy() override { return expNodeProcessorStrategy; };
 
@@ -451,10 +583,14 @@ class NumberExpNode : public ExpNode {
     memcpy(value, &val, sizeof(char));
   };
 
+  int getNumberType() const { return type; }
+
   // virtual void* eval() override;
   virtual std::unique_ptr<NodeValue> getValue() const override;
+  virtual TaggedValue getTaggedValue() const override;
   virtual Value* codegen(llvm::BasicBlock* bb = nullptr) override;
   virtual std::vector<Value*> codegen_elements(Error& error, llvm::BasicBlock* bb = nullptr) const override;
+  virtual void canonicalize(std::string& out) const override;
 
   // int getType() const override { return getClassType(); };
   // static int getClassType() { return AST_NODE_TYPE_NUMBER; };
@@ -472,8 +608,13 @@ class StringExpNode : public ExpNode {
 
   // virtual void* eval() override;
   virtual std::unique_ptr<NodeValue> getValue() const override;
+  virtual TaggedValue getTaggedValue() const override;
   virtual Value* codegen(llvm::BasicBlock* bb = nullptr) override;
   virtual std::vector<Value*> codegen_elements(Error& error, llvm::BasicBlock* bb = nullptr) const override;
+  virtual void canonicalize(std::string& out) const override {
+    ExpNode::canonicalize(out);
+    canonical_append(out, value);
+  }
 
   // int getType() const override { return getClassType(); };
   // static int getClassType() { return AST_NODE_TYPE_STRING; };
@@ -491,8 +632,13 @@ class VarExpNode : public ExpNode {
 
   // virtual void* eval() override;
   virtual std::unique_ptr<NodeValue> getValue() const override;
+  virtual TaggedValue getTaggedValue() const override;
   virtual Value* codegen(llvm::BasicBlock* bb = nullptr) override;
   virtual std::vector<Value*> codegen_elements(Error& error, llvm::BasicBlock* bb = nullptr) const override;
+  virtual void canonicalize(std::string& out) const override {
+    ExpNode::canonicalize(out);
+    canonical_append(out, name);
+  }
 
   // int getType() const override { return getClassType(); };
   // static int getClassType() { return AST_NODE_TYPE_VARIABLE; };
@@ -515,6 +661,14 @@ class UnaryExpNode : public ExpNode {
   virtual std::unique_ptr<NodeValue> getValue() const override;
   virtual Value* codegen(llvm::BasicBlock* bb = nullptr) override;
   virtual std::vector<Value*> codegen_elements(Error& error, llvm::BasicBlock* bb = nullptr) const override;
+  virtual void canonicalize(std::string& out) const override {
+    ExpNode::canonicalize(out);
+    canonical_append(out, (uint64_t)op);
+    rhs->canonicalize(out);
+  }
+
+  char getOp() const { return op; }
+  const ExpNode* getRHS() const { return rhs.get(); }
 
   // int getType() const override { return getClassType(); };
   // static int getClassType() { return AST_NODE_TYPE_UNARY_EXP; };
@@ -526,29 +680,143 @@ class BinaryExpNode : public ExpNode {
   char op;
   std::unique_ptr<ExpNode> lhs;
   std::unique_ptr<ExpNode> rhs;
+  bool result_in_slot = false;
+
+  void setOperandsResultInSlot();
 
  public:
   BinaryExpNode(ASTContext* context, char op, std::unique_ptr<ExpNode> lhs, std::unique_ptr<ExpNode> rhs)
-      : ExpNode(context, AST_NODE_TYPE_BINARY), op(op), lhs(std::move(lhs)), rhs(std::move(rhs)) {}
+      : ExpNode(context, AST_NODE_TYPE_BINARY), op(op), lhs(std::move(lhs)), rhs(std::move(rhs)) {
+    setOperandsResultInSlot();
+  }
   BinaryExpNode(ASTContext* context, char op, ExpNode* lhs, ExpNode* rhs)
       : ExpNode(context, AST_NODE_TYPE_BINARY),
         op(op),
         lhs(std::unique_ptr<ExpNode>(std::move(lhs))),
-        rhs(std::unique_ptr<ExpNode>(std::move(rhs))) {}
+        rhs(std::unique_ptr<ExpNode>(std::move(rhs))) {
+    setOperandsResultInSlot();
+  }
 
   // virtual void* eval() override;
   virtual std::unique_ptr<NodeValue> getValue() const override;
+  virtual TaggedValue getTaggedValue() const override;
   virtual Value* codegen(llvm::BasicBlock* bb = nullptr) override;
   virtual std::vector<Value*> codegen_elements(Error& error, llvm::BasicBlock* bb = nullptr) const override;
+  virtual void canonicalize(std::string& out) const override {
+    ExpNode::canonicalize(out);
+    canonical_append(out, (uint64_t)op);
+    lhs->canonicalize(out);
+    ASTNode::canonicalize(out, rhs.get());
+  }
+
+  char getOp() const { return op; }
+  const ExpNode* getLHS() const { return lhs.get(); }
+  // null for a parenthesized expression
+  const ExpNode* getRHS() const { return rhs.get(); }
+  // Its value is only an operand of the enclosing binary expression, read right
+  // away: the result is kept in a stack slot instead of a box of its own
+  void setResultInSlot();
 
   // int getType() const override { return getClassType(); };
   // static int getClassType() { return AST_NODE_TYPE_BINARY; };
   static bool classof(const ASTNode* S) { return S->getKind() == AST_NODE_TYPE_BINARY; }
 
+};
+
+// CompareExpNode - Node class for the comparison operators. The result is a
+// long: 1 when the comparison holds, 0 otherwise.
+class CompareExpNode : public ExpNode {
+ public:
+  enum CompareOp { CMP_LT, CMP_GT, CMP_LE, CMP_GE, CMP_EQ, CMP_NE };
+
+ private:
+  CompareOp op;
+  std::unique_ptr<ExpNode> lhs;
+  std::unique_ptr<ExpNode> rhs;
+
+ public:
+  CompareExpNode(ASTContext* context, CompareOp op, ExpNode* lhs, ExpNode* rhs)
+      : ExpNode(context, AST_NODE_TYPE_COMPARE_EXP),
+        op(op),
+        lhs(std::unique_ptr<ExpNode>(std::move(lhs))),
+        rhs(std::unique_ptr<ExpNode>(std::move(rhs))) {}
+
+  virtual std::unique_ptr<NodeValue> getValue() const override;
+  virtual TaggedValue getTaggedValue() const override;
+  virtual Value* codegen(llvm::BasicBlock* bb = nullptr) override;
+  virtual std::vector<Value*> codegen_elements(Error& error, llvm::BasicBlock* bb = nullptr) const override;
+  virtual void canonicalize(std::string& out) const override {
+    ExpNode::canonicalize(out);
+    canonical_append(out, (uint64_t)op);
+    lhs->canonicalize(out);
+    rhs->canonicalize(out);
+  }
+
+  // Same as codegen_elements but the last element is the i1 result, which is
+  // what a branch needs; no boxed value is built
+  std::vector<Value*> condition_codegen_elements(Error& error, llvm::BasicBlock* bb) const;
+
+  CompareOp getOp() const { return op; }
+  const ExpNode* getLHS() const { return lhs.get(); }
+  const ExpNode* getRHS() const { return rhs.get(); }
+
+  static bool classof(const ASTNode* S) { return S->getKind() == AST_NODE_TYPE_COMPARE_EXP; }
+};
+
+// lhs op rhs of two interpreted values; undefined when op does not apply to them
+TaggedValue binary_op_tagged_value(int op, const TaggedValue& lhs, const TaggedValue& rhs);
+// Whether lhs op rhs is a division the processor would trap on: by zero, or of
+// the minimum of an integer type by -1
+bool binary_op_traps(int op, const TaggedValue& lhs, const TaggedValue& rhs);
+// Compares two interpreted values; false when they cannot be compared
+bool compare_tagged_values(CompareExpNode::CompareOp op, const TaggedValue& lhs, const TaggedValue& rhs, bool& result);
+
+// Elements computing the truth value of any expression as an i1 (the last
+// element): comparisons directly, anything else is true when not zero
+std::vector<Value*> condition_codegen_elements(Error& error, const ExpNode* exp_node, llvm::BasicBlock* bb);
+
+// IfExpNode - Node class for if/else. Both `if (c) a else b` and the block
+// form `if (c) { ... } else { ... }` are expressions: the value is the one of
+// the last statement of the branch taken, undefined if it is not an expression.
+class IfExpNode : public ExpNode {
+ private:
+  std::unique_ptr<ExpNode> condition;
+  std::vector<std::unique_ptr<ASTNode>> then_nodes;
+  std::vector<std::unique_ptr<ASTNode>> else_nodes;
+
+ public:
+  IfExpNode(ASTContext* context, ExpNode* condition, ExpNode* then_exp, ExpNode* else_exp);
+  IfExpNode(ASTContext* context, ExpNode* condition, stmtlist_t* then_stmt_list, stmtlist_t* else_stmt_list);
+
+  virtual std::unique_ptr<NodeValue> getValue() const override;
+  virtual Value* codegen(llvm::BasicBlock* bb = nullptr) override;
+  virtual std::vector<Value*> codegen_elements(Error& error, llvm::BasicBlock* bb = nullptr) const override;
+  virtual void canonicalize(std::string& out) const override;
+
+  // Interprets the branch taken; false when a break was reached or on error.
+  // result gets the value of the branch.
+  bool evalBranch(std::unique_ptr<NodeValue>& result, bool in_loop) const;
+
+  const ExpNode* getCondition() const { return condition.get(); }
+  const std::vector<std::unique_ptr<ASTNode>>& getThenNodes() const { return then_nodes; }
+  const std::vector<std::unique_ptr<ASTNode>>& getElseNodes() const { return else_nodes; }
+
+  static bool classof(const ASTNode* S) { return S->getKind() == AST_NODE_TYPE_IF_EXP; }
+
  private:
-  Value* CreatePow(Value* L, Value* R, const char* name) const;
+  std::vector<Value*> branch_codegen_elements(Error& error, const std::vector<std::unique_ptr<ASTNode>>& nodes,
+                                              llvm::BasicBlock* bb, Value*& value) const;
 };
 
+// Interprets the statements of a top level block; false when a break was
+// reached or on error. result, when given, gets the value of the last
+// statement if it is an expression.
+bool eval_statements(const std::vector<std::unique_ptr<ASTNode>>& nodes, bool in_loop,
+                     std::unique_ptr<NodeValue>* result = nullptr);
+
+// Truth value of an interpreted value: not zero, or a non empty string
+bool is_true(const TaggedValue& value);
+
 // ImportNode - Node class for file import
 class ImportNode : public ASTNode {
  private:
@@ -560,6 +828,10 @@ class ImportNode : public ASTNode {
   // virtual void* eval() override;
   ProcessorStrategy* getProcessorStrategy() override { return importNodeProcessorStrategy; };
   const std::string& getFilename() const { return filename; }
+  virtual void canonicalize(std::string& out) const override {
+    ASTNode::canonicalize(out);
+    canonical_append(out, filename);
+  }
 
   // int getType() const override { return getClassType(); };
   // static int getClassType() { return AST_NODE_TYPE_IMPORT; };
@@ -579,6 +851,10 @@ class FunctionArgument {
  public:
   FunctionArgument(const std::string name, llvm::Type* type, ExpNode* default_value = nullptr)
       : name(name), type(type), default_value(default_value) {}
+
+  const std::string& getName() const { return name; }
+  const ExpNode* getDefaultValue() const { return default_value; }
+  ExpNode* getDefaultValue() { return default_value; }
 };
 
 // FunctionDefNode - Node class for function definition.
@@ -614,6 +890,7 @@ class FunctionDefNode : public ASTNode {
  private:
   std::vector<std::unique_ptr<ASTNode>> body_nodes;
   FunctionSignature* function_signature;
+  std::vector<std::string> annotations;
 
  public:
   FunctionDefNode(ASTContext* context, const std::string& name, std::vector<FunctionArgument*> args_defs,
@@ -640,7 +917,18 @@ class FunctionDefNode : public ASTNode {
   llvm::Type* getReturnLLVMType() { return function_signature->getReturnType(); }
   FunctionSignature* getFunctionSignature() { return function_signature; }
 
+  void addAnnotation(const std::string& annotation) { annotations.push_back(annotation); }
+  bool hasAnnotation(const std::string& annotation) const {
+    return std::find(annotations.begin(), annotations.end(), annotation) != annotations.end();
+  }
+  const std::vector<std::string>& getAnnotations() const { return annotations; }
+  FPMode getFPMode() const;
+  virtual void canonicalize(std::string& out) const override;
+
   Function* getFunctionDefinition();
+  // A clone named name, internal to TheModule, with the arguments that have a
+  // constant folded in and removed from its parameters (see noname-specialize.h)
+  Function* codegen_specialization(const std::string& name, const std::vector<llvm::Constant*>& constant_args);
   ProcessorStrategy* getProcessorStrategy() override { return functionDefNodeProcessorStrategy; };
 
   // int getType() const override { return getClassType(); };
@@ -650,13 +938,31 @@ class FunctionDefNode : public ASTNode {
  private:
   FunctionSignature* createFunctionSignature(Error& error, const std::string& name, std::vector<FunctionArgument*> args_defs);
   llvm::ReturnInst* getLLVMReturnInst(Value* return_value) const;
+  Function* codegen_function(Function* function, const std::vector<llvm::Constant*>& constant_args);
 };
 
+// A self recursive call in tail position does not call: it stores the new
+// arguments into their stack slots and jumps back to the body of the function
+// being generated, which mem2reg turns into a loop.
+typedef struct TailRecursionTarget_t {
+  const FunctionDefNode* function_def_node;
+  Function* function;
+  BasicBlock* body;
+  std::vector<AllocaInst*> arg_allocas;
+} TailRecursionTarget_t;
+
+// Target of the innermost function being generated, null if none
+const TailRecursionTarget_t* get_tail_recursion_target();
+// Whether the body of function_def_node (or of a clone of it) is being generated
+bool is_function_being_generated(const FunctionDefNode* function_def_node);
+
 class TopLevelExpNode : public ExpNode {
  private:
   ExpNode* exp_node;
   CallExpNode* call_exp_node;
   Function* anonymous_function;
+  // functions called by the code of anonymous_function
+  std::set<std::string> callees;
 
  public:
   TopLevelExpNode(ASTContext* context, ExpNode* exp_node, CallExpNode* call_exp_node, Function* anonymous_function);
@@ -667,8 +973,15 @@ class TopLevelExpNode : public ExpNode {
   virtual std::vector<Value*> codegen_elements(Error& error, llvm::BasicBlock* bb = nullptr) const override;
 
   virtual std::unique_ptr<NodeValue> getValue() const override { return exp_node->getValue(); };
+  virtual void canonicalize(std::string& out) const override {
+    ExpNode::canonicalize(out);
+    ASTNode::canonicalize(out, exp_node);
+  }
   void* release();
   llvm::Type* getReturnLLVMType() { return anonymous_function->getReturnType(); }
+  ExpNode* getExpNode() const { return exp_node; }
+  const std::set<std::string>& getCallees() const { return callees; }
+  void setCallees(const std::set<std::string>& callees) { this->callees = callees; }
   ProcessorStrategy* getProcessorStrategy() override { return topLevelExpNodeProcessorStrategy; };
 
   static bool classof(const ASTNode* S) { return S->getKind() == AST_NODE_TYPE_TOP_LEVEL_EXP_NODE; }
@@ -686,6 +999,12 @@ class ReturnExpNode : public ExpNode {
   virtual std::unique_ptr<NodeValue> getValue() const override { return exp_node->getValue(); };
   virtual Value* codegen(llvm::BasicBlock* bb) override;
   virtual std::vector<Value*> codegen_elements(Error& error, llvm::BasicBlock* bb) const override;
+  virtual void canonicalize(std::string& out) const override {
+    ExpNode::canonicalize(out);
+    exp_node->canonicalize(out);
+  }
+
+  const ExpNode* getExpNode() const { return exp_node; }
 
   static bool classof(const ASTNode* S) { return S->getKind() == AST_NODE_TYPE_RETURN_NODE; }
 };
@@ -708,11 +1027,21 @@ class CallExpNode : public ExpNode {
   virtual std::vector<Value*> codegen_elements(Error& error, llvm::BasicBlock* bb = nullptr) const override;
 
   virtual ProcessorStrategy* getProcessorStrategy() override { return callNodeProcessorStrategy; };
+  virtual void canonicalize(std::string& out) const override;
 
   const std::string& getCallee() const { return callee; }
   llvm::Function* getCalledFunction(Error& error) const;
   const std::vector<std::unique_ptr<ExpNode>>& getArgs() const { return args; }
 
+  // Elements computing the arguments (bb moves to the block they end in); the
+  // value of each argument is appended to args_value
+  std::vector<Value*> args_codegen_elements(Error& error, llvm::BasicBlock*& bb, std::vector<llvm::Value*>& args_value) const;
+  std::vector<Value*> args_codegen_elements(Error& error, llvm::BasicBlock*& bb, const std::vector<ExpNode*>& arg_nodes,
+                                            std::vector<llvm::Value*>& args_value) const;
+  // The arguments passed followed by the defaults of the ones left out, up to
+  // args_size; false when one left out has no default
+  bool getArgNodes(std::vector<ExpNode*>& arg_nodes, size_t args_size) const;
+
   // int getType() const override { return getClassType(); };
   // static int getClassType() { return AST_NODE_TYPE_CALL_EXP; };
   static bool classof(const ASTNode* S) { return S->getKind() == AST_NODE_TYPE_CALL_EXP; }
@@ -743,6 +1072,11 @@ class AssignmentNode : public ExpNode {
 
   virtual std::unique_ptr<NodeValue> getValue() const override;
   virtual ProcessorStrategy* getProcessorStrategy() override { return assignmentNodeProcessorStrategy; };
+  virtual void canonicalize(std::string& out) const override {
+    ExpNode::canonicalize(out);
+    canonical_append(out, name);
+    ASTNode::canonicalize(out, rhs.get());
+  }
   const std::string& getName() const { return name; }
   const std::unique_ptr<ExpNode>& getRHS() const { return rhs; }
 
@@ -781,12 +1115,50 @@ class DeclarationNode : public ASTNode {
   virtual std::vector<Value*> codegen_elements(Error& error, llvm::BasicBlock* bb = nullptr) const override;
 
   const std::string& getName() const { return name; }
+  virtual void canonicalize(std::string& out) const override {
+    ASTNode::canonicalize(out);
+    canonical_append(out, name);
+  }
 
   // int getType() const override { return getClassType(); };
   // static int getClassType() { return AST_NODE_TYPE_DECLARATION; };
   static bool classof(const ASTNode* S) { return S->getKind() == AST_NODE_TYPE_DECLARATION; }
 };
 
+// LoopNode - Node class for `while (cond) { ... }` and `loop { ... }`, which
+// is a while loop without condition. Inside a function it is compiled to a
+// loop header, a body and an exit block; at the top level it is interpreted.
+class LoopNode : public ASTNode {
+ private:
+  std::unique_ptr<ExpNode> condition;
+  std::vector<std::unique_ptr<ASTNode>> body_nodes;
+
+ public:
+  LoopNode(ASTContext* context, ExpNode* condition, stmtlist_t* head_stmt_list);
+
+  virtual void* eval() override;
+  virtual std::vector<Value*> codegen_elements(Error& error, llvm::BasicBlock* bb = nullptr) const override;
+  virtual void canonicalize(std::string& out) const override;
+  ProcessorStrategy* getProcessorStrategy() override { return loopNodeProcessorStrategy; };
+
+  // null for `loop { ... }`
+  const ExpNode* getCondition() const { return condition.get(); }
+  const std::vector<std::unique_ptr<ASTNode>>& getBodyNodes() const { return body_nodes; }
+
+  static bool classof(const ASTNode* S) { return S->getKind() == AST_NODE_TYPE_LOOP; }
+};
+
+class BreakNode : public ASTNode {
+ public:
+  BreakNode(ASTContext* context) : ASTNode(context, AST_NODE_TYPE_BREAK) {}
+
+  virtual void* eval() override;
+  virtual std::vector<Value*> codegen_elements(Error& error, llvm::BasicBlock* bb = nullptr) const override;
+  ProcessorStrategy* getProcessorStrategy() override { return loopNodeProcessorStrategy; };
+
+  static bool classof(const ASTNode* S) { return S->getKind() == AST_NODE_TYPE_BREAK; }
+};
+
 class ProcessorStrategy {
  public:
   virtual ~ProcessorStrategy() = default;
@@ -820,6 +1192,10 @@ class ImportNodeProcessorStrategy : public ProcessorStrategy {
  public:
   void* process(ASTNode* node) override;
 };
+class LoopNodeProcessorStrategy : public ProcessorStrategy {
+ public:
+  void* process(ASTNode* node) override;
+};
 
 // class ReturnExpNode : public ExpNode {
 //  private:
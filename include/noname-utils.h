@@ -20,8 +20,10 @@
 #include <cctype>
 #include <cctype>
 #include <cstdio>
+#include <cstdint>
 #include <cstdlib>
 #include <memory>
+#include <string>
 #include <typeinfo>
 #include <type_traits>
 
@@ -106,6 +108,32 @@ E push_back_ret(std::vector<T>& vec, E item) {
   return item;
 };
 
+// 64 bit FNV-1a. Unlike llvm::hash_code the result does not change between
+// runs, so it can be written to disk (profiles are keyed by it).
+const uint64_t STABLE_HASH_SEED = 0xcbf29ce484222325ULL;
+
+inline uint64_t stable_hash(uint64_t hash, const void* data, size_t size) {
+  const unsigned char* bytes = (const unsigned char*)data;
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+inline uint64_t stable_hash(uint64_t hash, uint64_t value) { return stable_hash(hash, &value, sizeof(value)); }
+inline uint64_t stable_hash(uint64_t hash, const std::string& value) {
+  return stable_hash(stable_hash(hash, (uint64_t)value.size()), value.data(), value.size());
+}
+
+// Appends to a canonical serialization (see ASTNode::canonicalize), strings
+// prefixed with their size so that no two serializations run into each other
+inline void canonical_append(std::string& out, const void* data, size_t size) { out.append((const char*)data, size); }
+inline void canonical_append(std::string& out, uint64_t value) { canonical_append(out, &value, sizeof(value)); }
+inline void canonical_append(std::string& out, const std::string& value) {
+  canonical_append(out, (uint64_t)value.size());
+  out.append(value);
+}
+
 bool is_file_already_imported(const std::string& file_path);
 bool is_file_already_imported(const char* file_path);
 char* get_current_dir();
@@ -156,6 +184,7 @@ AssignmentNode* new_declaration_node(ASTContext* context, const std::string name
 CallExpNode* new_call_node(ASTContext* context, const std::string name, explist_t* arg_exp_list = nullptr);
 CallExpNode* new_call_node(ASTContext* context, Function* function, explist_t* arg_exp_list = nullptr);
 ASTNode* new_function_def(ASTContext* context, const std::string name, arglist_t* arg_list, stmtlist_t* stmt_list);
+ASTNode* annotate_function_def(ASTContext* context, const std::string annotation, ASTNode* node);
 
 bool both_of_type(NodeValue* lhs, NodeValue* rhs, int type);
 bool any_of_type(NodeValue* lhs, NodeValue* rhs, int type);
@@ -169,6 +198,16 @@ llvm::Type* toLLVMType(llvm::Value* return_value);
 int toNonameType(llvm::Value* value);
 int toNonameType(llvm::Type* type);
 
+// Floating point semantics of the code emitted for a function. The session
+// default comes from -fp-mode and can be overridden per function with the
+// @strict, @contract and @fast annotations.
+enum FPMode { FP_MODE_STRICT, FP_MODE_CONTRACT, FP_MODE_FAST };
+
+const char* fp_mode_name(FPMode mode);
+FPMode get_fp_mode(const llvm::Function* function);
+void set_fp_mode(llvm::Function* function, FPMode mode);
+void apply_fp_mode(llvm::Value* value, FPMode mode);
+
 // Codegen functions
 Value* constant_codegen_util(int type, void* value, llvm::BasicBlock* bb = nullptr);
 Value* codegen_elements_retlast(ASTNode* node, llvm::BasicBlock* bb = nullptr);
@@ -182,6 +221,41 @@ StoreInst* store_untyped_var_codegen(int type, CastInst* cast_inst_from, AllocaI
 CastInst* cast_codegen(int type, AllocaInst* alloca_inst_from, llvm::BasicBlock* bb = nullptr);
 GetElementPtrInst* get_element_ptr_type_codegen(llvm::Value* value, const std::string& sufix = "", llvm::BasicBlock* bb = nullptr);
 GetElementPtrInst* get_element_ptr_v_codegen(llvm::Value* value, const std::string& sufix = "", llvm::BasicBlock* bb = nullptr);
+// Declaration of a runtime function (e.g. func__Znwm) inside the module being
+// built; the global one belongs to the first module only
+llvm::Function* get_module_function(llvm::Function* function);
+// The runtime of the host (noname_binary_op, ...) is referred to by name, never
+// by address, and linked when the module is: the objects of the JIT stay valid
+// in another process (the precompiled prelude, session snapshots).
+// register_host_symbols makes the names resolvable whatever the linker exports.
+void register_host_symbols();
+llvm::Constant* host_function_codegen(const std::string& name, llvm::FunctionType* function_type);
+// Address of a long of the host, as the i8* payload of a datatype_t
+llvm::Constant* host_long_address_codegen(const std::string& name);
+// Whether the code of module points into the memory of this process (an
+// inttoptr of a constant address, like the counters of -profile-generate): its
+// object cannot run in another one
+bool embeds_host_addresses(const llvm::Module& module);
+// Block where the code following the given elements must be emitted: the last
+// block they created (e.g. the merge block of a type dispatch) or bb itself
+llvm::BasicBlock* continuation_block(const std::vector<Value*>& elements, llvm::BasicBlock* bb);
+// bb itself, or a new block when bb already ends in a return or a break: the
+// code following those is unreachable but it still needs a block
+llvm::BasicBlock* insertion_block(llvm::BasicBlock* bb);
+// Functions called from JIT'd code use fastcc and take every datatype_t
+// argument split in its type tag and its payload, so both travel in registers;
+// only the entry points called by the host (top level expressions) keep the C
+// calling convention and the datatype_t arguments
+bool is_host_entry_point(const std::string& function_name);
+bool has_split_datatype_args(const llvm::Function* function);
+// Number of noname arguments of a function, whatever its calling convention
+size_t datatype_args_size(const llvm::Function* function);
+// Tag and payload of every datatype_t value, in order
+void split_datatype_args_codegen(std::vector<Value*>& codegen, const std::vector<Value*>& args_value,
+                                 std::vector<Value*>& split_args_value, llvm::BasicBlock* bb);
+// The datatype_t value of an argument received split in two registers
+Value* join_datatype_arg_codegen(std::vector<Value*>& codegen, Value* type, Value* v, const std::string& name,
+                                 llvm::BasicBlock* bb);
 
 //===----------------------------------------------------------------------===//
 // "Library" functions that can be "extern'd" from user code.
@@ -197,6 +271,15 @@ GetElementPtrInst* get_element_ptr_v_codegen(llvm::Value* value, const std::stri
 extern "C" DLLEXPORT double putchard(double X);
 /// printd - printf that takes a double prints it as "%f\n", returning 0.
 extern "C" DLLEXPORT double printd(double X);
+/// noname_pow_long - exact base^exponent; 0 when it overflows or exponent < 0.
+extern "C" DLLEXPORT int noname_pow_long(long base, long exponent, long* result);
+/// noname_numeric_promotion_table - result type of an arithmetic operation
+/// between two numbers, indexed by type - TYPE_CHAR.
+extern "C" DLLEXPORT const int noname_numeric_promotion_table[6][6];
+/// noname_numeric_binary_op - lhs op rhs of two numbers of any numeric types,
+/// in slot or a box of its own; null when the host has to compute it.
+extern "C" DLLEXPORT void* noname_numeric_binary_op(int op, int lhs_type, const void* lhs_v, int rhs_type, const void* rhs_v,
+                                                   void* slot, int* result_type);
 extern "C" DLLEXPORT void* get_copy_address_string(const std::string& value);
 extern "C" DLLEXPORT void* get_copy_address_long(long value);
 extern "C" DLLEXPORT void* get_copy_address_int(int value);
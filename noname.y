@@ -38,6 +38,7 @@ namespace noname {
   extern void division_by_zero(YYLTYPE &yylloc);
   extern ASTNode* pre_process(ASTNode* node);
   extern void eval(ASTNode* node);
+  extern void ast_file_record(ASTNode* node);
 }
 
 %}
@@ -120,10 +121,14 @@ namespace noname {
 %token <id_v> STR_CONST             "string_constant"
 %token <double_v> DOUBLE_TOK            "double"
 %token <long_v> LONG_TOK                "long"
+%token GE_TOK                    "ge"
+%token EQ_TOK                    "eq"
+%token NE_TOK                    "ne"
 %type  <ast_node> declaration       "declaration"
 %type  <exp_node> assignment        "assignment"
 // %type  <exp_node> optional_ret_stmt "optional_ret_stmt"
 %type  <exp_node> exp               "expression"
+%type  <exp_node> if_block          "if_block"
 %type  <ast_node> function_def      "function_def"
 %type  <stmtlist> stmtlist        "stmtlist"
 %type  <stmtlist> ne_stmt_list     "ne_stmt_list"
@@ -137,6 +142,8 @@ namespace noname {
 %type  <ast_node> import            "import"
 %type  <ast_node> stmt              "statement"
 
+%precedence ELSE_TOK   /* if (c) a else b + 1 is if (c) a else (b + 1) */
+%nonassoc EQ_TOK NE_TOK '<' '>' LE_TOK GE_TOK
 %left '-' '+'
 %left '*' '/'
 %right '^'        /* exponentiation */
@@ -155,6 +162,7 @@ prog:
     write_cursor();
   }
   | prog stmt {
+      ast_file_record($2);
       $2 = pre_process($2);
       eval($2);
       write_cursor();
@@ -202,6 +210,44 @@ stmt:
       }
       $$ = $function_def;
     }
+  | '@' IDENTIFIER stmt {
+      if (yydebug) {
+        fprintf(stderr, "\n[stmt - annotation]: ");
+      }
+      $$ = annotate_function_def(context, std::string($IDENTIFIER), $3);
+    }
+  | if_block optional_stmt_sep {
+      if (yydebug) {
+        fprintf(stderr, "\n[stmt - if]: ");
+      }
+      $$ = $if_block;
+    }
+  | WHILE '(' exp ')' '{' stmtlist '}' optional_stmt_sep {
+      if (yydebug) {
+        fprintf(stderr, "\n[stmt - while]: ");
+      }
+      if ($stmtlist == NULL) {
+        $stmtlist = new_stmt_list(context);
+      }
+      $$ = new LoopNode(context, $exp, $stmtlist);
+      release($stmtlist);
+    }
+  | LOOP_TOK '{' stmtlist '}' optional_stmt_sep {
+      if (yydebug) {
+        fprintf(stderr, "\n[stmt - loop]: ");
+      }
+      if ($stmtlist == NULL) {
+        $stmtlist = new_stmt_list(context);
+      }
+      $$ = new LoopNode(context, NULL, $stmtlist);
+      release($stmtlist);
+    }
+  | BREAK_TOK STMT_SEP {
+      if (yydebug) {
+        fprintf(stderr, "\n[stmt - break]: ");
+      }
+      $$ = new BreakNode(context);
+    }
   | RETURN exp STMT_SEP {
         if (yydebug) {
           fprintf(stderr, "\n[stmt - return]: ");
@@ -220,6 +266,32 @@ optional_stmt_sep:
   %empty
   | STMT_SEP
 ;
+
+if_block:
+  IF_TOK '(' exp ')' '{' stmtlist '}' {
+      $$ = new IfExpNode(context, $exp, $stmtlist, NULL);
+      if ($stmtlist) {
+        release($stmtlist);
+      }
+    }
+  | IF_TOK '(' exp ')' '{' stmtlist '}' ELSE_TOK '{' stmtlist '}' {
+      $$ = new IfExpNode(context, $3, $6, $10);
+      if ($6) {
+        release($6);
+      }
+      if ($10) {
+        release($10);
+      }
+    }
+  | IF_TOK '(' exp ')' '{' stmtlist '}' ELSE_TOK if_block {
+      stmtlist_t* else_stmt_list = new_stmt_list(context, $9);
+      $$ = new IfExpNode(context, $3, $6, else_stmt_list);
+      release(else_stmt_list);
+      if ($6) {
+        release($6);
+      }
+    }
+;
   // 
   // Handling multi level scope/context
   // gnu.org/software/bison/manual/html_node/Using-Mid_002dRule-Actions.html#Using-Mid_002dRule-Actions
@@ -314,6 +386,27 @@ exp:
   | exp '^' exp        {
       $$ = new BinaryExpNode(context, '^', $1, $3);
     }
+  | exp '<' exp        {
+      $$ = new CompareExpNode(context, CompareExpNode::CMP_LT, $1, $3);
+    }
+  | exp '>' exp        {
+      $$ = new CompareExpNode(context, CompareExpNode::CMP_GT, $1, $3);
+    }
+  | exp LE_TOK exp     {
+      $$ = new CompareExpNode(context, CompareExpNode::CMP_LE, $1, $3);
+    }
+  | exp GE_TOK exp     {
+      $$ = new CompareExpNode(context, CompareExpNode::CMP_GE, $1, $3);
+    }
+  | exp EQ_TOK exp     {
+      $$ = new CompareExpNode(context, CompareExpNode::CMP_EQ, $1, $3);
+    }
+  | exp NE_TOK exp     {
+      $$ = new CompareExpNode(context, CompareExpNode::CMP_NE, $1, $3);
+    }
+  | IF_TOK '(' exp ')' exp ELSE_TOK exp {
+      $$ = new IfExpNode(context, $3, $5, $7);
+    }
   | '(' exp ')'        {
       $$ = new BinaryExpNode(context, 0, $2, NULL);
     }
@@ -34,7 +34,7 @@ std::unique_ptr<NodeValue> AssignmentNode::getValue() const { return rhs->getVal
 void* AssignmentNode::eval() {
   std::unique_ptr<NodeValue> node_value = getValue();
 
-  getContext()->update(name, std::move(node_value.get()));
+  getContext()->update(name, node_value.release());
 
   if (debug >= 2) {
     fprintf(stdout, "\n############ updated %s on context %s \n\n", name.c_str(), getContext()->getName().c_str());
@@ -47,21 +47,29 @@ std::vector<Value*> AssignmentNode::codegen_elements(noname::Error& error, llvm:
   AllocaInst* alloca_inst = getContext()->getAllocaInst(getName());
 
   if (!alloca_inst) {
-    createError(error, "AllocaInst is invalid or undefined");
+    char msg[1024];
+    sprintf(msg, "Variable '%s' is not declared", getName().c_str());
+    createError(error, msg);
     return codegen;
   }
 
   const std::unique_ptr<ExpNode>& rhs = getRHS();
-  Value* value = rhs->codegen();
-  getContext()->storeValue(getName(), value);
+  std::vector<Value*> rhs_codegen_elements = rhs->get_codegen_elements(error, bb);
 
-  std::vector<Value*> assign_codegen = assign_codegen_util(alloca_inst, value, bb);
+  if (error.code()) {
+    return codegen;
+  }
 
-  codegen.push_back(alloca_inst);
-  for (auto& ptr : assign_codegen) {
-    codegen.push_back(std::move(ptr));
+  if (rhs_codegen_elements.empty() || !rhs_codegen_elements.back()) {
+    createError(error, "Invalid or undefined value assigned");
+    return codegen;
   }
 
+  codegen.insert(codegen.end(), rhs_codegen_elements.begin(), rhs_codegen_elements.end());
+  bb = continuation_block(rhs_codegen_elements, bb);
+
+  push_back_ret(codegen, store_typed_var_codegen(TYPE_DATATYPE, rhs_codegen_elements.back(), alloca_inst, bb));
+
   return codegen;
 }
 Value* AssignmentNode::codegen(llvm::BasicBlock* bb) { return codegen_elements_retlast(this, bb); }
@@ -1,6 +1,7 @@
 #include "noname-utils.h"
 #include "noname-types.h"
 #include "noname-jit.h"
+#include "noname-globals.h"
 #include <limits.h>
 #include <stdio.h>
 #include <algorithm>
@@ -77,7 +78,14 @@ bool ASTContext::storeVariable(const std::string name, NodeValue* node_value) {
   if (noname::debug >= 3) {
     fprintf(stdout, "\n[Storing NodeValue '%s' on context %s]", name.c_str(), this->getName().c_str());
   }
+  if (!getParent() && global_variable_frozen(name)) {
+    logErrorNV(new LogicErrorNode(this, "Variable '" + name + "' was folded into code restored from a snapshot and cannot be reassigned"));
+    return false;
+  }
   mVariables[name] = node_value;
+  if (!getParent()) {
+    global_variable_stored(name, node_value);
+  }
   return true;
 }
 bool ASTContext::removeVariable(const std::string name) {
@@ -96,7 +104,14 @@ NodeValue* ASTContext::updateVariable(const std::string name, NodeValue* node_va
   itVariables = mVariables.find(name);
 
   if (itVariables != mVariables.end()) {
+    if (!getParent() && global_variable_frozen(name)) {
+      std::string error_msg("Variable '" + name + "' was folded into code restored from a snapshot and cannot be reassigned");
+      return logErrorNV(new LogicErrorNode(this, error_msg));
+    }
     mVariables[name] = node_value;
+    if (!getParent()) {
+      global_variable_stored(name, node_value);
+    }
     return node_value;
   }
 
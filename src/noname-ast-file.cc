@@ -0,0 +1,676 @@
+#include "noname-ast-file.h"
+#include "noname-utils.h"
+#include "noname-types.h"
+#include "noname-stats.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace noname {
+
+ASTNode* pre_process(ASTNode* node);
+void eval(ASTNode* node);
+
+std::string emit_ast_file;
+std::string load_ast_file;
+
+static Statistic NumAstFilesLoaded("ast-file", "loaded", "Number of AST files run without parsing");
+static Statistic NumAstFilesRejected("ast-file", "rejected", "Number of AST files not valid for their source");
+static Statistic NumAstNodesLoaded("ast-file", "nodes", "Number of AST nodes built from AST files");
+
+namespace {
+
+const char AST_FILE_MAGIC[4] = {'N', 'N', 'A', 'S'};
+// bump whenever the layout or ASTNode::ASTNodeKind change
+const uint32_t AST_FILE_VERSION = 1;
+const uint32_t NO_INDEX = 0xFFFFFFFF;
+
+// Followed by the nodes, the lists, the symbol offsets (one more than the
+// symbols) and the symbol characters. Every index is relative to its section.
+struct AstFileHeader {
+  char magic[4];
+  uint32_t version;
+  // of everything after the header
+  uint64_t payload_hash;
+  // of the source the statements were parsed from
+  uint64_t source_hash;
+  uint32_t nodes_count;
+  uint32_t lists_size;
+  uint32_t symbols_count;
+  uint32_t strings_size;
+  // list of the top level statements
+  uint32_t statements;
+  uint32_t reserved;
+};
+
+// A child node always comes before its parent. By kind:
+//   NUMBER                  op: type, value: bits of the number
+//   STRING, VARIABLE        symbol
+//   UNARY_EXP               op, a: operand
+//   BINARY                  op, a: lhs, b: rhs or NO_INDEX for '(' exp ')'
+//   COMPARE_EXP             op, a: lhs, b: rhs
+//   IF_EXP                  a: condition, b: then list, c: else list
+//   CALL_EXP                symbol: callee, a: argument list
+//   RETURN_NODE             a: value
+//   (DECLARATION_)ASSIGNMENT symbol, a: value
+//   DECLARATION, IMPORT     symbol
+//   LOOP                    a: condition or NO_INDEX, b: body list
+//   DEF_FUNCTION            symbol, a: list of (name symbol, default value or
+//                           NO_INDEX) pairs, b: body list, c: annotation symbols
+// A list is its count followed by its items.
+struct AstFileNode {
+  uint16_t kind;
+  uint16_t op;
+  uint32_t symbol;
+  uint32_t a;
+  uint32_t b;
+  uint32_t c;
+  uint32_t reserved;
+  uint64_t value;
+};
+
+class AstFileWriter {
+ private:
+  std::vector<AstFileNode> nodes;
+  std::vector<uint32_t> lists;
+  std::vector<uint32_t> statements;
+  std::vector<std::string> symbols;
+  std::map<std::string, uint32_t> symbol_indexes;
+  // set when a node of the statement being written cannot be serialized
+  bool unsupported;
+
+ public:
+  AstFileWriter() : unsupported(false) {}
+
+  void addStatement(ASTNode* node) {
+    size_t nodes_size = nodes.size();
+    size_t lists_size = lists.size();
+
+    unsupported = false;
+    uint32_t index = write(node);
+
+    if (unsupported || index == NO_INDEX) {
+      nodes.resize(nodes_size);
+      lists.resize(lists_size);
+
+      if (noname::debug >= 1) {
+        fprintf(stderr, "\n[%s not written to the AST file]", ASTNode::toString(node->getKind()).c_str());
+      }
+      return;
+    }
+
+    statements.push_back(index);
+  }
+
+  bool writeTo(const std::string& file_path, uint64_t source_hash) {
+    std::vector<uint32_t> all_lists(lists);
+    uint32_t statements_list = all_lists.size();
+    all_lists.push_back(statements.size());
+    all_lists.insert(all_lists.end(), statements.begin(), statements.end());
+
+    std::vector<uint32_t> symbol_offsets;
+    std::string strings;
+    for (const std::string& symbol : symbols) {
+      symbol_offsets.push_back(strings.size());
+      strings += symbol;
+    }
+    symbol_offsets.push_back(strings.size());
+
+    std::string payload;
+    payload.append((const char*)nodes.data(), nodes.size() * sizeof(AstFileNode));
+    payload.append((const char*)all_lists.data(), all_lists.size() * sizeof(uint32_t));
+    payload.append((const char*)symbol_offsets.data(), symbol_offsets.size() * sizeof(uint32_t));
+    payload.append(strings);
+
+    AstFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, AST_FILE_MAGIC, sizeof(header.magic));
+    header.version = AST_FILE_VERSION;
+    header.payload_hash = stable_hash(STABLE_HASH_SEED, payload.data(), payload.size());
+    header.source_hash = source_hash;
+    header.nodes_count = nodes.size();
+    header.lists_size = all_lists.size();
+    header.symbols_count = symbols.size();
+    header.strings_size = strings.size();
+    header.statements = statements_list;
+
+    FILE* file = fopen(file_path.c_str(), "wb");
+    if (!file) {
+      return false;
+    }
+
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   (payload.empty() || fwrite(payload.data(), payload.size(), 1, file) == 1);
+    return fclose(file) == 0 && written;
+  }
+
+ private:
+  uint32_t symbol(const std::string& name) {
+    auto it = symbol_indexes.find(name);
+    if (it != symbol_indexes.end()) {
+      return it->second;
+    }
+
+    uint32_t index = symbols.size();
+    symbols.push_back(name);
+    symbol_indexes[name] = index;
+    return index;
+  }
+
+  uint32_t list(const std::vector<uint32_t>& items, uint32_t count) {
+    uint32_t index = lists.size();
+    lists.push_back(count);
+    lists.insert(lists.end(), items.begin(), items.end());
+    return index;
+  }
+
+  uint32_t writeList(const std::vector<std::unique_ptr<ASTNode>>& list_nodes) {
+    std::vector<uint32_t> items;
+    for (const std::unique_ptr<ASTNode>& list_node : list_nodes) {
+      if (list_node) {
+        items.push_back(write(list_node.get()));
+      }
+    }
+    return list(items, items.size());
+  }
+
+  uint32_t add(const ASTNode* node, uint16_t op = 0, uint32_t symbol = NO_INDEX, uint32_t a = NO_INDEX, uint32_t b = NO_INDEX,
+               uint32_t c = NO_INDEX, uint64_t value = 0) {
+    nodes.push_back(AstFileNode{(uint16_t)node->getKind(), op, symbol, a, b, c, 0, value});
+    return nodes.size() - 1;
+  }
+
+  uint32_t write(const ASTNode* node) {
+    if (!node) {
+      return NO_INDEX;
+    }
+
+    if (isa<NumberExpNode>(node)) {
+      TaggedValue number = ((const NumberExpNode*)node)->getTaggedValue();
+      uint64_t bits = 0;
+
+      if (number.getType() == TYPE_DOUBLE || number.getType() == TYPE_FLOAT) {
+        double double_value = number.as<double>();
+        memcpy(&bits, &double_value, sizeof(bits));
+      } else {
+        bits = (uint64_t)number.as<long>();
+      }
+      return add(node, number.getType(), NO_INDEX, NO_INDEX, NO_INDEX, NO_INDEX, bits);
+    }
+
+    if (isa<StringExpNode>(node)) {
+      return add(node, 0, symbol(((const StringExpNode*)node)->getTaggedValue().asString()));
+    }
+
+    if (isa<VarExpNode>(node)) {
+      return add(node, 0, symbol(((const VarExpNode*)node)->getName()));
+    }
+
+    if (isa<UnaryExpNode>(node)) {
+      const UnaryExpNode* unary_exp_node = (const UnaryExpNode*)node;
+      uint32_t rhs = write(unary_exp_node->getRHS());
+      return add(node, (unsigned char)unary_exp_node->getOp(), NO_INDEX, rhs);
+    }
+
+    if (isa<BinaryExpNode>(node)) {
+      const BinaryExpNode* binary_exp_node = (const BinaryExpNode*)node;
+      uint32_t lhs = write(binary_exp_node->getLHS());
+      uint32_t rhs = write(binary_exp_node->getRHS());
+      return add(node, (unsigned char)binary_exp_node->getOp(), NO_INDEX, lhs, rhs);
+    }
+
+    if (isa<CompareExpNode>(node)) {
+      const CompareExpNode* compare_exp_node = (const CompareExpNode*)node;
+      uint32_t lhs = write(compare_exp_node->getLHS());
+      uint32_t rhs = write(compare_exp_node->getRHS());
+      return add(node, compare_exp_node->getOp(), NO_INDEX, lhs, rhs);
+    }
+
+    if (isa<IfExpNode>(node)) {
+      const IfExpNode* if_exp_node = (const IfExpNode*)node;
+      uint32_t condition = write(if_exp_node->getCondition());
+      uint32_t then_list = writeList(if_exp_node->getThenNodes());
+      uint32_t else_list = writeList(if_exp_node->getElseNodes());
+      return add(node, 0, NO_INDEX, condition, then_list, else_list);
+    }
+
+    if (isa<CallExpNode>(node)) {
+      const CallExpNode* call_exp_node = (const CallExpNode*)node;
+      std::vector<uint32_t> args;
+      for (const std::unique_ptr<ExpNode>& arg : call_exp_node->getArgs()) {
+        args.push_back(write(arg.get()));
+      }
+      return add(node, 0, symbol(call_exp_node->getCallee()), list(args, args.size()));
+    }
+
+    if (isa<ReturnExpNode>(node)) {
+      return add(node, 0, NO_INDEX, write(((const ReturnExpNode*)node)->getExpNode()));
+    }
+
+    if (isa<AssignmentNode>(node)) {
+      const AssignmentNode* assignment_node = (const AssignmentNode*)node;
+      uint32_t rhs = write(assignment_node->getRHS().get());
+      return add(node, 0, symbol(assignment_node->getName()), rhs);
+    }
+
+    if (isa<DeclarationNode>(node)) {
+      return add(node, 0, symbol(((const DeclarationNode*)node)->getName()));
+    }
+
+    if (isa<ImportNode>(node)) {
+      return add(node, 0, symbol(((const ImportNode*)node)->getFilename()));
+    }
+
+    if (isa<LoopNode>(node)) {
+      const LoopNode* loop_node = (const LoopNode*)node;
+      uint32_t condition = write(loop_node->getCondition());
+      return add(node, 0, NO_INDEX, condition, writeList(loop_node->getBodyNodes()));
+    }
+
+    if (isa<BreakNode>(node)) {
+      return add(node);
+    }
+
+    if (isa<FunctionDefNode>(node)) {
+      FunctionDefNode* function_def_node = (FunctionDefNode*)node;
+
+      std::vector<uint32_t> args;
+      for (FunctionArgument* function_argument : function_def_node->getFunctionArguments()) {
+        args.push_back(symbol(function_argument->getName()));
+        args.push_back(write(function_argument->getDefaultValue()));
+      }
+      uint32_t args_list = list(args, function_def_node->getFunctionArguments().size());
+      uint32_t body_list = writeList(function_def_node->getBodyNodes());
+
+      std::vector<uint32_t> annotations;
+      for (const std::string& annotation : function_def_node->getAnnotations()) {
+        annotations.push_back(symbol(annotation));
+      }
+
+      return add(node, 0, symbol(function_def_node->getName()), args_list, body_list, list(annotations, annotations.size()));
+    }
+
+    unsupported = true;
+    return NO_INDEX;
+  }
+};
+
+class AstFileReader {
+ private:
+  const AstFileHeader* header;
+  const AstFileNode* nodes;
+  const uint32_t* lists;
+  const uint32_t* symbol_offsets;
+  const char* strings;
+
+ public:
+  AstFileReader() : header(nullptr), nodes(nullptr), lists(nullptr), symbol_offsets(nullptr), strings(nullptr) {}
+
+  // Checks the whole file, so that building the nodes cannot fail half way
+  bool open(const char* data, size_t size, uint64_t source_hash) {
+    if (size < sizeof(AstFileHeader)) {
+      return false;
+    }
+
+    header = (const AstFileHeader*)data;
+    if (memcmp(header->magic, AST_FILE_MAGIC, sizeof(header->magic)) != 0 || header->version != AST_FILE_VERSION ||
+        (source_hash && header->source_hash != source_hash)) {
+      return false;
+    }
+
+    uint64_t payload_size = (uint64_t)header->nodes_count * sizeof(AstFileNode) + (uint64_t)header->lists_size * sizeof(uint32_t) +
+                            ((uint64_t)header->symbols_count + 1) * sizeof(uint32_t) + header->strings_size;
+    if (size - sizeof(AstFileHeader) != payload_size ||
+        stable_hash(STABLE_HASH_SEED, data + sizeof(AstFileHeader), payload_size) != header->payload_hash) {
+      return false;
+    }
+
+    nodes = (const AstFileNode*)(data + sizeof(AstFileHeader));
+    lists = (const uint32_t*)(nodes + header->nodes_count);
+    symbol_offsets = lists + header->lists_size;
+    strings = (const char*)(symbol_offsets + header->symbols_count + 1);
+
+    for (uint32_t i = 0; i < header->symbols_count; ++i) {
+      if (symbol_offsets[i] > symbol_offsets[i + 1] || symbol_offsets[i + 1] > header->strings_size) {
+        return false;
+      }
+    }
+
+    for (uint32_t i = 0; i < header->nodes_count; ++i) {
+      if (!isValidNode(i)) {
+        return false;
+      }
+    }
+
+    return isValidList(header->statements, 1, header->nodes_count, false);
+  }
+
+  uint32_t getStatementsCount() const { return lists[header->statements]; }
+  uint32_t getStatement(uint32_t i) const { return lists[header->statements + 1 + i]; }
+
+  ASTNode* build(uint32_t index, ASTContext* context) const {
+    if (index == NO_INDEX) {
+      return nullptr;
+    }
+
+    ++NumAstNodesLoaded;
+    const AstFileNode& node = nodes[index];
+
+    switch (node.kind) {
+      case ASTNode::AST_NODE_TYPE_NUMBER:
+        return buildNumber(node, context);
+      case ASTNode::AST_NODE_TYPE_STRING:
+        return new StringExpNode(context, symbol(node.symbol));
+      case ASTNode::AST_NODE_TYPE_VARIABLE:
+        return new VarExpNode(context, symbol(node.symbol));
+      case ASTNode::AST_NODE_TYPE_UNARY_EXP:
+        return new UnaryExpNode(context, (char)node.op, buildExp(node.a, context));
+      case ASTNode::AST_NODE_TYPE_BINARY:
+        return new BinaryExpNode(context, (char)node.op, buildExp(node.a, context), buildExp(node.b, context));
+      case ASTNode::AST_NODE_TYPE_COMPARE_EXP:
+        return new CompareExpNode(context, (CompareExpNode::CompareOp)node.op, buildExp(node.a, context), buildExp(node.b, context));
+      case ASTNode::AST_NODE_TYPE_IF_EXP: {
+        ExpNode* condition = buildExp(node.a, context);
+        stmtlist_t* then_stmt_list = buildStatements(node.b, context);
+        stmtlist_t* else_stmt_list = buildStatements(node.c, context);
+        IfExpNode* if_exp_node = new IfExpNode(context, condition, then_stmt_list, else_stmt_list);
+        release(then_stmt_list);
+        release(else_stmt_list);
+        return if_exp_node;
+      }
+      case ASTNode::AST_NODE_TYPE_CALL_EXP: {
+        explist_t* arg_exp_list = new_exp_list(context);
+        for (uint32_t i = 0; i < lists[node.a]; ++i) {
+          ExpNode* arg = buildExp(lists[node.a + 1 + i], context);
+          arg_exp_list = i == 0 ? new_exp_list(context, arg) : new_exp_list(context, arg_exp_list, arg);
+        }
+        return new_call_node(context, symbol(node.symbol), arg_exp_list);
+      }
+      case ASTNode::AST_NODE_TYPE_RETURN_NODE:
+        return new_return_exp_node(buildExp(node.a, context));
+      case ASTNode::AST_NODE_TYPE_ASSIGNMENT:
+        return new AssignmentNode(context, symbol(node.symbol), buildExp(node.a, context));
+      case ASTNode::AST_NODE_TYPE_DECLARATION_ASSIGNMENT:
+        return new DeclarationAssignmentNode(context, symbol(node.symbol), buildExp(node.a, context));
+      case ASTNode::AST_NODE_TYPE_DECLARATION:
+        return new DeclarationNode(context, symbol(node.symbol));
+      case ASTNode::AST_NODE_TYPE_IMPORT:
+        return new_import(context, symbol(node.symbol));
+      case ASTNode::AST_NODE_TYPE_LOOP: {
+        ExpNode* condition = buildExp(node.a, context);
+        stmtlist_t* body_stmt_list = buildStatements(node.b, context);
+        LoopNode* loop_node = new LoopNode(context, condition, body_stmt_list);
+        release(body_stmt_list);
+        return loop_node;
+      }
+      case ASTNode::AST_NODE_TYPE_BREAK:
+        return new BreakNode(context);
+      case ASTNode::AST_NODE_TYPE_DEF_FUNCTION:
+        return buildFunctionDef(node, context);
+      default:
+        return nullptr;
+    }
+  }
+
+ private:
+  std::string symbol(uint32_t index) const {
+    return std::string(strings + symbol_offsets[index], symbol_offsets[index + 1] - symbol_offsets[index]);
+  }
+
+  bool isValidSymbol(uint32_t index) const { return index < header->symbols_count; }
+  // children come before their parent, which also rules out cycles
+  bool isValidChild(uint32_t child, uint32_t parent, bool optional) const {
+    return child < parent || (optional && child == NO_INDEX);
+  }
+
+  // every item of a list of width items per entry; the first item of each
+  // entry is a symbol when has_symbols
+  bool isValidList(uint32_t list, uint32_t width, uint32_t parent, bool has_symbols) const {
+    if (list >= header->lists_size || (uint64_t)list + 1 + (uint64_t)lists[list] * width > header->lists_size) {
+      return false;
+    }
+
+    for (uint32_t i = 0; i < lists[list]; ++i) {
+      for (uint32_t j = 0; j < width; ++j) {
+        uint32_t item = lists[list + 1 + i * width + j];
+        bool is_symbol = has_symbols && j == 0;
+
+        if (is_symbol ? !isValidSymbol(item) : !isValidChild(item, parent, width > 1)) {
+          return false;
+        }
+      }
+    }
+
+    return true;
+  }
+
+  bool isValidNode(uint32_t i) const {
+    const AstFileNode& node = nodes[i];
+
+    switch (node.kind) {
+      case ASTNode::AST_NODE_TYPE_NUMBER:
+        return node.op == TYPE_DOUBLE || node.op == TYPE_FLOAT || node.op == TYPE_LONG || node.op == TYPE_INT ||
+               node.op == TYPE_SHORT || node.op == TYPE_CHAR;
+      case ASTNode::AST_NODE_TYPE_STRING:
+      case ASTNode::AST_NODE_TYPE_VARIABLE:
+      case ASTNode::AST_NODE_TYPE_DECLARATION:
+      case ASTNode::AST_NODE_TYPE_IMPORT:
+        return isValidSymbol(node.symbol);
+      case ASTNode::AST_NODE_TYPE_UNARY_EXP:
+      case ASTNode::AST_NODE_TYPE_RETURN_NODE:
+        return isValidChild(node.a, i, false);
+      case ASTNode::AST_NODE_TYPE_BINARY:
+        return isValidChild(node.a, i, false) && isValidChild(node.b, i, true);
+      case ASTNode::AST_NODE_TYPE_COMPARE_EXP:
+        return node.op <= CompareExpNode::CMP_NE && isValidChild(node.a, i, false) && isValidChild(node.b, i, false);
+      case ASTNode::AST_NODE_TYPE_IF_EXP:
+        return isValidChild(node.a, i, false) && isValidList(node.b, 1, i, false) && isValidList(node.c, 1, i, false);
+      case ASTNode::AST_NODE_TYPE_CALL_EXP:
+        return isValidSymbol(node.symbol) && isValidList(node.a, 1, i, false);
+      case ASTNode::AST_NODE_TYPE_ASSIGNMENT:
+      case ASTNode::AST_NODE_TYPE_DECLARATION_ASSIGNMENT:
+        return isValidSymbol(node.symbol) && isValidChild(node.a, i, false);
+      case ASTNode::AST_NODE_TYPE_LOOP:
+        return isValidChild(node.a, i, true) && isValidList(node.b, 1, i, false);
+      case ASTNode::AST_NODE_TYPE_BREAK:
+        return true;
+      case ASTNode::AST_NODE_TYPE_DEF_FUNCTION:
+        return isValidSymbol(node.symbol) && isValidList(node.a, 2, i, true) && isValidList(node.b, 1, i, false) &&
+               isValidList(node.c, 1, i, false) && areSymbols(node.c);
+      default:
+        return false;
+    }
+  }
+
+  bool areSymbols(uint32_t list) const {
+    for (uint32_t i = 0; i < lists[list]; ++i) {
+      if (!isValidSymbol(lists[list + 1 + i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  ExpNode* buildExp(uint32_t index, ASTContext* context) const { return (ExpNode*)build(index, context); }
+
+  ASTNode* buildNumber(const AstFileNode& node, ASTContext* context) const {
+    double double_value = 0.0;
+    memcpy(&double_value, &node.value, sizeof(double_value));
+    long long_value = (long)node.value;
+
+    switch (node.op) {
+      case TYPE_DOUBLE:
+        return new NumberExpNode(context, double_value);
+      case TYPE_FLOAT:
+        return new NumberExpNode(context, (float)double_value);
+      case TYPE_INT:
+        return new NumberExpNode(context, (int)long_value);
+      case TYPE_SHORT:
+        return new NumberExpNode(context, (short)long_value);
+      case TYPE_CHAR:
+        return new NumberExpNode(context, (char)long_value);
+      default:
+        return new NumberExpNode(context, long_value);
+    }
+  }
+
+  stmtlist_t* buildStatements(uint32_t list, ASTContext* context) const {
+    stmtlist_t* stmt_list = new_stmt_list(context);
+
+    for (uint32_t i = 0; i < lists[list]; ++i) {
+      ASTNode* statement = build(lists[list + 1 + i], context);
+
+      if (i == 0) {
+        release(stmt_list);
+        stmt_list = new_stmt_list(context, statement);
+      } else {
+        stmt_list = new_stmt_list(context, stmt_list, statement);
+      }
+    }
+
+    return stmt_list;
+  }
+
+  // Same steps as the function_def rule of the parser
+  ASTNode* buildFunctionDef(const AstFileNode& node, ASTContext* context) const {
+    std::string name = symbol(node.symbol);
+
+    ASTContext* function_context = new ASTContext(name, context);
+    context_stack.push(function_context);
+    noname::context = function_context;
+
+    // arg_t keeps the name pointers until the FunctionDefNode copies them
+    uint32_t args_count = lists[node.a];
+    std::vector<std::string> arg_names;
+    arg_names.reserve(args_count);
+
+    arglist_t* arg_list = new_arg_list(function_context);
+    for (uint32_t i = 0; i < args_count; ++i) {
+      arg_names.push_back(symbol(lists[node.a + 1 + 2 * i]));
+      ExpNode* default_value = buildExp(lists[node.a + 2 + 2 * i], function_context);
+      arg_t* arg = new_arg(function_context, (char*)arg_names.back().c_str(), default_value);
+
+      arg_list = i == 0 ? new_arg_list(function_context, arg) : new_arg_list(function_context, arg_list, arg);
+    }
+
+    stmtlist_t* stmt_list = buildStatements(node.b, function_context);
+
+    ASTNode* function_def_node = new_function_def(context, name, arg_list, stmt_list);
+    context_stack.pop();
+    noname::context = context_stack.top();
+
+    release(arg_list);
+    release(stmt_list);
+
+    for (uint32_t i = 0; i < lists[node.c]; ++i) {
+      function_def_node = annotate_function_def(context, symbol(lists[node.c + 1 + i]), function_def_node);
+    }
+
+    return function_def_node;
+  }
+};
+}
+
+static std::unique_ptr<AstFileWriter> ast_file_writer;
+static bool input_begun = false;
+static uint64_t input_hash = STABLE_HASH_SEED;
+
+void ast_file_begin_input() {
+  if (input_begun) {
+    return;
+  }
+  input_begun = true;
+
+  if (!emit_ast_file.empty()) {
+    ast_file_writer.reset(new AstFileWriter());
+  }
+
+  if (!load_ast_file.empty() && !run_ast_file(load_ast_file)) {
+    fprintf(stderr, "\nError: '%s' is not a valid AST file", load_ast_file.c_str());
+  }
+}
+
+void ast_file_input(const char* buf, size_t size) { input_hash = stable_hash(input_hash, buf, size); }
+
+void ast_file_record(ASTNode* node) {
+  // the statements of an import are recorded themselves
+  if (!ast_file_writer || !node || isa<ErrorNode>(node) || isa<ImportNode>(node)) {
+    return;
+  }
+
+  ast_file_writer->addStatement(node);
+}
+
+bool write_ast_file(const std::string& file_path) {
+  return ast_file_writer && ast_file_writer->writeTo(file_path, input_hash);
+}
+
+bool hash_source_file(const std::string& file_path, uint64_t& hash) {
+  FILE* file = fopen(file_path.c_str(), "rb");
+  if (!file) {
+    return false;
+  }
+
+  hash = STABLE_HASH_SEED;
+  char buf[4096];
+  size_t size = 0;
+  while ((size = fread(buf, 1, sizeof(buf), file)) > 0) {
+    hash = stable_hash(hash, buf, size);
+  }
+
+  fclose(file);
+  return true;
+}
+
+bool run_ast_file(const std::string& file_path, uint64_t source_hash) {
+  int fd = ::open(file_path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 || file_stat.st_size <= 0) {
+    close(fd);
+    return false;
+  }
+
+  size_t size = file_stat.st_size;
+  void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (data == MAP_FAILED) {
+    return false;
+  }
+
+  AstFileReader reader;
+  if (!reader.open((const char*)data, size, source_hash)) {
+    munmap(data, size);
+    ++NumAstFilesRejected;
+
+    if (noname::debug >= 1) {
+      fprintf(stdout, "\n[AST file '%s' not valid for its source, ignored]", file_path.c_str());
+      fflush(stdout);
+    }
+    return false;
+  }
+
+  ++NumAstFilesLoaded;
+
+  for (uint32_t i = 0; i < reader.getStatementsCount(); ++i) {
+    ASTNode* node = reader.build(reader.getStatement(i), context);
+
+    ast_file_record(node);
+    eval(pre_process(node));
+  }
+
+  munmap(data, size);
+  return true;
+}
+}
@@ -0,0 +1,361 @@
+#include "noname-bigint.h"
+#include <limits.h>
+#include <stdio.h>
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace noname {
+
+typedef std::vector<uint32_t> Limbs;
+
+// Below this many limbs (in the shorter operand) schoolbook multiplication is
+// faster than splitting the operands again
+static const size_t KARATSUBA_THRESHOLD = 32;
+
+static void trim(Limbs& a) {
+  while (!a.empty() && a.back() == 0) {
+    a.pop_back();
+  }
+}
+
+static int compare_magnitude(const Limbs& a, const Limbs& b) {
+  if (a.size() != b.size()) {
+    return a.size() < b.size() ? -1 : 1;
+  }
+
+  for (size_t i = a.size(); i-- > 0;) {
+    if (a[i] != b[i]) {
+      return a[i] < b[i] ? -1 : 1;
+    }
+  }
+
+  return 0;
+}
+
+static Limbs add_magnitude(const Limbs& a, const Limbs& b) {
+  const Limbs& longer = a.size() >= b.size() ? a : b;
+  const Limbs& shorter = a.size() >= b.size() ? b : a;
+  Limbs result(longer.size() + 1);
+
+  uint64_t carry = 0;
+  for (size_t i = 0; i < longer.size(); ++i) {
+    uint64_t sum = (uint64_t)longer[i] + (i < shorter.size() ? shorter[i] : 0) + carry;
+    result[i] = (uint32_t)sum;
+    carry = sum >> 32;
+  }
+  result[longer.size()] = (uint32_t)carry;
+
+  trim(result);
+  return result;
+}
+
+// a - b, with a >= b
+static Limbs sub_magnitude(const Limbs& a, const Limbs& b) {
+  Limbs result(a.size());
+
+  int64_t borrow = 0;
+  for (size_t i = 0; i < a.size(); ++i) {
+    int64_t diff = (int64_t)a[i] - (i < b.size() ? b[i] : 0) - borrow;
+    borrow = diff < 0 ? 1 : 0;
+    result[i] = (uint32_t)(diff + (borrow << 32));
+  }
+
+  trim(result);
+  return result;
+}
+
+static Limbs mul_schoolbook(const Limbs& a, const Limbs& b) {
+  if (a.empty() || b.empty()) {
+    return Limbs();
+  }
+
+  Limbs result(a.size() + b.size());
+  for (size_t i = 0; i < a.size(); ++i) {
+    uint64_t carry = 0;
+    for (size_t j = 0; j < b.size(); ++j) {
+      uint64_t product = (uint64_t)a[i] * b[j] + result[i + j] + carry;
+      result[i + j] = (uint32_t)product;
+      carry = product >> 32;
+    }
+    result[i + b.size()] = (uint32_t)carry;
+  }
+
+  trim(result);
+  return result;
+}
+
+// limbs [begin, end) of a
+static Limbs slice(const Limbs& a, size_t begin, size_t end) {
+  if (begin >= a.size()) {
+    return Limbs();
+  }
+
+  Limbs result(a.begin() + begin, a.begin() + std::min(end, a.size()));
+  trim(result);
+  return result;
+}
+
+// result += a << (32 * shift)
+static void add_shifted(Limbs& result, const Limbs& a, size_t shift) {
+  if (result.size() < a.size() + shift + 1) {
+    result.resize(a.size() + shift + 1, 0);
+  }
+
+  uint64_t carry = 0;
+  size_t i = 0;
+  for (; i < a.size() || carry; ++i) {
+    if (i + shift == result.size()) {
+      result.push_back(0);
+    }
+    uint64_t sum = (uint64_t)result[i + shift] + (i < a.size() ? a[i] : 0) + carry;
+    result[i + shift] = (uint32_t)sum;
+    carry = sum >> 32;
+  }
+}
+
+// Karatsuba: with a = a1 * B + a0 and b = b1 * B + b0,
+// a * b = z2 * B^2 + z1 * B + z0 where z2 = a1 * b1, z0 = a0 * b0 and
+// z1 = (a0 + a1) * (b0 + b1) - z2 - z0; three multiplications instead of four
+static Limbs mul_magnitude(const Limbs& a, const Limbs& b) {
+  if (a.size() < KARATSUBA_THRESHOLD || b.size() < KARATSUBA_THRESHOLD) {
+    return mul_schoolbook(a, b);
+  }
+
+  size_t half = std::max(a.size(), b.size()) / 2;
+  Limbs a0 = slice(a, 0, half);
+  Limbs a1 = slice(a, half, a.size());
+  Limbs b0 = slice(b, 0, half);
+  Limbs b1 = slice(b, half, b.size());
+
+  Limbs z0 = mul_magnitude(a0, b0);
+  Limbs z2 = mul_magnitude(a1, b1);
+  Limbs z1 = mul_magnitude(add_magnitude(a0, a1), add_magnitude(b0, b1));
+  z1 = sub_magnitude(sub_magnitude(z1, z0), z2);
+
+  Limbs result(a.size() + b.size() + 1);
+  add_shifted(result, z0, 0);
+  add_shifted(result, z1, half);
+  add_shifted(result, z2, 2 * half);
+
+  trim(result);
+  return result;
+}
+
+static Limbs div_small_magnitude(const Limbs& a, uint32_t divisor, uint32_t& remainder) {
+  Limbs quotient(a.size());
+
+  uint64_t rest = 0;
+  for (size_t i = a.size(); i-- > 0;) {
+    uint64_t current = (rest << 32) | a[i];
+    quotient[i] = (uint32_t)(current / divisor);
+    rest = current % divisor;
+  }
+
+  remainder = (uint32_t)rest;
+  trim(quotient);
+  return quotient;
+}
+
+// Knuth's algorithm D (TAOCP vol. 2, 4.3.1), as written in Hacker's Delight
+static Limbs div_magnitude(const Limbs& a, const Limbs& b) {
+  if (compare_magnitude(a, b) < 0) {
+    return Limbs();
+  }
+
+  if (b.size() == 1) {
+    uint32_t remainder = 0;
+    return div_small_magnitude(a, b[0], remainder);
+  }
+
+  const uint64_t base = 1ULL << 32;
+  size_t n = b.size();
+  size_t m = a.size();
+
+  // normalize: the top bit of the divisor must be set for the quotient digit
+  // estimates to be off by at most 2
+  int shift = __builtin_clz(b.back());
+  Limbs v(n);
+  Limbs u(m + 1);
+  for (size_t i = n - 1; i > 0; --i) {
+    v[i] = (uint32_t)(((uint64_t)b[i] << shift) | ((uint64_t)b[i - 1] >> (32 - shift)));
+  }
+  v[0] = b[0] << shift;
+
+  u[m] = (uint32_t)((uint64_t)a[m - 1] >> (32 - shift));
+  for (size_t i = m - 1; i > 0; --i) {
+    u[i] = (uint32_t)(((uint64_t)a[i] << shift) | ((uint64_t)a[i - 1] >> (32 - shift)));
+  }
+  u[0] = a[0] << shift;
+
+  Limbs quotient(m - n + 1);
+  for (size_t j = m - n + 1; j-- > 0;) {
+    uint64_t numerator = ((uint64_t)u[j + n] << 32) | u[j + n - 1];
+    uint64_t qhat = numerator / v[n - 1];
+    uint64_t rhat = numerator % v[n - 1];
+
+    while (qhat >= base || qhat * v[n - 2] > ((rhat << 32) | u[j + n - 2])) {
+      qhat--;
+      rhat += v[n - 1];
+      if (rhat >= base) {
+        break;
+      }
+    }
+
+    // u[j .. j + n] -= qhat * v
+    int64_t borrow = 0;
+    int64_t t = 0;
+    for (size_t i = 0; i < n; ++i) {
+      uint64_t product = qhat * v[i];
+      t = (int64_t)u[i + j] - borrow - (int64_t)(product & 0xFFFFFFFF);
+      u[i + j] = (uint32_t)t;
+      borrow = (int64_t)(product >> 32) - (t >> 32);
+    }
+    t = (int64_t)u[j + n] - borrow;
+    u[j + n] = (uint32_t)t;
+
+    quotient[j] = (uint32_t)qhat;
+
+    // qhat was one too large: add v back
+    if (t < 0) {
+      quotient[j]--;
+      uint64_t carry = 0;
+      for (size_t i = 0; i < n; ++i) {
+        uint64_t sum = (uint64_t)u[i + j] + v[i] + carry;
+        u[i + j] = (uint32_t)sum;
+        carry = sum >> 32;
+      }
+      u[j + n] += (uint32_t)carry;
+    }
+  }
+
+  trim(quotient);
+  return quotient;
+}
+
+BigInt::BigInt(bool negative, Limbs&& limbs) : negative(negative), limbs(std::move(limbs)) {
+  trim(this->limbs);
+  if (this->limbs.empty()) {
+    this->negative = false;
+  }
+}
+
+BigInt::BigInt(long value) : negative(value < 0) {
+  uint64_t magnitude = negative ? 0 - (uint64_t)value : (uint64_t)value;
+
+  while (magnitude) {
+    limbs.push_back((uint32_t)magnitude);
+    magnitude >>= 32;
+  }
+}
+
+bool BigInt::fitsLong() const {
+  if (limbs.size() > 2) {
+    return false;
+  }
+
+  uint64_t magnitude = 0;
+  for (size_t i = limbs.size(); i-- > 0;) {
+    magnitude = (magnitude << 32) | limbs[i];
+  }
+
+  // LONG_MIN has no positive counterpart
+  return negative ? magnitude <= (uint64_t)LONG_MAX + 1 : magnitude <= (uint64_t)LONG_MAX;
+}
+
+long BigInt::toLong() const {
+  uint64_t magnitude = 0;
+  for (size_t i = std::min(limbs.size(), (size_t)2); i-- > 0;) {
+    magnitude = (magnitude << 32) | limbs[i];
+  }
+
+  return negative ? (long)(0 - magnitude) : (long)magnitude;
+}
+
+double BigInt::toDouble() const {
+  double value = 0.0;
+  for (size_t i = limbs.size(); i-- > 0;) {
+    value = value * 4294967296.0 + limbs[i];
+  }
+
+  return negative ? -value : value;
+}
+
+std::string BigInt::toString() const {
+  if (limbs.empty()) {
+    return "0";
+  }
+
+  // base 10^9 digits, least significant first
+  std::vector<uint32_t> chunks;
+  Limbs magnitude = limbs;
+  while (!magnitude.empty()) {
+    uint32_t chunk = 0;
+    magnitude = div_small_magnitude(magnitude, 1000000000, chunk);
+    chunks.push_back(chunk);
+  }
+
+  std::string result = negative ? "-" : "";
+  char buffer[16];
+  snprintf(buffer, sizeof(buffer), "%u", chunks.back());
+  result += buffer;
+  for (size_t i = chunks.size() - 1; i-- > 0;) {
+    snprintf(buffer, sizeof(buffer), "%09u", chunks[i]);
+    result += buffer;
+  }
+
+  return result;
+}
+
+int BigInt::compare(const BigInt& other) const {
+  if (negative != other.negative) {
+    return negative ? -1 : 1;
+  }
+
+  int magnitude_cmp = compare_magnitude(limbs, other.limbs);
+  return negative ? -magnitude_cmp : magnitude_cmp;
+}
+
+BigInt BigInt::operator-() const { return BigInt(!negative, Limbs(limbs)); }
+
+BigInt BigInt::operator+(const BigInt& other) const {
+  if (negative == other.negative) {
+    return BigInt(negative, add_magnitude(limbs, other.limbs));
+  }
+
+  if (compare_magnitude(limbs, other.limbs) >= 0) {
+    return BigInt(negative, sub_magnitude(limbs, other.limbs));
+  }
+  return BigInt(other.negative, sub_magnitude(other.limbs, limbs));
+}
+
+BigInt BigInt::operator-(const BigInt& other) const { return *this + -other; }
+
+BigInt BigInt::operator*(const BigInt& other) const {
+  return BigInt(negative != other.negative, mul_magnitude(limbs, other.limbs));
+}
+
+BigInt BigInt::operator/(const BigInt& other) const {
+  return BigInt(negative != other.negative, div_magnitude(limbs, other.limbs));
+}
+
+BigInt BigInt::pow(long exponent) const {
+  BigInt result(1L);
+  BigInt square = *this;
+
+  while (exponent > 0) {
+    if (exponent & 1) {
+      result = result * square;
+    }
+
+    exponent >>= 1;
+    if (exponent > 0) {
+      square = square * square;
+    }
+  }
+
+  return result;
+}
+}
@@ -1,6 +1,8 @@
+#include "llvm/IR/Intrinsics.h"
 #include "noname-utils.h"
 #include "noname-types.h"
 #include "noname-jit.h"
+#include "noname-profile.h"
 #include <limits.h>
 #include <stdio.h>
 #include <algorithm>
@@ -25,135 +27,251 @@ extern std::unique_ptr<Module> TheModule;
 extern std::unique_ptr<legacy::FunctionPassManager> TheFPM;
 extern std::unique_ptr<NonameJIT> TheJIT;
 
-std::string pow_function_name("_noname_function_pow");
-
-std::unique_ptr<NodeValue> BinaryExpNode::getValue() const {
-  std::unique_ptr<NodeValue> lhs_node_value = lhs->getValue();
-  std::unique_ptr<NodeValue> rhs_node_value = rhs->getValue();
-  int result_type = get_adequate_result_type(lhs_node_value.get(), rhs_node_value.get());
-  void* lhs_value = lhs_node_value->getValue(result_type);
-  void* rhs_value = rhs_node_value->getValue(result_type);
-  NodeValue* result = nullptr;
-  if (result_type == TYPE_DOUBLE) {
-    double typed_lhs_value = *(double*)lhs_value;
-    double typed_rhs_value = *(double*)rhs_value;
-
-    if (op == '+') {
-      result = new NodeValue(typed_lhs_value + typed_rhs_value);
-    } else if (op == '-') {
-      result = new NodeValue(typed_lhs_value - typed_rhs_value);
-    } else if (op == '*') {
-      result = new NodeValue(typed_lhs_value * typed_rhs_value);
-    } else if (op == '/') {
-      result = new NodeValue(typed_lhs_value / typed_rhs_value);
-    } else if (op == '^') {
-      result = new NodeValue(pow(typed_lhs_value, typed_rhs_value));
-    }
-  } else if (result_type == TYPE_FLOAT) {
-    float typed_lhs_value = *(float*)lhs_value;
-    float typed_rhs_value = *(float*)rhs_value;
-
-    if (op == '+') {
-      result = new NodeValue(typed_lhs_value + typed_rhs_value);
-    } else if (op == '-') {
-      result = new NodeValue(typed_lhs_value - typed_rhs_value);
-    } else if (op == '*') {
-      result = new NodeValue(typed_lhs_value * typed_rhs_value);
-    } else if (op == '/') {
-      result = new NodeValue(typed_lhs_value / typed_rhs_value);
-    } else if (op == '^') {
-      result = new NodeValue(pow(typed_lhs_value, typed_rhs_value));
+// A bigint result; back to a long when it fits
+static TaggedValue bigint_tagged_value(const BigInt& value) {
+  if (value.fitsLong()) {
+    return TaggedValue(value.toLong());
+  }
+  return TaggedValue(value);
+}
+
+static TaggedValue bigint_binary_op_tagged_value(int op, const BigInt& lhs, const BigInt& rhs) {
+  if (op == '+') {
+    return bigint_tagged_value(lhs + rhs);
+  } else if (op == '-') {
+    return bigint_tagged_value(lhs - rhs);
+  } else if (op == '*') {
+    return bigint_tagged_value(lhs * rhs);
+  } else if (op == '/') {
+    if (rhs.isZero()) {
+      logError("Division by zero");
+      return TaggedValue();
     }
-  } else if (result_type == TYPE_LONG) {
-    long typed_lhs_value = *(long*)lhs_value;
-    long typed_rhs_value = *(long*)rhs_value;
-
-    if (op == '+') {
-      result = new NodeValue(typed_lhs_value + typed_rhs_value);
-    } else if (op == '-') {
-      result = new NodeValue(typed_lhs_value - typed_rhs_value);
-    } else if (op == '*') {
-      result = new NodeValue(typed_lhs_value * typed_rhs_value);
-    } else if (op == '/') {
-      result = new NodeValue(typed_lhs_value / typed_rhs_value);
-    } else if (op == '^') {
-      result = new NodeValue((long)pow(typed_lhs_value, typed_rhs_value));
+    return bigint_tagged_value(lhs / rhs);
+  } else if (op == '^') {
+    if (rhs.isNegative() || !rhs.fitsLong()) {
+      return TaggedValue(pow(lhs.toDouble(), rhs.toDouble()));
     }
+    return bigint_tagged_value(lhs.pow(rhs.toLong()));
+  }
 
-  } else if (result_type == TYPE_INT) {
-    int typed_lhs_value = *(int*)lhs_value;
-    int typed_rhs_value = *(int*)rhs_value;
-
-    if (op == '+') {
-      result = new NodeValue(typed_lhs_value + typed_rhs_value);
-    } else if (op == '-') {
-      result = new NodeValue(typed_lhs_value - typed_rhs_value);
-    } else if (op == '*') {
-      result = new NodeValue(typed_lhs_value * typed_rhs_value);
-    } else if (op == '/') {
-      result = new NodeValue(typed_lhs_value / typed_rhs_value);
-    } else if (op == '^') {
-      result = new NodeValue((int)pow(typed_lhs_value, typed_rhs_value));
-    }
+  return TaggedValue();
+}
 
-  } else if (result_type == TYPE_SHORT) {
-    short typed_lhs_value = *(short*)lhs_value;
-    short typed_rhs_value = *(short*)rhs_value;
-
-    if (op == '+') {
-      result = new NodeValue(typed_lhs_value + typed_rhs_value);
-    } else if (op == '-') {
-      result = new NodeValue(typed_lhs_value - typed_rhs_value);
-    } else if (op == '*') {
-      result = new NodeValue(typed_lhs_value * typed_rhs_value);
-    } else if (op == '/') {
-      result = new NodeValue(typed_lhs_value / typed_rhs_value);
-    } else if (op == '^') {
-      result = new NodeValue((short)pow(typed_lhs_value, typed_rhs_value));
+// Exact power of two integers in result_type, widened to a long or a bigint
+// when it does not fit; a double when the exponent is negative
+static TaggedValue pow_integer_tagged_value(long base, long exponent, int result_type) {
+  long result = 0;
+
+  if (noname_pow_long(base, exponent, &result)) {
+    if (result_type == TYPE_INT && result == (int)result) {
+      return TaggedValue((int)result);
+    } else if (result_type == TYPE_SHORT && result == (short)result) {
+      return TaggedValue((short)result);
+    } else if (result_type == TYPE_CHAR && result == (char)result) {
+      return TaggedValue((char)result);
     }
+    return TaggedValue(result);
+  }
+
+  if (exponent >= 0) {
+    return bigint_tagged_value(BigInt(base).pow(exponent));
+  }
+  return TaggedValue(pow((double)base, (double)exponent));
+}
+
+enum BinaryOpIndex { BINARY_OP_ADD, BINARY_OP_SUB, BINARY_OP_MUL, BINARY_OP_DIV, BINARY_OP_POW, BINARY_OPS_COUNT };
+
+static constexpr int binary_op_index(int op) {
+  return op == '+' ? BINARY_OP_ADD
+                   : op == '-' ? BINARY_OP_SUB : op == '*' ? BINARY_OP_MUL : op == '/' ? BINARY_OP_DIV : op == '^' ? BINARY_OP_POW : -1;
+}
 
-  } else if (result_type == TYPE_CHAR) {
-    char typed_lhs_value = *(char*)lhs_value;
-    char typed_rhs_value = *(char*)rhs_value;
-
-    if (op == '+') {
-      result = new NodeValue(typed_lhs_value + typed_rhs_value);
-    } else if (op == '-') {
-      result = new NodeValue(typed_lhs_value - typed_rhs_value);
-    } else if (op == '*') {
-      result = new NodeValue(typed_lhs_value * typed_rhs_value);
-    } else if (op == '/') {
-      result = new NodeValue(typed_lhs_value / typed_rhs_value);
-    } else if (op == '^') {
-      result = new NodeValue((char)pow(typed_lhs_value, typed_rhs_value));
+// lhs op rhs on two numbers already converted to T, the type tagged Type.
+// Narrow types wrap like in C; longs never do (see the specializations below)
+template <int Op, typename T, int Type>
+struct BinaryKernel;
+
+template <typename T, int Type>
+struct BinaryKernel<BINARY_OP_ADD, T, Type> {
+  static TaggedValue apply(T lhs, T rhs) { return TaggedValue((T)(lhs + rhs)); }
+};
+
+template <typename T, int Type>
+struct BinaryKernel<BINARY_OP_SUB, T, Type> {
+  static TaggedValue apply(T lhs, T rhs) { return TaggedValue((T)(lhs - rhs)); }
+};
+
+template <typename T, int Type>
+struct BinaryKernel<BINARY_OP_MUL, T, Type> {
+  static TaggedValue apply(T lhs, T rhs) { return TaggedValue((T)(lhs * rhs)); }
+};
+
+// integers divided by zero are an error; the minimum of a narrow type divided
+// by -1 wraps like the other operations (the division itself would trap)
+template <typename T, int Type>
+struct BinaryKernel<BINARY_OP_DIV, T, Type> {
+  static TaggedValue apply(T lhs, T rhs) {
+    if (!std::is_floating_point<T>::value && rhs == 0) {
+      logError("Division by zero");
+      return TaggedValue();
     }
+    return std::is_floating_point<T>::value ? TaggedValue((T)(lhs / rhs)) : TaggedValue((T)((long)lhs / (long)rhs));
+  }
+};
+
+template <typename T, int Type>
+struct BinaryKernel<BINARY_OP_POW, T, Type> {
+  static TaggedValue apply(T lhs, T rhs) {
+    return std::is_floating_point<T>::value ? TaggedValue((T)pow((double)lhs, (double)rhs))
+                                            : pow_integer_tagged_value((long)lhs, (long)rhs, Type);
+  }
+};
+
+// the exact result of a long operation that overflowed is a bigint
+template <>
+struct BinaryKernel<BINARY_OP_ADD, long, TYPE_LONG> {
+  static TaggedValue apply(long lhs, long rhs) {
+    long result = 0;
+    return __builtin_add_overflow(lhs, rhs, &result) ? bigint_tagged_value(BigInt(lhs) + BigInt(rhs)) : TaggedValue(result);
+  }
+};
 
-  } else if (result_type == TYPE_STRING) {
-    std::string typed_lhs_value = *(std::string*)lhs_value;
-    std::string typed_rhs_value = *(std::string*)rhs_value;
+template <>
+struct BinaryKernel<BINARY_OP_SUB, long, TYPE_LONG> {
+  static TaggedValue apply(long lhs, long rhs) {
+    long result = 0;
+    return __builtin_sub_overflow(lhs, rhs, &result) ? bigint_tagged_value(BigInt(lhs) - BigInt(rhs)) : TaggedValue(result);
+  }
+};
 
-    if (op == '+') {
-      result = new NodeValue(typed_lhs_value + typed_rhs_value);
+template <>
+struct BinaryKernel<BINARY_OP_MUL, long, TYPE_LONG> {
+  static TaggedValue apply(long lhs, long rhs) {
+    long result = 0;
+    return __builtin_mul_overflow(lhs, rhs, &result) ? bigint_tagged_value(BigInt(lhs) * BigInt(rhs)) : TaggedValue(result);
+  }
+};
+
+template <>
+struct BinaryKernel<BINARY_OP_DIV, long, TYPE_LONG> {
+  static TaggedValue apply(long lhs, long rhs) {
+    if (rhs == 0) {
+      logError("Division by zero");
+      return TaggedValue();
     }
+    return lhs == LONG_MIN && rhs == -1 ? bigint_tagged_value(-BigInt(lhs)) : TaggedValue(lhs / rhs);
   }
+};
+
+typedef TaggedValue (*binary_kernel_t)(const TaggedValue& lhs, const TaggedValue& rhs);
 
-  return std::unique_ptr<NodeValue>(std::move(result));
+template <int Op, typename T, int Type>
+static TaggedValue binary_kernel(const TaggedValue& lhs, const TaggedValue& rhs) {
+  return BinaryKernel<Op, T, Type>::apply(lhs.as<T>(), rhs.as<T>());
 }
 
-Value* BinaryExpNode::CreatePow(Value* LHS, Value* RHS, const char* name = "call_pow_tmp") const {
-  Function* pow_function = TheModule->getFunction(pow_function_name);
+// one kernel per numeric type, in the order of the type tags
+#define BINARY_KERNELS_OF(Op)                                                                                         \
+  {                                                                                                                   \
+    &binary_kernel<Op, char, TYPE_CHAR>, &binary_kernel<Op, short, TYPE_SHORT>, &binary_kernel<Op, int, TYPE_INT>,    \
+        &binary_kernel<Op, float, TYPE_FLOAT>, &binary_kernel<Op, long, TYPE_LONG>, &binary_kernel<Op, double, TYPE_DOUBLE> \
+  }
+
+// binary_kernels[binary_op_index(op)][result_type - TYPE_CHAR]
+static constexpr binary_kernel_t binary_kernels[BINARY_OPS_COUNT][NUMERIC_TYPES_COUNT] = {
+    BINARY_KERNELS_OF(BINARY_OP_ADD), BINARY_KERNELS_OF(BINARY_OP_SUB), BINARY_KERNELS_OF(BINARY_OP_MUL),
+    BINARY_KERNELS_OF(BINARY_OP_DIV), BINARY_KERNELS_OF(BINARY_OP_POW),
+};
+
+#undef BINARY_KERNELS_OF
+
+TaggedValue binary_op_tagged_value(int op, const TaggedValue& lhs, const TaggedValue& rhs) {
+  int op_index = binary_op_index(op);
+  int result_type = get_adequate_result_type(lhs.getType(), rhs.getType());
 
-  if (!pow_function) {
-    return logErrorLLVM("Unknown function referenced");
+  if (op_index < 0) {
+    return TaggedValue();
   }
 
-  std::vector<Value*> args_values;
-  args_values.push_back(LHS);
-  args_values.push_back(RHS);
+  if (is_numeric_type(result_type)) {
+    return binary_kernels[op_index][result_type - TYPE_CHAR](lhs, rhs);
+  }
 
-  // return Builder.CreateCall(pow_function, args_values, name);
-  logError("pow function not implemented");
-  return nullptr;
+  if (result_type == TYPE_BIGINT) {
+    return bigint_binary_op_tagged_value(op, lhs.asBigInt(), rhs.asBigInt());
+  }
+
+  if (op == '+' && lhs.getType() == TYPE_STRING && rhs.getType() == TYPE_STRING) {
+    return TaggedValue(lhs.asString() + rhs.asString());
+  }
+
+  return TaggedValue();
+}
+
+bool binary_op_traps(int op, const TaggedValue& lhs, const TaggedValue& rhs) {
+  int result_type = get_adequate_result_type(lhs.getType(), rhs.getType());
+
+  if (op != '/' || result_type == TYPE_DOUBLE || result_type == TYPE_FLOAT) {
+    return false;
+  }
+
+  if (result_type == TYPE_BIGINT) {
+    return rhs.asBigInt().isZero();
+  }
+
+  if (!is_numeric_type(result_type)) {
+    return false;
+  }
+
+  long dividend = lhs.as<long>();
+  long divisor = rhs.as<long>();
+  long type_min = result_type == TYPE_CHAR ? CHAR_MIN : result_type == TYPE_SHORT ? SHRT_MIN : result_type == TYPE_INT ? INT_MIN : LONG_MIN;
+
+  return divisor == 0 || (dividend == type_min && divisor == -1);
+}
+
+TaggedValue BinaryExpNode::getTaggedValue() const {
+  // '(' exp ')' is a binary node without rhs
+  if (!rhs) {
+    return lhs->getTaggedValue();
+  }
+
+  TaggedValue lhs_value = lhs->getTaggedValue();
+  TaggedValue rhs_value = rhs->getTaggedValue();
+
+  if (!lhs_value.isDefined() || !rhs_value.isDefined()) {
+    return TaggedValue();
+  }
+
+  return binary_op_tagged_value(op, lhs_value, rhs_value);
+}
+
+std::unique_ptr<NodeValue> BinaryExpNode::getValue() const { return std::unique_ptr<NodeValue>(getTaggedValue().toNodeValue()); }
+
+extern "C" DLLEXPORT void noname_binary_op(int op, int lhs_type, void* lhs_v, int rhs_type, void* rhs_v, datatype_t* result) {
+  TaggedValue result_value =
+      binary_op_tagged_value(op, TaggedValue::borrowed(lhs_type, lhs_v), TaggedValue::borrowed(rhs_type, rhs_v));
+
+  result->type = result_value.isDefined() ? result_value.getType() : TYPE_VOID;
+  result->v = result_value.box();
+}
+
+static const char* numeric_type_name(int type) {
+  switch (type) {
+    case TYPE_CHAR:
+      return "char";
+    case TYPE_SHORT:
+      return "short";
+    case TYPE_INT:
+      return "int";
+    case TYPE_FLOAT:
+      return "float";
+    case TYPE_LONG:
+      return "long";
+    default:
+      return "double";
+  }
 }
 
 void prepare(Error& error, BinaryExpNode_Data_t& data, std::vector<Value*>& codegen, llvm::BasicBlock* bb) {
@@ -175,19 +293,285 @@ void prepare(Error& error, BinaryExpNode_Data_t& data, std::vector<Value*>& code
 
   Function* function = bb->getParent();
 
-  data.label_if_then_double = push_back_ret(codegen, BasicBlock::Create(TheContext, "if_then_double", function, 0));
-  data.label_else_if = push_back_ret(codegen, BasicBlock::Create(TheContext, "if_else", function, 0));
-  data.label_else_if_then_long = push_back_ret(codegen, BasicBlock::Create(TheContext, "if_then_long", function, 0));
+  // created for the result types of the pairs compiled inline only
+  for (int i = 0; i < NUMERIC_TYPES_COUNT; ++i) {
+    data.label_if_then_type[i] = nullptr;
+  }
   data.label_if_default = push_back_ret(codegen, BasicBlock::Create(TheContext, "label_if_default", function, 0));
   data.label_if_end = push_back_ret(codegen, BasicBlock::Create(TheContext, "if_end", function, 0));
 }
 
+// Value of type to_type of the number of type from_type boxed in v. The
+// promotion table only widens, so this is a sign extension, an int to floating
+// point conversion or a float extension.
+static Value* unbox_numeric_codegen(std::vector<Value*>& codegen, Value* v, int from_type, int to_type, const std::string& sufix,
+                                    llvm::BasicBlock* bb) {
+  CastInst* cast_inst_v =
+      push_back_ret(codegen, new BitCastInst(v, PointerType::getUnqual(toLLVMType(from_type)), "cast_inst_v" + sufix, bb));
+  LoadInst* value = push_back_ret(codegen, load_inst_codegen(from_type, cast_inst_v, bb));
+
+  if (from_type == to_type) {
+    return value;
+  }
+
+  Type* to_llvm_type = toLLVMType(to_type);
+  return push_back_ret(codegen,
+                       CastInst::Create(CastInst::getCastOpcode(value, true, to_llvm_type, true), value, to_llvm_type, "promoted" + sufix, bb));
+}
+
+static Value* binary_op_codegen(int op, int type, Value* lhs_value, Value* rhs_value, llvm::BasicBlock* bb) {
+  bool is_fp = type == TYPE_DOUBLE || type == TYPE_FLOAT;
+
+  if (op == '+') {
+    return BinaryOperator::Create(is_fp ? Instruction::FAdd : Instruction::Add, lhs_value, rhs_value, "add", bb);
+  } else if (op == '-') {
+    return BinaryOperator::Create(is_fp ? Instruction::FSub : Instruction::Sub, lhs_value, rhs_value, "sub", bb);
+  } else if (op == '*') {
+    return BinaryOperator::Create(is_fp ? Instruction::FMul : Instruction::Mul, lhs_value, rhs_value, "mul", bb);
+  } else if (op == '/') {
+    return BinaryOperator::Create(is_fp ? Instruction::FDiv : Instruction::SDiv, lhs_value, rhs_value, "div", bb);
+  }
+
+  return nullptr;
+}
+
+// lhs op rhs on longs, but for divisions; overflow is set when the result does
+// not fit
+static Value* checked_long_op_codegen(std::vector<Value*>& codegen, int op, Value* lhs_value, Value* rhs_value,
+                                      Value*& overflow, llvm::BasicBlock* bb) {
+  Type* int64_type = Type::getInt64Ty(TheContext);
+
+  Intrinsic::ID id = op == '+' ? Intrinsic::sadd_with_overflow : op == '-' ? Intrinsic::ssub_with_overflow : Intrinsic::smul_with_overflow;
+  Function* op_with_overflow = Intrinsic::getDeclaration(TheModule.get(), id, {int64_type});
+  CallInst* checked_op = push_back_ret(codegen, CallInst::Create(op_with_overflow, {lhs_value, rhs_value}, "checked_op", bb));
+  overflow = push_back_ret(codegen, ExtractValueInst::Create(checked_op, {1}, "op_overflow", bb));
+  return push_back_ret(codegen, ExtractValueInst::Create(checked_op, {0}, "op", bb));
+}
+
+// lhs / rhs on integers. A division by zero, or of the minimum of the type by
+// -1, would trap: it branches to label_slow before dividing, which leaves it to
+// noname_binary_op (an error, a wrapped result or a bigint). bb moves to the
+// block of the division.
+static Value* checked_div_codegen(std::vector<Value*>& codegen, Value* lhs_value, Value* rhs_value, BasicBlock* label_slow,
+                                  llvm::BasicBlock*& bb) {
+  IntegerType* int_type = cast<IntegerType>(lhs_value->getType());
+
+  Value* is_zero = push_back_ret(codegen, new ICmpInst(*bb, ICmpInst::ICMP_EQ, rhs_value, ConstantInt::get(int_type, 0), "is_zero"));
+  Value* is_min = push_back_ret(codegen, new ICmpInst(*bb, ICmpInst::ICMP_EQ, lhs_value,
+                                                      ConstantInt::get(TheContext, APInt::getSignedMinValue(int_type->getBitWidth())),
+                                                      "is_min"));
+  Value* is_minus_one =
+      push_back_ret(codegen, new ICmpInst(*bb, ICmpInst::ICMP_EQ, rhs_value, ConstantInt::get(int_type, -1, true), "is_minus_one"));
+  Value* overflow = push_back_ret(codegen, BinaryOperator::Create(Instruction::And, is_min, is_minus_one, "div_overflow", bb));
+  Value* traps = push_back_ret(codegen, BinaryOperator::Create(Instruction::Or, is_zero, overflow, "div_traps", bb));
+
+  BasicBlock* label_div = push_back_ret(codegen, BasicBlock::Create(TheContext, "div_safe", bb->getParent(), label_slow));
+  BranchInst* branch_inst = push_back_ret(codegen, BranchInst::Create(label_slow, label_div, traps, bb));
+  profile_set_branch_weights(branch_inst, 0, LIKELY_BRANCH_WEIGHT);
+
+  bb = label_div;
+  return push_back_ret(codegen, BinaryOperator::Create(Instruction::SDiv, lhs_value, rhs_value, "div", bb));
+}
+
+// Exponents up to this one, when they are integer literals, are unrolled into
+// multiplies (at most 2 * log2 of them)
+static const long MAX_UNROLLED_EXPONENT = 64;
+
+// Exponent of `x ^ <integer literal>`, -1 for anything else
+static long constant_exponent(const ExpNode* exp_node) {
+  if (!isa<NumberExpNode>(exp_node)) {
+    return -1;
+  }
+
+  TaggedValue value = exp_node->getTaggedValue();
+  if (!is_numeric_type(value.getType()) || value.getType() == TYPE_DOUBLE || value.getType() == TYPE_FLOAT) {
+    return -1;
+  }
+
+  long exponent = value.as<long>();
+  return exponent >= 0 && exponent <= MAX_UNROLLED_EXPONENT ? exponent : -1;
+}
+
+// Multiplication of integers; sets overflow when the product does not fit
+static Value* checked_mul_codegen(std::vector<Value*>& codegen, Value* lhs_value, Value* rhs_value, Value*& overflow,
+                                  llvm::BasicBlock* bb) {
+  Function* smul_with_overflow = Intrinsic::getDeclaration(TheModule.get(), Intrinsic::smul_with_overflow, {lhs_value->getType()});
+  CallInst* mul = push_back_ret(codegen, CallInst::Create(smul_with_overflow, {lhs_value, rhs_value}, "mul_checked", bb));
+  Value* mul_overflow = push_back_ret(codegen, ExtractValueInst::Create(mul, {1}, "mul_overflow", bb));
+
+  overflow = overflow ? push_back_ret(codegen, BinaryOperator::Create(Instruction::Or, overflow, mul_overflow, "pow_overflow", bb))
+                      : mul_overflow;
+  return push_back_ret(codegen, ExtractValueInst::Create(mul, {0}, "mul", bb));
+}
+
+// base ^ exponent by squaring, unrolled; integer multiplies are checked
+static Value* unrolled_pow_codegen(std::vector<Value*>& codegen, Value* base, long exponent, Value*& overflow,
+                                   llvm::BasicBlock* bb) {
+  Type* type = base->getType();
+  FPMode fp_mode = get_fp_mode(bb->getParent());
+  Value* result = nullptr;
+  Value* square = base;
+
+  while (exponent > 0) {
+    if (exponent & 1) {
+      if (!result) {
+        result = square;
+      } else if (type->isFloatingPointTy()) {
+        result = push_back_ret(codegen, BinaryOperator::Create(Instruction::FMul, result, square, "pow_mul", bb));
+        apply_fp_mode(result, fp_mode);
+      } else {
+        result = checked_mul_codegen(codegen, result, square, overflow, bb);
+      }
+    }
+
+    exponent >>= 1;
+    if (exponent > 0) {
+      if (type->isFloatingPointTy()) {
+        square = push_back_ret(codegen, BinaryOperator::Create(Instruction::FMul, square, square, "pow_square", bb));
+        apply_fp_mode(square, fp_mode);
+      } else {
+        square = checked_mul_codegen(codegen, square, square, overflow, bb);
+      }
+    }
+  }
+
+  if (!result) {
+    return type->isFloatingPointTy() ? (Value*)ConstantFP::get(type, 1.0) : (Value*)ConstantInt::get(type, 1);
+  }
+  return result;
+}
+
+static Value* pow_intrinsic_codegen(std::vector<Value*>& codegen, Value* base, Value* exponent, llvm::BasicBlock* bb) {
+  Intrinsic::ID id = exponent->getType()->isIntegerTy() ? Intrinsic::powi : Intrinsic::pow;
+  Function* pow_function = Intrinsic::getDeclaration(TheModule.get(), id, {base->getType()});
+  CallInst* pow = push_back_ret(codegen, CallInst::Create(pow_function, {base, exponent}, "pow", bb));
+
+  apply_fp_mode(pow, get_fp_mode(bb->getParent()));
+  return pow;
+}
+
+// lhs ^ rhs of two boxed numbers, in the type of the promotion table; bb moves
+// to the block where the result is available. A power of integers is exact:
+// when it overflows its type (or the exponent is negative) it branches to
+// label_slow, which leaves it to noname_binary_op (a bigint or a double).
+static Value* pow_codegen(std::vector<Value*>& codegen, Value* lhs_v, Value* rhs_v, int lhs_type, int rhs_type,
+                          long exponent, BasicBlock* label_slow, llvm::BasicBlock*& bb) {
+  int result_type = get_adequate_result_type(lhs_type, rhs_type);
+  Value* base = unbox_numeric_codegen(codegen, lhs_v, lhs_type, result_type, "_base", bb);
+
+  if (result_type == TYPE_DOUBLE || result_type == TYPE_FLOAT) {
+    Value* overflow = nullptr;
+
+    if (exponent >= 0) {
+      return unrolled_pow_codegen(codegen, base, exponent, overflow, bb);
+    }
+
+    // llvm.powi takes an i32 exponent; a long one goes through llvm.pow
+    int exponent_type = rhs_type == TYPE_CHAR || rhs_type == TYPE_SHORT || rhs_type == TYPE_INT ? TYPE_INT : result_type;
+    return pow_intrinsic_codegen(codegen, base, unbox_numeric_codegen(codegen, rhs_v, rhs_type, exponent_type, "_exponent", bb), bb);
+  }
+
+  Value* result = nullptr;
+  Value* inexact = nullptr;
+
+  if (exponent >= 0) {
+    result = unrolled_pow_codegen(codegen, base, exponent, inexact, bb);
+  } else {
+    Type* int64_type = Type::getInt64Ty(TheContext);
+    Type* int32_type = Type::getInt32Ty(TheContext);
+    FunctionType* pow_long_type = FunctionType::get(int32_type, {int64_type, int64_type, PointerTy_64}, false);
+    Constant* pow_long_address = host_function_codegen("noname_pow_long", pow_long_type);
+
+    AllocaInst* alloca_pow_result = push_back_ret(codegen, alloca_typed_var_codegen(TYPE_LONG, "_pow", bb));
+    Value* long_base = unbox_numeric_codegen(codegen, lhs_v, lhs_type, TYPE_LONG, "_long_base", bb);
+    Value* long_exponent = unbox_numeric_codegen(codegen, rhs_v, rhs_type, TYPE_LONG, "_long_exponent", bb);
+    CallInst* exact = push_back_ret(
+        codegen, CallInst::Create(pow_long_address, {long_base, long_exponent, alloca_pow_result}, "pow_exact", bb));
+    inexact = push_back_ret(codegen, new ICmpInst(*bb, ICmpInst::ICMP_EQ, exact, ConstantInt::get(int32_type, 0), "pow_inexact"));
+    result = push_back_ret(codegen, load_inst_codegen(TYPE_LONG, alloca_pow_result, bb));
+
+    if (result_type != TYPE_LONG) {
+      // narrow types stay narrow, as long as the result fits
+      Type* result_llvm_type = toLLVMType(result_type);
+      Value* narrow_result = push_back_ret(codegen, new TruncInst(result, result_llvm_type, "pow_narrow", bb));
+      Value* wide_result = push_back_ret(codegen, new SExtInst(narrow_result, int64_type, "pow_wide", bb));
+      Value* truncated = push_back_ret(codegen, new ICmpInst(*bb, ICmpInst::ICMP_NE, wide_result, result, "pow_truncated"));
+      inexact = push_back_ret(codegen, BinaryOperator::Create(Instruction::Or, inexact, truncated, "pow_inexact", bb));
+      result = narrow_result;
+    }
+  }
+
+  if (!inexact) {
+    return result;
+  }
+
+  BasicBlock* label_pow_exact = push_back_ret(codegen, BasicBlock::Create(TheContext, "pow_exact", bb->getParent(), label_slow));
+
+  BranchInst* branch_inst = push_back_ret(codegen, BranchInst::Create(label_slow, label_pow_exact, inexact, bb));
+  profile_set_branch_weights(branch_inst, 0, LIKELY_BRANCH_WEIGHT);
+
+  bb = label_pow_exact;
+  return result;
+}
+
+// Numeric type of the value of exp_node when it is known at compile time, 0
+// otherwise: that of a literal, or of an operation on numbers of known types
+// which cannot fail or overflow. Floating point operations never do, narrow
+// integers wrap, but a long may become a bigint and an integer division fail.
+static int static_numeric_type(const ExpNode* exp_node) {
+  if (const NumberExpNode* number_exp_node = dyn_cast<NumberExpNode>(exp_node)) {
+    return number_exp_node->getNumberType();
+  }
+
+  const BinaryExpNode* binary_exp_node = dyn_cast<BinaryExpNode>(exp_node);
+  if (!binary_exp_node) {
+    return 0;
+  }
+  if (!binary_exp_node->getRHS()) {
+    return static_numeric_type(binary_exp_node->getLHS());
+  }
+
+  int lhs_type = static_numeric_type(binary_exp_node->getLHS());
+  int rhs_type = static_numeric_type(binary_exp_node->getRHS());
+  if (!lhs_type || !rhs_type || binary_exp_node->getOp() == '^') {
+    return 0;
+  }
+
+  int result_type = get_adequate_result_type(lhs_type, rhs_type);
+  if (result_type == TYPE_DOUBLE || result_type == TYPE_FLOAT) {
+    return result_type;
+  }
+  return result_type == TYPE_LONG || binary_exp_node->getOp() == '/' ? 0 : result_type;
+}
+
+void BinaryExpNode::setResultInSlot() {
+  result_in_slot = true;
+  // a parenthesized expression is the expression itself
+  if (!rhs) {
+    if (BinaryExpNode* binary_exp_node = dyn_cast<BinaryExpNode>(lhs.get())) {
+      binary_exp_node->setResultInSlot();
+    }
+  }
+}
+
+void BinaryExpNode::setOperandsResultInSlot() {
+  if (!rhs) {
+    return;
+  }
+
+  for (ExpNode* operand : {lhs.get(), rhs.get()}) {
+    if (BinaryExpNode* binary_exp_node = dyn_cast_or_null<BinaryExpNode>(operand)) {
+      binary_exp_node->setResultInSlot();
+    }
+  }
+}
+
 std::vector<Value*> BinaryExpNode::codegen_elements(Error& error, llvm::BasicBlock* bb) const {
-  std::vector<Value*> codegen;
+  if (!rhs) {
+    return lhs->get_codegen_elements(error, bb);
+  }
 
-  // TODO: are all these constants necessary?
-  ConstantInt* const_int32_double = ConstantInt::get(TheContext, APInt(32, TYPE_DOUBLE, true));
-  ConstantInt* const_int32_long = ConstantInt::get(TheContext, APInt(32, TYPE_LONG, true));
+  std::vector<Value*> codegen;
 
   BinaryExpNode_Data_t data;
   prepare(error, data, codegen, bb);
@@ -205,12 +589,18 @@ std::vector<Value*> BinaryExpNode::codegen_elements(Error& error, llvm::BasicBlo
       return codegen;
     }
 
+    // each operand may end in a block of its own (e.g. a nested binary
+    // expression), the code that follows it goes there
+    bb = continuation_block(lhs_codegen_elements, bb);
+
     std::vector<Value*> rhs_codegen_elements(rhs->get_codegen_elements(error, bb));
     if (error.code()) {
       logError(error.what().c_str());
       return codegen;
     }
 
+    bb = continuation_block(rhs_codegen_elements, bb);
+
     // fprintf(stdout, "\nlhs_codegen_elements:\n");
     // fflush(stdout);
     for (auto current_value : lhs_codegen_elements) {
@@ -249,112 +639,219 @@ std::vector<Value*> BinaryExpNode::codegen_elements(Error& error, llvm::BasicBlo
 
   LoadInst* lhs_type = push_back_ret(codegen, load_inst_codegen(TYPE_INT, data.get_elem_ptr_larg_type, bb));
   LoadInst* rhs_type = push_back_ret(codegen, load_inst_codegen(TYPE_INT, data.get_elem_ptr_rarg_type, bb));
-
-  // ###############################################################################################
-  // ###############################################################################################
-
   LoadInst* lhs_v = push_back_ret(codegen, load_inst_codegen(TYPE_VOID_POINTER, data.get_elem_ptr_larg_v, bb));
-  CastInst* lcast_inst_long_v = push_back_ret(codegen, new BitCastInst(lhs_v, PointerTy_64, "lcast_inst_long_v", bb));
-  LoadInst* lhs_long_v = push_back_ret(codegen, load_inst_codegen(TYPE_VOID_POINTER, lcast_inst_long_v, bb));
-  // CastInst* cast_inst_ptr_50 = new BitCastInst(load_inst_ptr_49, PointerTy_to64, "", label_if_then);
-  // LoadInst* int64_51 = new LoadInst(cast_inst_ptr_50, "", false, label_if_then);
-
   LoadInst* rhs_v = push_back_ret(codegen, load_inst_codegen(TYPE_VOID_POINTER, data.get_elem_ptr_rarg_v, bb));
-  CastInst* rcast_inst_long_v = push_back_ret(codegen, new BitCastInst(rhs_v, PointerTy_64, "rcast_inst_long_v", bb));
-  LoadInst* rhs_long_v = push_back_ret(codegen, load_inst_codegen(TYPE_VOID_POINTER, rcast_inst_long_v, bb));
 
   // ###############################################################################################
   // ###############################################################################################
 
-  CastInst* lcast_inst_double_v = push_back_ret(codegen, new BitCastInst(lhs_v, PointerTy_Double, "lcast_inst_double_v", bb));
-  CastInst* rcast_inst_double_v = push_back_ret(codegen, new BitCastInst(rhs_v, PointerTy_Double, "rcast_inst_double_v", bb));
-  LoadInst* lload_inst_double_v = push_back_ret(codegen, load_inst_codegen(TYPE_VOID_POINTER, lcast_inst_double_v, bb));
-  LoadInst* rload_inst_double_v = push_back_ret(codegen, load_inst_codegen(TYPE_VOID_POINTER, rcast_inst_double_v, bb));
+  // The pairs of types compiled inline are those known at compile time or, for
+  // an operand only known at run time, long and double (the types of the
+  // literals): a switch on (lhs_type << 8) | rhs_type converts both operands to
+  // the type of the promotion table, then the arm of that type does the
+  // arithmetic. Any other pair of numbers goes to noname_numeric_binary_op,
+  // shared by every binary expression, and anything else to the host.
+  int lhs_static_type = static_numeric_type(lhs.get());
+  int rhs_static_type = static_numeric_type(rhs.get());
+  std::vector<int> lhs_types = lhs_static_type ? std::vector<int>{lhs_static_type} : std::vector<int>{TYPE_LONG, TYPE_DOUBLE};
+  std::vector<int> rhs_types = rhs_static_type ? std::vector<int>{rhs_static_type} : std::vector<int>{TYPE_LONG, TYPE_DOUBLE};
+  bool is_static = lhs_static_type && rhs_static_type;
+
+  // the operand of an enclosing binary expression is read right away: it is
+  // kept in a stack slot of the function rather than boxed on the heap
+  Value* result_slot = nullptr;
+  if (result_in_slot) {
+    AllocaInst* alloca_slot = push_back_ret(codegen, alloca_typed_var_codegen(TYPE_LONG, "_result", bb));
+    result_slot = push_back_ret(codegen, new BitCastInst(alloca_slot, PointerTy_8, "result_slot", bb));
+  }
 
-  //http://llvm.org/docs/doxygen/html/IRBuilder_8h_source.html#l01428
+  SwitchInst* switch_inst = nullptr;
+  BasicBlock* label_numeric = nullptr;
+  int counter_numeric = -1;
+  std::vector<int> case_counters;
 
-  CmpInst* cond_equal_double = new ICmpInst(*bb, ICmpInst::ICMP_EQ, lhs_type, const_int32_double, "cond_equal_double");
-  codegen.push_back(BranchInst::Create(data.label_if_then_double, data.label_else_if, cond_equal_double, bb));
+  if (!is_static) {
+    ConstantInt* const_int32_8 = ConstantInt::get(TheContext, APInt(32, 8, true));
+    Value* lhs_type_key = push_back_ret(codegen, BinaryOperator::Create(Instruction::Shl, lhs_type, const_int32_8, "lhs_type_key", bb));
+    Value* types_key = push_back_ret(codegen, BinaryOperator::Create(Instruction::Or, lhs_type_key, rhs_type, "types_key", bb));
 
-  CmpInst* cond_equal_long = new ICmpInst(*data.label_else_if, ICmpInst::ICMP_EQ, lhs_type, const_int32_long, "cond_equal_long");
-  codegen.push_back(BranchInst::Create(data.label_else_if_then_long, data.label_if_default, cond_equal_long, data.label_else_if));
+    label_numeric = push_back_ret(codegen, BasicBlock::Create(TheContext, "numeric_op", function, data.label_if_default));
+    switch_inst = push_back_ret(codegen, SwitchInst::Create(types_key, label_numeric, lhs_types.size() * rhs_types.size(), bb));
+    counter_numeric = profile_counter_codegen(label_numeric);
+  }
 
-  AllocaInst* alloca_datatype_double_v = push_back_ret(codegen, alloca_typed_var_codegen(TYPE_DOUBLE, data.label_if_then_double));
-  AllocaInst* alloca_datatype_long_v = push_back_ret(codegen, alloca_typed_var_codegen(TYPE_LONG, data.label_else_if_then_long));
+  // the arm of every type receives the operands or, for ^, the result: a power
+  // depends on the types of the operands before the promotion
+  PHINode* lhs_values[NUMERIC_TYPES_COUNT];
+  PHINode* rhs_values[NUMERIC_TYPES_COUNT];
+  PHINode* pow_values[NUMERIC_TYPES_COUNT];
+  long exponent = op == '^' ? constant_exponent(rhs.get()) : -1;
+
+  for (int lhs_numeric_type : lhs_types) {
+    for (int rhs_numeric_type : rhs_types) {
+      int result_type = get_adequate_result_type(lhs_numeric_type, rhs_numeric_type);
+      int result_index = result_type - TYPE_CHAR;
+
+      if (!data.label_if_then_type[result_index]) {
+        data.label_if_then_type[result_index] = push_back_ret(
+            codegen, BasicBlock::Create(TheContext, std::string("if_then_") + numeric_type_name(result_type), function, data.label_if_default));
+
+        Type* llvm_type = toLLVMType(result_type);
+        if (op == '^') {
+          pow_values[result_index] = PHINode::Create(llvm_type, NUMERIC_TYPES_COUNT, "pow_value", data.label_if_then_type[result_index]);
+        } else {
+          lhs_values[result_index] = PHINode::Create(llvm_type, NUMERIC_TYPES_COUNT, "lhs_value", data.label_if_then_type[result_index]);
+          rhs_values[result_index] = PHINode::Create(llvm_type, NUMERIC_TYPES_COUNT, "rhs_value", data.label_if_then_type[result_index]);
+        }
+      }
 
-  Value* binary_op_double = nullptr;
-  Value* binary_op_long = nullptr;
+      BasicBlock* label_case = push_back_ret(
+          codegen, BasicBlock::Create(TheContext, std::string("case_") + numeric_type_name(lhs_numeric_type) + "_" +
+                                                      numeric_type_name(rhs_numeric_type),
+                                      function, data.label_if_then_type[result_index]));
+
+      if (op == '^') {
+        BasicBlock* case_end = label_case;
+        Value* pow_value =
+            pow_codegen(codegen, lhs_v, rhs_v, lhs_numeric_type, rhs_numeric_type, exponent, data.label_if_default, case_end);
+        push_back_ret(codegen, BranchInst::Create(data.label_if_then_type[result_index], case_end));
+
+        pow_values[result_index]->addIncoming(pow_value, case_end);
+      } else {
+        Value* lhs_value = unbox_numeric_codegen(codegen, lhs_v, lhs_numeric_type, result_type, "_LHS", label_case);
+        Value* rhs_value = unbox_numeric_codegen(codegen, rhs_v, rhs_numeric_type, result_type, "_RHS", label_case);
+        push_back_ret(codegen, BranchInst::Create(data.label_if_then_type[result_index], label_case));
+
+        lhs_values[result_index]->addIncoming(lhs_value, label_case);
+        rhs_values[result_index]->addIncoming(rhs_value, label_case);
+      }
 
-  if (op == '+') {
-    binary_op_double =
-        BinaryOperator::Create(Instruction::FAdd, lload_inst_double_v, rload_inst_double_v, "add", data.label_if_then_double);
-    binary_op_long = BinaryOperator::Create(Instruction::Add, lhs_long_v, rhs_long_v, "add", data.label_else_if_then_long);
-  } else if (op == '-') {
-    binary_op_double =
-        BinaryOperator::Create(Instruction::FSub, lload_inst_double_v, rload_inst_double_v, "sub", data.label_if_then_double);
-    binary_op_long = BinaryOperator::Create(Instruction::Sub, lhs_long_v, rhs_long_v, "sub", data.label_else_if_then_long);
-  } else if (op == '*') {
-    binary_op_double =
-        BinaryOperator::Create(Instruction::FMul, lload_inst_double_v, rload_inst_double_v, "mul", data.label_if_then_double);
-    binary_op_long = BinaryOperator::Create(Instruction::Mul, lhs_long_v, rhs_long_v, "mul", data.label_else_if_then_long);
-  } else if (op == '/') {
-    binary_op_double =
-        BinaryOperator::Create(Instruction::FDiv, lload_inst_double_v, rload_inst_double_v, "div", data.label_if_then_double);
-    binary_op_long = BinaryOperator::Create(Instruction::SDiv, lhs_long_v, rhs_long_v, "div", data.label_else_if_then_long);
-  } else if (op == '^') {
-    logError("^ NOT IMPLEMENTED YET");
-    // result = CreatePow(LHS, RHS);
+      if (is_static) {
+        // the only pair there can be
+        push_back_ret(codegen, BranchInst::Create(label_case, bb));
+      } else {
+        case_counters.push_back(profile_counter_codegen(label_case));
+        switch_inst->addCase(ConstantInt::get(TheContext, APInt(32, (lhs_numeric_type << 8) | rhs_numeric_type, true)), label_case);
+      }
+    }
   }
 
-  push_back_ret(codegen, store_typed_var_codegen(TYPE_INT, const_int32_double, data.get_elem_ptr_type, data.label_if_then_double));
-  push_back_ret(codegen, store_typed_var_codegen(TYPE_INT, const_int32_long, data.get_elem_ptr_type, data.label_else_if_then_long));
+  if (switch_inst) {
+    std::vector<uint64_t> case_counts;
+    uint64_t count = 0;
+    bool has_profile = profile_get_count(function, counter_numeric, count);
+    case_counts.push_back(count);
+    for (int case_counter : case_counters) {
+      has_profile = has_profile && profile_get_count(function, case_counter, count);
+      case_counts.push_back(count);
+    }
 
-  // #################################
-  // #################################
-  // #################################
+    if (!has_profile) {
+      // without a profile, the other types only come from narrow values of the
+      // host (AST files, snapshots); keep them out of the hot path
+      case_counts.assign(case_counts.size(), LIKELY_BRANCH_WEIGHT);
+      case_counts[0] = 0;
+    }
+    profile_set_switch_weights(switch_inst, case_counts);
+  }
 
-  push_back_ret(codegen, store_typed_var_codegen(TYPE_DOUBLE, binary_op_double, alloca_datatype_double_v, data.label_if_then_double));
-  push_back_ret(codegen, store_typed_var_codegen(TYPE_LONG, binary_op_long, alloca_datatype_long_v, data.label_else_if_then_long));
-
-  // arg.void_v = new long(actual_long_v);
-  ConstantInt* const_int64_8 = ConstantInt::get(TheContext, APInt(64, StringRef("8"), 10));
-  CallInst* malloc_ptr_long_v =
-      push_back_ret(codegen, CallInst::Create(func__Znwm, const_int64_8, "call", data.label_else_if_then_long));  // new long
-  CastInst* ptr_long_v =
-      push_back_ret(codegen, new BitCastInst(malloc_ptr_long_v, PointerTy_64, "", data.label_else_if_then_long));  // new long
-  // malloc done
-  LoadInst* load_long_v = push_back_ret(codegen, load_inst_codegen(TYPE_LONG, alloca_datatype_long_v, data.label_else_if_then_long));
-  StoreInst* si_long_v1 =
-      push_back_ret(codegen, store_typed_var_codegen(TYPE_VOID_POINTER, load_long_v, ptr_long_v, data.label_else_if_then_long));
-  CastInst* cast_inst_long_v = push_back_ret(codegen, new BitCastInst(ptr_long_v, PointerTy_8, "", data.label_else_if_then_long));
-  StoreInst* si_long_v2 = push_back_ret(
-      codegen, store_typed_var_codegen(TYPE_VOID_POINTER, cast_inst_long_v, data.get_elem_ptr_v, data.label_else_if_then_long));
+  // arg.void_v = the slot, or new <type>(result): narrow types keep their 1, 2
+  // or 4 bytes
+  Function* function_new = result_slot ? nullptr : get_module_function(func__Znwm);
 
-  //////////////////////////////////////
-  //////////////////////////////////////
-  //////////////////////////////////////
+  for (int i = 0; i < NUMERIC_TYPES_COUNT; ++i) {
+    int result_type = TYPE_CHAR + i;
+    BasicBlock* label_if_then = data.label_if_then_type[i];
+    Value* binary_op = nullptr;
 
-  ConstantInt* const_int32_5432 = ConstantInt::get(TheContext, APInt(32, 5432, true));
+    if (!label_if_then) {
+      continue;
+    }
 
-  long* heap_value = new long(888777);
-  Constant* default_constant_address = ConstantInt::get(Type::getInt64Ty(TheContext), (uint64_t)heap_value);
-  Value* constant_value = ConstantExpr::getIntToPtr(default_constant_address, PointerType::getUnqual(IntegerType::get(TheContext, 8)));
+    if (op == '^') {
+      binary_op = push_back_ret(codegen, pow_values[i]);
+    } else {
+      codegen.push_back(lhs_values[i]);
+      codegen.push_back(rhs_values[i]);
+
+      if (op == '/' && result_type != TYPE_DOUBLE && result_type != TYPE_FLOAT) {
+        binary_op = checked_div_codegen(codegen, lhs_values[i], rhs_values[i], data.label_if_default, label_if_then);
+      } else if (result_type == TYPE_LONG) {
+        // longs never wrap: on overflow the slow path computes a bigint
+        Value* overflow = nullptr;
+        binary_op = checked_long_op_codegen(codegen, op, lhs_values[i], rhs_values[i], overflow, label_if_then);
+
+        BasicBlock* label_if_exact =
+            push_back_ret(codegen, BasicBlock::Create(TheContext, "if_exact_long", function, data.label_if_default));
+        BranchInst* branch_inst =
+            push_back_ret(codegen, BranchInst::Create(data.label_if_default, label_if_exact, overflow, label_if_then));
+        profile_set_branch_weights(branch_inst, 0, LIKELY_BRANCH_WEIGHT);
+        label_if_then = label_if_exact;
+      } else {
+        binary_op = push_back_ret(codegen, binary_op_codegen(op, result_type, lhs_values[i], rhs_values[i], label_if_then));
+        apply_fp_mode(binary_op, get_fp_mode(function));
+      }
+    }
 
-  if (!constant_value) {
-    createError(error, "Invalid or undefined constant value");
-    return codegen;
+    ConstantInt* const_int32_type = ConstantInt::get(TheContext, APInt(32, result_type, true));
+    push_back_ret(codegen, store_typed_var_codegen(TYPE_INT, const_int32_type, data.get_elem_ptr_type, label_if_then));
+
+    Type* llvm_type = toLLVMType(result_type);
+    Value* box = result_slot;
+    if (!box) {
+      ConstantInt* const_int64_size = ConstantInt::get(TheContext, APInt(64, llvm_type->getPrimitiveSizeInBits() / 8, false));
+      box = push_back_ret(codegen, CallInst::Create(function_new, const_int64_size, "call", label_if_then));
+    }
+    CastInst* ptr_v = push_back_ret(codegen, new BitCastInst(box, PointerType::getUnqual(llvm_type), "", label_if_then));
+    push_back_ret(codegen, store_typed_var_codegen(result_type, binary_op, ptr_v, label_if_then));
+    push_back_ret(codegen, store_typed_var_codegen(TYPE_VOID_POINTER, box, data.get_elem_ptr_v, label_if_then));
+
+    BranchInst::Create(data.label_if_end, label_if_then);
   }
 
-  push_back_ret(codegen, store_typed_var_codegen(TYPE_VOID_POINTER, constant_value, data.get_elem_ptr_v, data.label_if_default));
-  push_back_ret(codegen, store_typed_var_codegen(TYPE_INT, const_int32_5432, data.get_elem_ptr_type, data.label_if_default));
+  Type* int32_type = Type::getInt32Ty(TheContext);
+
+  if (label_numeric) {
+    // the other pairs of numbers; null when the host has to compute the result
+    FunctionType* numeric_op_type =
+        FunctionType::get(PointerTy_8, {int32_type, int32_type, PointerTy_8, int32_type, PointerTy_8, PointerTy_8,
+                                        PointerType::getUnqual(int32_type)},
+                          false);
+    Constant* numeric_op_address = host_function_codegen("noname_numeric_binary_op", numeric_op_type);
+    Value* slot_arg = result_slot ? result_slot : ConstantPointerNull::get(PointerTy_8);
+    CallInst* numeric_box = push_back_ret(
+        codegen, CallInst::Create(numeric_op_address,
+                                  {ConstantInt::get(int32_type, op), lhs_type, lhs_v, rhs_type, rhs_v, slot_arg, data.get_elem_ptr_type},
+                                  "numeric_box", label_numeric));
+    ICmpInst* is_host = push_back_ret(codegen, new ICmpInst(*label_numeric, ICmpInst::ICMP_EQ, numeric_box,
+                                                            ConstantPointerNull::get(PointerTy_8), "is_host"));
+
+    BasicBlock* label_numeric_done = push_back_ret(codegen, BasicBlock::Create(TheContext, "numeric_done", function, data.label_if_default));
+    push_back_ret(codegen, BranchInst::Create(data.label_if_default, label_numeric_done, is_host, label_numeric));
+
+    push_back_ret(codegen, store_typed_var_codegen(TYPE_VOID_POINTER, numeric_box, data.get_elem_ptr_v, label_numeric_done));
+    BranchInst::Create(data.label_if_end, label_numeric_done);
+  }
+
+  //////////////////////////////////////
+  //////////////////////////////////////
+  //////////////////////////////////////
+
+  // anything else (bigints, strings, overflows) is computed by the host like
+  // the interpreter does, straight into the result
+  FunctionType* binary_op_type = FunctionType::get(
+      Type::getVoidTy(TheContext), {int32_type, int32_type, PointerTy_8, int32_type, PointerTy_8, PointerTy_StructTy_struct_datatype_t},
+      false);
+  Constant* binary_op_address = host_function_codegen("noname_binary_op", binary_op_type);
+  push_back_ret(codegen, CallInst::Create(binary_op_address, {ConstantInt::get(int32_type, op), lhs_type, lhs_v, rhs_type, rhs_v,
+                                                              data.alloca_datatype},
+                                          "", data.label_if_default));
 
   //////////////////////////////////////
   //////////////////////////////////////
   //////////////////////////////////////
 
   BranchInst::Create(data.label_if_end, data.label_if_default);
-  BranchInst::Create(data.label_if_end, data.label_if_then_double);
-  BranchInst::Create(data.label_if_end, data.label_else_if_then_long);
 
   codegen.push_back(data.label_if_end);
 
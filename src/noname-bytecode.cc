@@ -0,0 +1,955 @@
+#include "noname-bytecode.h"
+#include "noname-utils.h"
+#include "noname-types.h"
+#include "noname-stats.h"
+#include <stdio.h>
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace noname {
+
+ExecutionTier execution_tier = TIER_JIT;
+uint64_t bytecode_fold_fuel = 1000000;
+
+static Statistic NumBytecodeFunctions("bytecode", "functions", "Number of functions compiled to bytecode");
+static Statistic NumBytecodeFallbacks("bytecode", "fallbacks", "Number of functions left to the JIT");
+static Statistic NumBytecodeInstructions("bytecode", "instructions", "Number of bytecode instructions emitted");
+static Statistic NumBytecodeRuns("bytecode", "runs", "Number of top level calls run on the VM");
+static Statistic NumBytecodeTierUps("bytecode", "tier-ups", "Number of bytecode functions compiled by the JIT");
+static Statistic NumBytecodeFolds("bytecode", "folds", "Number of pure calls evaluated at compile time");
+static Statistic NumBytecodeFoldsOutOfFuel("bytecode", "folds-out-of-fuel", "Number of pure calls that ran out of fuel at compile time");
+static Statistic NumBytecodeFoldsTrapping("bytecode", "folds-trapping", "Number of pure calls left to run time for a division that traps");
+
+// frames of the VM, past which a recursion is reported instead of running out
+// of memory
+static const size_t MAX_CALL_DEPTH = 1 << 20;
+
+#if defined(__GNUC__)
+// dispatch with computed gotos: every instruction jumps straight to the next
+// handler, which the branch predictor tracks per handler
+#define BYTECODE_THREADED_DISPATCH
+#endif
+
+#define BYTECODE_OPCODES(X) \
+  X(LOAD_CONST)             \
+  X(LOAD_UNDEF)             \
+  X(LOAD_GLOBAL)            \
+  X(MOVE)                   \
+  X(BINARY)                 \
+  X(COMPARE)                \
+  X(JUMP)                   \
+  X(JUMP_IF_FALSE)          \
+  X(CALL)                   \
+  X(TAIL_CALL)              \
+  X(RETURN)                 \
+  X(RETURN_UNDEF)
+
+namespace {
+
+#define BYTECODE_OPCODE_ENUM(name) OP_##name,
+enum Opcode : uint8_t { BYTECODE_OPCODES(BYTECODE_OPCODE_ENUM) };
+#undef BYTECODE_OPCODE_ENUM
+
+#define BYTECODE_OPCODE_NAME(name) #name,
+const char* opcode_names[] = {BYTECODE_OPCODES(BYTECODE_OPCODE_NAME)};
+#undef BYTECODE_OPCODE_NAME
+
+//   LOAD_CONST     a = constants[b]
+//   LOAD_UNDEF     a = undefined
+//   LOAD_GLOBAL    a = value of the variable globals[b], read when run
+//   MOVE           a = b
+//   BINARY         a = b op c
+//   COMPARE        a = b op c, 1 or 0
+//   JUMP           to instruction a
+//   JUMP_IF_FALSE  to instruction b unless a is true
+//   CALL           a = functions[b](c, c + 1, ...)
+//   TAIL_CALL      return functions[b](c, c + 1, ...), reusing the frame
+//   RETURN         return a
+//   RETURN_UNDEF   return undefined
+struct Instruction {
+  Opcode opcode;
+  // '+', '-', ... for BINARY, a CompareExpNode::CompareOp for COMPARE
+  uint8_t op;
+  int32_t a;
+  int32_t b;
+  int32_t c;
+};
+
+// The arguments are the first registers, then the local variables, then the
+// temporaries of the expressions
+struct BytecodeFunction {
+  std::string name;
+  int arity;
+  int registers_count;
+  std::vector<Instruction> code;
+  std::vector<TaggedValue> constants;
+  std::vector<const VarExpNode*> globals;
+  // a later definition of the name went to the JIT; the callers compiled
+  // before still call this one
+  bool superseded;
+  // the JIT compiles it as well; only the VM runs code that does not call it
+  bool jit_compiled;
+};
+
+struct Frame {
+  const BytecodeFunction* function;
+  const Instruction* pc;
+  size_t base;
+  // where the caller wants the value returned
+  int result_register;
+};
+}
+
+// every function compiled to bytecode; calls refer to them by index
+static std::vector<std::unique_ptr<BytecodeFunction>> bytecode_functions;
+static std::map<std::string, int> bytecode_function_indexes;
+// functions only compiled to bytecode so far, in definition order
+static std::vector<FunctionDefNode*> bytecode_only_functions;
+
+static void dump_bytecode_function(FILE* file, const BytecodeFunction& function) {
+  fprintf(file, "\n[bytecode of %s: %d arguments, %d registers]", function.name.c_str(), function.arity, function.registers_count);
+
+  for (size_t i = 0; i < function.code.size(); ++i) {
+    const Instruction& instruction = function.code[i];
+    fprintf(file, "\n%5zu %-14s %3d %3d %3d %3d", i, opcode_names[instruction.opcode], instruction.op, instruction.a,
+            instruction.b, instruction.c);
+  }
+  fflush(file);
+}
+
+namespace {
+
+// Compiles the body of one function. Every method returns false, with the
+// reason in what(), when the body uses something the VM does not run.
+class BytecodeCompiler {
+ private:
+  BytecodeFunction& function;
+  std::map<std::string, int> locals;
+  // first free temporary
+  int next_register;
+  // jumps of the break statements of the loops being compiled, innermost last
+  std::vector<std::vector<size_t>> break_jumps;
+  std::string reason;
+
+ public:
+  BytecodeCompiler(BytecodeFunction& function) : function(function), next_register(0) {}
+
+  const std::string& what() const { return reason; }
+
+  void declareArgument(const std::string& name) {
+    locals[name] = next_register++;
+    function.registers_count = next_register;
+  }
+
+  // Gives a register to every variable declared by the statements, before the
+  // temporaries, so they never share one
+  void declareLocals(const std::vector<std::unique_ptr<ASTNode>>& nodes) {
+    for (const std::unique_ptr<ASTNode>& node : nodes) {
+      if (!node) {
+        continue;
+      }
+
+      std::string name;
+      if (isa<DeclarationNode>(node.get())) {
+        name = ((DeclarationNode*)node.get())->getName();
+      } else if (isa<DeclarationAssignmentNode>(node.get())) {
+        name = ((DeclarationAssignmentNode*)node.get())->getName();
+      } else if (isa<IfExpNode>(node.get())) {
+        declareLocals(((IfExpNode*)node.get())->getThenNodes());
+        declareLocals(((IfExpNode*)node.get())->getElseNodes());
+      } else if (isa<LoopNode>(node.get())) {
+        declareLocals(((LoopNode*)node.get())->getBodyNodes());
+      }
+
+      if (!name.empty() && locals.find(name) == locals.end()) {
+        declareArgument(name);
+      }
+    }
+  }
+
+  bool compileBody(const std::vector<std::unique_ptr<ASTNode>>& nodes) {
+    if (!compileStatements(nodes, -1)) {
+      return false;
+    }
+
+    emit(OP_RETURN_UNDEF);
+    return true;
+  }
+
+  // Runs the call and returns its value; the body of a top level call
+  bool compileTopLevelCall(const CallExpNode* call_exp_node) {
+    int result = newRegister();
+
+    if (!compileCall(call_exp_node, result, false)) {
+      return false;
+    }
+
+    emit(OP_RETURN, 0, result);
+    return true;
+  }
+
+ private:
+  bool fail(const std::string& why) {
+    reason = why;
+    return false;
+  }
+
+  int newRegister() {
+    int new_register = next_register++;
+    function.registers_count = std::max(function.registers_count, next_register);
+    return new_register;
+  }
+
+  size_t emit(Opcode opcode, uint8_t op = 0, int32_t a = 0, int32_t b = 0, int32_t c = 0) {
+    function.code.push_back(Instruction{opcode, op, a, b, c});
+    ++NumBytecodeInstructions;
+    return function.code.size() - 1;
+  }
+
+  int localRegister(const std::string& name) const {
+    auto it = locals.find(name);
+    return it == locals.end() ? -1 : it->second;
+  }
+
+  // Register holding the value of node: the one of a local variable, otherwise
+  // a new temporary; -1 on failure
+  int operand(const ExpNode* node) {
+    if (isa<VarExpNode>(node)) {
+      int local_register = localRegister(((const VarExpNode*)node)->getName());
+      if (local_register >= 0) {
+        return local_register;
+      }
+    }
+
+    int temporary = newRegister();
+    return compileExp(node, temporary) ? temporary : -1;
+  }
+
+  // Statements of a block; the value of the last one goes to target (unless
+  // it is -1), undefined if it is not an expression
+  bool compileStatements(const std::vector<std::unique_ptr<ASTNode>>& nodes, int target) {
+    bool has_value = false;
+
+    for (size_t i = 0; i < nodes.size(); ++i) {
+      if (!nodes[i]) {
+        continue;
+      }
+
+      bool is_last = i == nodes.size() - 1;
+      int saved_next_register = next_register;
+
+      if (!compileStatement(nodes[i].get(), is_last ? target : -1, has_value)) {
+        return false;
+      }
+
+      next_register = saved_next_register;
+    }
+
+    if (target >= 0 && !has_value) {
+      emit(OP_LOAD_UNDEF, 0, target);
+    }
+
+    return true;
+  }
+
+  bool compileStatement(const ASTNode* node, int target, bool& has_value) {
+    has_value = false;
+
+    if (isa<DeclarationNode>(node)) {
+      int local_register = localRegister(((const DeclarationNode*)node)->getName());
+
+      if (local_register < 0) {
+        return fail("declares '" + ((const DeclarationNode*)node)->getName() + "' inside an expression");
+      }
+
+      emit(OP_LOAD_UNDEF, 0, local_register);
+      return true;
+    }
+
+    if (isa<AssignmentNode>(node)) {
+      const AssignmentNode* assignment_node = (const AssignmentNode*)node;
+      int local_register = localRegister(assignment_node->getName());
+
+      if (local_register < 0) {
+        return fail("assigns '" + assignment_node->getName() + "', which is not a local variable");
+      }
+
+      return compileExp(assignment_node->getRHS().get(), local_register);
+    }
+
+    if (isa<ReturnExpNode>(node)) {
+      const ExpNode* exp_node = ((const ReturnExpNode*)node)->getExpNode();
+
+      if (!exp_node) {
+        emit(OP_RETURN_UNDEF);
+        return true;
+      }
+
+      if (isa<CallExpNode>(exp_node)) {
+        return compileCall((const CallExpNode*)exp_node, -1, true);
+      }
+
+      int value = operand(exp_node);
+      if (value < 0) {
+        return false;
+      }
+
+      emit(OP_RETURN, 0, value);
+      return true;
+    }
+
+    if (isa<BreakNode>(node)) {
+      if (break_jumps.empty()) {
+        return fail("break outside of a loop");
+      }
+
+      break_jumps.back().push_back(emit(OP_JUMP));
+      return true;
+    }
+
+    if (isa<LoopNode>(node)) {
+      return compileLoop((const LoopNode*)node);
+    }
+
+    if (isa<IfExpNode>(node)) {
+      has_value = target >= 0;
+      return compileIf((const IfExpNode*)node, target);
+    }
+
+    if (isa<ExpNode>(node)) {
+      has_value = target >= 0;
+      return compileExp((const ExpNode*)node, target >= 0 ? target : newRegister());
+    }
+
+    return fail(ASTNode::toString(node->getKind()) + " is not supported");
+  }
+
+  bool compileExp(const ExpNode* node, int target) {
+    if (isa<NumberExpNode>(node) || isa<StringExpNode>(node)) {
+      function.constants.push_back(node->getTaggedValue());
+      emit(OP_LOAD_CONST, 0, target, function.constants.size() - 1);
+      return true;
+    }
+
+    if (isa<VarExpNode>(node)) {
+      const VarExpNode* var_exp_node = (const VarExpNode*)node;
+      int local_register = localRegister(var_exp_node->getName());
+
+      if (local_register < 0) {
+        function.globals.push_back(var_exp_node);
+        emit(OP_LOAD_GLOBAL, 0, target, function.globals.size() - 1);
+      } else if (local_register != target) {
+        emit(OP_MOVE, 0, target, local_register);
+      }
+      return true;
+    }
+
+    if (isa<BinaryExpNode>(node)) {
+      const BinaryExpNode* binary_exp_node = (const BinaryExpNode*)node;
+
+      // '(' exp ')'
+      if (!binary_exp_node->getRHS()) {
+        return compileExp(binary_exp_node->getLHS(), target);
+      }
+
+      int saved_next_register = next_register;
+      int lhs = operand(binary_exp_node->getLHS());
+      int rhs = lhs < 0 ? -1 : operand(binary_exp_node->getRHS());
+      next_register = saved_next_register;
+
+      if (rhs < 0) {
+        return false;
+      }
+
+      emit(OP_BINARY, (uint8_t)binary_exp_node->getOp(), target, lhs, rhs);
+      return true;
+    }
+
+    if (isa<CompareExpNode>(node)) {
+      const CompareExpNode* compare_exp_node = (const CompareExpNode*)node;
+
+      int saved_next_register = next_register;
+      int lhs = operand(compare_exp_node->getLHS());
+      int rhs = lhs < 0 ? -1 : operand(compare_exp_node->getRHS());
+      next_register = saved_next_register;
+
+      if (rhs < 0) {
+        return false;
+      }
+
+      emit(OP_COMPARE, (uint8_t)compare_exp_node->getOp(), target, lhs, rhs);
+      return true;
+    }
+
+    if (isa<CallExpNode>(node)) {
+      return compileCall((const CallExpNode*)node, target, false);
+    }
+
+    if (isa<IfExpNode>(node)) {
+      return compileIf((const IfExpNode*)node, target);
+    }
+
+    return fail(ASTNode::toString(node->getKind()) + " is not supported");
+  }
+
+  // The arguments go to consecutive registers, which become the first
+  // registers of the frame of the callee
+  bool compileCall(const CallExpNode* call_exp_node, int target, bool is_tail_call) {
+    auto it = bytecode_function_indexes.find(call_exp_node->getCallee());
+
+    if (it == bytecode_function_indexes.end()) {
+      return fail("calls '" + call_exp_node->getCallee() + "', which is not compiled to bytecode");
+    }
+
+    // e.g. a memoized function: the compiled code has the cache, the VM does not
+    if (bytecode_functions[it->second]->jit_compiled && !function.jit_compiled) {
+      return fail("calls '" + call_exp_node->getCallee() + "', which runs compiled");
+    }
+
+    const std::vector<std::unique_ptr<ExpNode>>& args = call_exp_node->getArgs();
+    if ((size_t)bytecode_functions[it->second]->arity != args.size()) {
+      return fail("calls '" + call_exp_node->getCallee() + "' with a wrong number of arguments");
+    }
+
+    int saved_next_register = next_register;
+    int first_arg = next_register;
+    for (size_t i = 0; i < args.size(); ++i) {
+      newRegister();
+    }
+
+    for (size_t i = 0; i < args.size(); ++i) {
+      if (!compileExp(args[i].get(), first_arg + i)) {
+        return false;
+      }
+    }
+
+    next_register = saved_next_register;
+
+    if (is_tail_call) {
+      emit(OP_TAIL_CALL, 0, 0, it->second, first_arg);
+    } else {
+      emit(OP_CALL, 0, target, it->second, first_arg);
+    }
+    return true;
+  }
+
+  bool compileIf(const IfExpNode* if_exp_node, int target) {
+    int saved_next_register = next_register;
+    int condition = operand(if_exp_node->getCondition());
+    next_register = saved_next_register;
+
+    if (condition < 0) {
+      return false;
+    }
+
+    size_t jump_to_else = emit(OP_JUMP_IF_FALSE, 0, condition);
+
+    if (!compileStatements(if_exp_node->getThenNodes(), target)) {
+      return false;
+    }
+
+    size_t jump_to_end = emit(OP_JUMP);
+    function.code[jump_to_else].b = function.code.size();
+
+    if (!compileStatements(if_exp_node->getElseNodes(), target)) {
+      return false;
+    }
+
+    function.code[jump_to_end].a = function.code.size();
+    return true;
+  }
+
+  bool compileLoop(const LoopNode* loop_node) {
+    size_t loop_header = function.code.size();
+    size_t jump_to_exit = 0;
+    bool has_condition = loop_node->getCondition() != nullptr;
+
+    if (has_condition) {
+      int saved_next_register = next_register;
+      int condition = operand(loop_node->getCondition());
+      next_register = saved_next_register;
+
+      if (condition < 0) {
+        return false;
+      }
+
+      jump_to_exit = emit(OP_JUMP_IF_FALSE, 0, condition);
+    }
+
+    break_jumps.push_back(std::vector<size_t>());
+
+    if (!compileStatements(loop_node->getBodyNodes(), -1)) {
+      return false;
+    }
+
+    emit(OP_JUMP, 0, loop_header);
+
+    size_t loop_exit = function.code.size();
+    if (has_condition) {
+      function.code[jump_to_exit].b = loop_exit;
+    }
+    for (size_t break_jump : break_jumps.back()) {
+      function.code[break_jump].a = loop_exit;
+    }
+    break_jumps.pop_back();
+
+    return true;
+  }
+};
+}
+
+// The fuel of a compile time evaluation; a run may end with none left without
+// having needed more, so running out is recorded apart. A division the
+// processor would trap on stops the run too: its error belongs to run time,
+// if the call ever runs
+struct Fuel {
+  uint64_t left;
+  bool ran_out;
+  bool trapped;
+};
+
+// false, with nothing burnt, once the fuel of a compile time evaluation ran out;
+// only jumps and calls burn it, which every loop and recursion go through
+static inline bool burn_fuel(Fuel* fuel) {
+  if (!fuel) {
+    return true;
+  }
+  if (!fuel->left) {
+    fuel->ran_out = true;
+    return false;
+  }
+  --fuel->left;
+  return true;
+}
+
+static inline TaggedValue* ensure_registers(std::vector<TaggedValue>& stack, size_t base, int registers_count) {
+  if (stack.size() < base + registers_count) {
+    stack.resize(std::max(base + registers_count, stack.size() * 2));
+  }
+
+  return stack.data() + base;
+}
+
+// fuel, when given, limits the run: undefined is returned once it ran out or
+// a division would trap
+static TaggedValue execute(const BytecodeFunction& entry, Fuel* fuel = nullptr) {
+  std::vector<TaggedValue> stack;
+  std::vector<Frame> frames;
+
+  const BytecodeFunction* function = &entry;
+  const Instruction* pc = entry.code.data();
+  size_t base = 0;
+  TaggedValue* registers = ensure_registers(stack, base, entry.registers_count);
+  TaggedValue return_value;
+
+#ifdef BYTECODE_THREADED_DISPATCH
+#define BYTECODE_LABEL_ADDRESS(name) &&TARGET_##name,
+  static const void* dispatch_table[] = {BYTECODE_OPCODES(BYTECODE_LABEL_ADDRESS)};
+#undef BYTECODE_LABEL_ADDRESS
+#define TARGET(name) TARGET_##name:
+#define DISPATCH() goto *dispatch_table[pc->opcode]
+
+  DISPATCH();
+#else
+#define TARGET(name) case OP_##name:
+#define DISPATCH() continue
+
+  for (;;) {
+    switch (pc->opcode) {
+#endif
+
+  TARGET(LOAD_CONST) {
+    registers[pc->a] = function->constants[pc->b];
+    ++pc;
+    DISPATCH();
+  }
+
+  TARGET(LOAD_UNDEF) {
+    registers[pc->a] = TaggedValue();
+    ++pc;
+    DISPATCH();
+  }
+
+  TARGET(LOAD_GLOBAL) {
+    registers[pc->a] = function->globals[pc->b]->getTaggedValue();
+    ++pc;
+    DISPATCH();
+  }
+
+  TARGET(MOVE) {
+    registers[pc->a] = registers[pc->b];
+    ++pc;
+    DISPATCH();
+  }
+
+  TARGET(BINARY) {
+    const TaggedValue& lhs = registers[pc->b];
+    const TaggedValue& rhs = registers[pc->c];
+
+    if (fuel && lhs.isDefined() && rhs.isDefined() && binary_op_traps(pc->op, lhs, rhs)) {
+      fuel->trapped = true;
+      return TaggedValue();
+    }
+
+    registers[pc->a] = lhs.isDefined() && rhs.isDefined() ? binary_op_tagged_value(pc->op, lhs, rhs) : TaggedValue();
+    ++pc;
+    DISPATCH();
+  }
+
+  TARGET(COMPARE) {
+    const TaggedValue& lhs = registers[pc->b];
+    const TaggedValue& rhs = registers[pc->c];
+    bool result = false;
+
+    if (!lhs.isDefined() || !rhs.isDefined()) {
+      registers[pc->a] = TaggedValue();
+    } else if (compare_tagged_values((CompareExpNode::CompareOp)pc->op, lhs, rhs, result)) {
+      registers[pc->a] = TaggedValue((long)result);
+    } else {
+      logError("Values cannot be compared");
+      registers[pc->a] = TaggedValue();
+    }
+    ++pc;
+    DISPATCH();
+  }
+
+  TARGET(JUMP) {
+    if (!burn_fuel(fuel)) {
+      return TaggedValue();
+    }
+
+    pc = function->code.data() + pc->a;
+    DISPATCH();
+  }
+
+  TARGET(JUMP_IF_FALSE) {
+    pc = is_true(registers[pc->a]) ? pc + 1 : function->code.data() + pc->b;
+    DISPATCH();
+  }
+
+  TARGET(CALL) {
+    if (!burn_fuel(fuel)) {
+      return TaggedValue();
+    }
+
+    if (frames.size() >= MAX_CALL_DEPTH) {
+      logError("Too many nested calls");
+      return TaggedValue();
+    }
+
+    frames.push_back(Frame{function, pc + 1, base, pc->a});
+
+    base += pc->c;
+    function = bytecode_functions[pc->b].get();
+    registers = ensure_registers(stack, base, function->registers_count);
+    pc = function->code.data();
+    DISPATCH();
+  }
+
+  TARGET(TAIL_CALL) {
+    if (!burn_fuel(fuel)) {
+      return TaggedValue();
+    }
+
+    const BytecodeFunction* callee = bytecode_functions[pc->b].get();
+
+    // the arguments are temporaries, above the registers they move to
+    for (int i = 0; pc->c > 0 && i < callee->arity; ++i) {
+      registers[i] = std::move(registers[pc->c + i]);
+    }
+
+    function = callee;
+    registers = ensure_registers(stack, base, function->registers_count);
+    pc = function->code.data();
+    DISPATCH();
+  }
+
+  TARGET(RETURN) {
+    return_value = std::move(registers[pc->a]);
+    goto do_return;
+  }
+
+  TARGET(RETURN_UNDEF) { return_value = TaggedValue(); }
+
+  do_return: {
+    if (frames.empty()) {
+      return return_value;
+    }
+
+    const Frame& frame = frames.back();
+    function = frame.function;
+    pc = frame.pc;
+    base = frame.base;
+    registers = stack.data() + base;
+    registers[frame.result_register] = std::move(return_value);
+    frames.pop_back();
+    DISPATCH();
+  }
+
+#ifndef BYTECODE_THREADED_DISPATCH
+    }
+  }
+#endif
+
+#undef TARGET
+#undef DISPATCH
+}
+
+bool bytecode_compile_function(FunctionDefNode* function_def_node, bool jit_compiled) {
+  const std::string& name = function_def_node->getName();
+
+  std::unique_ptr<BytecodeFunction> function(new BytecodeFunction());
+  function->name = name;
+  function->arity = function_def_node->getFunctionArguments().size();
+  function->registers_count = 0;
+  function->superseded = false;
+  function->jit_compiled = jit_compiled;
+
+  // registered before compiling the body, so it can call itself; a
+  // redefinition takes the index of the previous one, which its callers use
+  int index = 0;
+  std::unique_ptr<BytecodeFunction> previous_function;
+  auto it = bytecode_function_indexes.find(name);
+  if (it != bytecode_function_indexes.end()) {
+    index = it->second;
+    previous_function = std::move(bytecode_functions[index]);
+  } else {
+    index = bytecode_functions.size();
+    bytecode_functions.push_back(nullptr);
+    bytecode_function_indexes[name] = index;
+  }
+  bytecode_functions[index] = std::move(function);
+
+  BytecodeFunction& bytecode_function = *bytecode_functions[index];
+  BytecodeCompiler compiler(bytecode_function);
+
+  for (FunctionArgument* function_argument : function_def_node->getFunctionArguments()) {
+    compiler.declareArgument(function_argument->getName());
+  }
+  compiler.declareLocals(function_def_node->getBodyNodes());
+
+  if (!compiler.compileBody(function_def_node->getBodyNodes())) {
+    if (previous_function) {
+      bytecode_functions[index] = std::move(previous_function);
+      bytecode_functions[index]->superseded = true;
+    } else {
+      bytecode_functions.pop_back();
+      bytecode_function_indexes.erase(name);
+    }
+
+    if (noname::debug >= 1) {
+      fprintf(stdout, "\n[function %s left to the JIT: %s]", name.c_str(), compiler.what().c_str());
+      fflush(stdout);
+    }
+
+    ++NumBytecodeFallbacks;
+    return false;
+  }
+
+  if (noname::debug >= 1) {
+    dump_bytecode_function(stdout, bytecode_function);
+  }
+
+  if (jit_compiled) {
+    ++NumBytecodeFunctions;
+    return true;
+  }
+
+  bytecode_only_functions.erase(std::remove_if(bytecode_only_functions.begin(), bytecode_only_functions.end(),
+                                               [&](FunctionDefNode* node) { return node->getName() == name; }),
+                                bytecode_only_functions.end());
+  bytecode_only_functions.push_back(function_def_node);
+
+  ++NumBytecodeFunctions;
+  return true;
+}
+
+bool bytecode_run_top_level(CallExpNode* call_exp_node) {
+  BytecodeFunction function;
+  function.name = "__anon_expr";
+  function.arity = 0;
+  function.registers_count = 0;
+  function.superseded = false;
+  function.jit_compiled = false;
+
+  BytecodeCompiler compiler(function);
+  if (!compiler.compileTopLevelCall(call_exp_node)) {
+    if (noname::debug >= 1) {
+      fprintf(stdout, "\n[top level call left to the JIT: %s]", compiler.what().c_str());
+      fflush(stdout);
+    }
+    return false;
+  }
+
+  if (noname::debug >= 1) {
+    dump_bytecode_function(stdout, function);
+  }
+
+  ++NumBytecodeRuns;
+
+  std::unique_ptr<NodeValue> return_value(execute(function).toNodeValue());
+  print_node_value(stdout, return_value.get());
+
+  return true;
+}
+
+// Whether the function, and every function it may call, only computes: the
+// VM runs nothing else but reads of the variables of the top level
+static bool is_pure(int index) {
+  std::vector<int> pending(1, index);
+  std::vector<bool> visited(bytecode_functions.size(), false);
+
+  while (!pending.empty()) {
+    int current = pending.back();
+    pending.pop_back();
+
+    if (visited[current]) {
+      continue;
+    }
+    visited[current] = true;
+
+    const BytecodeFunction& function = *bytecode_functions[current];
+    if (!function.globals.empty()) {
+      return false;
+    }
+
+    for (const Instruction& instruction : function.code) {
+      if (instruction.opcode == OP_CALL || instruction.opcode == OP_TAIL_CALL) {
+        pending.push_back(instruction.b);
+      }
+    }
+  }
+
+  return true;
+}
+
+bool bytecode_is_pure(const std::string& name, int* self_calls) {
+  auto it = bytecode_function_indexes.find(name);
+  if (it == bytecode_function_indexes.end() || bytecode_functions[it->second]->superseded || !is_pure(it->second)) {
+    return false;
+  }
+
+  if (self_calls) {
+    *self_calls = 0;
+    for (const Instruction& instruction : bytecode_functions[it->second]->code) {
+      if (instruction.opcode == OP_CALL && instruction.b == it->second) {
+        ++*self_calls;
+      }
+    }
+  }
+
+  return true;
+}
+
+bool bytecode_evaluate_call(const std::string& callee, const std::vector<TaggedValue>& args, TaggedValue& result) {
+  if (!bytecode_fold_fuel) {
+    return false;
+  }
+
+  auto it = bytecode_function_indexes.find(callee);
+  if (it == bytecode_function_indexes.end()) {
+    return false;
+  }
+
+  const BytecodeFunction& callee_function = *bytecode_functions[it->second];
+  if (callee_function.superseded || (size_t)callee_function.arity != args.size() || !is_pure(it->second)) {
+    return false;
+  }
+
+  // __fold: loads the arguments after the result register and calls
+  BytecodeFunction function;
+  function.name = "__fold";
+  function.arity = 0;
+  function.registers_count = args.size() + 1;
+  function.constants = args;
+  function.superseded = false;
+  function.jit_compiled = true;
+
+  for (size_t i = 0; i < args.size(); ++i) {
+    function.code.push_back(Instruction{OP_LOAD_CONST, 0, (int32_t)i + 1, (int32_t)i, 0});
+  }
+  function.code.push_back(Instruction{OP_CALL, 0, 0, it->second, 1});
+  function.code.push_back(Instruction{OP_RETURN, 0, 0, 0, 0});
+
+  Fuel fuel{bytecode_fold_fuel, false, false};
+  TaggedValue value = execute(function, &fuel);
+
+  if (fuel.ran_out) {
+    if (noname::debug >= 1) {
+      fprintf(stdout, "\n[call of %s ran out of fuel at compile time]", callee.c_str());
+      fflush(stdout);
+    }
+
+    ++NumBytecodeFoldsOutOfFuel;
+    return false;
+  }
+
+  if (fuel.trapped) {
+    if (noname::debug >= 1) {
+      fprintf(stdout, "\n[call of %s would trap on a division, left to run time]", callee.c_str());
+      fflush(stdout);
+    }
+
+    ++NumBytecodeFoldsTrapping;
+    return false;
+  }
+
+  if (!value.isDefined()) {
+    return false;
+  }
+
+  ++NumBytecodeFolds;
+  result = value;
+  return true;
+}
+
+bool bytecode_evaluate_top_level(CallExpNode* call_exp_node) {
+  auto it = bytecode_function_indexes.find(call_exp_node->getCallee());
+  if (it == bytecode_function_indexes.end()) {
+    return false;
+  }
+
+  // the arguments left out are filled with the defaults of the signature
+  std::vector<ExpNode*> arg_nodes;
+  if (!call_exp_node->getArgNodes(arg_nodes, bytecode_functions[it->second]->arity)) {
+    return false;
+  }
+
+  std::vector<TaggedValue> args;
+  for (ExpNode* arg_node : arg_nodes) {
+    if (!isa<NumberExpNode>(arg_node) && !isa<StringExpNode>(arg_node)) {
+      return false;
+    }
+    args.push_back(arg_node->getTaggedValue());
+  }
+
+  TaggedValue result;
+  if (!bytecode_evaluate_call(call_exp_node->getCallee(), args, result)) {
+    return false;
+  }
+
+  std::unique_ptr<NodeValue> return_value(result.toNodeValue());
+  print_node_value(stdout, return_value.get());
+
+  return true;
+}
+
+void bytecode_tier_up() {
+  // callees are defined before their callers, so the JIT compiles them first
+  std::vector<FunctionDefNode*> functions;
+  functions.swap(bytecode_only_functions);
+
+  for (FunctionDefNode* function_def_node : functions) {
+    if (!function_def_node->codegen()) {
+      fprintf(stdout, "\nFunction %s could not be compiled", function_def_node->getName().c_str());
+      fflush(stdout);
+    }
+
+    ++NumBytecodeTierUps;
+  }
+}
+}
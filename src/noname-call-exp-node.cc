@@ -1,6 +1,11 @@
 #include "noname-utils.h"
 #include "noname-types.h"
 #include "noname-jit.h"
+#include "noname-profile.h"
+#include "noname-globals.h"
+#include "noname-dedupe.h"
+#include "noname-specialize.h"
+#include "noname-bytecode.h"
 #include <limits.h>
 #include <stdio.h>
 #include <algorithm>
@@ -102,46 +107,51 @@ llvm::Function* CallExpNode::getCalledFunction(Error& error) const {
   return function;
 }
 
-std::vector<Value*> CallExpNode::codegen_elements(Error& error, llvm::BasicBlock* bb) const {
-  std::vector<Value*> codegen;
-  ASTContext* call_exp_context = getContext();
+bool CallExpNode::getArgNodes(std::vector<ExpNode*>& arg_nodes, size_t args_size) const {
+  for (const std::unique_ptr<ExpNode>& value_arg : getArgs()) {
+    arg_nodes.push_back(value_arg.get());
+  }
 
-  Function* called_function = nullptr;
+  if (arg_nodes.size() > args_size) {
+    return false;
+  }
 
-  if (!called_function) {
-    called_function = getCalledFunction(error);
+  if (arg_nodes.size() == args_size) {
+    return true;
   }
 
-  if (!called_function) {
-    if (!error.code()) {  // error may be already set
-      char msg[1024];
-      sprintf(msg, "Unknown function '%s' referenced", getCallee().c_str());
-      createError(error, msg);
+  FunctionSignature* function_signature = getContext()->getFunctionSignature(getCallee());
+  if (!function_signature || function_signature->getArgsDefs().size() != args_size) {
+    return false;
+  }
+
+  for (size_t i = arg_nodes.size(); i < args_size; i++) {
+    ExpNode* default_value = function_signature->getArgsDefs()[i]->getDefaultValue();
+    if (!default_value) {
+      return false;
     }
-    return codegen;
+    arg_nodes.push_back(default_value);
   }
 
-  FunctionType* called_function_type = called_function->getFunctionType();
-  const std::vector<std::unique_ptr<ExpNode>>& value_args = getArgs();
+  return true;
+}
 
-  // If argument mismatch error.
-  if (called_function->arg_size() != (size_t)value_args.size()) {
-    char msg[1024];
-    sprintf(msg, "Incorrect # arguments passed for function '%s'", getCallee().c_str());
-    createError(error, msg);
-    return codegen;
+std::vector<Value*> CallExpNode::args_codegen_elements(Error& error, llvm::BasicBlock*& bb,
+                                                       std::vector<llvm::Value*>& args_value) const {
+  std::vector<ExpNode*> arg_nodes;
+  for (const std::unique_ptr<ExpNode>& value_arg : getArgs()) {
+    arg_nodes.push_back(value_arg.get());
   }
 
-  std::vector<std::unique_ptr<ExpNode>>::const_iterator it_value_args = value_args.begin();
-  std::vector<llvm::Value*> args_value;
-
-  llvm::Function::arg_iterator it_signature_args = called_function->arg_begin();
-  while (it_signature_args != called_function->arg_end()) {
-    const std::unique_ptr<ExpNode>& value_arg = *it_value_args++;
-    const Argument* signature_arg = (Argument*)it_signature_args++;
+  return args_codegen_elements(error, bb, arg_nodes, args_value);
+}
 
-    call_exp_context->storeVariable(signature_arg->getName().str(), std::move(value_arg->getValue().get()));
+std::vector<Value*> CallExpNode::args_codegen_elements(Error& error, llvm::BasicBlock*& bb,
+                                                       const std::vector<ExpNode*>& arg_nodes,
+                                                       std::vector<llvm::Value*>& args_value) const {
+  std::vector<Value*> codegen;
 
+  for (ExpNode* value_arg : arg_nodes) {
     std::vector<Value*> value_arg_codegen_elements = value_arg->get_codegen_elements(error, bb);
 
     if (error.code()) {
@@ -165,9 +175,94 @@ std::vector<Value*> CallExpNode::codegen_elements(Error& error, llvm::BasicBlock
       codegen.push_back(current_value);
     }
 
+    // the next argument, and eventually the call, continue where this one ended
+    bb = continuation_block(value_arg_codegen_elements, bb);
+
     args_value.push_back(value_arg_codegen_elements.back());
   }
 
+  return codegen;
+}
+
+std::vector<Value*> CallExpNode::codegen_elements(Error& error, llvm::BasicBlock* bb) const {
+  std::vector<Value*> codegen;
+
+  Function* called_function = nullptr;
+
+  if (!called_function) {
+    called_function = getCalledFunction(error);
+  }
+
+  if (!called_function) {
+    if (!error.code()) {  // error may be already set
+      char msg[1024];
+      sprintf(msg, "Unknown function '%s' referenced", getCallee().c_str());
+      createError(error, msg);
+    }
+    return codegen;
+  }
+
+  // recompiling the callee means recompiling the caller (see noname-globals.h)
+  global_function_call(getCallee());
+  dedupe_function_call(getCallee());
+
+  FunctionType* called_function_type = called_function->getFunctionType();
+
+  // If argument mismatch error.
+  std::vector<ExpNode*> arg_nodes;
+  if (!getArgNodes(arg_nodes, datatype_args_size(called_function))) {
+    char msg[1024];
+    sprintf(msg, "Incorrect # arguments passed for function '%s'", getCallee().c_str());
+    createError(error, msg);
+    return codegen;
+  }
+
+  // a pure function of constants, literal or default arguments, is evaluated now
+  // (see noname-bytecode.h)
+  std::vector<TaggedValue> constant_args;
+  for (ExpNode* arg_node : arg_nodes) {
+    if (!isa<NumberExpNode>(arg_node) && !isa<StringExpNode>(arg_node)) {
+      break;
+    }
+    constant_args.push_back(arg_node->getTaggedValue());
+  }
+
+  TaggedValue folded_value;
+  if (constant_args.size() == arg_nodes.size() && bytecode_evaluate_call(getCallee(), constant_args, folded_value)) {
+    if (Constant* folded_call = constant_datatype_codegen(folded_value, getCallee() + ".folded")) {
+      codegen.push_back(folded_call);
+      return codegen;
+    }
+  }
+
+  // constants are folded into a clone of the callee (see noname-specialize.h)
+  std::vector<bool> folded_args;
+  if (Function* specialized_function = specialize_call(getCallee(), arg_nodes, folded_args)) {
+    std::vector<ExpNode*> passed_arg_nodes;
+    for (size_t i = 0; i < arg_nodes.size(); i++) {
+      if (!folded_args[i]) {
+        passed_arg_nodes.push_back(arg_nodes[i]);
+      }
+    }
+
+    arg_nodes.swap(passed_arg_nodes);
+    called_function = specialized_function;
+    called_function_type = called_function->getFunctionType();
+  }
+
+  std::vector<llvm::Value*> args_value;
+  codegen = args_codegen_elements(error, bb, arg_nodes, args_value);
+
+  if (error.code()) {
+    return codegen;
+  }
+
+  if (has_split_datatype_args(called_function)) {
+    std::vector<llvm::Value*> split_args_value;
+    split_datatype_args_codegen(codegen, args_value, split_args_value, bb);
+    args_value.swap(split_args_value);
+  }
+
   if (args_value.size() > called_function_type->getNumParams()) {
     createError(error, "Calling function with more arguments than accepted");
     return codegen;
@@ -189,6 +284,8 @@ std::vector<Value*> CallExpNode::codegen_elements(Error& error, llvm::BasicBlock
 
   // Calling a function with a bad signature
 
+  int call_counter = profile_counter_codegen(bb);
+
   llvm::CallInst* call_inst = nullptr;
   if (called_function->getReturnType() == llvm::Type::getVoidTy(TheContext)) {
     // Cannot assign a name to void values!
@@ -198,7 +295,8 @@ std::vector<Value*> CallExpNode::codegen_elements(Error& error, llvm::BasicBlock
   }
 
   call_inst->setTailCall(false);
-  call_inst->setCallingConv(CallingConv::C);
+  call_inst->setCallingConv(called_function->getCallingConv());
+  profile_set_call_hotness(call_inst, call_counter);
 
   if (noname::debug >= 2) {
     fprintf(stdout, "\n[call_inst->dump() calling '%s']", called_function->getName().str().c_str());
@@ -211,6 +309,16 @@ std::vector<Value*> CallExpNode::codegen_elements(Error& error, llvm::BasicBlock
 }
 Value* CallExpNode::codegen(llvm::BasicBlock* bb) { return codegen_elements_retlast(this, bb); }
 
+void CallExpNode::canonicalize(std::string& out) const {
+  ExpNode::canonicalize(out);
+  canonical_append(out, callee);
+
+  canonical_append(out, (uint64_t)args.size());
+  for (const std::unique_ptr<ExpNode>& arg : args) {
+    arg->canonicalize(out);
+  }
+}
+
 //----------------------------------------------//
 //----------- Processor Strategy ---------------//
 //----------------------------------------------//
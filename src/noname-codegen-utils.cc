@@ -1,6 +1,9 @@
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Support/DynamicLibrary.h"
 #include "noname-utils.h"
 #include "noname-types.h"
 #include "noname-jit.h"
+#include "noname-memo.h"
 #include <limits.h>
 #include <stdio.h>
 #include <algorithm>
@@ -25,52 +28,58 @@ extern std::unique_ptr<Module> TheModule;
 extern std::unique_ptr<legacy::FunctionPassManager> TheFPM;
 extern std::unique_ptr<NonameJIT> TheJIT;
 
-//===----------------------------------------------------------------------===//
-// "Library" functions that can be "extern'd" from user code.
-//===----------------------------------------------------------------------===//
+// the other helpers are in noname-runtime.cc; this one needs std::string, which
+// the runtime bitcode keeps out
+extern "C" DLLEXPORT void* get_copy_address_string(const std::string& value) { return new std::string(value); }
 
-/// putchard - putchar that takes a double and returns 0.
-extern "C" DLLEXPORT double putchard(double X) {
-  fputc((char)X, stderr);
-  return 0;
+const char* fp_mode_name(FPMode mode) {
+  switch (mode) {
+    case FP_MODE_CONTRACT:
+      return "contract";
+    case FP_MODE_FAST:
+      return "fast";
+    default:
+      return "strict";
+  }
 }
 
-/// printd - printf that takes a double prints it as "%f\n", returning 0.
-extern "C" DLLEXPORT double printd(double X) {
-  fprintf(stderr, "%f\n", X);
-  return 0;
-}
+FPMode get_fp_mode(const llvm::Function* function) {
+  if (!function || !function->hasFnAttribute("noname-fp-mode")) {
+    return fp_mode;
+  }
 
-extern "C" DLLEXPORT void* get_copy_address_string(const std::string& value) { return new std::string(value); }
-extern "C" DLLEXPORT void* get_copy_address_long(long value) {
-  long* out_value = new long;
-  memcpy(out_value, &value, sizeof(long));
-  return out_value;
-}
-extern "C" DLLEXPORT void* get_copy_address_int(int value) {
-  int* out_value = new int;
-  memcpy(out_value, &value, sizeof(int));
-  return out_value;
-}
-extern "C" DLLEXPORT void* get_copy_address_short(short value) {
-  short* out_value = new short;
-  memcpy(out_value, &value, sizeof(short));
-  return out_value;
-}
-extern "C" DLLEXPORT void* get_copy_address_char(char value) {
-  char* out_value = new char;
-  memcpy(out_value, &value, sizeof(char));
-  return out_value;
+  StringRef mode = function->getFnAttribute("noname-fp-mode").getValueAsString();
+  if (mode == "fast") {
+    return FP_MODE_FAST;
+  } else if (mode == "contract") {
+    return FP_MODE_CONTRACT;
+  }
+  return FP_MODE_STRICT;
 }
-extern "C" DLLEXPORT void* get_copy_address_double(double value) {
-  double* out_value = new double;
-  memcpy(out_value, &value, sizeof(double));
-  return out_value;
+
+void set_fp_mode(llvm::Function* function, FPMode mode) {
+  const char* fast = mode == FP_MODE_FAST ? "true" : "false";
+
+  function->addFnAttr("noname-fp-mode", fp_mode_name(mode));
+  // always set explicitly: the code generator resets its options from these
+  // attributes per function, so a strict function must not inherit the
+  // settings of a fast one compiled right before it
+  function->addFnAttr("unsafe-fp-math", fast);
+  function->addFnAttr("no-infs-fp-math", fast);
+  function->addFnAttr("no-nans-fp-math", fast);
+  function->addFnAttr("no-signed-zeros-fp-math", fast);
 }
-extern "C" DLLEXPORT void* get_copy_address_float(float value) {
-  float* out_value = new float;
-  memcpy(out_value, &value, sizeof(float));
-  return out_value;
+
+void apply_fp_mode(llvm::Value* value, FPMode mode) {
+  if (mode != FP_MODE_FAST || !value || !isa<FPMathOperator>(value) || !isa<Instruction>(value)) {
+    return;
+  }
+
+  // contraction has no instruction flag in this LLVM; it is controlled by the
+  // AllowFPOpFusion target option that NonameJIT sets per module
+  FastMathFlags flags;
+  flags.setUnsafeAlgebra();
+  cast<Instruction>(value)->setFastMathFlags(flags);
 }
 
 Value* codegen_elements_retlast(ASTNode* node, llvm::BasicBlock* bb) {
@@ -94,6 +103,151 @@ Value* codegen_elements_retlast(ASTNode* node, llvm::BasicBlock* bb) {
   return last;
 }
 
+Function* get_module_function(Function* function) {
+  if (function->getParent() == TheModule.get()) {
+    return function;
+  }
+
+  Function* module_function = TheModule->getFunction(function->getName());
+  if (!module_function) {
+    module_function = Function::Create(function->getFunctionType(), Function::ExternalLinkage, function->getName(), TheModule.get());
+    module_function->setCallingConv(function->getCallingConv());
+    module_function->setAttributes(function->getAttributes());
+  }
+
+  return module_function;
+}
+
+void register_host_symbols() {
+  sys::DynamicLibrary::AddSymbol("noname_binary_op", (void*)&noname_binary_op);
+  sys::DynamicLibrary::AddSymbol("noname_compare_op", (void*)&noname_compare_op);
+  sys::DynamicLibrary::AddSymbol("noname_pow_long", (void*)&noname_pow_long);
+  sys::DynamicLibrary::AddSymbol("noname_numeric_binary_op", (void*)&noname_numeric_binary_op);
+  sys::DynamicLibrary::AddSymbol("noname_compare_false_value", (void*)&noname_compare_false_value);
+  sys::DynamicLibrary::AddSymbol("noname_compare_true_value", (void*)&noname_compare_true_value);
+  sys::DynamicLibrary::AddSymbol("putchard", (void*)&putchard);
+  sys::DynamicLibrary::AddSymbol("printd", (void*)&printd);
+  sys::DynamicLibrary::AddSymbol("get_copy_address_long", (void*)&get_copy_address_long);
+  sys::DynamicLibrary::AddSymbol("get_copy_address_int", (void*)&get_copy_address_int);
+  sys::DynamicLibrary::AddSymbol("get_copy_address_short", (void*)&get_copy_address_short);
+  sys::DynamicLibrary::AddSymbol("get_copy_address_char", (void*)&get_copy_address_char);
+  sys::DynamicLibrary::AddSymbol("get_copy_address_double", (void*)&get_copy_address_double);
+  sys::DynamicLibrary::AddSymbol("get_copy_address_float", (void*)&get_copy_address_float);
+  sys::DynamicLibrary::AddSymbol("noname_memo_cache", (void*)&noname_memo_cache);
+  sys::DynamicLibrary::AddSymbol("noname_memo_lookup", (void*)&noname_memo_lookup);
+  sys::DynamicLibrary::AddSymbol("noname_memo_store", (void*)&noname_memo_store);
+}
+
+Constant* host_function_codegen(const std::string& name, FunctionType* function_type) {
+  return TheModule->getOrInsertFunction(name, function_type);
+}
+
+Constant* host_long_address_codegen(const std::string& name) {
+  return ConstantExpr::getBitCast(TheModule->getOrInsertGlobal(name, Type::getInt64Ty(TheContext)), PointerTy_8);
+}
+
+static bool is_host_address(const Constant* constant, SmallPtrSetImpl<const Constant*>& visited) {
+  if (!visited.insert(constant).second || isa<GlobalValue>(constant)) {
+    return false;
+  }
+
+  const ConstantExpr* constant_expr = dyn_cast<ConstantExpr>(constant);
+  if (constant_expr && constant_expr->getOpcode() == Instruction::IntToPtr && isa<ConstantInt>(constant_expr->getOperand(0))) {
+    return true;
+  }
+
+  for (const Use& operand : constant->operands()) {
+    if (is_host_address(cast<Constant>(operand.get()), visited)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool embeds_host_addresses(const Module& module) {
+  SmallPtrSet<const Constant*, 32> visited;
+
+  for (const GlobalVariable& global : module.globals()) {
+    if (global.hasInitializer() && is_host_address(global.getInitializer(), visited)) {
+      return true;
+    }
+  }
+
+  for (const Function& function : module) {
+    for (const BasicBlock& bb : function) {
+      for (const Instruction& instruction : bb) {
+        for (const Use& operand : instruction.operands()) {
+          const Constant* constant = dyn_cast<Constant>(operand.get());
+          if (constant && is_host_address(constant, visited)) {
+            return true;
+          }
+        }
+      }
+    }
+  }
+  return false;
+}
+
+Constant* constant_datatype_codegen(const TaggedValue& value, const std::string& name) {
+  if (!is_numeric_type(value.getType())) {
+    return nullptr;
+  }
+
+  Type* llvm_type = toLLVMType(value.getType());
+
+  Constant* number = nullptr;
+  if (llvm_type->isFloatingPointTy()) {
+    number = ConstantFP::get(llvm_type, value.as<double>());
+  } else {
+    number = ConstantInt::get(llvm_type, value.as<long>(), true);
+  }
+
+  GlobalVariable* boxed = new GlobalVariable(*TheModule, llvm_type, true, GlobalValue::PrivateLinkage, number, name);
+
+  Constant* fields[] = {ConstantInt::get(Type::getInt32Ty(TheContext), value.getType()), ConstantExpr::getBitCast(boxed, PointerTy_8)};
+  return ConstantStruct::get(StructTy_struct_datatype_t, fields);
+}
+
+BasicBlock* continuation_block(const std::vector<Value*>& elements, BasicBlock* bb) {
+  for (auto it = elements.rbegin(); it != elements.rend(); ++it) {
+    if (*it && isa<BasicBlock>(*it)) {
+      return dyn_cast<BasicBlock>(*it);
+    }
+  }
+
+  return bb;
+}
+
+BasicBlock* insertion_block(BasicBlock* bb) {
+  if (!bb || !bb->getTerminator()) {
+    return bb;
+  }
+
+  return BasicBlock::Create(TheContext, "unreachable", bb->getParent());
+}
+
+bool is_host_entry_point(const std::string& function_name) { return function_name == "__anon_expr"; }
+
+bool has_split_datatype_args(const Function* function) { return function->getCallingConv() == CallingConv::Fast; }
+
+size_t datatype_args_size(const Function* function) {
+  return has_split_datatype_args(function) ? function->arg_size() / 2 : function->arg_size();
+}
+
+void split_datatype_args_codegen(std::vector<Value*>& codegen, const std::vector<Value*>& args_value,
+                                 std::vector<Value*>& split_args_value, BasicBlock* bb) {
+  for (Value* arg_value : args_value) {
+    split_args_value.push_back(push_back_ret(codegen, ExtractValueInst::Create(arg_value, {0}, "arg_type", bb)));
+    split_args_value.push_back(push_back_ret(codegen, ExtractValueInst::Create(arg_value, {1}, "arg_v", bb)));
+  }
+}
+
+Value* join_datatype_arg_codegen(std::vector<Value*>& codegen, Value* type, Value* v, const std::string& name, BasicBlock* bb) {
+  Value* datatype = push_back_ret(
+      codegen, InsertValueInst::Create(UndefValue::get(StructTy_struct_datatype_t), type, {0}, name + "_partial", bb));
+  return push_back_ret(codegen, InsertValueInst::Create(datatype, v, {1}, name, bb));
+}
+
 AllocaInst* declaration_codegen_util(const ASTNode* node, llvm::BasicBlock* bb) {
   std::string alloca_name = "untyped_poiter_alloca_";
   /**
@@ -156,7 +310,12 @@ AllocaInst* alloca_typed_var_codegen(int type, const std::string& sufix, llvm::B
   alloca_inst->setName(alloca_inst->getName() + sufix);
 
   if (bb && alloca_inst) {
-    bb->getInstList().push_back(alloca_inst);
+    // stack slots always go to the entry block: mem2reg and SROA only promote
+    // those and one emitted inside a loop body would grow the stack on every
+    // iteration
+    Function* function = bb->getParent();
+    BasicBlock* entry_bb = function && !function->empty() ? &function->getEntryBlock() : bb;
+    entry_bb->getInstList().push_front(alloca_inst);
   }
 
   return alloca_inst;
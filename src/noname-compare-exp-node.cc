@@ -0,0 +1,298 @@
+#include "noname-utils.h"
+#include "noname-types.h"
+#include "noname-jit.h"
+#include "noname-profile.h"
+#include <limits.h>
+#include <stdio.h>
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+using namespace llvm::orc;
+
+namespace noname {
+
+extern LLVMContext TheContext;
+extern IRBuilder<> Builder;
+extern std::unique_ptr<Module> TheModule;
+extern std::unique_ptr<legacy::FunctionPassManager> TheFPM;
+extern std::unique_ptr<NonameJIT> TheJIT;
+
+template <typename T>
+static bool compare_values(CompareExpNode::CompareOp op, const T& lhs, const T& rhs) {
+  switch (op) {
+    case CompareExpNode::CMP_LT:
+      return lhs < rhs;
+    case CompareExpNode::CMP_GT:
+      return lhs > rhs;
+    case CompareExpNode::CMP_LE:
+      return lhs <= rhs;
+    case CompareExpNode::CMP_GE:
+      return lhs >= rhs;
+    case CompareExpNode::CMP_EQ:
+      return lhs == rhs;
+    default:
+      return lhs != rhs;
+  }
+}
+
+bool compare_tagged_values(CompareExpNode::CompareOp op, const TaggedValue& lhs, const TaggedValue& rhs, bool& result) {
+  if (lhs.getType() == TYPE_STRING && rhs.getType() == TYPE_STRING) {
+    result = compare_values(op, lhs.asString(), rhs.asString());
+    return true;
+  }
+
+  int result_type = get_adequate_result_type(lhs.getType(), rhs.getType());
+
+  if (result_type == TYPE_DOUBLE || result_type == TYPE_FLOAT) {
+    result = compare_values(op, lhs.as<double>(), rhs.as<double>());
+  } else if (result_type == TYPE_BIGINT) {
+    result = compare_values(op, lhs.asBigInt().compare(rhs.asBigInt()), 0);
+  } else if (result_type) {
+    result = compare_values(op, lhs.as<long>(), rhs.as<long>());
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+TaggedValue CompareExpNode::getTaggedValue() const {
+  TaggedValue lhs_value = lhs->getTaggedValue();
+  TaggedValue rhs_value = rhs->getTaggedValue();
+
+  if (!lhs_value.isDefined() || !rhs_value.isDefined()) {
+    return TaggedValue();
+  }
+
+  bool result = false;
+
+  if (!compare_tagged_values(op, lhs_value, rhs_value, result)) {
+    logError("Values cannot be compared");
+    return TaggedValue();
+  }
+
+  return TaggedValue((long)result);
+}
+
+std::unique_ptr<NodeValue> CompareExpNode::getValue() const { return std::unique_ptr<NodeValue>(getTaggedValue().toNodeValue()); }
+
+extern "C" DLLEXPORT int noname_compare_op(int op, int lhs_type, void* lhs_v, int rhs_type, void* rhs_v) {
+  bool result = false;
+
+  if (!compare_tagged_values((CompareExpNode::CompareOp)op, TaggedValue::borrowed(lhs_type, lhs_v),
+                             TaggedValue::borrowed(rhs_type, rhs_v), result)) {
+    logError("Values cannot be compared");
+    return 0;
+  }
+
+  return result;
+}
+
+static CmpInst::Predicate get_double_predicate(CompareExpNode::CompareOp op) {
+  switch (op) {
+    case CompareExpNode::CMP_LT:
+      return CmpInst::FCMP_OLT;
+    case CompareExpNode::CMP_GT:
+      return CmpInst::FCMP_OGT;
+    case CompareExpNode::CMP_LE:
+      return CmpInst::FCMP_OLE;
+    case CompareExpNode::CMP_GE:
+      return CmpInst::FCMP_OGE;
+    case CompareExpNode::CMP_EQ:
+      return CmpInst::FCMP_OEQ;
+    default:
+      return CmpInst::FCMP_UNE;
+  }
+}
+
+static CmpInst::Predicate get_long_predicate(CompareExpNode::CompareOp op) {
+  switch (op) {
+    case CompareExpNode::CMP_LT:
+      return CmpInst::ICMP_SLT;
+    case CompareExpNode::CMP_GT:
+      return CmpInst::ICMP_SGT;
+    case CompareExpNode::CMP_LE:
+      return CmpInst::ICMP_SLE;
+    case CompareExpNode::CMP_GE:
+      return CmpInst::ICMP_SGE;
+    case CompareExpNode::CMP_EQ:
+      return CmpInst::ICMP_EQ;
+    default:
+      return CmpInst::ICMP_NE;
+  }
+}
+
+// Unboxes a datatype_t value as a long and as a double (converting a long);
+// only one of them is meaningful, depending on the type tag
+static void unbox_number_codegen(std::vector<Value*>& codegen, Value* datatype, const std::string& sufix, Value*& is_double,
+                                 Value*& long_v, Value*& double_v, BasicBlock* bb) {
+  ConstantInt* const_int32_double = ConstantInt::get(TheContext, APInt(32, TYPE_DOUBLE, true));
+
+  Value* type = push_back_ret(codegen, ExtractValueInst::Create(datatype, {0}, "type" + sufix, bb));
+  Value* v = push_back_ret(codegen, ExtractValueInst::Create(datatype, {1}, "v" + sufix, bb));
+
+  is_double = push_back_ret(codegen, new ICmpInst(*bb, ICmpInst::ICMP_EQ, type, const_int32_double, "is_double" + sufix));
+
+  CastInst* cast_inst_long_v = push_back_ret(codegen, new BitCastInst(v, PointerTy_64, "cast_inst_long_v" + sufix, bb));
+  long_v = push_back_ret(codegen, load_inst_codegen(TYPE_LONG, cast_inst_long_v, bb));
+
+  CastInst* cast_inst_double_v = push_back_ret(codegen, new BitCastInst(v, PointerTy_Double, "cast_inst_double_v" + sufix, bb));
+  LoadInst* raw_double_v = push_back_ret(codegen, load_inst_codegen(TYPE_DOUBLE, cast_inst_double_v, bb));
+  CastInst* long_as_double_v =
+      push_back_ret(codegen, new SIToFPInst(long_v, Type::getDoubleTy(TheContext), "long_as_double_v" + sufix, bb));
+
+  double_v = push_back_ret(codegen, SelectInst::Create(is_double, raw_double_v, long_as_double_v, "double_v" + sufix, bb));
+}
+
+// Whether the type tag of a datatype_t value is a long or a double
+static Value* is_long_or_double_codegen(std::vector<Value*>& codegen, Value* datatype, const std::string& sufix, BasicBlock* bb) {
+  ConstantInt* const_int32_long = ConstantInt::get(TheContext, APInt(32, TYPE_LONG, true));
+  ConstantInt* const_int32_double = ConstantInt::get(TheContext, APInt(32, TYPE_DOUBLE, true));
+
+  Value* type = push_back_ret(codegen, ExtractValueInst::Create(datatype, {0}, "type" + sufix, bb));
+  Value* is_long = push_back_ret(codegen, new ICmpInst(*bb, ICmpInst::ICMP_EQ, type, const_int32_long, "is_long" + sufix));
+  Value* is_double = push_back_ret(codegen, new ICmpInst(*bb, ICmpInst::ICMP_EQ, type, const_int32_double, "is_double" + sufix));
+  return push_back_ret(codegen, BinaryOperator::Create(Instruction::Or, is_long, is_double, "is_long_or_double" + sufix, bb));
+}
+
+// lhs op rhs of two datatype_t values as an i1. Longs and doubles are compared
+// inline; anything else (bigints, narrow types, strings) by noname_compare_op
+static void compare_codegen(std::vector<Value*>& codegen, CompareExpNode::CompareOp op, Value* lhs_datatype, Value* rhs_datatype,
+                            BasicBlock* bb) {
+  Function* function = bb->getParent();
+  BasicBlock* cmp_end = BasicBlock::Create(TheContext, "cmp_end", function, bb->getNextNode());
+  BasicBlock* cmp_fast = BasicBlock::Create(TheContext, "cmp_fast", function, cmp_end);
+  BasicBlock* cmp_slow = BasicBlock::Create(TheContext, "cmp_slow", function, cmp_end);
+
+  Value* lhs_is_fast = is_long_or_double_codegen(codegen, lhs_datatype, "_LHS", bb);
+  Value* rhs_is_fast = is_long_or_double_codegen(codegen, rhs_datatype, "_RHS", bb);
+  Value* is_fast = push_back_ret(codegen, BinaryOperator::Create(Instruction::And, lhs_is_fast, rhs_is_fast, "is_fast", bb));
+  BranchInst* branch_inst = push_back_ret(codegen, BranchInst::Create(cmp_fast, cmp_slow, is_fast, bb));
+  profile_set_branch_weights(branch_inst, LIKELY_BRANCH_WEIGHT, 0);
+
+  codegen.push_back(cmp_fast);
+  Value *lhs_is_double, *lhs_long_v, *lhs_double_v;
+  Value *rhs_is_double, *rhs_long_v, *rhs_double_v;
+  unbox_number_codegen(codegen, lhs_datatype, "_LHS", lhs_is_double, lhs_long_v, lhs_double_v, cmp_fast);
+  unbox_number_codegen(codegen, rhs_datatype, "_RHS", rhs_is_double, rhs_long_v, rhs_double_v, cmp_fast);
+
+  // no branches: once the type tags are known (e.g. a loop counter that is
+  // always a long) instcombine folds the selects and the loop passes see a
+  // plain integer comparison
+  Value* any_double =
+      push_back_ret(codegen, BinaryOperator::Create(Instruction::Or, lhs_is_double, rhs_is_double, "any_double", cmp_fast));
+  Value* cond_double =
+      push_back_ret(codegen, new FCmpInst(*cmp_fast, get_double_predicate(op), lhs_double_v, rhs_double_v, "cond_double"));
+  Value* cond_long = push_back_ret(codegen, new ICmpInst(*cmp_fast, get_long_predicate(op), lhs_long_v, rhs_long_v, "cond_long"));
+  Value* cond_fast = push_back_ret(codegen, SelectInst::Create(any_double, cond_double, cond_long, "cond_fast", cmp_fast));
+  push_back_ret(codegen, BranchInst::Create(cmp_end, cmp_fast));
+
+  codegen.push_back(cmp_slow);
+  Type* int32_type = Type::getInt32Ty(TheContext);
+  FunctionType* compare_op_type = FunctionType::get(int32_type, {int32_type, int32_type, PointerTy_8, int32_type, PointerTy_8}, false);
+  Constant* compare_op_address = host_function_codegen("noname_compare_op", compare_op_type);
+  Value* lhs_type = push_back_ret(codegen, ExtractValueInst::Create(lhs_datatype, {0}, "type_LHS", cmp_slow));
+  Value* lhs_v = push_back_ret(codegen, ExtractValueInst::Create(lhs_datatype, {1}, "v_LHS", cmp_slow));
+  Value* rhs_type = push_back_ret(codegen, ExtractValueInst::Create(rhs_datatype, {0}, "type_RHS", cmp_slow));
+  Value* rhs_v = push_back_ret(codegen, ExtractValueInst::Create(rhs_datatype, {1}, "v_RHS", cmp_slow));
+  CallInst* compare_op = push_back_ret(
+      codegen, CallInst::Create(compare_op_address, {ConstantInt::get(int32_type, op), lhs_type, lhs_v, rhs_type, rhs_v}, "compare_op",
+                                cmp_slow));
+  Value* cond_slow =
+      push_back_ret(codegen, new ICmpInst(*cmp_slow, ICmpInst::ICMP_NE, compare_op, ConstantInt::get(int32_type, 0), "cond_slow"));
+  push_back_ret(codegen, BranchInst::Create(cmp_end, cmp_slow));
+
+  codegen.push_back(cmp_end);
+  PHINode* cond = push_back_ret(codegen, PHINode::Create(Type::getInt1Ty(TheContext), 2, "cond", cmp_end));
+  cond->addIncoming(cond_fast, cmp_fast);
+  cond->addIncoming(cond_slow, cmp_slow);
+}
+
+std::vector<Value*> CompareExpNode::condition_codegen_elements(Error& error, llvm::BasicBlock* bb) const {
+  std::vector<Value*> codegen;
+
+  std::vector<Value*> lhs_codegen_elements(lhs->get_codegen_elements(error, bb));
+  if (error.code()) {
+    return codegen;
+  }
+  codegen.insert(codegen.end(), lhs_codegen_elements.begin(), lhs_codegen_elements.end());
+  bb = continuation_block(lhs_codegen_elements, bb);
+
+  std::vector<Value*> rhs_codegen_elements(rhs->get_codegen_elements(error, bb));
+  if (error.code()) {
+    return codegen;
+  }
+  codegen.insert(codegen.end(), rhs_codegen_elements.begin(), rhs_codegen_elements.end());
+  bb = continuation_block(rhs_codegen_elements, bb);
+
+  if (lhs_codegen_elements.empty() || rhs_codegen_elements.empty()) {
+    createError(error, "LHS or RHS are undefined");
+    return codegen;
+  }
+
+  compare_codegen(codegen, op, lhs_codegen_elements.back(), rhs_codegen_elements.back(), bb);
+
+  return codegen;
+}
+
+std::vector<Value*> CompareExpNode::codegen_elements(Error& error, llvm::BasicBlock* bb) const {
+  std::vector<Value*> codegen = condition_codegen_elements(error, bb);
+
+  if (error.code()) {
+    return codegen;
+  }
+
+  bb = continuation_block(codegen, bb);
+  Value* cond = codegen.back();
+
+  Constant* false_address = host_long_address_codegen("noname_compare_false_value");
+  Constant* true_address = host_long_address_codegen("noname_compare_true_value");
+  ConstantInt* const_int32_long = ConstantInt::get(TheContext, APInt(32, TYPE_LONG, true));
+
+  Value* v = push_back_ret(codegen, SelectInst::Create(cond, true_address, false_address, "cmp_v", bb));
+  Value* datatype = push_back_ret(
+      codegen, InsertValueInst::Create(UndefValue::get(StructTy_struct_datatype_t), const_int32_long, {0}, "cmp_type", bb));
+  push_back_ret(codegen, InsertValueInst::Create(datatype, v, {1}, "cmp_datatype", bb));
+
+  return codegen;
+}
+
+Value* CompareExpNode::codegen(llvm::BasicBlock* bb) { return codegen_elements_retlast(this, bb); }
+
+std::vector<Value*> condition_codegen_elements(Error& error, const ExpNode* exp_node, llvm::BasicBlock* bb) {
+  if (isa<CompareExpNode>(exp_node)) {
+    return ((const CompareExpNode*)exp_node)->condition_codegen_elements(error, bb);
+  }
+
+  std::vector<Value*> codegen = ((ExpNode*)exp_node)->get_codegen_elements(error, bb);
+
+  if (error.code()) {
+    return codegen;
+  }
+
+  if (codegen.empty() || !codegen.back()) {
+    createError(error, "Invalid or undefined condition");
+    return codegen;
+  }
+
+  Value* datatype = codegen.back();
+  bb = continuation_block(codegen, bb);
+
+  // true when != 0, like the interpreter
+  Constant* false_address = host_long_address_codegen("noname_compare_false_value");
+  Constant* false_datatype =
+      ConstantStruct::get(StructTy_struct_datatype_t, {ConstantInt::get(TheContext, APInt(32, TYPE_LONG, true)), false_address});
+  compare_codegen(codegen, CompareExpNode::CMP_NE, datatype, false_datatype, bb);
+
+  return codegen;
+}
+}
\ No newline at end of file
@@ -28,7 +28,10 @@ extern std::unique_ptr<NonameJIT> TheJIT;
 void* DeclarationAssignmentNode::eval() {
   std::unique_ptr<NodeValue> node_value = getValue();
 
-  getContext()->storeVariable(name, std::move(node_value.get()));
+  if (!getContext()->storeVariable(name, node_value.get())) {
+    return nullptr;
+  }
+  node_value.release();
 
   if (noname::debug >= 3) {
     fprintf(stdout, "\n############ stored %s on context %s \n\n", name.c_str(), getContext()->getName().c_str());
@@ -37,21 +40,29 @@ void* DeclarationAssignmentNode::eval() {
   return nullptr;
 }
 std::vector<Value*> DeclarationAssignmentNode::codegen_elements(Error& error, llvm::BasicBlock* bb) const {
-  AllocaInst* untyped_poiter_alloca = declaration_codegen_util(this, bb);
+  std::vector<Value*> codegen;
 
   const std::unique_ptr<ExpNode>& rhs = getRHS();
-  Value* value = rhs->codegen();
-  getContext()->storeValue(getName(), value);
+  std::vector<Value*> rhs_codegen_elements = rhs->get_codegen_elements(error, bb);
 
-  std::vector<Value*> assign_codegen = assign_codegen_util(untyped_poiter_alloca, value, bb);
-  std::vector<Value*> codegen;
+  if (error.code()) {
+    return codegen;
+  }
 
-  codegen.push_back(untyped_poiter_alloca);
-  codegen.reserve(1 + assign_codegen.size());
-  for (auto& ptr : assign_codegen) {
-    codegen.push_back(std::move(ptr));
+  if (rhs_codegen_elements.empty() || !rhs_codegen_elements.back()) {
+    createError(error, "Invalid or undefined value assigned");
+    return codegen;
   }
 
+  codegen.insert(codegen.end(), rhs_codegen_elements.begin(), rhs_codegen_elements.end());
+  bb = continuation_block(rhs_codegen_elements, bb);
+
+  // see DeclarationNode::codegen_elements
+  AllocaInst* alloca_datatype = push_back_ret(codegen, alloca_typed_var_codegen(TYPE_DATATYPE, "_" + getName(), bb));
+  push_back_ret(codegen, store_typed_var_codegen(TYPE_DATATYPE, rhs_codegen_elements.back(), alloca_datatype, bb));
+
+  getContext()->storeAllocaInst(getName(), alloca_datatype);
+
   return codegen;
 }
 
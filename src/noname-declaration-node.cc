@@ -42,10 +42,15 @@ AssignmentNode* new_declaration_node(ASTContext* context, const std::string name
 }
 
 std::vector<Value*> DeclarationNode::codegen_elements(Error& error, llvm::BasicBlock* bb) const {
-  AllocaInst* alloca_inst = declaration_codegen_util(this, bb);
-
   std::vector<Value*> codegen;
-  codegen.push_back(alloca_inst);
+
+  // a local variable is a stack slot holding the boxed value; mem2reg turns
+  // its loads and stores into SSA values (and phi nodes inside loops)
+  AllocaInst* alloca_datatype = push_back_ret(codegen, alloca_typed_var_codegen(TYPE_DATATYPE, "_" + getName(), bb));
+  Constant* undefined_value = Constant::getNullValue(StructTy_struct_datatype_t);
+  push_back_ret(codegen, store_typed_var_codegen(TYPE_DATATYPE, undefined_value, alloca_datatype, bb));
+
+  getContext()->storeAllocaInst(getName(), alloca_datatype);
 
   return codegen;
 }
@@ -0,0 +1,268 @@
+#include "noname-utils.h"
+#include "noname-types.h"
+#include "noname-jit.h"
+#include "noname-dedupe.h"
+#include "noname-globals.h"
+#include "noname-stats.h"
+#include <stdio.h>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+using namespace llvm::orc;
+
+namespace noname {
+
+extern LLVMContext TheContext;
+extern std::unique_ptr<Module> TheModule;
+extern std::unique_ptr<NonameJIT> TheJIT;
+
+unsigned dedupe_expressions = 64;
+
+static Statistic NumDedupeExpressions("dedupe", "expressions", "Number of top level expressions run with the code of an identical one");
+static Statistic NumDedupeFunctionsReused("dedupe", "reused", "Number of function definitions identical to the one they replace");
+static Statistic NumDedupeFunctionsShared("dedupe", "shared", "Number of functions sharing the code of an identical one");
+static Statistic NumDedupeCollisions("dedupe", "collisions", "Number of codes with the structural hash of another one");
+static Statistic NumDedupeStale("dedupe", "stale", "Number of compiled codes dropped because a function they call changed");
+
+namespace {
+struct CompiledCode {
+  // canonical serialization of its AST: the structural hash only narrows the
+  // search, two codes are identical when these are
+  std::string canonical;
+  // versions of the functions it called when it was generated
+  std::map<std::string, uint64_t> callee_versions;
+};
+
+struct CompiledFunction : CompiledCode {
+  std::string name;
+  uint64_t version;
+};
+
+struct CompiledExpression : CompiledCode {
+  NonameJIT::ModuleHandleT module_handle;
+  uint64_t address;
+  Type* result_type;
+  // the least recently run is removed first
+  uint64_t last_run;
+};
+}
+
+static std::map<std::string, uint64_t> function_versions;
+// recordings in progress, innermost last
+static std::vector<std::set<std::string>*> recordings;
+// by structural hash
+static std::multimap<uint64_t, CompiledFunction> compiled_functions;
+static std::map<uint64_t, CompiledExpression> compiled_expressions;
+static uint64_t expressions_run = 0;
+
+static uint64_t function_version(const std::string& name) {
+  auto it = function_versions.find(name);
+  return it == function_versions.end() ? 0 : it->second;
+}
+
+static std::map<std::string, uint64_t> callee_versions(const std::set<std::string>& callees) {
+  std::map<std::string, uint64_t> versions;
+  for (const std::string& callee : callees) {
+    versions[callee] = function_version(callee);
+  }
+  return versions;
+}
+
+static bool is_current(const CompiledCode& code) {
+  for (auto& it : code.callee_versions) {
+    if (function_version(it.first) != it.second) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void dedupe_function_generated(const std::string& name) {
+  if (!is_host_entry_point(name)) {
+    ++function_versions[name];
+  }
+}
+
+void dedupe_function_call(const std::string& callee) {
+  // nested definitions and clones generated meanwhile count for the outer code
+  for (std::set<std::string>* callees : recordings) {
+    callees->insert(callee);
+  }
+}
+
+DedupeRecording::DedupeRecording() { recordings.push_back(&callees); }
+
+DedupeRecording::~DedupeRecording() { recordings.pop_back(); }
+
+// name as a tail call to target, whose definition is identical
+static Function* shared_function_codegen(FunctionDefNode* function_def_node, const std::string& target) {
+  // recompiling target recompiles it for good (see noname-globals.h)
+  GlobalDependencyScope global_dependency_scope(function_def_node);
+  global_function_call(target);
+
+  Function* function = function_def_node->getFunctionDefinition();
+  if (!function) {
+    return nullptr;
+  }
+
+  dedupe_function_generated(function_def_node->getName());
+  TheModule->getFunctionList().push_back(function);
+
+  Function* target_function = TheModule->getFunction(target);
+  if (!target_function) {
+    target_function = Function::Create(function->getFunctionType(), Function::ExternalLinkage, target, TheModule.get());
+    target_function->setCallingConv(function->getCallingConv());
+    target_function->setAttributes(function->getAttributes());
+  }
+
+  BasicBlock* function_bb = BasicBlock::Create(TheContext, "fn_entry", function);
+
+  std::vector<Value*> args;
+  for (Argument& arg : function->args()) {
+    args.push_back(&arg);
+  }
+
+  CallInst* call = CallInst::Create(target_function, args, "", function_bb);
+  call->setCallingConv(function->getCallingConv());
+  call->setTailCallKind(CallInst::TCK_MustTail);
+  ReturnInst::Create(TheContext, call, function_bb);
+
+  return function;
+}
+
+bool dedupe_function_definition(FunctionDefNode* function_def_node) {
+  const std::string& name = function_def_node->getName();
+  if (is_host_entry_point(name)) {
+    return false;
+  }
+
+  std::string canonical = function_def_node->canonical();
+  auto range = compiled_functions.equal_range(function_def_node->hash());
+  for (auto it = range.first; it != range.second;) {
+    CompiledFunction& compiled = it->second;
+    if (compiled.canonical != canonical) {
+      ++NumDedupeCollisions;
+      ++it;
+      continue;
+    }
+
+    // redefined or compiled again since, or it calls something that was
+    if (function_version(compiled.name) != compiled.version || !is_current(compiled)) {
+      ++NumDedupeStale;
+      it = compiled_functions.erase(it);
+      continue;
+    }
+
+    if (compiled.name == name) {
+      if (noname::debug >= 1) {
+        fprintf(stdout, "\n[function %s is identical to its last definition]", name.c_str());
+        fflush(stdout);
+      }
+
+      ++NumDedupeFunctionsReused;
+      return true;
+    }
+
+    if (shared_function_codegen(function_def_node, compiled.name)) {
+      if (noname::debug >= 1) {
+        fprintf(stdout, "\n[function %s shares the code of %s]", name.c_str(), compiled.name.c_str());
+        fflush(stdout);
+      }
+
+      ++NumDedupeFunctionsShared;
+      return true;
+    }
+
+    return false;
+  }
+
+  return false;
+}
+
+void dedupe_function_compiled(const FunctionDefNode* function_def_node, const std::set<std::string>& callees) {
+  const std::string& name = function_def_node->getName();
+  if (is_host_entry_point(name)) {
+    return;
+  }
+
+  CompiledFunction compiled;
+  compiled.canonical = function_def_node->canonical();
+  compiled.callee_versions = callee_versions(callees);
+  compiled.name = name;
+  compiled.version = function_version(name);
+  compiled_functions.insert(std::make_pair(function_def_node->hash(), compiled));
+}
+
+bool dedupe_run_top_level(const CallExpNode* call_exp_node) {
+  auto it = compiled_expressions.find(call_exp_node->hash());
+  if (it == compiled_expressions.end()) {
+    return false;
+  }
+
+  CompiledExpression& compiled = it->second;
+  if (compiled.canonical != call_exp_node->canonical()) {
+    ++NumDedupeCollisions;
+    return false;
+  }
+  if (!is_current(compiled)) {
+    ++NumDedupeStale;
+    TheJIT->removeModule(compiled.module_handle);
+    compiled_expressions.erase(it);
+    return false;
+  }
+
+  if (noname::debug >= 1) {
+    fprintf(stdout, "\n[top level expression run with the code of an identical one]");
+    fflush(stdout);
+  }
+
+  compiled.last_run = ++expressions_run;
+  ++NumDedupeExpressions;
+
+  JITSymbol symbol(compiled.address, JITSymbolFlags::Exported);
+  call_and_print_jit_symbol_value(stdout, compiled.result_type, symbol);
+
+  return true;
+}
+
+bool dedupe_keep_top_level(const TopLevelExpNode* top_level_exp_node, NonameJIT::ModuleHandleT module_handle,
+                           uint64_t address, Type* result_type) {
+  if (!dedupe_expressions || !top_level_exp_node->getExpNode()) {
+    return false;
+  }
+
+  uint64_t hash = top_level_exp_node->getExpNode()->hash();
+  auto it = compiled_expressions.find(hash);
+  if (it != compiled_expressions.end()) {
+    TheJIT->removeModule(it->second.module_handle);
+    compiled_expressions.erase(it);
+  }
+
+  if (compiled_expressions.size() >= dedupe_expressions) {
+    auto it_least_recent = compiled_expressions.begin();
+    for (auto it_expression = compiled_expressions.begin(); it_expression != compiled_expressions.end(); ++it_expression) {
+      if (it_expression->second.last_run < it_least_recent->second.last_run) {
+        it_least_recent = it_expression;
+      }
+    }
+
+    TheJIT->removeModule(it_least_recent->second.module_handle);
+    compiled_expressions.erase(it_least_recent);
+  }
+
+  CompiledExpression& compiled = compiled_expressions[hash];
+  compiled.canonical = top_level_exp_node->getExpNode()->canonical();
+  compiled.callee_versions = callee_versions(top_level_exp_node->getCallees());
+  compiled.module_handle = module_handle;
+  compiled.address = address;
+  compiled.result_type = result_type;
+  compiled.last_run = ++expressions_run;
+
+  // its __anon_expr is only ever called through the address
+  TheJIT->dropSessionObject(module_handle);
+  return true;
+}
+}
@@ -1,6 +1,13 @@
 #include "noname-utils.h"
 #include "noname-types.h"
 #include "noname-jit.h"
+#include "noname-profile.h"
+#include "noname-bytecode.h"
+#include "noname-globals.h"
+#include "noname-specialize.h"
+#include "noname-memo.h"
+#include "noname-dedupe.h"
+#include "noname-opt-level.h"
 #include <limits.h>
 #include <stdio.h>
 #include <algorithm>
@@ -45,24 +52,41 @@ Function* FunctionSignature::codegen() {
     fflush(stdout);
   }
 
-  // std::vector<llvm::Type*> function_args_types(args_defs.size(), Type::getVoidTy(TheContext));
-  std::vector<llvm::Type*> function_args_types(args_defs.size(), StructTy_struct_datatype_t);
-  // std::vector<llvm::Type*> function_args_types;
-  // for (unsigned int i = 0; i < args_defs.size(); i++) {
-  //   function_args_types.push_back(IntegerType::get(TheContext, 32));
-  //   function_args_types.push_back(PointerTy_8);
-  // }
+  // the datatype_t of every argument is passed as its type tag and its payload
+  // (two registers instead of an aggregate) to everything but the host entry
+  // points; the returned datatype_t already comes back in two registers
+  bool split_args = !is_host_entry_point(name);
+
+  std::vector<llvm::Type*> function_args_types;
+  for (unsigned int i = 0; i < args_defs.size(); i++) {
+    if (split_args) {
+      function_args_types.push_back(IntegerType::get(TheContext, 32));
+      function_args_types.push_back(PointerTy_8);
+    } else {
+      function_args_types.push_back(StructTy_struct_datatype_t);
+    }
+  }
 
   FunctionType* function_type = FunctionType::get(return_type, function_args_types, false);
 
   Function* function = Function::Create(function_type, Function::ExternalLinkage, name);
-  function->setCallingConv(CallingConv::C);
+  function->setCallingConv(split_args ? CallingConv::Fast : CallingConv::C);
+
+  // keep the host CPU in the IR so the bitcode written by writeToFile and any
+  // later per-function subtarget lookup agree with the JIT TargetMachine
+  TargetMachine& target_machine = TheJIT->getTargetMachine();
+  function->addFnAttr("target-cpu", target_machine.getTargetCPU());
+  function->addFnAttr("target-features", target_machine.getTargetFeatureString());
 
   // Set names for all arguments.
-  double index = 0.0;
+  unsigned int index = 0;
   for (auto& function_arg : function->args()) {
-    // function_arg.setName(args_defs[floor(index / 2.0)]->name);
-    function_arg.setName(args_defs[index++]->name);
+    if (split_args) {
+      function_arg.setName(args_defs[index / 2]->name + (index % 2 == 0 ? "_type" : "_v"));
+    } else {
+      function_arg.setName(args_defs[index]->name);
+    }
+    index++;
   }
 
   if (noname::debug >= 1) {
@@ -93,6 +117,64 @@ ASTNode* new_function_def(ASTContext* context, const std::string name, arglist_t
   return function_new_node;
 }
 
+ASTNode* annotate_function_def(ASTContext* context, const std::string annotation, ASTNode* node) {
+  static const char* known_annotations[] = {"strict", "contract", "fast", "memo"};
+
+  if (!node || isa<ErrorNode>(*node)) {
+    return node;
+  }
+
+  if (!isa<FunctionDefNode>(*node)) {
+    char msg[2048];
+    snprintf(msg, 2048, "Annotation '@%s' can only be applied to function definitions", annotation.c_str());
+    return new LogicErrorNode(context, msg);
+  }
+
+  if (std::find_if(std::begin(known_annotations), std::end(known_annotations), [&](const char* known) {
+        return annotation == known;
+      }) == std::end(known_annotations)) {
+    char msg[2048];
+    snprintf(msg, 2048, "Unknown annotation '@%s'", annotation.c_str());
+    return new LogicErrorNode(context, msg);
+  }
+
+  ((FunctionDefNode*)node)->addAnnotation(annotation);
+  return node;
+}
+
+FPMode FunctionDefNode::getFPMode() const {
+  // annotations are added from the innermost out, so the one written closest
+  // to the definition wins
+  for (auto it = annotations.begin(); it != annotations.end(); ++it) {
+    if (*it == "fast") {
+      return FP_MODE_FAST;
+    } else if (*it == "contract") {
+      return FP_MODE_CONTRACT;
+    } else if (*it == "strict") {
+      return FP_MODE_STRICT;
+    }
+  }
+  return fp_mode;
+}
+
+void FunctionDefNode::canonicalize(std::string& out) const {
+  ASTNode::canonicalize(out);
+
+  canonical_append(out, (uint64_t)function_signature->args_defs.size());
+  for (FunctionArgument* arg : function_signature->args_defs) {
+    canonical_append(out, arg->name);
+    ASTNode::canonicalize(out, arg->default_value);
+  }
+  canonical_append(out, (uint64_t)body_nodes.size());
+  for (const std::unique_ptr<ASTNode>& body_node : body_nodes) {
+    body_node->canonicalize(out);
+  }
+  canonical_append(out, (uint64_t)annotations.size());
+  for (const std::string& annotation : annotations) {
+    canonical_append(out, annotation);
+  }
+}
+
 FunctionSignature* FunctionDefNode::createFunctionSignature(Error& error, const std::string& name,
                                                             std::vector<FunctionArgument*> args_defs) {
   llvm::Type* return_type = nullptr;
@@ -254,6 +336,22 @@ Function* FunctionDefNode::getFunctionDefinition() {
 
   return function;
 }
+// innermost function being generated last
+static std::vector<TailRecursionTarget_t> tail_recursion_targets;
+
+const TailRecursionTarget_t* get_tail_recursion_target() {
+  return tail_recursion_targets.empty() ? nullptr : &tail_recursion_targets.back();
+}
+
+bool is_function_being_generated(const FunctionDefNode* function_def_node) {
+  for (const TailRecursionTarget_t& target : tail_recursion_targets) {
+    if (target.function_def_node == function_def_node) {
+      return true;
+    }
+  }
+  return false;
+}
+
 llvm::ReturnInst* FunctionDefNode::getLLVMReturnInst(Value* return_value) const {
   ReturnInst* return_inst = nullptr;
   // Finish off the function by creating the ReturnInst
@@ -280,8 +378,46 @@ Value* FunctionDefNode::codegen(BasicBlock* bb) {
   // fprintf(stdout, "\n[## codegen of %s ]", name.c_str());
   // fflush(stdout);
 
-  auto& return_node = getReturnNode();
   Function* function = getFunctionDefinition();
+  dedupe_function_generated(getName());
+
+  if (function && memo_function(this)) {
+    // defined first, so the recursive calls of the body go through the cache
+    TheModule->getFunctionList().push_back(function);
+
+    Function* body = codegen_specialization(getName() + ".memo", std::vector<Constant*>());
+    if (!body) {
+      function->eraseFromParent();
+      return nullptr;
+    }
+
+    return memo_wrapper_codegen(this, function, body);
+  }
+
+  return codegen_function(function, std::vector<Constant*>());
+}
+Function* FunctionDefNode::codegen_specialization(const std::string& name, const std::vector<Constant*>& constant_args) {
+  std::vector<FunctionArgument*> args_defs;
+  std::vector<FunctionArgument*>& signature_args = getFunctionArguments();
+
+  for (size_t i = 0; i < signature_args.size(); i++) {
+    if (i >= constant_args.size() || !constant_args[i]) {
+      args_defs.push_back(signature_args[i]);
+    }
+  }
+
+  FunctionSignature clone_signature(name, args_defs, getReturnLLVMType());
+  Function* function = clone_signature.codegen();
+  // only the module calling it knows the constants
+  function->setLinkage(GlobalValue::InternalLinkage);
+
+  return codegen_function(function, constant_args);
+}
+Function* FunctionDefNode::codegen_function(Function* function, const std::vector<Constant*>& constant_args) {
+  // the top level variables folded into it
+  GlobalDependencyScope global_dependency_scope(this);
+
+  auto& return_node = getReturnNode();
 
   if (!function) {
     fprintf(stdout, "\nError: function %s not defined", getName().c_str());
@@ -291,6 +427,8 @@ Value* FunctionDefNode::codegen(BasicBlock* bb) {
 
   // Define function inside Module
   TheModule->getFunctionList().push_back(function);
+  set_fp_mode(function, getFPMode());
+  profile_begin_function(function, function->getName().str(), hash());
 
   if (noname::debug >= 1) {
     fprintf(stdout, "\n[Function %s declared inside Module %s]", getName().c_str(), TheModule->getName().str().c_str());
@@ -301,12 +439,20 @@ Value* FunctionDefNode::codegen(BasicBlock* bb) {
   // Create a new basic block to start insertion into.
   BasicBlock* function_bb = BasicBlock::Create(TheContext, "fn_entry", function);
 
+  // counter 0 is the entry count
+  profile_counter_codegen(function_bb);
+
   ASTContext* function_def_node_context = getContext();
   std::vector<FunctionArgument*>& signature_args = getFunctionArguments();
   std::vector<FunctionArgument*>::iterator it_signature_args = signature_args.begin();
 
+  TailRecursionTarget_t tail_recursion_target;
+  tail_recursion_target.function_def_node = this;
+  tail_recursion_target.function = function;
+
   llvm::Function::arg_iterator it_function_args = function->arg_begin();
-  while (it_function_args != function->arg_end()) {
+  while (it_signature_args != signature_args.end()) {
+    size_t arg_index = it_signature_args - signature_args.begin();
     FunctionArgument* signature_arg = *it_signature_args++;
 
     // NodeValue* arg_node_value = NULL;
@@ -329,15 +475,33 @@ Value* FunctionDefNode::codegen(BasicBlock* bb) {
     // function_def_node_context->storeAllocaInst(signature_arg->name, alloca_inst);
     // function_bb->getInstList().push_back(alloca_inst);
 
-    // Argument* function_arg_type = (Argument*)it_function_args++;
-    // Argument* function_arg_value = (Argument*)it_function_args++;
-    // function_def_node_context->storeValue(signature_arg->name + "_type", function_arg_type);
-    // function_def_node_context->storeValue(signature_arg->name + "_value", function_arg_value);
-
-    Argument* function_arg = (Argument*)it_function_args++;
+    Value* function_arg = nullptr;
+    if (arg_index < constant_args.size() && constant_args[arg_index]) {
+      function_arg = constant_args[arg_index];
+    } else if (has_split_datatype_args(function)) {
+      std::vector<Value*> join_codegen;
+      Argument* function_arg_type = (Argument*)it_function_args++;
+      Argument* function_arg_value = (Argument*)it_function_args++;
+      function_arg = join_datatype_arg_codegen(join_codegen, function_arg_type, function_arg_value, signature_arg->name, function_bb);
+    } else {
+      function_arg = (Argument*)it_function_args++;
+    }
     function_def_node_context->storeValue(signature_arg->name, function_arg);
+
+    // arguments can be reassigned (e.g. a counter in a loop), so they get a
+    // stack slot like any other local variable; mem2reg removes it again
+    AllocaInst* alloca_arg = alloca_typed_var_codegen(TYPE_DATATYPE, "_" + signature_arg->name, function_bb);
+    store_typed_var_codegen(TYPE_DATATYPE, function_arg, alloca_arg, function_bb);
+    function_def_node_context->storeAllocaInst(signature_arg->name, alloca_arg);
+    tail_recursion_target.arg_allocas.push_back(alloca_arg);
   }
 
+  // self recursive calls in tail position jump back here with new arguments
+  tail_recursion_target.body = BasicBlock::Create(TheContext, "fn_body", function);
+  BranchInst::Create(tail_recursion_target.body, function_bb);
+  function_bb = tail_recursion_target.body;
+  tail_recursion_targets.push_back(tail_recursion_target);
+
   std::vector<std::unique_ptr<ASTNode>>& body_nodes = getBodyNodes();
   std::vector<std::unique_ptr<ASTNode>>::iterator it_body_nodes = body_nodes.begin();
 
@@ -352,12 +516,20 @@ Value* FunctionDefNode::codegen(BasicBlock* bb) {
     }
 
     Error error;
+    function_bb = insertion_block(function_bb);
     std::vector<Value*> body_node_codegen_elements = body_node->get_codegen_elements(error, function_bb);
 
     if (error.code()) {
-      return logErrorLLVM(error.what().c_str());
+      tail_recursion_targets.pop_back();
+      function->eraseFromParent();
+      logErrorLLVM(error.what().c_str());
+      return nullptr;
     }
 
+    // statements with control flow (binary expressions, loops) leave the
+    // next statement a block of their own
+    function_bb = continuation_block(body_node_codegen_elements, function_bb);
+
     for (auto current_value : body_node_codegen_elements) {
       Instruction* instruction_codegen_value = (Instruction*)current_value;
 
@@ -375,11 +547,13 @@ Value* FunctionDefNode::codegen(BasicBlock* bb) {
     }
   }
 
+  tail_recursion_targets.pop_back();
+
   //////////////////////////////////////////////////////////////////////
   //////////////////////////////////////////////////////////////////////
   //////////////////////////////////////////////////////////////////////
 
-  if (isa<CallInst>(last)) {
+  if (!function_bb->getTerminator() && last && isa<CallInst>(last)) {
     ConstantInt* const_int32_double = ConstantInt::get(TheContext, APInt(32, TYPE_DOUBLE, true));
     ConstantInt* const_int32_long = ConstantInt::get(TheContext, APInt(32, TYPE_LONG, true));
 
@@ -420,13 +594,17 @@ Value* FunctionDefNode::codegen(BasicBlock* bb) {
   //////////////////////////////////////////////////////////////////////
   //////////////////////////////////////////////////////////////////////
 
-  if (!return_inst) {
-    Value* return_value = nullptr;
-    if (return_node) {
-      return_value = return_node->codegen(bb);
+  if (!function_bb->getTerminator()) {
+    Value* return_value = last;
+
+    // falling off the end of the function (e.g. after a loop) returns the
+    // value of the last expression, or an undefined datatype
+    if (!return_value || return_value->getType() != function->getReturnType()) {
+      return_value = Constant::getNullValue(function->getReturnType());
     }
 
     return_inst = getLLVMReturnInst(return_value);
+    function_bb->getInstList().push_back(return_inst);
   }
 
   if (!return_inst) {
@@ -442,14 +620,18 @@ Value* FunctionDefNode::codegen(BasicBlock* bb) {
   // function_bb->getInstList().push_back(return_inst);
 
   // Validate the generated code, checking for consistency.
-  verifyFunction(*function, &errs());
+  bool broken = verifyFunction(*function, &errs());
 
   if (noname::debug >= 2) {
     function->dump();
   }
 
-  // Run the optimizer on the function.
-  // TheFPM->run(*function);
+  // Run the optimizer on the function: promotes the stack slots of the
+  // variables to SSA values and runs the loop pipeline, as far as its level
+  // goes (see noname-opt-level.h). Broken IR would only make the passes assert.
+  if (!broken) {
+    optimize_function(function, this);
+  }
 
   if (noname::debug >= 2) {
     fprintf(stdout, "\n[Function %s defined inside Module %s]", getName().c_str(), TheModule->getName().str().c_str());
@@ -466,6 +648,31 @@ Value* FunctionDefNode::codegen(BasicBlock* bb) {
 
 void* FunctionDefNodeProcessorStrategy::process(ASTNode* node) {
   FunctionDefNode* function_def_node = (FunctionDefNode*)node;
+  specialize_register_function(function_def_node);
+
+  // memoized functions only run compiled, where the cache is
+  if (noname::execution_tier == TIER_BYTECODE && !memo_requested(function_def_node)) {
+    if (bytecode_compile_function(function_def_node)) {
+      return nullptr;
+    }
+
+    // it may call functions only compiled to bytecode so far
+    bytecode_tier_up();
+  } else {
+    // for the calls of it evaluated at compile time
+    bytecode_compile_function(function_def_node, true);
+
+    if (noname::execution_tier == TIER_BYTECODE) {
+      bytecode_tier_up();
+    }
+  }
+
+  // identical to a definition compiled before (see noname-dedupe.h)
+  if (dedupe_function_definition(function_def_node)) {
+    return nullptr;
+  }
+
+  DedupeRecording recording;
   Function* function = (Function*)function_def_node->codegen();
 
   if (!function) {
@@ -474,6 +681,8 @@ void* FunctionDefNodeProcessorStrategy::process(ASTNode* node) {
     return nullptr;
   }
 
+  dedupe_function_compiled(function_def_node, recording.getCallees());
+
   if (function) {
     if (noname::debug >= 1) {
       fprintf(stdout, "\nRead function definition:");
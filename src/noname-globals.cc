@@ -0,0 +1,236 @@
+#include "llvm/IR/Constants.h"
+#include "llvm/Support/DynamicLibrary.h"
+#include "noname-globals.h"
+#include "noname-utils.h"
+#include "noname-types.h"
+#include "noname-stats.h"
+#include <stdio.h>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+namespace noname {
+
+static Statistic NumGlobalsFolded("globals", "folded", "Number of reads of top level variables folded to constants");
+static Statistic NumGlobalsLoaded("globals", "loaded", "Number of reads of top level variables loaded from their slot");
+static Statistic NumGlobalsReassigned("globals", "reassigned", "Number of top level variables that became mutable");
+static Statistic NumGlobalsRecompiled("globals", "recompiled", "Number of functions compiled again after a reassignment");
+
+namespace {
+struct GlobalState {
+  // what compiled code reads, exported as noname_global_<name>
+  datatype_t* slot;
+  NodeValue* value;
+  bool reassigned;
+  // functions restored from a snapshot that folded the value; they cannot be
+  // compiled again, so the variable cannot be reassigned while there are any
+  std::set<std::string> restored_dependents;
+};
+
+struct CompiledFunction {
+  FunctionDefNode* function_def_node;
+  // callees are compiled before their callers
+  uint64_t order;
+};
+}
+
+static std::map<std::string, GlobalState> globals;
+// top level functions compiled so far, by name (the last definition)
+static std::map<std::string, CompiledFunction> compiled_functions;
+static uint64_t next_function_order = 0;
+// functions that folded each variable and callers of each function
+static std::map<std::string, std::set<std::string>> global_dependents;
+static std::map<std::string, std::set<std::string>> function_callers;
+// functions being compiled, outermost first
+static std::vector<FunctionDefNode*> compiling_functions;
+
+static std::string slot_symbol(const std::string& name) { return "noname_global_" + name; }
+
+static void store_slot(datatype_t* slot, NodeValue* node_value) {
+  if (!node_value) {
+    slot->type = TYPE_VOID;
+    slot->v = nullptr;
+    return;
+  }
+
+  // the box of the value of the variable itself: it lives as long as it is the
+  // value, and compiled code never keeps a v past the call that read it
+  slot->type = node_value->getType();
+  slot->v = node_value->getRawValue();
+}
+
+// The function constants are folded into, nullptr for top level expressions:
+// their modules are removed once they ran, while a value they return may
+// still point to the constant
+static FunctionDefNode* current_function() {
+  if (compiling_functions.empty() || is_host_entry_point(compiling_functions.front()->getName())) {
+    return nullptr;
+  }
+  return compiling_functions.front();
+}
+
+static void recompile_dependents(const std::string& name) {
+  auto it_dependents = global_dependents.find(name);
+  if (it_dependents == global_dependents.end()) {
+    return;
+  }
+
+  // the functions that folded the variable, and whatever calls them
+  std::set<std::string> names;
+  std::vector<std::string> pending(it_dependents->second.begin(), it_dependents->second.end());
+  global_dependents.erase(it_dependents);
+
+  while (!pending.empty()) {
+    std::string function_name = pending.back();
+    pending.pop_back();
+
+    if (!names.insert(function_name).second) {
+      continue;
+    }
+
+    auto it_callers = function_callers.find(function_name);
+    if (it_callers != function_callers.end()) {
+      pending.insert(pending.end(), it_callers->second.begin(), it_callers->second.end());
+    }
+  }
+
+  std::vector<CompiledFunction> functions;
+  for (const std::string& function_name : names) {
+    auto it_function = compiled_functions.find(function_name);
+    if (it_function != compiled_functions.end()) {
+      functions.push_back(it_function->second);
+    }
+  }
+
+  std::sort(functions.begin(), functions.end(),
+            [](const CompiledFunction& a, const CompiledFunction& b) { return a.order < b.order; });
+
+  // what was compiled so far may still be in TheModule, which cannot define
+  // the functions twice
+  CreateNewModuleAndInitialize();
+
+  for (CompiledFunction& function : functions) {
+    if (noname::debug >= 1) {
+      fprintf(stdout, "\n[Compiling %s again: '%s' was reassigned]", function.function_def_node->getName().c_str(), name.c_str());
+      fflush(stdout);
+    }
+
+    if (!function.function_def_node->codegen()) {
+      fprintf(stdout, "\nFunction %s could not be compiled", function.function_def_node->getName().c_str());
+      fflush(stdout);
+    }
+
+    ++NumGlobalsRecompiled;
+  }
+}
+
+void global_variable_stored(const std::string& name, NodeValue* node_value) {
+  auto it = globals.find(name);
+
+  if (it == globals.end()) {
+    GlobalState& global = globals[name];
+    global.slot = new datatype_t;
+    global.value = node_value;
+    global.reassigned = false;
+    store_slot(global.slot, node_value);
+    sys::DynamicLibrary::AddSymbol(slot_symbol(name), global.slot);
+    return;
+  }
+
+  GlobalState& global = it->second;
+  global.value = node_value;
+  store_slot(global.slot, node_value);
+
+  if (global.reassigned) {
+    return;
+  }
+
+  global.reassigned = true;
+  ++NumGlobalsReassigned;
+
+  recompile_dependents(name);
+}
+
+void global_variable_saved_state(const std::string& name, bool& reassigned, std::set<std::string>& dependents) {
+  reassigned = false;
+  dependents.clear();
+
+  auto it = globals.find(name);
+  if (it == globals.end()) {
+    return;
+  }
+
+  reassigned = it->second.reassigned;
+  dependents = it->second.restored_dependents;
+
+  auto it_dependents = global_dependents.find(name);
+  if (it_dependents != global_dependents.end()) {
+    dependents.insert(it_dependents->second.begin(), it_dependents->second.end());
+  }
+}
+
+void global_variable_restored(const std::string& name, bool reassigned, const std::set<std::string>& dependents) {
+  auto it = globals.find(name);
+  if (it == globals.end()) {
+    return;
+  }
+
+  // a reassigned variable is read from its slot by the restored code too
+  it->second.reassigned = it->second.reassigned || reassigned;
+  if (!it->second.reassigned) {
+    it->second.restored_dependents = dependents;
+  }
+}
+
+bool global_variable_frozen(const std::string& name) {
+  auto it = globals.find(name);
+  return it != globals.end() && !it->second.restored_dependents.empty();
+}
+
+Value* global_variable_codegen(const std::string& name, BasicBlock* bb) {
+  auto it = globals.find(name);
+  if (it == globals.end()) {
+    return nullptr;
+  }
+
+  GlobalState& global = it->second;
+  FunctionDefNode* function = current_function();
+
+  if (function && !global.reassigned && global.value) {
+    TaggedValue value = TaggedValue::borrowed(global.value->getType(), global.value->getRawValue());
+    Constant* constant = constant_datatype_codegen(value, "noname_constant_" + name);
+    if (constant) {
+      global_dependents[name].insert(function->getName());
+      ++NumGlobalsFolded;
+      return constant;
+    }
+  }
+
+  ++NumGlobalsLoaded;
+  Constant* slot = TheModule->getOrInsertGlobal(slot_symbol(name), StructTy_struct_datatype_t);
+  return load_inst_codegen(TYPE_DATATYPE, slot, bb);
+}
+
+void global_function_call(const std::string& callee) {
+  FunctionDefNode* function = current_function();
+  if (function && function->getName() != callee) {
+    function_callers[callee].insert(function->getName());
+  }
+}
+
+GlobalDependencyScope::GlobalDependencyScope(FunctionDefNode* function_def_node) {
+  compiling_functions.push_back(function_def_node);
+
+  if (compiling_functions.size() == 1 && !is_host_entry_point(function_def_node->getName())) {
+    CompiledFunction& function = compiled_functions[function_def_node->getName()];
+    function.function_def_node = function_def_node;
+    function.order = next_function_order++;
+  }
+}
+
+GlobalDependencyScope::~GlobalDependencyScope() { compiling_functions.pop_back(); }
+}
@@ -0,0 +1,231 @@
+#include "noname-utils.h"
+#include "noname-types.h"
+#include "noname-jit.h"
+#include "noname-profile.h"
+#include <limits.h>
+#include <stdio.h>
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+using namespace llvm::orc;
+
+namespace noname {
+
+extern LLVMContext TheContext;
+extern IRBuilder<> Builder;
+extern std::unique_ptr<Module> TheModule;
+extern std::unique_ptr<legacy::FunctionPassManager> TheFPM;
+extern std::unique_ptr<NonameJIT> TheJIT;
+
+static void append_stmt_list(std::vector<std::unique_ptr<ASTNode>>& nodes, stmtlist_t* head_stmt_list) {
+  if (!head_stmt_list) {
+    return;
+  }
+
+  stmtlist_node_t* stmtlist_node = head_stmt_list->first;
+  do {
+    if (stmtlist_node && stmtlist_node->node) {
+      nodes.push_back(std::unique_ptr<ASTNode>(stmtlist_node->node));
+      stmtlist_node = stmtlist_node->next;
+    }
+  } while (stmtlist_node);
+}
+
+IfExpNode::IfExpNode(ASTContext* context, ExpNode* condition, ExpNode* then_exp, ExpNode* else_exp)
+    : ExpNode(context, AST_NODE_TYPE_IF_EXP),
+      condition(std::unique_ptr<ExpNode>(condition)),
+      then_nodes(std::vector<std::unique_ptr<ASTNode>>()),
+      else_nodes(std::vector<std::unique_ptr<ASTNode>>()) {
+  then_nodes.push_back(std::unique_ptr<ASTNode>(then_exp));
+  else_nodes.push_back(std::unique_ptr<ASTNode>(else_exp));
+}
+
+IfExpNode::IfExpNode(ASTContext* context, ExpNode* condition, stmtlist_t* then_stmt_list, stmtlist_t* else_stmt_list)
+    : ExpNode(context, AST_NODE_TYPE_IF_EXP),
+      condition(std::unique_ptr<ExpNode>(condition)),
+      then_nodes(std::vector<std::unique_ptr<ASTNode>>()),
+      else_nodes(std::vector<std::unique_ptr<ASTNode>>()) {
+  append_stmt_list(then_nodes, then_stmt_list);
+  append_stmt_list(else_nodes, else_stmt_list);
+}
+
+void IfExpNode::canonicalize(std::string& out) const {
+  ExpNode::canonicalize(out);
+  condition->canonicalize(out);
+
+  // keeps `if (c) { a; b; }` and `if (c) { a; } else { b; }` apart
+  canonical_append(out, (uint64_t)then_nodes.size());
+  for (const std::unique_ptr<ASTNode>& then_node : then_nodes) {
+    then_node->canonicalize(out);
+  }
+  canonical_append(out, (uint64_t)else_nodes.size());
+  for (const std::unique_ptr<ASTNode>& else_node : else_nodes) {
+    else_node->canonicalize(out);
+  }
+}
+
+bool IfExpNode::evalBranch(std::unique_ptr<NodeValue>& result, bool in_loop) const {
+  return eval_statements(is_true(condition->getTaggedValue()) ? then_nodes : else_nodes, in_loop, &result);
+}
+
+std::unique_ptr<NodeValue> IfExpNode::getValue() const {
+  std::unique_ptr<NodeValue> result;
+  evalBranch(result, false);
+  return result;
+}
+
+// Arms that can be computed unconditionally: no side effects, no allocation
+// and no control flow of their own
+static bool is_cheap_and_pure(const ASTNode* node) {
+  if (isa<NumberExpNode>(node) || isa<VarExpNode>(node)) {
+    return true;
+  }
+
+  if (isa<CompareExpNode>(node)) {
+    const CompareExpNode* compare_exp_node = (const CompareExpNode*)node;
+    return is_cheap_and_pure(compare_exp_node->getLHS()) && is_cheap_and_pure(compare_exp_node->getRHS());
+  }
+
+  return false;
+}
+
+std::vector<Value*> IfExpNode::branch_codegen_elements(Error& error, const std::vector<std::unique_ptr<ASTNode>>& nodes,
+                                                       llvm::BasicBlock* bb, Value*& value) const {
+  std::vector<Value*> codegen;
+  value = nullptr;
+
+  for (const std::unique_ptr<ASTNode>& node : nodes) {
+    bb = insertion_block(bb);
+
+    std::vector<Value*> node_codegen_elements = node->get_codegen_elements(error, bb);
+    if (error.code()) {
+      return codegen;
+    }
+    codegen.insert(codegen.end(), node_codegen_elements.begin(), node_codegen_elements.end());
+
+    bb = continuation_block(node_codegen_elements, bb);
+
+    value = nullptr;
+    if (!node_codegen_elements.empty() && node_codegen_elements.back() &&
+        node_codegen_elements.back()->getType() == StructTy_struct_datatype_t) {
+      value = node_codegen_elements.back();
+    }
+  }
+
+  return codegen;
+}
+
+std::vector<Value*> IfExpNode::codegen_elements(Error& error, llvm::BasicBlock* bb) const {
+  std::vector<Value*> codegen;
+
+  if (!bb) {
+    createError(error, "if can only be compiled inside a function");
+    return codegen;
+  }
+
+  // the condition stays an i1, it is never boxed into a datatype_t
+  std::vector<Value*> condition_codegen = condition_codegen_elements(error, condition.get(), bb);
+  if (error.code()) {
+    return codegen;
+  }
+  codegen.insert(codegen.end(), condition_codegen.begin(), condition_codegen.end());
+
+  bb = continuation_block(condition_codegen, bb);
+  Value* cond = condition_codegen.back();
+  Constant* undefined_value = Constant::getNullValue(StructTy_struct_datatype_t);
+
+  if (then_nodes.size() == 1 && else_nodes.size() == 1 && is_cheap_and_pure(then_nodes.front().get()) &&
+      is_cheap_and_pure(else_nodes.front().get())) {
+    Value* then_value = nullptr;
+    Value* else_value = nullptr;
+
+    std::vector<Value*> then_codegen = branch_codegen_elements(error, then_nodes, bb, then_value);
+    if (error.code()) {
+      return codegen;
+    }
+    codegen.insert(codegen.end(), then_codegen.begin(), then_codegen.end());
+
+    std::vector<Value*> else_codegen = branch_codegen_elements(error, else_nodes, bb, else_value);
+    if (error.code()) {
+      return codegen;
+    }
+    codegen.insert(codegen.end(), else_codegen.begin(), else_codegen.end());
+
+    push_back_ret(codegen, SelectInst::Create(cond, then_value ? then_value : undefined_value,
+                                              else_value ? else_value : undefined_value, "if_value", bb));
+    return codegen;
+  }
+
+  Function* function = bb->getParent();
+  BasicBlock* if_then = BasicBlock::Create(TheContext, "if_then", function);
+  BasicBlock* if_else = BasicBlock::Create(TheContext, "if_else", function);
+  BasicBlock* if_end = BasicBlock::Create(TheContext, "if_end", function);
+
+  BranchInst* branch_inst = push_back_ret(codegen, BranchInst::Create(if_then, if_else, cond, bb));
+
+  int then_counter = profile_counter_codegen(if_then);
+  int else_counter = profile_counter_codegen(if_else);
+
+  uint64_t then_count = 0;
+  uint64_t else_count = 0;
+  if (profile_get_count(function, then_counter, then_count) && profile_get_count(function, else_counter, else_count)) {
+    profile_set_branch_weights(branch_inst, then_count, else_count);
+  }
+
+  std::vector<std::pair<Value*, BasicBlock*>> incoming;
+
+  codegen.push_back(if_then);
+  Value* then_value = nullptr;
+  std::vector<Value*> then_codegen = branch_codegen_elements(error, then_nodes, if_then, then_value);
+  if (error.code()) {
+    return codegen;
+  }
+  codegen.insert(codegen.end(), then_codegen.begin(), then_codegen.end());
+
+  BasicBlock* then_end = continuation_block(then_codegen, if_then);
+  if (!then_end->getTerminator()) {
+    push_back_ret(codegen, BranchInst::Create(if_end, then_end));
+    incoming.push_back(std::make_pair(then_value, then_end));
+  }
+
+  // keep the blocks in source order
+  if_else->moveAfter(&function->back());
+  codegen.push_back(if_else);
+  Value* else_value = nullptr;
+  std::vector<Value*> else_codegen = branch_codegen_elements(error, else_nodes, if_else, else_value);
+  if (error.code()) {
+    return codegen;
+  }
+  codegen.insert(codegen.end(), else_codegen.begin(), else_codegen.end());
+
+  BasicBlock* else_end = continuation_block(else_codegen, if_else);
+  if (!else_end->getTerminator()) {
+    push_back_ret(codegen, BranchInst::Create(if_end, else_end));
+    incoming.push_back(std::make_pair(else_value, else_end));
+  }
+
+  if_end->moveAfter(&function->back());
+  codegen.push_back(if_end);
+
+  // both branches ending in break or return leave if_end unreachable
+  if (!incoming.empty()) {
+    PHINode* phi = push_back_ret(codegen, PHINode::Create(StructTy_struct_datatype_t, incoming.size(), "if_value", if_end));
+    for (auto& incoming_value : incoming) {
+      phi->addIncoming(incoming_value.first ? incoming_value.first : undefined_value, incoming_value.second);
+    }
+  }
+
+  return codegen;
+}
+
+Value* IfExpNode::codegen(llvm::BasicBlock* bb) { return codegen_elements_retlast(this, bb); }
+}
@@ -0,0 +1,392 @@
+#include "noname-jit-memory-manager.h"
+#include "noname-stats.h"
+#include "noname-types.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/Process.h"
+#include <sys/mman.h>
+#include <stdio.h>
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+using namespace llvm::orc;
+
+namespace llvm {
+namespace orc {
+
+static noname::Statistic NumSlabs("jit-memory", "slabs", "Number of JIT slabs mapped");
+static noname::Statistic NumBytesReserved("jit-memory", "reserved", "Bytes reserved by JIT slabs");
+static noname::Statistic NumBytesUsed("jit-memory", "used", "Bytes used by live JIT sections");
+static noname::Statistic NumBytesUsedPeak("jit-memory", "used-peak", "Peak bytes used by live JIT sections");
+static noname::Statistic NumSections("jit-memory", "sections", "Number of JIT sections allocated");
+static noname::Statistic NumSectionsReused("jit-memory", "reused", "Number of JIT sections placed in freed regions");
+static noname::Statistic NumPageBreaks("jit-memory", "page-breaks", "Number of modules started on a fresh page");
+static noname::Statistic NumProtectCalls("jit-memory", "mprotect", "Number of page protection changes");
+static noname::Statistic NumHotSections("jit-memory", "hot", "Number of code sections placed in the hot pool");
+static noname::Statistic NumColdSections("jit-memory", "cold", "Number of code sections placed in the cold pool");
+
+static const uintptr_t DEFAULT_SLAB_SIZE = 1024 * 1024;
+static const uintptr_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+static const unsigned DEFAULT_SECTION_ALIGNMENT = 16;
+
+NonameJITSlabAllocator::NonameJITSlabAllocator(bool use_huge_pages)
+    : UseHugePages(use_huge_pages), PageSize(sys::Process::getPageSize()) {}
+
+NonameJITSlabAllocator::~NonameJITSlabAllocator() {
+  for (Pool &pool : Pools) {
+    for (Slab &slab : pool.slabs) {
+      NumBytesReserved -= slab.block.size();
+      sys::Memory::releaseMappedMemory(slab.block);
+    }
+  }
+}
+
+unsigned NonameJITSlabAllocator::finalPermissions(SectionKind kind) {
+  if (isCode(kind)) {
+    return sys::Memory::MF_READ | sys::Memory::MF_EXEC;
+  } else if (kind == SECTION_RODATA) {
+    return sys::Memory::MF_READ;
+  }
+  return sys::Memory::MF_READ | sys::Memory::MF_WRITE;
+}
+
+NonameJITSlabAllocator::Slab *NonameJITSlabAllocator::findSlab(Pool &pool, uint8_t *address) {
+  for (Slab &slab : pool.slabs) {
+    uint8_t *base = (uint8_t *)slab.block.base();
+    if (address >= base && address < base + slab.block.size()) {
+      return &slab;
+    }
+  }
+  return nullptr;
+}
+
+NonameJITSlabAllocator::Slab *NonameJITSlabAllocator::newSlab(SectionKind kind, uintptr_t min_size) {
+  Pool &pool = Pools[kind];
+  // cold code is rarely touched, a huge page would only cost memory
+  bool huge = UseHugePages && isCode(kind) && kind != SECTION_COLD_CODE;
+  uintptr_t granule = huge ? HUGE_PAGE_SIZE : PageSize;
+  uintptr_t size = alignTo(std::max(min_size, huge ? HUGE_PAGE_SIZE : DEFAULT_SLAB_SIZE), granule);
+
+  // keep new slabs close to the previous ones so calls between modules stay
+  // within rel32 range
+  const sys::MemoryBlock *near_block = pool.slabs.empty() ? nullptr : &pool.slabs.back().block;
+
+  std::error_code ec;
+  sys::MemoryBlock mapped = sys::Memory::allocateMappedMemory(huge ? size + HUGE_PAGE_SIZE : size, near_block,
+                                                              sys::Memory::MF_READ | sys::Memory::MF_WRITE, ec);
+  if (ec) {
+    fprintf(stderr, "\n[JIT slab allocation failed: %s]", ec.message().c_str());
+    return nullptr;
+  }
+
+  sys::MemoryBlock block = mapped;
+  if (huge) {
+    // over-allocated by one huge page; trim both ends so the slab starts on a
+    // huge page boundary
+    uint8_t *mapped_base = (uint8_t *)mapped.base();
+    uint8_t *aligned_base = (uint8_t *)alignTo((uintptr_t)mapped_base, HUGE_PAGE_SIZE);
+    uint8_t *mapped_end = mapped_base + mapped.size();
+
+    if (aligned_base > mapped_base) {
+      sys::MemoryBlock head(mapped_base, aligned_base - mapped_base);
+      sys::Memory::releaseMappedMemory(head);
+    }
+    if (mapped_end > aligned_base + size) {
+      sys::MemoryBlock tail(aligned_base + size, mapped_end - (aligned_base + size));
+      sys::Memory::releaseMappedMemory(tail);
+    }
+    block = sys::MemoryBlock(aligned_base, size);
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if (madvise(block.base(), block.size(), MADV_HUGEPAGE) != 0 && noname::debug >= 1) {
+      fprintf(stderr, "\n[madvise(MADV_HUGEPAGE) failed; the slab will use regular pages]");
+    }
+#endif
+  }
+
+  Slab slab;
+  slab.block = block;
+  slab.used = 0;
+  slab.live = 0;
+  pool.slabs.push_back(slab);
+
+  ++NumSlabs;
+  NumBytesReserved += block.size();
+
+  if (noname::debug >= 2) {
+    fprintf(stdout, "\n[new JIT slab kind %d at %p size %lu]", (int)kind, block.base(), (unsigned long)block.size());
+  }
+
+  return &pool.slabs.back();
+}
+
+void NonameJITSlabAllocator::reopen(SectionKind kind, uint8_t *page_begin, uint8_t *page_end, const void *owner) {
+  if (kind == SECTION_RWDATA) {
+    return;
+  }
+
+  // the pages were sealed by a module removed since, nothing runs from them
+  sys::MemoryBlock block(page_begin, page_end - page_begin);
+  sys::Memory::protectMappedMemory(block, sys::Memory::MF_READ | sys::Memory::MF_WRITE);
+  ++NumProtectCalls;
+  Pools[kind].pending[owner].push_back(block);
+}
+
+uint8_t *NonameJITSlabAllocator::allocate(SectionKind kind, uintptr_t size, unsigned alignment, const void *owner) {
+  Pool &pool = Pools[kind];
+  uintptr_t align = std::max(alignment, DEFAULT_SECTION_ALIGNMENT);
+  size = std::max(size, (uintptr_t)1);
+
+  // first fit over regions released by removed modules
+  for (auto it = pool.free_regions.begin(); it != pool.free_regions.end(); ++it) {
+    uint8_t *region = it->first;
+    uintptr_t region_size = it->second;
+    uint8_t *aligned = (uint8_t *)alignTo((uintptr_t)region, align);
+
+    if (aligned + size > region + region_size) {
+      continue;
+    }
+
+    uint8_t *page_begin = (uint8_t *)alignDown((uintptr_t)aligned, PageSize);
+    uint8_t *page_end = (uint8_t *)alignTo((uintptr_t)(aligned + size), PageSize);
+    if (kind != SECTION_RWDATA && (page_begin < region || page_end > region + region_size)) {
+      continue;  // another module has sections on these pages
+    }
+
+    pool.free_regions.erase(it);
+    if (aligned > region) {
+      pool.free_regions[region] = aligned - region;
+    }
+    if (aligned + size < region + region_size) {
+      pool.free_regions[aligned + size] = (region + region_size) - (aligned + size);
+    }
+
+    Slab *slab = findSlab(pool, aligned);
+    assert(slab && "free region outside of any slab");
+    slab->live += size;
+    reopen(kind, page_begin, page_end, owner);
+
+    ++NumSections;
+    ++NumSectionsReused;
+    NumBytesUsed += size;
+    NumBytesUsedPeak.updateMax(NumBytesUsed.getValue());
+    return aligned;
+  }
+
+  Slab *slab = pool.slabs.empty() ? nullptr : &pool.slabs.back();
+  uint8_t *aligned = nullptr;
+
+  if (slab) {
+    uint8_t *base = (uint8_t *)slab->block.base();
+    uint8_t *next = base + slab->used;
+    if (kind != SECTION_RWDATA && pool.tail_owner != owner && (uint8_t *)alignDown((uintptr_t)next, PageSize) != next) {
+      // the last page is another module's: sealed already, or to be sealed when
+      // that module is finalized
+      next = (uint8_t *)alignTo((uintptr_t)next, PageSize);
+      ++NumPageBreaks;
+    }
+    aligned = (uint8_t *)alignTo((uintptr_t)next, align);
+    if (aligned + size > base + slab->block.size()) {
+      slab = nullptr;
+    }
+  }
+
+  if (!slab) {
+    slab = newSlab(kind, size + align);
+    if (!slab) {
+      return nullptr;
+    }
+    aligned = (uint8_t *)alignTo((uintptr_t)slab->block.base(), align);
+  }
+
+  uint8_t *base = (uint8_t *)slab->block.base();
+  slab->used = (aligned + size) - base;
+  slab->live += size;
+  pool.tail_owner = owner;
+
+  if (kind != SECTION_RWDATA) {
+    uint8_t *page_begin = (uint8_t *)alignDown((uintptr_t)aligned, PageSize);
+    uint8_t *page_end = std::min((uint8_t *)alignTo((uintptr_t)(aligned + size), PageSize), base + slab->block.size());
+    pool.pending[owner].push_back(sys::MemoryBlock(page_begin, page_end - page_begin));
+  }
+
+  ++NumSections;
+  NumBytesUsed += size;
+  NumBytesUsedPeak.updateMax(NumBytesUsed.getValue());
+  return aligned;
+}
+
+void NonameJITSlabAllocator::release(SectionKind kind, uint8_t *address, uintptr_t size) {
+  Pool &pool = Pools[kind];
+  Slab *slab = findSlab(pool, address);
+  if (!slab) {
+    return;
+  }
+
+  size = std::max(size, (uintptr_t)1);
+  slab->live -= size;
+  NumBytesUsed -= size;
+
+  // insert and coalesce with the neighbours
+  auto next = pool.free_regions.lower_bound(address);
+  if (next != pool.free_regions.end() && address + size == next->first) {
+    size += next->second;
+    next = pool.free_regions.erase(next);
+  }
+  if (next != pool.free_regions.begin()) {
+    auto prev = std::prev(next);
+    if (prev->first + prev->second == address) {
+      address = prev->first;
+      size += prev->second;
+      pool.free_regions.erase(prev);
+    }
+  }
+  pool.free_regions[address] = size;
+
+  if (slab->live != 0) {
+    return;
+  }
+
+  // the slab is empty: forget its free regions and either rewind it (if it is
+  // the one we bump allocate from) or give it back to the system
+  uint8_t *base = (uint8_t *)slab->block.base();
+  uint8_t *end = base + slab->block.size();
+
+  pool.free_regions.erase(pool.free_regions.lower_bound(base), pool.free_regions.lower_bound(end));
+
+  if (slab == &pool.slabs.back()) {
+    if (kind != SECTION_RWDATA && slab->used) {
+      // nothing runs from the slab anymore, all of it can be written again
+      uintptr_t dirty_end = std::min(alignTo(slab->used, PageSize), (uint64_t)slab->block.size());
+      sys::Memory::protectMappedMemory(sys::MemoryBlock(base, dirty_end),
+                                       sys::Memory::MF_READ | sys::Memory::MF_WRITE);
+      ++NumProtectCalls;
+    }
+    slab->used = 0;
+    pool.tail_owner = nullptr;
+    return;
+  }
+
+  NumBytesReserved -= slab->block.size();
+  NumSlabs -= 1;
+  sys::Memory::releaseMappedMemory(slab->block);
+  pool.slabs.erase(pool.slabs.begin() + (slab - &pool.slabs[0]));
+}
+
+bool NonameJITSlabAllocator::finalize(const void *owner, std::string *error_msg) {
+  for (int kind = SECTION_CODE; kind < SECTION_RWDATA; ++kind) {
+    Pool &pool = Pools[kind];
+    if (pool.tail_owner == owner) {
+      pool.tail_owner = nullptr;
+    }
+
+    auto it = pool.pending.find(owner);
+    if (it == pool.pending.end()) {
+      continue;
+    }
+
+    std::vector<sys::MemoryBlock> ranges;
+    ranges.swap(it->second);
+    pool.pending.erase(it);
+
+    std::sort(ranges.begin(), ranges.end(),
+              [](const sys::MemoryBlock &b1, const sys::MemoryBlock &b2) { return b1.base() < b2.base(); });
+
+    // merge adjacent or overlapping ranges so each run costs a single mprotect
+    std::vector<sys::MemoryBlock> merged;
+    for (const sys::MemoryBlock &range : ranges) {
+      if (!merged.empty()) {
+        sys::MemoryBlock &last = merged.back();
+        uint8_t *last_end = (uint8_t *)last.base() + last.size();
+        if ((uint8_t *)range.base() <= last_end) {
+          uint8_t *range_end = (uint8_t *)range.base() + range.size();
+          last = sys::MemoryBlock(last.base(), std::max(last_end, range_end) - (uint8_t *)last.base());
+          continue;
+        }
+      }
+      merged.push_back(range);
+    }
+
+    for (auto range = merged.begin(); range != merged.end(); ++range) {
+      if (std::error_code ec = sys::Memory::protectMappedMemory(*range, finalPermissions((SectionKind)kind))) {
+        // keep what is left for the next call
+        pool.pending[owner].assign(range, merged.end());
+        if (error_msg) {
+          *error_msg = ec.message();
+        }
+        return true;
+      }
+      ++NumProtectCalls;
+
+      if (isCode((SectionKind)kind)) {
+        sys::Memory::InvalidateInstructionCache(range->base(), range->size());
+      }
+    }
+  }
+
+  return false;
+}
+
+void NonameJITSlabAllocator::forget(const void *owner) {
+  for (Pool &pool : Pools) {
+    pool.pending.erase(owner);
+    if (pool.tail_owner == owner) {
+      pool.tail_owner = nullptr;
+    }
+  }
+}
+
+NonameJITMemoryManager::NonameJITMemoryManager(NonameJITSlabAllocator &slabs) : Slabs(slabs) {}
+
+NonameJITMemoryManager::~NonameJITMemoryManager() {
+  for (EHFrame &frame : EHFrames) {
+    RTDyldMemoryManager::deregisterEHFrames(frame.address, frame.load_address, frame.size);
+  }
+  Slabs.forget(this);
+  for (Allocation &allocation : Allocations) {
+    Slabs.release(allocation.kind, allocation.address, allocation.size);
+  }
+}
+
+uint8_t *NonameJITMemoryManager::allocateCodeSection(uintptr_t Size, unsigned Alignment, unsigned SectionID,
+                                                     StringRef SectionName) {
+  // the section names are the ones the profile gives to hot and cold functions
+  NonameJITSlabAllocator::SectionKind kind = NonameJITSlabAllocator::SECTION_CODE;
+  if (SectionName.startswith(".text.hot")) {
+    kind = NonameJITSlabAllocator::SECTION_HOT_CODE;
+    ++NumHotSections;
+  } else if (SectionName.startswith(".text.unlikely")) {
+    kind = NonameJITSlabAllocator::SECTION_COLD_CODE;
+    ++NumColdSections;
+  }
+
+  uint8_t *address = Slabs.allocate(kind, Size, Alignment, this);
+  if (address) {
+    Allocations.push_back({kind, address, Size});
+  }
+  return address;
+}
+
+uint8_t *NonameJITMemoryManager::allocateDataSection(uintptr_t Size, unsigned Alignment, unsigned SectionID,
+                                                     StringRef SectionName, bool IsReadOnly) {
+  NonameJITSlabAllocator::SectionKind kind =
+      IsReadOnly ? NonameJITSlabAllocator::SECTION_RODATA : NonameJITSlabAllocator::SECTION_RWDATA;
+  uint8_t *address = Slabs.allocate(kind, Size, Alignment, this);
+  if (address) {
+    Allocations.push_back({kind, address, Size});
+  }
+  return address;
+}
+
+bool NonameJITMemoryManager::finalizeMemory(std::string *ErrMsg) { return Slabs.finalize(this, ErrMsg); }
+
+void NonameJITMemoryManager::registerEHFrames(uint8_t *Addr, uint64_t LoadAddr, size_t Size) {
+  RTDyldMemoryManager::registerEHFrames(Addr, LoadAddr, Size);
+  EHFrames.push_back({Addr, LoadAddr, Size});
+}
+
+}  // end namespace orc
+}  // end namespace llvm
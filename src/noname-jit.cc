@@ -1,5 +1,8 @@
+#include "llvm/Object/ObjectFile.h"
 #include "noname-jit.h"
 #include "noname-types.h"
+#include "noname-runtime.h"
+#include <chrono>
 #include <limits.h>
 #include <unistd.h>
 #include <stdio.h>
@@ -17,6 +20,12 @@
 using namespace llvm;
 using namespace llvm::orc;
 
+namespace noname {
+bool jit_huge_pages = false;
+std::string jit_mcpu;
+std::string jit_mattr;
+}
+
 namespace llvm {
 namespace orc {
 typedef ObjectLinkingLayer<> ObjLayerT;
@@ -28,10 +37,81 @@ typedef CompileLayerT::ModuleSetHandleT ModuleHandleT;
 // extern std::unique_ptr<Module> TheModule;
 // extern std::unique_ptr<legacy::FunctionPassManager> TheFPM;
 
+// Builds the TargetMachine for the machine we are running on instead of the
+// generic triple default, so JIT code can use AVX2/FMA/AVX-512 when present.
+// -mcpu replaces the detected CPU (and drops the detected features, since they
+// describe a different CPU); -mattr is applied last so it always wins.
+static TargetMachine *selectHostTarget() {
+  std::string cpu = noname::jit_mcpu;
+  std::vector<std::string> attrs;
+
+  if (cpu.empty()) {
+    cpu = sys::getHostCPUName();
+
+    StringMap<bool> host_features;
+    if (sys::getHostCPUFeatures(host_features)) {
+      for (auto &feature : host_features) {
+        attrs.push_back((feature.second ? "+" : "-") + feature.first().str());
+      }
+    }
+  }
+
+  SmallVector<StringRef, 8> overrides;
+  StringRef(noname::jit_mattr).split(overrides, ',', -1, false);
+  for (StringRef attr : overrides) {
+    attrs.push_back(attr.trim().str());
+  }
+
+  if (noname::debug >= 1) {
+    fprintf(stderr, "\n[JIT target cpu '%s' with %lu features]", cpu.c_str(), (unsigned long)attrs.size());
+  }
+
+  // session wide floating point semantics; functions annotated with a
+  // different mode carry their own fp-math attributes
+  TargetOptions options;
+  options.AllowFPOpFusion = noname::fp_mode == noname::FP_MODE_STRICT ? FPOpFusion::Strict : FPOpFusion::Fast;
+  options.UnsafeFPMath = noname::fp_mode == noname::FP_MODE_FAST;
+  options.NoInfsFPMath = noname::fp_mode == noname::FP_MODE_FAST;
+  options.NoNaNsFPMath = noname::fp_mode == noname::FP_MODE_FAST;
+  // `tail` calls between fastcc functions (every function but the top level
+  // expressions) are always turned into jumps, whatever the number of arguments
+  options.GuaranteedTailCallOpt = true;
+
+  return EngineBuilder().setMCPU(cpu).setMAttrs(attrs).setTargetOptions(options).selectTarget();
+}
+
+// FMA contraction is a target option rather than a function attribute, so it is
+// decided per module: a module is contracted when any function defined in it
+// asked for contract or fast semantics.
+static FPOpFusion::FPOpFusionMode getFPOpFusionMode(const Module &module) {
+  for (const Function &function : module) {
+    if (!function.isDeclaration() && noname::get_fp_mode(&function) != noname::FP_MODE_STRICT) {
+      return FPOpFusion::Fast;
+    }
+  }
+  return FPOpFusion::Strict;
+}
+
+// The code generator level of a module (see noname-opt-level.h)
+static CodeGenOpt::Level getCodeGenOptLevel(noname::OptLevel opt_level) {
+  switch (opt_level) {
+    case noname::OPT_LEVEL_NONE:
+      return CodeGenOpt::None;
+    case noname::OPT_LEVEL_CAPPED:
+      return CodeGenOpt::Less;
+    default:
+      return CodeGenOpt::Default;
+  }
+}
+
 NonameJIT::NonameJIT()
-    : TM(EngineBuilder().selectTarget()), DL(TM->createDataLayout()), CompileLayer(ObjectLayer, SimpleCompiler(*TM)) {
+    : TM(selectHostTarget()),
+      DL(TM->createDataLayout()),
+      Slabs(llvm::make_unique<NonameJITSlabAllocator>(noname::jit_huge_pages)),
+      CompileLayer(ObjectLayer, SimpleCompiler(*TM)) {
   ;
   llvm::sys::DynamicLibrary::LoadLibraryPermanently(nullptr);
+  CompileLayer.setObjectCache(&ObjectRecorder);
 }
 
 NonameJIT::~NonameJIT() {
@@ -43,10 +123,20 @@ NonameJIT::~NonameJIT() {
 
 TargetMachine &NonameJIT::getTargetMachine() { return *TM; }
 
-CompileLayerT::ModuleSetHandleT NonameJIT::addModule(std::unique_ptr<Module> module) {
-  // We need a memory manager to allocate memory and resolve symbols for this
-  // new module. Create one that resolves symbols by looking back into the JIT.
-  auto Resolver = createLambdaResolver(
+std::unique_ptr<TargetMachine> NonameJIT::createTargetMachine() { return std::unique_ptr<TargetMachine>(selectHostTarget()); }
+
+noname::OptLevel NonameJIT::configureTargetMachine(TargetMachine &target_machine, const Module &module) {
+  target_machine.Options.AllowFPOpFusion = getFPOpFusionMode(module);
+
+  noname::OptLevel opt_level = noname::get_module_opt_level(module);
+  target_machine.setOptLevel(getCodeGenOptLevel(opt_level));
+  target_machine.setFastISel(opt_level == noname::OPT_LEVEL_NONE);
+  return opt_level;
+}
+
+// Resolves the symbols of a new module (or object) by looking back into the JIT
+std::unique_ptr<RuntimeDyld::SymbolResolver> NonameJIT::createResolver() {
+  return createLambdaResolver(
       [&](const std::string &Name) {
         if (auto Sym = findMangledSymbol(Name)) {
           return Sym.toRuntimeDyldSymbol();
@@ -54,18 +144,110 @@ CompileLayerT::ModuleSetHandleT NonameJIT::addModule(std::unique_ptr<Module> mod
         return RuntimeDyld::SymbolInfo(nullptr);
       },
       [](const std::string &S) { return nullptr; });
+}
+
+CompileLayerT::ModuleSetHandleT NonameJIT::addModule(std::unique_ptr<Module> module) {
+  // We need a memory manager to allocate memory and resolve symbols for this
+  // new module.
+  auto Resolver = createResolver();
+
+  // the IR passes deferred until now (see noname-parallel.h), then the runtime
+  // helpers the module calls are inlined before it is compiled
+  noname::run_pending_passes(*module, *TM);
+  noname::link_runtime(*module);
+  bool host_addresses = noname::embeds_host_addresses(*module);
 
   Modules.push_back(module.get());
 
+  // the compile layer compiles eagerly, so the options only have to hold for
+  // the duration of addModuleSet
+  FPOpFusion::FPOpFusionMode saved_fusion_mode = TM->Options.AllowFPOpFusion;
+  CodeGenOpt::Level saved_opt_level = TM->getOptLevel();
+  bool saved_fast_isel = TM->Options.EnableFastISel;
+  noname::OptLevel opt_level = configureTargetMachine(*TM, *module);
+
+  uint64_t instructions = noname::count_instructions(*module);
+  auto start = std::chrono::steady_clock::now();
+
+  // sections are carved out of the slabs shared by all modules of the session
   auto module_set_handle = CompileLayer.addModuleSet(singletonSet(std::move(module)),
-                                                     make_unique<SectionMemoryManager>(), std::move(Resolver));
+                                                     make_unique<NonameJITMemoryManager>(*Slabs), std::move(Resolver));
+  TM->Options.AllowFPOpFusion = saved_fusion_mode;
+  TM->setOptLevel(saved_opt_level);
+  TM->setFastISel(saved_fast_isel);
+
+  noname::opt_level_module_compiled(
+      opt_level, instructions,
+      std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
 
   ModuleHandles.push_back(module_set_handle);
+  SessionObjects.emplace_back(module_set_handle, std::move(ObjectRecorder.LastObject));
+  if (host_addresses) {
+    HostAddressModules.push_back(module_set_handle);
+  }
   return module_set_handle;
 }
 
+bool NonameJIT::addObject(std::unique_ptr<MemoryBuffer> object_buffer, bool session_object, bool host_addresses) {
+  std::unique_ptr<MemoryBuffer> session_buffer;
+  if (session_object) {
+    // the layer links a view of the recorded copy
+    session_buffer = MemoryBuffer::getMemBufferCopy(object_buffer->getBuffer(), object_buffer->getBufferIdentifier());
+    object_buffer = MemoryBuffer::getMemBuffer(session_buffer->getMemBufferRef(), false);
+  }
+
+  Expected<std::unique_ptr<object::ObjectFile>> object = object::ObjectFile::createObjectFile(object_buffer->getMemBufferRef());
+  if (!object) {
+    consumeError(object.takeError());
+    return false;
+  }
+
+  std::vector<std::unique_ptr<object::OwningBinary<object::ObjectFile>>> objects;
+  objects.push_back(
+      llvm::make_unique<object::OwningBinary<object::ObjectFile>>(std::move(*object), std::move(object_buffer)));
+
+  // found by findSymbol like the compiled modules: both layers share the handles
+  ModuleHandles.push_back(
+      ObjectLayer.addObjectSet(std::move(objects), make_unique<NonameJITMemoryManager>(*Slabs), createResolver()));
+
+  if (session_buffer) {
+    SessionObjects.emplace_back(ModuleHandles.back(), std::move(session_buffer));
+    if (host_addresses) {
+      HostAddressModules.push_back(ModuleHandles.back());
+    }
+  }
+  return true;
+}
+
+std::vector<MemoryBufferRef> NonameJIT::getSessionObjects() const {
+  std::vector<MemoryBufferRef> objects;
+  for (auto &session_object : SessionObjects) {
+    if (session_object.second) {
+      objects.push_back(session_object.second->getMemBufferRef());
+    }
+  }
+  return objects;
+}
+
+void NonameJIT::dropSessionObject(ModuleHandleT module_handle) {
+  for (auto &session_object : SessionObjects) {
+    if (session_object.first == module_handle) {
+      session_object.second.reset();
+    }
+  }
+  HostAddressModules.erase(std::remove(HostAddressModules.begin(), HostAddressModules.end(), module_handle),
+                           HostAddressModules.end());
+}
+
 void NonameJIT::removeModule(ModuleHandleT module_handle) {
   ModuleHandles.erase(std::find(ModuleHandles.begin(), ModuleHandles.end(), module_handle));
+  SessionObjects.erase(std::find_if(SessionObjects.begin(), SessionObjects.end(),
+                                    [&](const std::pair<ModuleHandleT, std::unique_ptr<MemoryBuffer>> &session_object) {
+                                      return session_object.first == module_handle;
+                                    }));
+  HostAddressModules.erase(std::remove(HostAddressModules.begin(), HostAddressModules.end(), module_handle),
+                           HostAddressModules.end());
+  // destroys the module memory manager, which returns its sections to the slabs
   CompileLayer.removeModuleSet(module_handle);
 }
 
@@ -0,0 +1,216 @@
+#include "noname-utils.h"
+#include "noname-types.h"
+#include "noname-jit.h"
+#include "noname-profile.h"
+#include <limits.h>
+#include <stdio.h>
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+using namespace llvm::orc;
+
+namespace noname {
+
+extern LLVMContext TheContext;
+extern IRBuilder<> Builder;
+extern std::unique_ptr<Module> TheModule;
+extern std::unique_ptr<legacy::FunctionPassManager> TheFPM;
+extern std::unique_ptr<NonameJIT> TheJIT;
+
+// exit blocks of the loops being generated, innermost last
+static std::vector<BasicBlock*> break_targets;
+
+LoopNode::LoopNode(ASTContext* context, ExpNode* condition, stmtlist_t* head_stmt_list)
+    : ASTNode(context, AST_NODE_TYPE_LOOP),
+      condition(std::unique_ptr<ExpNode>(condition)),
+      body_nodes(std::vector<std::unique_ptr<ASTNode>>()) {
+  stmtlist_node_t* stmtlist_node = head_stmt_list->first;
+
+  do {
+    if (stmtlist_node && stmtlist_node->node) {
+      body_nodes.push_back(std::unique_ptr<ASTNode>(stmtlist_node->node));
+      stmtlist_node = stmtlist_node->next;
+    }
+  } while (stmtlist_node);
+}
+
+void LoopNode::canonicalize(std::string& out) const {
+  ASTNode::canonicalize(out);
+  ASTNode::canonicalize(out, condition.get());
+
+  canonical_append(out, (uint64_t)body_nodes.size());
+  for (const std::unique_ptr<ASTNode>& body_node : body_nodes) {
+    body_node->canonicalize(out);
+  }
+}
+
+bool is_true(const TaggedValue& value) {
+  if (value.getType() == TYPE_STRING) {
+    return !value.asString().empty();
+  }
+
+  return value.isDefined() && value.as<double>() != 0.0;
+}
+
+bool eval_statements(const std::vector<std::unique_ptr<ASTNode>>& nodes, bool in_loop, std::unique_ptr<NodeValue>* result) {
+  for (const std::unique_ptr<ASTNode>& node : nodes) {
+    ASTNode* statement = node.get();
+    bool is_last = node == nodes.back();
+
+    if (isa<BreakNode>(statement)) {
+      if (!in_loop) {
+        logError("break outside of a loop");
+      }
+      return false;
+    }
+
+    if (isa<CallExpNode>(statement) || isa<ReturnExpNode>(statement) || isa<FunctionDefNode>(statement) ||
+        isa<ImportNode>(statement)) {
+      logError(
+          "Function calls, definitions, returns and imports inside a top level block are not supported; define it "
+          "inside a function");
+      return false;
+    }
+
+    if (isa<IfExpNode>(statement)) {
+      std::unique_ptr<NodeValue> branch_result;
+      if (!((IfExpNode*)statement)->evalBranch(branch_result, in_loop)) {
+        return false;
+      }
+      if (result && is_last) {
+        *result = std::move(branch_result);
+      }
+      continue;
+    }
+
+    if (result && is_last && isa<ExpNode>(statement) && !isa<AssignmentNode>(statement)) {
+      *result = ((ExpNode*)statement)->getValue();
+      continue;
+    }
+
+    statement->eval();
+  }
+
+  return true;
+}
+
+void* LoopNode::eval() {
+  // top level loops are interpreted like any other top level statement; the
+  // ones inside functions are compiled by codegen_elements
+  while (true) {
+    if (condition && !is_true(condition->getTaggedValue())) {
+      break;
+    }
+
+    if (!eval_statements(body_nodes, true)) {
+      break;
+    }
+  }
+
+  return nullptr;
+}
+
+std::vector<Value*> LoopNode::codegen_elements(Error& error, BasicBlock* bb) const {
+  std::vector<Value*> codegen;
+
+  if (!bb) {
+    createError(error, "Loops can only be compiled inside a function");
+    return codegen;
+  }
+
+  Function* function = bb->getParent();
+  BasicBlock* loop_header = BasicBlock::Create(TheContext, "loop_header", function);
+  BasicBlock* loop_body = BasicBlock::Create(TheContext, "loop_body", function);
+  BasicBlock* loop_exit = BasicBlock::Create(TheContext, "loop_exit", function);
+
+  push_back_ret(codegen, BranchInst::Create(loop_header, bb));
+  codegen.push_back(loop_header);
+
+  if (condition) {
+    int header_counter = profile_counter_codegen(loop_header);
+
+    std::vector<Value*> condition_codegen = condition_codegen_elements(error, condition.get(), loop_header);
+    if (error.code()) {
+      return codegen;
+    }
+    codegen.insert(codegen.end(), condition_codegen.begin(), condition_codegen.end());
+
+    BasicBlock* condition_bb = continuation_block(condition_codegen, loop_header);
+    BranchInst* branch_inst = push_back_ret(codegen, BranchInst::Create(loop_body, loop_exit, condition_codegen.back(), condition_bb));
+
+    int body_counter = profile_counter_codegen(loop_body);
+
+    uint64_t header_count = 0;
+    uint64_t body_count = 0;
+    if (profile_get_count(function, header_counter, header_count) && profile_get_count(function, body_counter, body_count)) {
+      // the header runs once more than the body every time the loop exits
+      profile_set_branch_weights(branch_inst, body_count, header_count > body_count ? header_count - body_count : 0);
+    }
+  } else {
+    push_back_ret(codegen, BranchInst::Create(loop_body, loop_header));
+  }
+
+  codegen.push_back(loop_body);
+
+  break_targets.push_back(loop_exit);
+
+  BasicBlock* body_bb = loop_body;
+  for (const std::unique_ptr<ASTNode>& body_node : body_nodes) {
+    body_bb = insertion_block(body_bb);
+
+    std::vector<Value*> body_node_codegen_elements = body_node->get_codegen_elements(error, body_bb);
+    if (error.code()) {
+      break_targets.pop_back();
+      return codegen;
+    }
+    codegen.insert(codegen.end(), body_node_codegen_elements.begin(), body_node_codegen_elements.end());
+
+    body_bb = continuation_block(body_node_codegen_elements, body_bb);
+  }
+
+  break_targets.pop_back();
+
+  // the back edge; a body ending in break or return has none
+  if (!body_bb->getTerminator()) {
+    push_back_ret(codegen, BranchInst::Create(loop_header, body_bb));
+  }
+
+  // keep the blocks in source order: the next statement goes after the body
+  loop_exit->moveAfter(&function->back());
+  codegen.push_back(loop_exit);
+
+  return codegen;
+}
+
+void* BreakNode::eval() {
+  logError("break outside of a loop");
+  return nullptr;
+}
+
+std::vector<Value*> BreakNode::codegen_elements(Error& error, BasicBlock* bb) const {
+  std::vector<Value*> codegen;
+
+  if (break_targets.empty() || !bb) {
+    createError(error, "break outside of a loop");
+    return codegen;
+  }
+
+  push_back_ret(codegen, BranchInst::Create(break_targets.back(), bb));
+  return codegen;
+}
+
+//----------------------------------------------//
+//----------- Processor Strategy ---------------//
+//----------------------------------------------//
+
+void* LoopNodeProcessorStrategy::process(ASTNode* node) { return node->eval(); }
+}
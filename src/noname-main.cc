@@ -10,6 +10,17 @@
 #include "noname-parse.h"
 #include "noname-types.h"
 #include "noname-jit.h"
+#include "noname-stats.h"
+#include "noname-profile.h"
+#include "noname-bytecode.h"
+#include "noname-ast-file.h"
+#include "noname-prelude.h"
+#include "noname-snapshot.h"
+#include "noname-specialize.h"
+#include "noname-memo.h"
+#include "noname-dedupe.h"
+#include "noname-opt-level.h"
+#include "noname-parallel.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
@@ -22,6 +33,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string>
+#include <thread>
 #include <cassert>
 #include <cctype>
 #include <cstdint>
@@ -156,6 +168,9 @@ int noname_read(char *buf, int *result, int max_size) {
       fatal_error("Input stream is invalid");
     }
 
+    ast_file_begin_input();
+
+    bool from_prompt = !read_from_file_import;
     for (; n < max_size && (cur_char = getc(fin)) != EOF; ++n) {
       buf[n] = (char)cur_char;
       if (read_from_file_import) {
@@ -178,6 +193,13 @@ int noname_read(char *buf, int *result, int max_size) {
         fatal_error("Input stream scanner failed");
       }
     }
+
+    // session commands are lines of their own, never parsed
+    if (from_prompt && n > 0 && buf[0] == ':' && run_session_command(buf, n)) {
+      return noname_read(buf, result, max_size);
+    }
+
+    ast_file_input(buf, n);
   }
 
   *result = n;
@@ -197,8 +219,13 @@ void CreateNewModuleAndInitialize() {
       TheModule->dump();
     }
 
-    TheJIT->writeToFile(TheModule.get());
-    TheJIT->addModule(std::move(TheModule));
+    if (!parallel_add_module(TheModule)) {
+      run_pending_passes(*TheModule, TheJIT->getTargetMachine());
+      profile_optimize_module(*TheModule);
+      opt_level_optimize_module(*TheModule);
+      TheJIT->writeToFile(TheModule.get());
+      TheJIT->addModule(std::move(TheModule));
+    }
     InitializeModuleAndPassManager();
   }
 }
@@ -219,15 +246,7 @@ void InitializeModuleAndPassManager() {
   // Create a new pass manager attached to it.
   TheFPM = llvm::make_unique<legacy::FunctionPassManager>(TheModule.get());
 
-  // Do simple "peephole" optimizations and bit-twiddling optzns.
-  TheFPM->add(createInstructionCombiningPass());
-  // Reassociate expressions.
-  TheFPM->add(createReassociatePass());
-  // Eliminate Common SubExpressions.
-  TheFPM->add(createGVNPass());
-  // Simplify the control flow graph (deleting unreachable blocks, etc).
-  TheFPM->add(createCFGSimplificationPass());
-
+  add_function_passes(*TheFPM, OPT_LEVEL_FULL, TheJIT->getTargetMachine());
   TheFPM->doInitialization();
 }
 
@@ -237,6 +256,27 @@ ASTNode *pre_process(ASTNode *node) {
   }
 
   if (isa<CallExpNode>(*node)) {
+    if (noname::execution_tier == TIER_BYTECODE) {
+      if (bytecode_run_top_level((CallExpNode *)node)) {
+        // already run, nothing left for eval
+        return nullptr;
+      }
+
+      // the top level expression may call functions only compiled to bytecode
+      bytecode_tier_up();
+    } else if (bytecode_evaluate_top_level((CallExpNode *)node)) {
+      // a pure function of constants, nothing to compile
+      return nullptr;
+    }
+
+    // before the hot functions may be called again
+    opt_level_tier_up();
+
+    if (dedupe_run_top_level((CallExpNode *)node)) {
+      // the code of an identical expression, nothing to compile
+      return nullptr;
+    }
+
     return new_top_level_exp_node((CallExpNode *)node);
   }
 
@@ -244,7 +284,11 @@ ASTNode *pre_process(ASTNode *node) {
 }
 
 void eval(ASTNode *node) {
-  if (!node || isa<ErrorNode>(*node)) {
+  if (!node) {
+    return;
+  }
+
+  if (isa<ErrorNode>(*node)) {
     logError((ErrorNode *)node);
     return;
   }
@@ -298,6 +342,28 @@ int yylex(void) {
 void yyerror(char const *s) { fprintf(stdout, "\nERROR: %s\n", s); }
 
 void exit_hook() {
+  if (noname::print_stats) {
+    print_statistics(stderr);
+    print_memo_statistics(stderr);
+    print_opt_level_statistics(stderr);
+  }
+
+  if (noname::profile_mode == PROFILE_GENERATE && !write_profile(noname::profile_file)) {
+    fprintf(stderr, "\nError: could not write the profile '%s'", noname::profile_file.c_str());
+  }
+
+  if (!noname::emit_ast_file.empty() && !write_ast_file(noname::emit_ast_file)) {
+    fprintf(stderr, "\nError: could not write the AST file '%s'", noname::emit_ast_file.c_str());
+  }
+
+  // the bitcode first: generating the object rewrites the module
+  if (!noname::emit_bitcode_file.empty() && !write_module_bitcode(*TheModule, noname::emit_bitcode_file)) {
+    fprintf(stderr, "\nError: could not write the bitcode '%s'", noname::emit_bitcode_file.c_str());
+  }
+  if (!noname::emit_object_file.empty() && !write_module_object(*TheModule, noname::emit_object_file)) {
+    fprintf(stderr, "\nError: could not write the object '%s'", noname::emit_object_file.c_str());
+  }
+
   TheJIT->release();
   // def f() { return 32122; }; f();
   llvm_shutdown();
@@ -320,6 +386,66 @@ int main(int argc, char **argv) {
   cl::opt<bool> quiet_arg1("quiet", cl::desc("Don't print informational messages"));
   cl::opt<bool> quiet_arg2("q", cl::desc("Don't print informational messages"));
   cl::opt<bool> quiet_arg3("no-verbose", cl::desc("Don't print informational messages"), cl::Hidden);
+  cl::opt<bool> stats_arg("noname-stats", cl::desc("Print the noname statistics on exit"));
+  cl::opt<bool> huge_pages_arg("jit-huge-pages", cl::desc("Back the JIT code slabs with transparent huge pages"));
+  cl::opt<std::string> mcpu_arg("mcpu", cl::desc("Target a specific cpu type instead of the host cpu"),
+                                cl::value_desc("cpu-name"));
+  cl::opt<std::string> mattr_arg("mattr", cl::desc("Target specific attributes, e.g. -mattr=+avx2,-avx512f"),
+                                 cl::value_desc("a1,+a2,-a3,..."));
+  cl::opt<FPMode> fp_mode_arg("fp-mode", cl::desc("Floating point semantics of the generated code"),
+                              cl::init(FP_MODE_STRICT),
+                              cl::values(clEnumValN(FP_MODE_STRICT, "strict", "IEEE semantics, no contraction (default)"),
+                                         clEnumValN(FP_MODE_CONTRACT, "contract", "allow fusing multiply and add into FMA"),
+                                         clEnumValN(FP_MODE_FAST, "fast", "allow every fast-math transformation"),
+                                         clEnumValEnd));
+  cl::opt<bool> profile_generate_arg("profile-generate",
+                                     cl::desc("Compile functions with counters and write them to the profile file on exit"));
+  cl::opt<bool> profile_use_arg("profile-use", cl::desc("Optimize functions with the counters of the profile file"));
+  cl::opt<ExecutionTier> tier_arg(
+      "tier", cl::desc("How functions and top level calls are executed"), cl::init(TIER_AUTO),
+      cl::values(clEnumValN(TIER_AUTO, "auto", "bytecode when the input is not a terminal, jit otherwise (default)"),
+                 clEnumValN(TIER_JIT, "jit", "compile everything with LLVM"),
+                 clEnumValN(TIER_BYTECODE, "bytecode", "run on the bytecode VM what it can, compile the rest with LLVM"),
+                 clEnumValEnd));
+  cl::opt<std::string> profile_file_arg("profile-file", cl::desc("Profile written by -profile-generate and read by -profile-use"),
+                                        cl::init("default.nnprof"), cl::value_desc("filename"));
+  cl::opt<std::string> emit_ast_arg("emit-ast", cl::desc("Write the statements parsed from the input to an AST file on exit"),
+                                    cl::value_desc("filename"));
+  cl::opt<std::string> load_ast_arg("load-ast", cl::desc("Run the statements of an AST file before the input"),
+                                    cl::value_desc("filename"));
+  cl::opt<std::string> emit_bitcode_arg("emit-bitcode", cl::desc("Write the functions defined by the input as bitcode on exit"),
+                                        cl::value_desc("filename"));
+  cl::opt<std::string> restore_arg("restore", cl::desc("Restore a session saved with :save before reading the input"),
+                                   cl::value_desc("filename"));
+  cl::opt<unsigned> specialize_limit_arg("specialize-limit",
+                                         cl::desc("Constant argument patterns specialized per function (0 to disable)"),
+                                         cl::init(4));
+  cl::opt<unsigned long> fold_fuel_arg("fold-fuel",
+                                       cl::desc("Jumps and calls a pure call may run to be evaluated at compile time"),
+                                       cl::init(1000000));
+  cl::opt<MemoMode> memo_arg("memo", cl::desc("Which pure functions remember their results"), cl::init(MEMO_ANNOTATED),
+                             cl::values(clEnumValN(MEMO_NONE, "none", "none, even when annotated"),
+                                        clEnumValN(MEMO_ANNOTATED, "annotated", "the functions annotated @memo (default)"),
+                                        clEnumValN(MEMO_AUTO, "auto", "the annotated ones and those calling themselves twice or more"),
+                                        clEnumValEnd));
+  cl::opt<unsigned> memo_capacity_arg("memo-capacity", cl::desc("Results cached per memoized function"), cl::init(4096));
+  cl::opt<unsigned> dedupe_expressions_arg("dedupe-expressions",
+                                           cl::desc("Top level expressions kept compiled for identical ones (0 to disable)"),
+                                           cl::init(64));
+  cl::opt<bool> opt_full_arg("opt-full", cl::desc("Optimize every function with the whole pipeline, whatever its size and use"));
+  cl::opt<unsigned> opt_huge_size_arg("opt-huge-size",
+                                      cl::desc("Instructions above which a function only gets the capped pipeline"),
+                                      cl::init(2000));
+  cl::opt<unsigned> opt_hot_calls_arg("opt-hot-calls",
+                                      cl::desc("Calls after which a capped function is optimized fully (0 never)"),
+                                      cl::init(10000));
+  cl::opt<unsigned> jobs_arg("jobs",
+                             cl::desc("Threads compiling the functions of a module (0, the default, for one per core when "
+                                      "the input is not a terminal)"),
+                             cl::init(0));
+  cl::opt<std::string> emit_object_arg("emit-object",
+                                       cl::desc("Write the functions defined by the input as a native object on exit"),
+                                       cl::value_desc("filename"));
 
   cl::ParseCommandLineOptions(argc, argv,
                               " CommandLine compiler example\n\n"
@@ -330,6 +456,60 @@ int main(int argc, char **argv) {
 
   yydebug = yydebug_arg;
   noname::debug = std::max((int)debug_arg1, (int)debug_arg2);
+  noname::print_stats = stats_arg;
+  noname::jit_huge_pages = huge_pages_arg;
+  noname::jit_mcpu = mcpu_arg;
+  noname::jit_mattr = mattr_arg;
+  noname::fp_mode = fp_mode_arg;
+  noname::profile_file = profile_file_arg;
+  noname::emit_ast_file = emit_ast_arg;
+  noname::load_ast_file = load_ast_arg;
+  noname::emit_bitcode_file = emit_bitcode_arg;
+  noname::emit_object_file = emit_object_arg;
+  noname::restore_snapshot_file = restore_arg;
+  noname::specialize_limit = specialize_limit_arg;
+  noname::bytecode_fold_fuel = fold_fuel_arg;
+  noname::memo_mode = memo_arg;
+  noname::dedupe_expressions = dedupe_expressions_arg;
+  noname::adaptive_opt_level = !opt_full_arg;
+  noname::opt_huge_size = opt_huge_size_arg;
+  noname::opt_hot_calls = opt_hot_calls_arg;
+  noname::memo_capacity = std::max(1u, (unsigned)memo_capacity_arg);
+
+  if (profile_generate_arg && profile_use_arg) {
+    fatal_error("-profile-generate and -profile-use cannot be used together");
+  } else if (profile_generate_arg) {
+    noname::profile_mode = PROFILE_GENERATE;
+  } else if (profile_use_arg) {
+    noname::profile_mode = PROFILE_USE;
+
+    if (!load_profile(noname::profile_file)) {
+      fprintf(stderr, "\nWarning: could not read the profile '%s', running without it", noname::profile_file.c_str());
+    }
+  }
+
+  // a script read from a pipe or a file runs once: compiling its functions
+  // would take longer than running them. The profiles need compiled code, and
+  // so do -emit-bitcode and -emit-object.
+  bool emit_module = !noname::emit_bitcode_file.empty() || !noname::emit_object_file.empty();
+  noname::execution_tier = tier_arg;
+  if (noname::execution_tier == TIER_AUTO) {
+    noname::execution_tier =
+        isatty(fileno(stdin)) || noname::profile_mode != PROFILE_NONE || emit_module ? TIER_JIT : TIER_BYTECODE;
+  } else if (noname::execution_tier == TIER_BYTECODE && noname::profile_mode != PROFILE_NONE) {
+    fatal_error("-tier=bytecode cannot be used with -profile-generate or -profile-use");
+  } else if (noname::execution_tier == TIER_BYTECODE && emit_module) {
+    fatal_error("-tier=bytecode cannot be used with -emit-bitcode or -emit-object");
+  }
+
+  // a file defines all of its functions at once, a terminal one at a time.
+  // -emit-bitcode and -emit-object write the module optimized on the main thread.
+  noname::compile_jobs = jobs_arg;
+  if (emit_module) {
+    noname::compile_jobs = 1;
+  } else if (noname::compile_jobs == 0) {
+    noname::compile_jobs = isatty(fileno(stdin)) ? 1 : std::max(1u, std::thread::hardware_concurrency());
+  }
 
   if (atexit(exit_hook) != 0) {
     logError("Cannot set exit function\n");
@@ -344,54 +524,56 @@ int main(int argc, char **argv) {
   // assert_equals(cast<float>(1000.0), (float)1000.0);
   // exit(0);
   {
-    map[258] = "LINE_BREAK";
-    map[259] = "STMT_SEP";
-    map[260] = "LETTER";
-    map[261] = "DIGIT";
-    map[262] = "DIGITS";
-    map[263] = "DARROW";
-    map[264] = "ELSE_TOK";
-    map[265] = "FALSE";
-    map[266] = "IF_TOK";
-    map[267] = "IN_TOK";
-    map[268] = "LET_TOK";
-    map[269] = "DEF_TOK";
-    map[270] = "LOOP_TOK";
-    map[271] = "THEN_TOK";
-    map[272] = "WHILE";
-    map[273] = "BREAK_TOK";
-    map[274] = "CASE_TOK";
-    map[275] = "NEW_TOK";
-    map[276] = "NOT_TOK";
-    map[277] = "RETURN";
-    map[278] = "TRUE";
-    map[279] = "NEWLINE";
-    map[280] = "NOTNEWLINE";
-    map[281] = "WHITESPACE";
-    map[282] = "LE_TOK";
-    map[283] = "ASSIGN";
-    map[284] = "NULLCH";
-    map[285] = "BACKSLASH";
-    map[286] = "STAR_TOK";
-    map[287] = "NOTSTAR";
-    map[288] = "LEFTPAREN_TOK";
-    map[289] = "NOTLEFTPAREN_TOK";
-    map[290] = "RIGHTPAREN";
-    map[291] = "NOTRIGHTPAREN";
-    map[292] = "LINE_COMMENT";
-    map[293] = "START_COMMENT";
-    map[294] = "END_COMMENT";
-    map[295] = "QUOTES";
-    map[296] = "ERROR_TOK";
-    map[297] = "IDENTIFIER";
-    map[298] = "STR_CONST";
-    map[299] = "DOUBLE_TOK";
-    map[300] = "LONG_TOK";
-    map[314] = "NEG_TOK";
+    map[LINE_BREAK] = "LINE_BREAK";
+    map[IMPORT] = "IMPORT";
+    map[STMT_SEP] = "STMT_SEP";
+    map[LETTER] = "LETTER";
+    map[DIGIT] = "DIGIT";
+    map[DIGITS] = "DIGITS";
+    map[DARROW] = "DARROW";
+    map[ELSE_TOK] = "ELSE_TOK";
+    map[FALSE] = "FALSE";
+    map[IF_TOK] = "IF_TOK";
+    map[IN_TOK] = "IN_TOK";
+    map[LET_TOK] = "LET_TOK";
+    map[DEF_TOK] = "DEF_TOK";
+    map[LOOP_TOK] = "LOOP_TOK";
+    map[THEN_TOK] = "THEN_TOK";
+    map[WHILE] = "WHILE";
+    map[BREAK_TOK] = "BREAK_TOK";
+    map[CASE_TOK] = "CASE_TOK";
+    map[NEW_TOK] = "NEW_TOK";
+    map[NOT_TOK] = "NOT_TOK";
+    map[RETURN] = "RETURN";
+    map[TRUE] = "TRUE";
+    map[NEWLINE] = "NEWLINE";
+    map[NOTNEWLINE] = "NOTNEWLINE";
+    map[WHITESPACE] = "WHITESPACE";
+    map[LE_TOK] = "LE_TOK";
+    map[ASSIGN] = "ASSIGN";
+    map[NULLCH] = "NULLCH";
+    map[BACKSLASH] = "BACKSLASH";
+    map[STAR_TOK] = "STAR_TOK";
+    map[NOTSTAR] = "NOTSTAR";
+    map[LEFTPAREN_TOK] = "LEFTPAREN_TOK";
+    map[NOTLEFTPAREN_TOK] = "NOTLEFTPAREN_TOK";
+    map[RIGHTPAREN] = "RIGHTPAREN";
+    map[NOTRIGHTPAREN] = "NOTRIGHTPAREN";
+    map[LINE_COMMENT] = "LINE_COMMENT";
+    map[START_COMMENT] = "START_COMMENT";
+    map[END_COMMENT] = "END_COMMENT";
+    map[QUOTES] = "QUOTES";
+    map[ERROR_TOK] = "ERROR_TOK";
+    map[IDENTIFIER] = "IDENTIFIER";
+    map[STR_CONST] = "STR_CONST";
+    map[DOUBLE_TOK] = "DOUBLE_TOK";
+    map[LONG_TOK] = "LONG_TOK";
+    map[GE_TOK] = "GE_TOK";
+    map[EQ_TOK] = "EQ_TOK";
+    map[NE_TOK] = "NE_TOK";
+    map[NEG_TOK] = "NEG_TOK";
   }
 
-  fprintf(stdout, "\n[MUST INCLUDE BASIC LIBRARIES]\n");
-
   InitializeNativeTarget();
   InitializeNativeTargetAsmPrinter();
   InitializeNativeTargetAsmParser();
@@ -404,18 +586,12 @@ int main(int argc, char **argv) {
 
   noname::InitializeNonameEnvironment();
 
-  bootstrap_codes.push("def f1(a,b) { return a; };");
-  bootstrap_codes.push("def f2(a,b) { return b; };");
-  bootstrap_codes.push("def f3(a,b) { return a + b; };");
-  bootstrap_codes.push("f3(11, 22);");
-  bootstrap_codes.push("f1(11, 22);");
-
-  /**
-    * 
-    * How to load LLVM bitcode file from an ifstream?
-    * 
-    * http://stackoverflow.com/questions/22239801/how-to-load-llvm-bitcode-file-from-an-ifstream
-    */
+  // the standard library, already compiled
+  load_prelude(context);
+
+  if (!noname::restore_snapshot_file.empty() && !restore_snapshot(noname::restore_snapshot_file, context)) {
+    fprintf(stderr, "\nError: '%s' is not a session snapshot saved on this target", noname::restore_snapshot_file.c_str());
+  }
 
   int parse_output = yyparse();
 
@@ -0,0 +1,348 @@
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Verifier.h"
+#include "noname-memo.h"
+#include "noname-bytecode.h"
+#include "noname-opt-level.h"
+#include "noname-stats.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+namespace noname {
+
+extern LLVMContext TheContext;
+extern std::unique_ptr<Module> TheModule;
+
+MemoMode memo_mode = MEMO_ANNOTATED;
+unsigned memo_capacity = 4096;
+
+static Statistic NumMemoFunctions("memo", "functions", "Number of functions compiled memoized");
+static Statistic NumMemoHits("memo", "hits", "Number of calls answered by a memo cache");
+static Statistic NumMemoMisses("memo", "misses", "Number of calls that missed the memo cache");
+static Statistic NumMemoEvictions("memo", "evictions", "Number of results evicted from a memo cache");
+static Statistic NumMemoBypasses("memo", "bypasses", "Number of calls not cached, passing something else than numbers");
+
+// slots probed for a key from the one its hash points to
+static const size_t MEMO_PROBE_WINDOW = 8;
+// arguments of a key, which is built on the stack; calls passing more are not
+// cached
+static const int MEMO_MAX_ARITY = 8;
+
+namespace {
+struct MemoCache {
+  std::string name;
+  int arity;
+  size_t mask;
+  // per slot, 0 when empty; never emptied again, so a lookup stops at the
+  // first empty slot of the window
+  std::vector<uint64_t> hashes;
+  // per slot, type and bits of every argument
+  std::vector<uint64_t> keys;
+  // per slot, type and bits of the result, boxed on every hit: the box belongs
+  // to the caller like the result of any call, and nothing is left to free when
+  // the slot is taken over
+  std::vector<int> result_types;
+  std::vector<uint64_t> result_bits;
+  // hit since the clock hand last passed
+  std::vector<bool> referenced;
+  size_t hand;
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+};
+}
+
+static std::map<std::string, std::unique_ptr<MemoCache>> memo_caches;
+
+bool memo_requested(const FunctionDefNode* function_def_node) {
+  return memo_mode != MEMO_NONE && function_def_node->hasAnnotation("memo");
+}
+
+bool memo_function(const FunctionDefNode* function_def_node) {
+  const std::string& name = function_def_node->getName();
+  bool requested = memo_requested(function_def_node);
+
+  if (memo_mode == MEMO_NONE || is_host_entry_point(name) || (!requested && memo_mode != MEMO_AUTO)) {
+    return false;
+  }
+
+  int self_calls = 0;
+  if (!bytecode_is_pure(name, &self_calls)) {
+    if (requested) {
+      fprintf(stdout, "\nWarning: '%s' is not memoized, it is not pure", name.c_str());
+      fflush(stdout);
+    }
+    return false;
+  }
+
+  return requested || self_calls > 1;
+}
+
+Function* memo_wrapper_codegen(const FunctionDefNode* function_def_node, Function* function, Function* body) {
+  Type* int32_type = Type::getInt32Ty(TheContext);
+  size_t arity = datatype_args_size(function);
+
+  char cache_name[256];
+  snprintf(cache_name, sizeof(cache_name), "%s#%016" PRIx64, function_def_node->getName().c_str(), function_def_node->hash());
+
+  // one per module, set on the first call
+  GlobalVariable* cache_slot = new GlobalVariable(*TheModule, PointerTy_8, false, GlobalValue::InternalLinkage,
+                                                  ConstantPointerNull::get(PointerTy_8), body->getName() + "_cache");
+  Constant* cache_name_data = ConstantDataArray::getString(TheContext, cache_name);
+  GlobalVariable* cache_name_global = new GlobalVariable(*TheModule, cache_name_data->getType(), true, GlobalValue::PrivateLinkage,
+                                                         cache_name_data, body->getName() + "_name");
+
+  FunctionType* cache_type = FunctionType::get(PointerTy_8, {PointerTy_8, int32_type}, false);
+  FunctionType* lookup_type = FunctionType::get(
+      int32_type, {PointerTy_8, PointerTy_StructTy_struct_datatype_t, PointerTy_StructTy_struct_datatype_t}, false);
+  FunctionType* store_type = FunctionType::get(
+      Type::getVoidTy(TheContext), {PointerTy_8, PointerTy_StructTy_struct_datatype_t, int32_type, PointerTy_8}, false);
+
+  BasicBlock* entry_bb = BasicBlock::Create(TheContext, "memo_entry", function);
+  BasicBlock* init_bb = BasicBlock::Create(TheContext, "memo_init", function);
+  BasicBlock* lookup_bb = BasicBlock::Create(TheContext, "memo_lookup", function);
+  BasicBlock* hit_bb = BasicBlock::Create(TheContext, "memo_hit", function);
+  BasicBlock* miss_bb = BasicBlock::Create(TheContext, "memo_miss", function);
+
+  // the arguments as the datatype_t array the cache takes
+  AllocaInst* args = new AllocaInst(StructTy_struct_datatype_t, ConstantInt::get(int32_type, arity ? arity : 1), "memo_args", entry_bb);
+  AllocaInst* result = new AllocaInst(StructTy_struct_datatype_t, "memo_result", entry_bb);
+
+  std::vector<Value*> body_args;
+  Function::arg_iterator it_function_args = function->arg_begin();
+  for (size_t i = 0; i < arity; i++) {
+    Value* arg_type = (Argument*)it_function_args++;
+    Value* arg_v = (Argument*)it_function_args++;
+    body_args.push_back(arg_type);
+    body_args.push_back(arg_v);
+
+    GetElementPtrInst* arg = GetElementPtrInst::Create(StructTy_struct_datatype_t, args, ConstantInt::get(int32_type, i), "", entry_bb);
+    store_typed_var_codegen(TYPE_INT, arg_type, get_element_ptr_type_codegen(arg, "", entry_bb), entry_bb);
+    store_typed_var_codegen(TYPE_VOID_POINTER, arg_v, get_element_ptr_v_codegen(arg, "", entry_bb), entry_bb);
+  }
+
+  LoadInst* cache = load_inst_codegen(TYPE_VOID_POINTER, cache_slot, entry_bb);
+  ICmpInst* no_cache = new ICmpInst(*entry_bb, ICmpInst::ICMP_EQ, cache, ConstantPointerNull::get(PointerTy_8), "no_cache");
+  BranchInst::Create(init_bb, lookup_bb, no_cache, entry_bb);
+
+  Constant* cache_name_ptr = ConstantExpr::getBitCast(cache_name_global, PointerTy_8);
+  CallInst* new_cache = CallInst::Create(host_function_codegen("noname_memo_cache", cache_type),
+                                         {cache_name_ptr, ConstantInt::get(int32_type, arity)}, "new_cache", init_bb);
+  store_typed_var_codegen(TYPE_VOID_POINTER, new_cache, cache_slot, init_bb);
+  BranchInst::Create(lookup_bb, init_bb);
+
+  PHINode* lookup_cache = PHINode::Create(PointerTy_8, 2, "cache", lookup_bb);
+  lookup_cache->addIncoming(cache, entry_bb);
+  lookup_cache->addIncoming(new_cache, init_bb);
+  CallInst* found = CallInst::Create(host_function_codegen("noname_memo_lookup", lookup_type), {lookup_cache, args, result},
+                                     "found", lookup_bb);
+  ICmpInst* hit = new ICmpInst(*lookup_bb, ICmpInst::ICMP_NE, found, ConstantInt::get(int32_type, 0), "hit");
+  BranchInst::Create(hit_bb, miss_bb, hit, lookup_bb);
+
+  ReturnInst::Create(TheContext, load_inst_codegen(TYPE_DATATYPE, result, hit_bb), hit_bb);
+
+  CallInst* computed = CallInst::Create(body, body_args, "computed", miss_bb);
+  computed->setCallingConv(body->getCallingConv());
+  ExtractValueInst* computed_type = ExtractValueInst::Create(computed, {0}, "", miss_bb);
+  ExtractValueInst* computed_v = ExtractValueInst::Create(computed, {1}, "", miss_bb);
+  CallInst::Create(host_function_codegen("noname_memo_store", store_type), {lookup_cache, args, computed_type, computed_v}, "",
+                   miss_bb);
+  ReturnInst::Create(TheContext, computed, miss_bb);
+
+  if (!verifyFunction(*function, &errs())) {
+    optimize_function(function, nullptr);
+  }
+
+  if (noname::debug >= 1) {
+    fprintf(stdout, "\n[Function %s memoized, computed by %s]", function->getName().str().c_str(), body->getName().str().c_str());
+    fflush(stdout);
+  }
+
+  ++NumMemoFunctions;
+  return function;
+}
+
+void print_memo_statistics(FILE* file) {
+  for (auto& it : memo_caches) {
+    const MemoCache& cache = *it.second;
+    fprintf(file, "%14" PRIu64 " %-12s - %s\n", cache.hits, "memo", ("hits of " + cache.name).c_str());
+    fprintf(file, "%14" PRIu64 " %-12s - %s\n", cache.misses, "memo", ("misses of " + cache.name).c_str());
+    fprintf(file, "%14" PRIu64 " %-12s - %s\n", cache.evictions, "memo", ("evictions of " + cache.name).c_str());
+  }
+  fflush(file);
+}
+
+// The bits of a boxed number: those of the double for floating point types, of
+// the long otherwise
+static uint64_t number_bits(int type, const void* v) {
+  TaggedValue value = TaggedValue::borrowed(type, v);
+  uint64_t bits = 0;
+  if (type == TYPE_DOUBLE || type == TYPE_FLOAT) {
+    double number = value.as<double>();
+    memcpy(&bits, &number, sizeof(bits));
+  } else {
+    bits = (uint64_t)value.as<long>();
+  }
+  return bits;
+}
+
+static TaggedValue number_from_bits(int type, uint64_t bits) {
+  double number;
+  memcpy(&number, &bits, sizeof(number));
+
+  switch (type) {
+    case TYPE_CHAR:
+      return TaggedValue((char)bits);
+    case TYPE_SHORT:
+      return TaggedValue((short)bits);
+    case TYPE_INT:
+      return TaggedValue((int)bits);
+    case TYPE_FLOAT:
+      return TaggedValue((float)number);
+    case TYPE_LONG:
+      return TaggedValue((long)bits);
+    default:
+      return TaggedValue(number);
+  }
+}
+
+// Type and bits of every argument, like the constant patterns of the clones;
+// false when an argument is not a number or there are too many of them
+static bool memo_key(const MemoCache& cache, const datatype_t* args, uint64_t* key, uint64_t& hash) {
+  hash = 0xcbf29ce484222325ULL;
+
+  if (cache.arity > MEMO_MAX_ARITY) {
+    return false;
+  }
+
+  for (int i = 0; i < cache.arity; i++) {
+    if (!is_numeric_type(args[i].type)) {
+      return false;
+    }
+
+    uint64_t bits = number_bits(args[i].type, args[i].v);
+
+    key[2 * i] = (uint64_t)args[i].type;
+    key[2 * i + 1] = bits;
+    hash = (hash ^ key[2 * i]) * 0x100000001b3ULL;
+    hash = (hash ^ bits) * 0x100000001b3ULL;
+  }
+
+  hash ^= hash >> 29;
+  // 0 marks the empty slots
+  hash |= 1;
+  return true;
+}
+
+static bool memo_key_equals(const MemoCache& cache, size_t slot, const uint64_t* key) {
+  size_t key_size = 2 * cache.arity;
+  return std::equal(key, key + key_size, cache.keys.begin() + slot * key_size);
+}
+
+void* noname_memo_cache(const char* cache_name, int arity) {
+  std::unique_ptr<MemoCache>& cache = memo_caches[cache_name];
+
+  if (!cache) {
+    size_t capacity = 1;
+    while (capacity < memo_capacity) {
+      capacity <<= 1;
+    }
+
+    cache.reset(new MemoCache());
+    cache->name = std::string(cache_name).substr(0, std::string(cache_name).find('#'));
+    cache->arity = arity;
+    cache->mask = capacity - 1;
+    cache->hashes.assign(capacity, 0);
+    cache->keys.assign(capacity * 2 * arity, 0);
+    cache->result_types.assign(capacity, TYPE_VOID);
+    cache->result_bits.assign(capacity, 0);
+    cache->referenced.assign(capacity, false);
+    cache->hand = 0;
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->evictions = 0;
+  }
+
+  return cache.get();
+}
+
+int noname_memo_lookup(void* cache_ptr, const datatype_t* args, datatype_t* result) {
+  MemoCache& cache = *(MemoCache*)cache_ptr;
+  uint64_t key[2 * MEMO_MAX_ARITY];
+  uint64_t hash;
+
+  if (!memo_key(cache, args, key, hash)) {
+    ++NumMemoBypasses;
+    return 0;
+  }
+
+  size_t window = std::min(MEMO_PROBE_WINDOW, cache.mask + 1);
+  for (size_t i = 0; i < window; i++) {
+    size_t slot = (hash + i) & cache.mask;
+
+    if (!cache.hashes[slot]) {
+      break;
+    }
+
+    if (cache.hashes[slot] == hash && memo_key_equals(cache, slot, key)) {
+      cache.referenced[slot] = true;
+      result->type = cache.result_types[slot];
+      result->v = number_from_bits(cache.result_types[slot], cache.result_bits[slot]).box();
+      ++cache.hits;
+      ++NumMemoHits;
+      return 1;
+    }
+  }
+
+  ++cache.misses;
+  ++NumMemoMisses;
+  return 0;
+}
+
+void noname_memo_store(void* cache_ptr, const datatype_t* args, int result_type, void* result_v) {
+  MemoCache& cache = *(MemoCache*)cache_ptr;
+  uint64_t key[2 * MEMO_MAX_ARITY];
+  uint64_t hash;
+
+  if (!is_numeric_type(result_type) || !memo_key(cache, args, key, hash)) {
+    return;
+  }
+
+  size_t window = std::min(MEMO_PROBE_WINDOW, cache.mask + 1);
+  size_t slot = cache.mask + 1;
+
+  for (size_t i = 0; i < window; i++) {
+    size_t probed = (hash + i) & cache.mask;
+    if (!cache.hashes[probed] || (cache.hashes[probed] == hash && memo_key_equals(cache, probed, key))) {
+      slot = probed;
+      break;
+    }
+  }
+
+  // the window is full: the clock hand passes over it, sparing the results hit
+  // since it last did, twice around at most
+  for (size_t i = 0; slot > cache.mask && i < 2 * window; i++) {
+    size_t probed = (hash + cache.hand++ % window) & cache.mask;
+    if (cache.referenced[probed]) {
+      cache.referenced[probed] = false;
+    } else {
+      slot = probed;
+      ++cache.evictions;
+      ++NumMemoEvictions;
+    }
+  }
+
+  cache.hashes[slot] = hash;
+  std::copy(key, key + 2 * cache.arity, cache.keys.begin() + slot * 2 * cache.arity);
+  cache.result_types[slot] = result_type;
+  cache.result_bits[slot] = number_bits(result_type, result_v);
+  cache.referenced[slot] = false;
+}
+}
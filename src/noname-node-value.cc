@@ -59,11 +59,16 @@ NodeValue::NodeValue(long value) : type(TYPE_LONG), value(0) {
   initialize();
   this->value = get_copy_address_long(value);
 }
+NodeValue::NodeValue(const BigInt& value) : type(TYPE_BIGINT), value(0) {
+  initialize();
+  this->value = new BigInt(value);
+}
 NodeValue::~NodeValue() {
   if (noname::debug >= 1) {
     fprintf(stderr, "\n[NodeValue::~NodeValue() called]");
   }
 }
+
 Value* constant_codegen_util(int type, void* value, llvm::BasicBlock* bb) {
   Value* constant_value = nullptr;
 
@@ -110,155 +115,87 @@ Value* constant_codegen_util(int type, void* value, llvm::BasicBlock* bb) {
 }
 Value* NodeValue::constant_codegen(llvm::BasicBlock* bb) { return constant_codegen_util(type, value, bb); }
 
-void* NodeValue::getValue(int as_type) const {
-  // string
-  if (as_type == TYPE_STRING && type != TYPE_STRING) {
-    return nullptr;
-  }
-  // double
-  if (as_type == TYPE_DOUBLE) {
-    if (type == TYPE_DOUBLE) {
-      return value;
-    }
-    double* doublep_res = new double;
-    if (type == TYPE_FLOAT) {
-      double double_res = (double)*(float*)value;
-      *doublep_res = double_res;
-    } else if (type == TYPE_LONG) {
-      double double_res = (double)*(long*)value;
-      *doublep_res = double_res;
-    } else if (type == TYPE_INT) {
-      double double_res = (double)*(int*)value;
-      *doublep_res = double_res;
-    } else if (type == TYPE_SHORT) {
-      double double_res = (double)*(short*)value;
-      *doublep_res = double_res;
-    } else if (type == TYPE_CHAR) {
-      double double_res = (double)*(char*)value;
-      *doublep_res = double_res;
-    }
-    return doublep_res;
-  }
-  // float
-  if (as_type == TYPE_FLOAT) {
-    if (type == TYPE_FLOAT) {
-      return value;
-    }
-    float* floatp_res = new float;
-    if (type == TYPE_DOUBLE) {
-      float float_res = (float)*(double*)value;
-      *floatp_res = float_res;
-    } else if (type == TYPE_LONG) {
-      float float_res = (float)*(long*)value;
-      *floatp_res = float_res;
-    } else if (type == TYPE_INT) {
-      float float_res = (float)*(int*)value;
-      *floatp_res = float_res;
-    } else if (type == TYPE_SHORT) {
-      float float_res = (float)*(short*)value;
-      *floatp_res = float_res;
-    } else if (type == TYPE_CHAR) {
-      float float_res = (float)*(char*)value;
-      *floatp_res = float_res;
-    }
-    return floatp_res;
+TaggedValue::TaggedValue(const std::string& value) : type(TYPE_STRING), owner(std::make_shared<std::string>(value)) {
+  p = owner.get();
+}
+
+TaggedValue::TaggedValue(const BigInt& value) : type(TYPE_BIGINT), owner(std::make_shared<BigInt>(value)) { p = owner.get(); }
+
+TaggedValue TaggedValue::borrowed(int type, const void* raw_value) {
+  if (!raw_value) {
+    return TaggedValue();
   }
-  // long
-  if (as_type == TYPE_LONG) {
-    if (type == TYPE_LONG) {
-      return value;
-    }
-    long* longp_res = new long;
-    if (type == TYPE_DOUBLE) {
-      long long_res = (long)*(double*)value;
-      *longp_res = long_res;
-    } else if (type == TYPE_FLOAT) {
-      long long_res = (long)*(float*)value;
-      *longp_res = long_res;
-    } else if (type == TYPE_INT) {
-      long long_res = (long)*(int*)value;
-      *longp_res = long_res;
-    } else if (type == TYPE_SHORT) {
-      long long_res = (long)*(short*)value;
-      *longp_res = long_res;
-    } else if (type == TYPE_CHAR) {
-      long long_res = (long)*(char*)value;
-      *longp_res = long_res;
-    }
-    return longp_res;
+
+  if (type == TYPE_DOUBLE) {
+    return TaggedValue(*(const double*)raw_value);
+  } else if (type == TYPE_FLOAT) {
+    return TaggedValue(*(const float*)raw_value);
+  } else if (type == TYPE_LONG) {
+    return TaggedValue(*(const long*)raw_value);
+  } else if (type == TYPE_INT) {
+    return TaggedValue(*(const int*)raw_value);
+  } else if (type == TYPE_SHORT) {
+    return TaggedValue(*(const short*)raw_value);
+  } else if (type == TYPE_CHAR) {
+    return TaggedValue(*(const char*)raw_value);
+  } else if (type == TYPE_STRING || type == TYPE_BIGINT) {
+    TaggedValue value;
+    value.type = type;
+    value.p = raw_value;
+    return value;
   }
-  // int
-  if (as_type == TYPE_INT) {
-    if (type == TYPE_INT) {
-      return value;
-    }
-    int* intp_res = new int;
-    if (type == TYPE_DOUBLE) {
-      int int_res = (int)*(double*)value;
-      *intp_res = int_res;
-    } else if (type == TYPE_FLOAT) {
-      int int_res = (int)*(float*)value;
-      *intp_res = int_res;
-    } else if (type == TYPE_LONG) {
-      int int_res = (int)*(long*)value;
-      *intp_res = int_res;
-    } else if (type == TYPE_SHORT) {
-      int int_res = (int)*(short*)value;
-      *intp_res = int_res;
-    } else if (type == TYPE_CHAR) {
-      int int_res = (int)*(char*)value;
-      *intp_res = int_res;
-    }
-    return intp_res;
+
+  return TaggedValue();
+}
+
+BigInt TaggedValue::asBigInt() const {
+  if (type == TYPE_BIGINT) {
+    return *(const BigInt*)p;
   }
-  // short
-  if (as_type == TYPE_SHORT) {
-    if (type == TYPE_SHORT) {
-      return value;
-    }
-    short* shortp_res = new short;
-    if (type == TYPE_DOUBLE) {
-      short short_res = (short)*(double*)value;
-      *shortp_res = short_res;
-    } else if (type == TYPE_FLOAT) {
-      short short_res = (short)*(float*)value;
-      *shortp_res = short_res;
-    } else if (type == TYPE_LONG) {
-      short short_res = (short)*(long*)value;
-      *shortp_res = short_res;
-    } else if (type == TYPE_INT) {
-      short short_res = (short)*(int*)value;
-      *shortp_res = short_res;
-    } else if (type == TYPE_CHAR) {
-      short short_res = (short)*(char*)value;
-      *shortp_res = short_res;
-    }
-    return shortp_res;
+  return BigInt(as<long>());
+}
+
+NodeValue* TaggedValue::toNodeValue() const {
+  if (type == TYPE_DOUBLE) {
+    return new NodeValue(d);
+  } else if (type == TYPE_FLOAT) {
+    return new NodeValue(f);
+  } else if (type == TYPE_LONG) {
+    return new NodeValue(l);
+  } else if (type == TYPE_INT) {
+    return new NodeValue(i);
+  } else if (type == TYPE_SHORT) {
+    return new NodeValue(s);
+  } else if (type == TYPE_CHAR) {
+    return new NodeValue(c);
+  } else if (type == TYPE_STRING) {
+    return new NodeValue(asString());
+  } else if (type == TYPE_BIGINT) {
+    return new NodeValue(*(const BigInt*)p);
   }
-  // char
-  if (as_type == TYPE_CHAR) {
-    if (type == TYPE_CHAR) {
-      return value;
-    }
-    char* charp_res = new char;
-    if (type == TYPE_DOUBLE) {
-      char char_res = (char)*(double*)value;
-      *charp_res = char_res;
-    } else if (type == TYPE_FLOAT) {
-      char char_res = (char)*(float*)value;
-      *charp_res = char_res;
-    } else if (type == TYPE_LONG) {
-      char char_res = (char)*(long*)value;
-      *charp_res = char_res;
-    } else if (type == TYPE_INT) {
-      char char_res = (char)*(int*)value;
-      *charp_res = char_res;
-    } else if (type == TYPE_SHORT) {
-      char char_res = (char)*(short*)value;
-      *charp_res = char_res;
-    }
-    return charp_res;
+
+  return nullptr;
+}
+
+void* TaggedValue::box() const {
+  if (type == TYPE_DOUBLE) {
+    return get_copy_address_double(d);
+  } else if (type == TYPE_FLOAT) {
+    return get_copy_address_float(f);
+  } else if (type == TYPE_LONG) {
+    return get_copy_address_long(l);
+  } else if (type == TYPE_INT) {
+    return get_copy_address_int(i);
+  } else if (type == TYPE_SHORT) {
+    return get_copy_address_short(s);
+  } else if (type == TYPE_CHAR) {
+    return get_copy_address_char(c);
+  } else if (type == TYPE_STRING) {
+    return get_copy_address_string(asString());
+  } else if (type == TYPE_BIGINT) {
+    return new BigInt(*(const BigInt*)p);
   }
-  return value;
+
+  return nullptr;
 }
 }
\ No newline at end of file
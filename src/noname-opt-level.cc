@@ -0,0 +1,392 @@
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/Transforms/IPO.h"
+#include "llvm/Transforms/Scalar.h"
+#include "llvm/Transforms/Vectorize.h"
+#include "noname-utils.h"
+#include "noname-types.h"
+#include "noname-jit.h"
+#include "noname-opt-level.h"
+#include "noname-parallel.h"
+#include "noname-stats.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+using namespace llvm::orc;
+
+namespace noname {
+
+extern LLVMContext TheContext;
+extern std::unique_ptr<Module> TheModule;
+extern std::unique_ptr<legacy::FunctionPassManager> TheFPM;
+extern std::unique_ptr<NonameJIT> TheJIT;
+
+void CreateNewModuleAndInitialize();
+
+bool adaptive_opt_level = true;
+unsigned opt_huge_size = 2000;
+unsigned opt_hot_calls = 10000;
+
+static Statistic NumOptLevelNone("opt-level", "none", "Number of functions compiled without optimizations");
+static Statistic NumOptLevelCapped("opt-level", "capped", "Number of functions compiled with the capped pipeline");
+static Statistic NumOptLevelFull("opt-level", "full", "Number of functions compiled with the full pipeline");
+static Statistic NumOptLevelHot("opt-level", "hot", "Number of capped functions compiled again at full once hot");
+
+static const char* opt_level_names[] = {"none", "capped", "full"};
+
+namespace {
+// what the IR passes or the code generator cost at one level
+struct LevelCost {
+  uint64_t instructions;
+  uint64_t microseconds;
+};
+
+struct CappedFunction {
+  FunctionDefNode* function_def_node;
+  // the counter of calls of the last code compiled, nullptr until it is linked
+  uint64_t* calls;
+};
+}
+
+static LevelCost optimization_costs[3];
+static LevelCost codegen_costs[3];
+// the pending passes and the code generator may run on several threads
+static std::mutex costs_mutex;
+// the capped functions, by name, until they get hot
+static std::map<std::string, CappedFunction> capped_functions;
+// definitions to compile at full whatever their size
+static std::set<const FunctionDefNode*> hot_functions;
+
+// the capped pipeline of TheModule
+static std::unique_ptr<legacy::FunctionPassManager> capped_fpm;
+static const Module* capped_fpm_module = nullptr;
+
+static uint64_t now_microseconds() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+size_t count_instructions(const Function& function) {
+  size_t instructions = 0;
+  for (const BasicBlock& bb : function) {
+    instructions += bb.size();
+  }
+  return instructions;
+}
+
+size_t count_instructions(const Module& module) {
+  size_t instructions = 0;
+  for (const Function& function : module) {
+    instructions += count_instructions(function);
+  }
+  return instructions;
+}
+
+static void add_cost(LevelCost* costs, OptLevel level, uint64_t instructions, uint64_t microseconds) {
+  std::lock_guard<std::mutex> lock(costs_mutex);
+  costs[level].instructions += instructions;
+  costs[level].microseconds += microseconds;
+}
+
+static OptLevel parse_opt_level(StringRef name) {
+  return name == "none" ? OPT_LEVEL_NONE : name == "capped" ? OPT_LEVEL_CAPPED : OPT_LEVEL_FULL;
+}
+
+static std::string calls_symbol(const std::string& name) { return "noname_calls_" + name; }
+
+static OptLevel function_opt_level(const Function* function, const FunctionDefNode* function_def_node, size_t instructions) {
+  if (!adaptive_opt_level) {
+    return OPT_LEVEL_FULL;
+  }
+
+  if (is_host_entry_point(function->getName().str())) {
+    return OPT_LEVEL_NONE;
+  }
+
+  if (instructions > opt_huge_size && !hot_functions.count(function_def_node)) {
+    return OPT_LEVEL_CAPPED;
+  }
+
+  return OPT_LEVEL_FULL;
+}
+
+void add_function_passes(legacy::FunctionPassManager& fpm, OptLevel level, TargetMachine& target_machine) {
+  // Let the loop passes query the costs of the host CPU.
+  fpm.add(createTargetTransformInfoWrapperPass(target_machine.getTargetIRAnalysis()));
+  // Promote the stack slots of the variables to SSA values (phi nodes).
+  fpm.add(createSROAPass());
+  fpm.add(createPromoteMemoryToRegisterPass());
+
+  if (level == OPT_LEVEL_CAPPED) {
+    fpm.add(createEarlyCSEPass());
+    fpm.add(createCFGSimplificationPass());
+    return;
+  }
+
+  // Do simple "peephole" optimizations and bit-twiddling optzns.
+  fpm.add(createInstructionCombiningPass());
+  // Reassociate expressions.
+  fpm.add(createReassociatePass());
+  // Eliminate Common SubExpressions.
+  fpm.add(createGVNPass());
+  // Simplify the control flow graph (deleting unreachable blocks, etc).
+  fpm.add(createCFGSimplificationPass());
+  // Loop pipeline: canonical loops, invariant code hoisted out of them,
+  // canonical induction variables, then unrolling and vectorization.
+  fpm.add(createLoopRotatePass());
+  fpm.add(createLICMPass());
+  fpm.add(createIndVarSimplifyPass());
+  fpm.add(createLoopUnrollPass());
+  fpm.add(createLoopVectorizePass());
+  // Clean up after the loop passes.
+  fpm.add(createInstructionCombiningPass());
+  fpm.add(createCFGSimplificationPass());
+}
+
+static legacy::FunctionPassManager& get_capped_fpm() {
+  if (!capped_fpm || capped_fpm_module != TheModule.get()) {
+    capped_fpm = llvm::make_unique<legacy::FunctionPassManager>(TheModule.get());
+    add_function_passes(*capped_fpm, OPT_LEVEL_CAPPED, TheJIT->getTargetMachine());
+    capped_fpm->doInitialization();
+    capped_fpm_module = TheModule.get();
+  }
+  return *capped_fpm;
+}
+
+// Bumps the call counter of the function on entry, in a global of its module
+// the host finds once the module is linked
+static void calls_counter_codegen(Function* function) {
+  Type* int64_type = Type::getInt64Ty(TheContext);
+  std::string symbol = calls_symbol(function->getName().str());
+
+  GlobalVariable* calls = TheModule->getNamedGlobal(symbol);
+  if (!calls) {
+    calls = new GlobalVariable(*TheModule, int64_type, false, GlobalValue::ExternalLinkage, ConstantInt::get(int64_type, 0), symbol);
+  }
+
+  Instruction* first = &*function->getEntryBlock().getFirstInsertionPt();
+  LoadInst* count = new LoadInst(calls, "calls", first);
+  BinaryOperator* next_count = BinaryOperator::CreateAdd(count, ConstantInt::get(int64_type, 1), "", first);
+  new StoreInst(next_count, calls, first);
+}
+
+void optimize_function(Function* function, FunctionDefNode* function_def_node) {
+  size_t instructions = count_instructions(*function);
+  OptLevel level = function_opt_level(function, function_def_node, instructions);
+
+  function->addFnAttr("noname-opt-level", opt_level_names[level]);
+
+  // the clones (.spec, .memo) are never compiled again by name
+  bool named = function_def_node && function->getName() == function_def_node->getName();
+
+  if (level == OPT_LEVEL_CAPPED && named && opt_hot_calls) {
+    calls_counter_codegen(function);
+    capped_functions[function->getName().str()] = CappedFunction{function_def_node, nullptr};
+  } else if (named) {
+    capped_functions.erase(function->getName().str());
+  }
+
+  if (level == OPT_LEVEL_FULL) {
+    ++NumOptLevelFull;
+  } else if (level == OPT_LEVEL_CAPPED) {
+    ++NumOptLevelCapped;
+  } else {
+    ++NumOptLevelNone;
+  }
+
+  // the passes run on a compile thread (see noname-parallel.h)
+  bool pending = level != OPT_LEVEL_NONE && compile_jobs > 1;
+
+  if (pending) {
+    function->addFnAttr("noname-opt-pending");
+  } else {
+    uint64_t start = now_microseconds();
+
+    if (level == OPT_LEVEL_FULL) {
+      TheFPM->run(*function);
+    } else if (level == OPT_LEVEL_CAPPED) {
+      get_capped_fpm().run(*function);
+    }
+
+    add_cost(optimization_costs, level, instructions, now_microseconds() - start);
+  }
+
+  if (noname::debug >= 1) {
+    fprintf(stdout, "\n[function %s %s at level %s: %zu instructions]", function->getName().str().c_str(),
+            pending ? "left to optimize" : "optimized", opt_level_names[level], instructions);
+    fflush(stdout);
+  }
+}
+
+void run_pending_passes(Module& module, TargetMachine& target_machine) {
+  // built on the first pending function of each level
+  std::unique_ptr<legacy::FunctionPassManager> fpms[3];
+
+  for (Function& function : module) {
+    if (function.isDeclaration() || !function.hasFnAttribute("noname-opt-pending")) {
+      continue;
+    }
+
+    function.removeFnAttr("noname-opt-pending");
+    OptLevel level = parse_opt_level(function.getFnAttribute("noname-opt-level").getValueAsString());
+
+    if (!fpms[level]) {
+      fpms[level] = llvm::make_unique<legacy::FunctionPassManager>(&module);
+      add_function_passes(*fpms[level], level, target_machine);
+      fpms[level]->doInitialization();
+    }
+
+    size_t instructions = count_instructions(function);
+    uint64_t start = now_microseconds();
+    fpms[level]->run(function);
+    add_cost(optimization_costs, level, instructions, now_microseconds() - start);
+
+    if (noname::debug >= 1) {
+      fprintf(stdout, "\n[function %s optimized at level %s: %zu instructions]", function.getName().str().c_str(),
+              opt_level_names[level], instructions);
+      fflush(stdout);
+    }
+  }
+}
+
+void opt_level_optimize_module(Module& module) {
+  if (!adaptive_opt_level) {
+    return;
+  }
+
+  if (get_module_opt_level(module) != OPT_LEVEL_FULL) {
+    return;
+  }
+
+  // only worth it when a function calls another one defined next to it
+  bool has_local_calls = false;
+  for (Function& function : module) {
+    if (function.isDeclaration()) {
+      continue;
+    }
+
+    for (User* user : function.users()) {
+      if (isa<CallInst>(user) && ((CallInst*)user)->getParent()->getParent() != &function) {
+        has_local_calls = true;
+      }
+    }
+  }
+
+  if (!has_local_calls) {
+    return;
+  }
+
+  uint64_t start = now_microseconds();
+
+  legacy::PassManager pass_manager;
+  pass_manager.add(createFunctionInliningPass());
+  pass_manager.run(module);
+
+  add_cost(optimization_costs, OPT_LEVEL_FULL, 0, now_microseconds() - start);
+}
+
+OptLevel get_module_opt_level(const Module& module) {
+  bool any_level = false;
+  OptLevel module_level = OPT_LEVEL_NONE;
+
+  for (const Function& function : module) {
+    if (function.isDeclaration() || !function.hasFnAttribute("noname-opt-level")) {
+      continue;
+    }
+
+    OptLevel level = parse_opt_level(function.getFnAttribute("noname-opt-level").getValueAsString());
+    module_level = std::max(module_level, level);
+    any_level = true;
+  }
+
+  return any_level ? module_level : OPT_LEVEL_FULL;
+}
+
+void opt_level_module_compiled(OptLevel level, uint64_t instructions, uint64_t microseconds) {
+  add_cost(codegen_costs, level, instructions, microseconds);
+}
+
+void opt_level_tier_up() {
+  if (!opt_hot_calls || capped_functions.empty()) {
+    return;
+  }
+
+  std::vector<FunctionDefNode*> hot;
+  for (auto& it : capped_functions) {
+    CappedFunction& capped = it.second;
+
+    if (!capped.calls) {
+      JITSymbol symbol = TheJIT->findSymbol(calls_symbol(it.first));
+      capped.calls = symbol ? (uint64_t*)symbol.getAddress() : nullptr;
+    }
+
+    if (capped.calls && *capped.calls >= opt_hot_calls) {
+      hot.push_back(capped.function_def_node);
+    }
+  }
+
+  if (hot.empty()) {
+    return;
+  }
+
+  // what was compiled so far may still be in TheModule, which cannot define
+  // the functions twice
+  CreateNewModuleAndInitialize();
+
+  for (FunctionDefNode* function_def_node : hot) {
+    if (noname::debug >= 1) {
+      fprintf(stdout, "\n[Compiling %s again at full: it is hot]", function_def_node->getName().c_str());
+      fflush(stdout);
+    }
+
+    hot_functions.insert(function_def_node);
+    capped_functions.erase(function_def_node->getName());
+
+    if (!function_def_node->codegen()) {
+      fprintf(stdout, "\nFunction %s could not be compiled", function_def_node->getName().c_str());
+      fflush(stdout);
+    }
+
+    ++NumOptLevelHot;
+  }
+}
+
+void print_opt_level_statistics(FILE* file) {
+  int64_t saved = 0;
+  bool estimated = false;
+
+  for (int level = OPT_LEVEL_NONE; level <= OPT_LEVEL_FULL; ++level) {
+    fprintf(file, "%14" PRIu64 " %-12s - %s\n", optimization_costs[level].microseconds, "opt-level",
+            (std::string("microseconds optimizing at ") + opt_level_names[level]).c_str());
+    fprintf(file, "%14" PRIu64 " %-12s - %s\n", codegen_costs[level].microseconds, "opt-level",
+            (std::string("microseconds generating code at ") + opt_level_names[level]).c_str());
+  }
+
+  // what the instructions of the lower levels would have cost at full
+  for (const LevelCost* costs : {optimization_costs, codegen_costs}) {
+    const LevelCost& full = costs[OPT_LEVEL_FULL];
+    if (!full.instructions) {
+      continue;
+    }
+
+    for (int level = OPT_LEVEL_NONE; level < OPT_LEVEL_FULL; ++level) {
+      saved += (int64_t)(costs[level].instructions * full.microseconds / full.instructions) - (int64_t)costs[level].microseconds;
+    }
+    estimated = true;
+  }
+
+  if (estimated) {
+    fprintf(file, "%14" PRId64 " %-12s - %s\n", saved, "opt-level", "microseconds saved (estimated from the cost at full)");
+  }
+  fflush(file);
+}
+}
@@ -0,0 +1,198 @@
+#include "llvm/Bitcode/ReaderWriter.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/Object/ObjectFile.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Transforms/Utils/SplitModule.h"
+#include "noname-utils.h"
+#include "noname-types.h"
+#include "noname-jit.h"
+#include "noname-opt-level.h"
+#include "noname-parallel.h"
+#include "noname-profile.h"
+#include "noname-runtime.h"
+#include "noname-stats.h"
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace llvm;
+using namespace llvm::orc;
+
+namespace noname {
+
+extern LLVMContext TheContext;
+extern std::unique_ptr<NonameJIT> TheJIT;
+
+unsigned compile_jobs = 1;
+
+// below that, starting the threads costs more than they save
+static const size_t parallel_min_instructions = 1000;
+
+static Statistic NumParallelModules("parallel", "modules", "Number of modules compiled on several threads");
+static Statistic NumParallelParts("parallel", "parts", "Number of module parts compiled by the threads");
+static Statistic NumParallelFallbacks("parallel", "fallbacks", "Number of parts compiled again on the main thread");
+
+namespace {
+// One per thread, kept from a module to the next: the parts it compiles are
+// read into its context, where the runtime is only parsed the first time
+struct CompileWorker {
+  LLVMContext context;
+  std::unique_ptr<TargetMachine> target_machine;
+  std::unique_ptr<Module> runtime;
+  bool runtime_loaded;
+};
+
+struct CompilePart {
+  // written by the main thread
+  SmallVector<char, 0> bitcode;
+  // its code points into this process (see embeds_host_addresses)
+  bool host_addresses;
+  CompileWorker* worker;
+  // nullptr when the part could not be compiled
+  std::unique_ptr<MemoryBuffer> object;
+  std::string error;
+};
+}
+
+static std::vector<std::unique_ptr<CompileWorker>> workers;
+
+static bool has_definitions(const Module& module) {
+  return std::any_of(module.begin(), module.end(), [](const Function& function) { return !function.isDeclaration(); });
+}
+
+static MemoryBufferRef bitcode_buffer(const CompilePart& part) {
+  return MemoryBufferRef(StringRef(part.bitcode.data(), part.bitcode.size()), "noname-part.bc");
+}
+
+// Runs on a thread of its own: what the main thread does to a module from the
+// moment it goes to the JIT (see CreateNewModuleAndInitialize and addModule),
+// in the context of its worker
+static void compile_part(CompilePart* part) {
+  CompileWorker& worker = *part->worker;
+  ErrorOr<std::unique_ptr<Module>> parsed = parseBitcodeFile(bitcode_buffer(*part), worker.context);
+  if (!parsed) {
+    part->error = parsed.getError().message();
+    return;
+  }
+
+  Module& module = **parsed;
+  run_pending_passes(module, *worker.target_machine);
+  profile_optimize_module(module);
+  opt_level_optimize_module(module);
+
+  if (!worker.runtime_loaded) {
+    worker.runtime_loaded = true;
+    worker.runtime = load_runtime_module(worker.context, module.getDataLayout());
+  }
+  if (worker.runtime) {
+    link_runtime(module, *worker.runtime);
+  }
+
+  OptLevel opt_level = NonameJIT::configureTargetMachine(*worker.target_machine, module);
+  uint64_t instructions = count_instructions(module);
+  auto start = std::chrono::steady_clock::now();
+
+  object::OwningBinary<object::ObjectFile> object = SimpleCompiler(*worker.target_machine)(module);
+
+  opt_level_module_compiled(
+      opt_level, instructions,
+      std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+
+  auto binary = object.takeBinary();
+  if (!binary.first) {
+    part->error = "no object was generated";
+    return;
+  }
+  part->object = std::move(binary.second);
+}
+
+bool parallel_add_module(std::unique_ptr<Module>& module) {
+  if (compile_jobs < 2) {
+    return false;
+  }
+
+  unsigned functions = std::count_if(module->begin(), module->end(), [](const Function& function) { return !function.isDeclaration(); });
+  unsigned parts = std::min(compile_jobs, functions);
+  if (parts < 2 || count_instructions(*module) < parallel_min_instructions) {
+    return false;
+  }
+
+  std::string module_name = module->getName().str();
+
+  // the parts reach what is local to the module by name: it becomes global,
+  // under a name of this module only, so that nothing else ever binds to it
+  for (GlobalValue& value : module->global_values()) {
+    if (value.hasLocalLinkage()) {
+      value.setName(value.getName().str() + "." + module_name);
+      value.setLinkage(GlobalValue::ExternalLinkage);
+      value.setVisibility(GlobalValue::DefaultVisibility);
+    }
+  }
+
+  std::vector<CompilePart> compile_parts(parts);
+  unsigned written = 0;
+
+  SplitModule(std::move(module), parts, [&](std::unique_ptr<Module> part_module) {
+    // every function may have gone to the other parts
+    if (!has_definitions(*part_module)) {
+      return;
+    }
+
+    CompilePart& part = compile_parts[written++];
+    part.host_addresses = embeds_host_addresses(*part_module);
+
+    raw_svector_ostream os(part.bitcode);
+    WriteBitcodeToFile(part_module.get(), os);
+  });
+  compile_parts.resize(written);
+
+  while (workers.size() < compile_parts.size()) {
+    std::unique_ptr<CompileWorker> worker(new CompileWorker());
+    worker->target_machine = TheJIT->createTargetMachine();
+    worker->runtime_loaded = false;
+    workers.push_back(std::move(worker));
+  }
+
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < compile_parts.size(); ++i) {
+    compile_parts[i].worker = workers[i].get();
+    threads.emplace_back(compile_part, &compile_parts[i]);
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+
+  if (noname::debug >= 1) {
+    fprintf(stdout, "\n[module '%s' compiled in %zu parts on as many threads]", module_name.c_str(), compile_parts.size());
+    fflush(stdout);
+  }
+
+  ++NumParallelModules;
+  NumParallelParts += compile_parts.size();
+
+  for (CompilePart& part : compile_parts) {
+    if (part.object && TheJIT->addObject(std::move(part.object), true, part.host_addresses)) {
+      continue;
+    }
+
+    // the part is still whole in its bitcode: the JIT compiles it as usual
+    fprintf(stderr, "\nWarning: a part of '%s' could not be compiled on its thread (%s), compiling it again",
+            module_name.c_str(), part.error.empty() ? "the object cannot be linked" : part.error.c_str());
+    ++NumParallelFallbacks;
+
+    ErrorOr<std::unique_ptr<Module>> parsed = parseBitcodeFile(bitcode_buffer(part), TheContext);
+    if (!parsed) {
+      fprintf(stderr, "\nError: a part of '%s' could not be read back: %s", module_name.c_str(),
+              parsed.getError().message().c_str());
+      continue;
+    }
+    TheJIT->addModule(std::move(*parsed));
+  }
+
+  return true;
+}
+}
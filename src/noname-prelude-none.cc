@@ -0,0 +1,9 @@
+#include "noname-prelude.h"
+
+// Linked into noname-stage0, the noname that compiles the prelude
+namespace noname {
+extern const unsigned char noname_prelude_bitcode[] = {0};
+extern const unsigned int noname_prelude_bitcode_size = 0;
+extern const unsigned char noname_prelude_object[] = {0};
+extern const unsigned int noname_prelude_object_size = 0;
+}
@@ -0,0 +1,133 @@
+#include "llvm/Bitcode/ReaderWriter.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include "noname-prelude.h"
+#include "noname-runtime.h"
+#include "noname-utils.h"
+#include "noname-types.h"
+#include "noname-jit.h"
+#include "noname-stats.h"
+#include <stdio.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+using namespace llvm::orc;
+
+namespace noname {
+
+std::string emit_bitcode_file;
+std::string emit_object_file;
+
+static Statistic NumPreludeFunctions("prelude", "functions", "Number of prelude functions declared at startup");
+
+// the datatype_t arguments split in two are named <name>_type and <name>_v
+static const char SPLIT_ARG_TYPE_SUFFIX[] = "_type";
+
+static FunctionSignature* prelude_function_signature(const Function& function) {
+  bool split_args = has_split_datatype_args(&function);
+  std::vector<FunctionArgument*> args_defs;
+
+  unsigned int index = 0;
+  for (const Argument& function_arg : function.args()) {
+    if (split_args && index++ % 2 == 1) {
+      continue;
+    }
+
+    StringRef name = function_arg.getName();
+    if (split_args && name.endswith(SPLIT_ARG_TYPE_SUFFIX)) {
+      name = name.drop_back(sizeof(SPLIT_ARG_TYPE_SUFFIX) - 1);
+    }
+    args_defs.push_back(new FunctionArgument(name.str(), VoidTy));
+  }
+
+  return new FunctionSignature(function.getName().str(), args_defs, StructTy_struct_datatype_t);
+}
+
+bool load_prelude(ASTContext* context) {
+  if (!noname_prelude_bitcode_size || !noname_prelude_object_size) {
+    return false;
+  }
+
+  // only the prototypes are read. The bitcode gets its own context, so its
+  // types are not added (and renamed) next to the ones of TheContext.
+  LLVMContext prelude_context;
+  std::unique_ptr<MemoryBuffer> bitcode_buffer = MemoryBuffer::getMemBuffer(
+      StringRef((const char*)noname_prelude_bitcode, noname_prelude_bitcode_size), "noname-prelude.bc", false);
+  ErrorOr<std::unique_ptr<Module>> module = getLazyBitcodeModule(std::move(bitcode_buffer), prelude_context);
+
+  if (!module) {
+    fprintf(stderr, "\nError: the prelude bitcode could not be read: %s", module.getError().message().c_str());
+    return false;
+  }
+
+  std::unique_ptr<MemoryBuffer> object_buffer = MemoryBuffer::getMemBuffer(
+      StringRef((const char*)noname_prelude_object, noname_prelude_object_size), "noname-prelude.obj", false);
+
+  if (!TheJIT->addObject(std::move(object_buffer))) {
+    fprintf(stderr, "\nError: the prelude object could not be linked");
+    return false;
+  }
+
+  for (const Function& function : **module) {
+    if (function.isDeclaration() || function.hasLocalLinkage()) {
+      continue;
+    }
+
+    context->storeFunctionSignature(function.getName().str(), prelude_function_signature(function));
+    ++NumPreludeFunctions;
+  }
+
+  if (noname::debug >= 1) {
+    fprintf(stdout, "\n[prelude: %u bytes of code, %u bytes of bitcode]", noname_prelude_object_size,
+            noname_prelude_bitcode_size);
+    fflush(stdout);
+  }
+
+  return true;
+}
+
+bool write_module_bitcode(const Module& module, const std::string& file_path) {
+  std::error_code error_code;
+  raw_fd_ostream os(file_path, error_code, sys::fs::F_None);
+  if (error_code) {
+    return false;
+  }
+
+  WriteBitcodeToFile(&module, os);
+  os.flush();
+  return !os.has_error();
+}
+
+bool write_module_object(Module& module, const std::string& file_path) {
+  // the object is meant for another process (the prelude is embedded in the
+  // binary): code pointing into this one would read memory it does not own
+  if (embeds_host_addresses(module)) {
+    fprintf(stderr, "\nError: the code of '%s' points to addresses of this process", module.getName().str().c_str());
+    return false;
+  }
+
+  // like the JIT does before compiling a module
+  link_runtime(module);
+
+  std::error_code error_code;
+  raw_fd_ostream os(file_path, error_code, sys::fs::F_None);
+  if (error_code) {
+    return false;
+  }
+
+  // same target machine, hence same cpu, code model and float options, as the
+  // code the JIT compiles
+  legacy::PassManager pass_manager;
+  if (TheJIT->getTargetMachine().addPassesToEmitFile(pass_manager, os, TargetMachine::CGFT_ObjectFile)) {
+    return false;
+  }
+
+  pass_manager.run(module);
+  os.flush();
+  return !os.has_error();
+}
+}
@@ -0,0 +1,425 @@
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Transforms/IPO.h"
+#include "llvm/Transforms/Utils/CodeExtractor.h"
+#include "noname-profile.h"
+#include "noname-stats.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <algorithm>
+#include <deque>
+#include <map>
+#include <utility>
+#include <vector>
+
+using namespace llvm;
+
+namespace noname {
+
+extern LLVMContext TheContext;
+
+ProfileMode profile_mode = PROFILE_NONE;
+std::string profile_file = "default.nnprof";
+
+static Statistic NumProfiledFunctions("profile", "functions", "Number of functions compiled with counters");
+static Statistic NumProfileCounters("profile", "counters", "Number of profile counters emitted");
+static Statistic NumProfileMatched("profile", "matched", "Number of functions optimized with a recorded profile");
+static Statistic NumProfileMismatched("profile", "mismatched", "Number of functions without a matching profile");
+static Statistic NumProfileHot("profile", "hot", "Number of functions marked hot by the profile");
+static Statistic NumProfileCold("profile", "cold", "Number of functions marked cold by the profile");
+static Statistic NumProfileColdRegions("profile", "cold-regions", "Number of cold regions split out of their function");
+
+// a function is hot when it was entered at least 1/HOT_FUNCTION_FRACTION as
+// many times as the hottest function of the profile
+static const uint64_t HOT_FUNCTION_FRACTION = 100;
+
+// instructions a cold region must have to be split out of its function; below
+// that the call replacing it costs about as much as the region itself
+static const size_t COLD_REGION_MIN_INSTRUCTIONS = 12;
+
+namespace {
+typedef std::pair<std::string, uint64_t> ProfileKey;
+
+struct FunctionProfile {
+  ProfileKey key;
+  int num_counters;
+  // the JIT'd code holds the address of each counter, so they must never move
+  std::deque<uint64_t> counters;
+  // counters recorded by a previous run, null when none matched
+  const std::vector<uint64_t>* recorded;
+};
+}
+
+// Every function compiled while profiling. They are never released because the
+// JIT'd code keeps bumping their counters until exit.
+static std::deque<FunctionProfile> function_profiles;
+static std::map<const Function*, FunctionProfile*> active_profiles;
+static std::map<ProfileKey, std::vector<uint64_t>> recorded_profiles;
+static uint64_t max_recorded_entry_count = 0;
+
+static void set_function_section(Function* function, const char* section) {
+  // RuntimeDyld keeps arbitrary section names for ELF objects only; elsewhere
+  // the attributes alone have to do
+  static const bool is_elf = Triple(sys::getProcessTriple()).isOSBinFormatELF();
+  if (is_elf) {
+    function->setSection(section);
+  }
+}
+
+void profile_begin_function(Function* function, const std::string& name, uint64_t hash) {
+  // llvm::Function addresses are reused once a module is removed from the JIT
+  active_profiles.erase(function);
+
+  // top level expressions run exactly once, there is nothing to learn from them
+  if (profile_mode == PROFILE_NONE || name == "__anon_expr") {
+    return;
+  }
+
+  function_profiles.push_back(FunctionProfile());
+  FunctionProfile& profile = function_profiles.back();
+  profile.key = ProfileKey(name, hash);
+  profile.num_counters = 0;
+  profile.recorded = nullptr;
+  active_profiles[function] = &profile;
+
+  if (profile_mode == PROFILE_GENERATE) {
+    ++NumProfiledFunctions;
+    return;
+  }
+
+  auto it = recorded_profiles.find(profile.key);
+  if (it == recorded_profiles.end() || it->second.empty()) {
+    ++NumProfileMismatched;
+    return;
+  }
+
+  profile.recorded = &it->second;
+  ++NumProfileMatched;
+
+  uint64_t entry_count = it->second[0];
+  function->setEntryCount(entry_count);
+
+  if (entry_count == 0) {
+    function->addFnAttr(Attribute::Cold);
+    function->addFnAttr(Attribute::OptimizeForSize);
+    set_function_section(function, ".text.unlikely");
+    ++NumProfileCold;
+  } else if (entry_count * HOT_FUNCTION_FRACTION >= max_recorded_entry_count) {
+    function->addFnAttr(Attribute::InlineHint);
+    set_function_section(function, ".text.hot");
+    ++NumProfileHot;
+  }
+}
+
+int profile_counter_codegen(BasicBlock* bb) {
+  if (!bb) {
+    return -1;
+  }
+
+  auto it = active_profiles.find(bb->getParent());
+  if (it == active_profiles.end()) {
+    return -1;
+  }
+
+  FunctionProfile* profile = it->second;
+  int counter = profile->num_counters++;
+
+  if (profile_mode != PROFILE_GENERATE) {
+    return counter;
+  }
+
+  profile->counters.push_back(0);
+
+  // plain load/add/store: the JIT'd code is single threaded
+  Type* int64_type = Type::getInt64Ty(TheContext);
+  Constant* counter_address = ConstantExpr::getIntToPtr(ConstantInt::get(int64_type, (uint64_t)&profile->counters.back()),
+                                                        PointerType::getUnqual(int64_type));
+  LoadInst* count = new LoadInst(counter_address, "prof_count", false, bb);
+  Value* next_count = BinaryOperator::Create(Instruction::Add, count, ConstantInt::get(int64_type, 1), "prof_next", bb);
+  new StoreInst(next_count, counter_address, false, bb);
+
+  ++NumProfileCounters;
+  return counter;
+}
+
+bool profile_get_count(const Function* function, int counter, uint64_t& count) {
+  if (counter < 0) {
+    return false;
+  }
+
+  auto it = active_profiles.find(function);
+  if (it == active_profiles.end()) {
+    return false;
+  }
+
+  const std::vector<uint64_t>* recorded = it->second->recorded;
+  if (!recorded || (size_t)counter >= recorded->size()) {
+    return false;
+  }
+
+  count = (*recorded)[counter];
+  return true;
+}
+
+void profile_set_branch_weights(BranchInst* branch_inst, uint64_t true_count, uint64_t false_count) {
+  // branch weights are 32 bits; scale like clang does and never emit a zero
+  // weight so an arm that did not run in the training is still reachable
+  uint64_t max_count = std::max(true_count, false_count);
+  uint64_t scale = max_count < UINT32_MAX ? 1 : max_count / UINT32_MAX + 1;
+
+  MDBuilder md_builder(TheContext);
+  branch_inst->setMetadata(LLVMContext::MD_prof,
+                           md_builder.createBranchWeights(true_count / scale + 1, false_count / scale + 1));
+}
+
+void profile_set_switch_weights(SwitchInst* switch_inst, const std::vector<uint64_t>& counts) {
+  uint64_t max_count = counts.empty() ? 0 : *std::max_element(counts.begin(), counts.end());
+  uint64_t scale = max_count < UINT32_MAX ? 1 : max_count / UINT32_MAX + 1;
+
+  std::vector<uint32_t> weights;
+  for (uint64_t count : counts) {
+    weights.push_back(count / scale + 1);
+  }
+
+  MDBuilder md_builder(TheContext);
+  switch_inst->setMetadata(LLVMContext::MD_prof, md_builder.createBranchWeights(weights));
+}
+
+void profile_set_call_hotness(CallInst* call_inst, int counter) {
+  const Function* caller = call_inst->getParent() ? call_inst->getParent()->getParent() : nullptr;
+  uint64_t call_count = 0;
+  uint64_t entry_count = 0;
+
+  if (!profile_get_count(caller, counter, call_count) || !profile_get_count(caller, 0, entry_count)) {
+    return;
+  }
+
+  // a call that never ran in a function that did: branch probability treats
+  // cold call sites as unlikely, so block placement moves them out of the way
+  if (call_count == 0 && entry_count > 0) {
+    call_inst->addAttribute(AttributeSet::FunctionIndex, Attribute::Cold);
+  }
+}
+
+// Successors of the branches of function that never ran while the branch did
+// (the weight of a count of 0 is 1, see profile_set_branch_weights), or that
+// are known to be unlikely
+static void find_cold_successors(Function& function, std::vector<BasicBlock*>& cold_successors) {
+  for (BasicBlock& bb : function) {
+    TerminatorInst* terminator = bb.getTerminator();
+    MDNode* weights = terminator ? terminator->getMetadata(LLVMContext::MD_prof) : nullptr;
+    if (!weights || weights->getNumOperands() != terminator->getNumSuccessors() + 1) {
+      continue;
+    }
+
+    uint64_t max_weight = 0;
+    for (unsigned i = 1; i < weights->getNumOperands(); ++i) {
+      max_weight = std::max(max_weight, mdconst::extract<ConstantInt>(weights->getOperand(i))->getZExtValue());
+    }
+
+    for (unsigned i = 0; max_weight > 1 && i < terminator->getNumSuccessors(); ++i) {
+      BasicBlock* successor = terminator->getSuccessor(i);
+      if (mdconst::extract<ConstantInt>(weights->getOperand(i + 1))->getZExtValue() == 1 &&
+          successor->getSinglePredecessor() == &bb) {
+        cold_successors.push_back(successor);
+      }
+    }
+  }
+}
+
+// The blocks dominated by cold_bb, when they can be moved to a function of
+// their own: they end in the function (no return, no alloca the rest may
+// use), every phi they lead to has one incoming edge from them, and there are
+// enough of them to be worth a call
+static bool cold_region(BasicBlock* cold_bb, DominatorTree& dominator_tree, SmallVectorImpl<BasicBlock*>& region) {
+  dominator_tree.getDescendants(cold_bb, region);
+  SmallPtrSet<BasicBlock*, 16> region_blocks(region.begin(), region.end());
+  std::map<BasicBlock*, int> exit_edges;
+  size_t instructions = 0;
+
+  for (BasicBlock* bb : region) {
+    if (isa<ReturnInst>(bb->getTerminator())) {
+      return false;
+    }
+
+    for (Instruction& instruction : *bb) {
+      if (isa<AllocaInst>(instruction)) {
+        return false;
+      }
+      ++instructions;
+    }
+
+    for (unsigned i = 0; i < bb->getTerminator()->getNumSuccessors(); ++i) {
+      BasicBlock* successor = bb->getTerminator()->getSuccessor(i);
+      if (!region_blocks.count(successor) && isa<PHINode>(successor->front()) && ++exit_edges[successor] > 1) {
+        return false;
+      }
+    }
+  }
+
+  return instructions >= COLD_REGION_MIN_INSTRUCTIONS;
+}
+
+// Moves the cold regions of a function that ran to functions of their own in
+// .text.unlikely, so the code that runs is packed together
+static void split_cold_regions(Function& function) {
+  Optional<uint64_t> entry_count = function.getEntryCount();
+  if (!entry_count || !*entry_count || function.isDeclaration()) {
+    return;
+  }
+
+  std::vector<BasicBlock*> cold_successors;
+  find_cold_successors(function, cold_successors);
+  if (cold_successors.empty()) {
+    return;
+  }
+
+  DominatorTree dominator_tree(function);
+
+  for (BasicBlock* cold_bb : cold_successors) {
+    // already moved along with the region of another branch
+    if (cold_bb->getParent() != &function) {
+      continue;
+    }
+
+    SmallVector<BasicBlock*, 16> region;
+    if (!cold_region(cold_bb, dominator_tree, region)) {
+      continue;
+    }
+
+    CodeExtractor code_extractor(region, &dominator_tree);
+    if (!code_extractor.isEligible()) {
+      continue;
+    }
+
+    Function* cold_function = code_extractor.extractCodeRegion();
+    if (!cold_function) {
+      continue;
+    }
+
+    cold_function->setName(function.getName() + ".cold");
+    cold_function->addFnAttr(Attribute::Cold);
+    cold_function->addFnAttr(Attribute::OptimizeForSize);
+    cold_function->addFnAttr(Attribute::NoInline);
+    set_function_section(cold_function, ".text.unlikely");
+
+    for (User* user : cold_function->users()) {
+      if (CallInst* call_inst = dyn_cast<CallInst>(user)) {
+        call_inst->addAttribute(AttributeSet::FunctionIndex, Attribute::Cold);
+      }
+    }
+
+    dominator_tree.recalculate(function);
+    ++NumProfileColdRegions;
+  }
+}
+
+void profile_optimize_module(Module& module) {
+  if (profile_mode != PROFILE_USE) {
+    return;
+  }
+
+  bool has_hot_functions = std::any_of(module.begin(), module.end(), [](const Function& function) {
+    return function.hasFnAttribute(Attribute::InlineHint);
+  });
+
+  if (has_hot_functions) {
+    legacy::PassManager pass_manager;
+    pass_manager.add(createFunctionInliningPass());
+    pass_manager.run(module);
+  }
+
+  // after inlining, which may bring cold code of the callees along
+  std::vector<Function*> functions;
+  for (Function& function : module) {
+    functions.push_back(&function);
+  }
+
+  for (Function* function : functions) {
+    split_cold_regions(*function);
+  }
+}
+
+/**
+ * The profile is a text file with one line per function:
+ *
+ *   <name> <hash> <number of counters> <counter 0> <counter 1> ...
+ *
+ * counter 0 is the number of times the function was entered.
+ */
+bool load_profile(const std::string& file_path) {
+  FILE* file = fopen(file_path.c_str(), "r");
+  if (!file) {
+    return false;
+  }
+
+  char name[1024];
+  while (fscanf(file, "%1023s", name) == 1) {
+    if (name[0] == '#') {
+      int c;
+      while ((c = fgetc(file)) != EOF && c != '\n') {
+      }
+      continue;
+    }
+
+    uint64_t hash = 0;
+    size_t num_counters = 0;
+    if (fscanf(file, "%" SCNx64 " %zu", &hash, &num_counters) != 2) {
+      fclose(file);
+      return false;
+    }
+
+    std::vector<uint64_t> counters(num_counters);
+    for (size_t i = 0; i < num_counters; ++i) {
+      if (fscanf(file, "%" SCNu64, &counters[i]) != 1) {
+        fclose(file);
+        return false;
+      }
+    }
+
+    if (!counters.empty()) {
+      max_recorded_entry_count = std::max(max_recorded_entry_count, counters[0]);
+    }
+    recorded_profiles[ProfileKey(std::string(name), hash)] = std::move(counters);
+  }
+
+  fclose(file);
+  return true;
+}
+
+bool write_profile(const std::string& file_path) {
+  // the same function may have been compiled several times (e.g. once per
+  // module that defines it); sum them up
+  std::map<ProfileKey, std::vector<uint64_t>> merged;
+  for (const FunctionProfile& profile : function_profiles) {
+    std::vector<uint64_t>& counters = merged[profile.key];
+    counters.resize(std::max(counters.size(), profile.counters.size()), 0);
+
+    for (size_t i = 0; i < profile.counters.size(); ++i) {
+      counters[i] += profile.counters[i];
+    }
+  }
+
+  FILE* file = fopen(file_path.c_str(), "w");
+  if (!file) {
+    return false;
+  }
+
+  fprintf(file, "# noname profile: <name> <hash> <number of counters> <counters...>\n");
+  for (auto& entry : merged) {
+    fprintf(file, "%s %016" PRIx64 " %zu", entry.first.first.c_str(), entry.first.second, entry.second.size());
+    for (uint64_t count : entry.second) {
+      fprintf(file, " %" PRIu64, count);
+    }
+    fprintf(file, "\n");
+  }
+
+  fclose(file);
+  return true;
+}
+}
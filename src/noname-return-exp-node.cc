@@ -49,9 +49,55 @@ ReturnExpNode::~ReturnExpNode() {
 }
 
 Value* ReturnExpNode::codegen(llvm::BasicBlock* bb) { return codegen_elements_retlast(this, bb); }
+
+// `return f(...)` inside f: the arguments are all computed before any of them
+// is overwritten (think f(b, a)), then the function starts over
+static std::vector<Value*> tail_recursion_codegen_elements(Error& error, const CallExpNode* call_exp_node,
+                                                           const TailRecursionTarget_t* target, llvm::BasicBlock* bb) {
+  std::vector<Value*> args_value;
+  std::vector<Value*> codegen = call_exp_node->args_codegen_elements(error, bb, args_value);
+
+  if (error.code()) {
+    return codegen;
+  }
+
+  for (size_t i = 0; i < args_value.size(); ++i) {
+    push_back_ret(codegen, store_typed_var_codegen(TYPE_DATATYPE, args_value[i], target->arg_allocas[i], bb));
+  }
+  push_back_ret(codegen, BranchInst::Create(target->body, bb));
+
+  return codegen;
+}
+
+// The self recursive call of `return f(...)` inside f, null for any other
+// return
+static const TailRecursionTarget_t* get_self_tail_call_target(Error& error, const ExpNode* exp_node, llvm::BasicBlock* bb) {
+  const TailRecursionTarget_t* target = get_tail_recursion_target();
+
+  if (!bb || !target || target->function != bb->getParent() || !isa<CallExpNode>(exp_node)) {
+    return nullptr;
+  }
+
+  const CallExpNode* call_exp_node = (const CallExpNode*)exp_node;
+  if (call_exp_node->getCalledFunction(error) != target->function ||
+      call_exp_node->getArgs().size() != target->arg_allocas.size()) {
+    return nullptr;
+  }
+
+  return target;
+}
+
 std::vector<Value*> ReturnExpNode::codegen_elements(Error& error, llvm::BasicBlock* bb) const {
   std::vector<Value*> codegen;
 
+  if (const TailRecursionTarget_t* target = get_self_tail_call_target(error, exp_node, bb)) {
+    return tail_recursion_codegen_elements(error, (const CallExpNode*)exp_node, target, bb);
+  }
+
+  if (error.code()) {
+    return codegen;
+  }
+
   std::vector<Value*> exp_node_codegen_elements = exp_node->get_codegen_elements(error, bb);
 
   if (error.code()) {
@@ -93,6 +139,22 @@ std::vector<Value*> ReturnExpNode::codegen_elements(Error& error, llvm::BasicBlo
       value_to_be_returned->dump();
     }
 
+    // any other call in return position reuses the frame of the caller. With
+    // the same prototype (the same number of arguments) and calling convention
+    // the backend must honor it; between fastcc functions the JIT guarantees
+    // it anyway (GuaranteedTailCallOpt).
+    if (CallInst* call_inst = dyn_cast<CallInst>(value_to_be_returned)) {
+      Function* caller = last_bb->getParent();
+      Function* callee = call_inst->getCalledFunction();
+
+      if (callee && callee->getFunctionType() == caller->getFunctionType() &&
+          call_inst->getCallingConv() == caller->getCallingConv()) {
+        call_inst->setTailCallKind(CallInst::TCK_MustTail);
+      } else {
+        call_inst->setTailCallKind(CallInst::TCK_Tail);
+      }
+    }
+
     return_inst = ReturnInst::Create(TheContext, value_to_be_returned, last_bb);
 
     // createError(error, "No such elements from expression node of return");
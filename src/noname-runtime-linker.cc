@@ -0,0 +1,139 @@
+#include "llvm/Bitcode/ReaderWriter.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Transforms/IPO.h"
+#include "llvm/Transforms/Scalar.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "noname-runtime.h"
+#include "noname-utils.h"
+#include "noname-types.h"
+#include "noname-stats.h"
+#include <stdio.h>
+#include <memory>
+#include <set>
+#include <string>
+
+using namespace llvm;
+
+namespace noname {
+
+static Statistic NumRuntimeModules("runtime", "modules", "Number of modules the runtime was linked into");
+static Statistic NumRuntimeDefinitions("runtime", "definitions", "Number of runtime definitions linked into modules");
+
+// parsed once, in TheContext, and cloned into the modules that need it
+static std::unique_ptr<Module> runtime_module;
+static bool runtime_loaded = false;
+
+std::unique_ptr<Module> load_runtime_module(LLVMContext& context, const DataLayout& data_layout) {
+  if (!noname_runtime_bitcode_size) {
+    return nullptr;
+  }
+
+  MemoryBufferRef bitcode(StringRef((const char*)noname_runtime_bitcode, noname_runtime_bitcode_size), "noname-runtime.bc");
+  ErrorOr<std::unique_ptr<Module>> module = parseBitcodeFile(bitcode, context);
+
+  if (!module) {
+    fprintf(stderr, "\nError: the runtime bitcode could not be read: %s", module.getError().message().c_str());
+    return nullptr;
+  }
+
+  std::unique_ptr<Module> runtime = std::move(*module);
+  // the modules of the JIT decide the target
+  runtime->setTargetTriple("");
+  runtime->setDataLayout(data_layout);
+
+  for (Function& function : *runtime) {
+    if (function.isDeclaration()) {
+      continue;
+    }
+
+    // a helper the runtime keeps out of line is shared: every call goes to the
+    // one copy of the host instead of a body inlined at each site
+    if (function.hasFnAttribute(Attribute::NoInline)) {
+      function.deleteBody();
+      continue;
+    }
+
+    // compiled for the cpu of the build machine, inlined into code for the cpu
+    // of the JIT
+    function.removeFnAttr("target-cpu");
+    function.removeFnAttr("target-features");
+    function.removeFnAttr(Attribute::NoInline);
+    function.addFnAttr(Attribute::AlwaysInline);
+  }
+
+  return runtime;
+}
+
+static Module* get_runtime_module(const DataLayout& data_layout) {
+  if (runtime_loaded) {
+    return runtime_module.get();
+  }
+  runtime_loaded = true;
+
+  runtime_module = load_runtime_module(TheContext, data_layout);
+  return runtime_module.get();
+}
+
+bool link_runtime(Module& module) {
+  Module* runtime = get_runtime_module(module.getDataLayout());
+  if (!runtime) {
+    return false;
+  }
+
+  return link_runtime(module, *runtime);
+}
+
+bool link_runtime(Module& module, const Module& runtime) {
+  // a name the module defines itself (a user `def printd`) stays its own
+  std::set<std::string> defined_names;
+  bool needed = false;
+
+  for (const GlobalValue& value : runtime.global_values()) {
+    GlobalValue* module_value = module.getNamedValue(value.getName());
+    if (!module_value || value.isDeclaration()) {
+      continue;
+    }
+
+    if (module_value->isDeclaration()) {
+      needed = true;
+    } else {
+      defined_names.insert(value.getName().str());
+    }
+  }
+
+  if (!needed) {
+    return false;
+  }
+
+  // only what the module declares, and what that uses in turn
+  if (Linker::linkModules(module, CloneModule(&runtime), Linker::Flags::LinkOnlyNeeded)) {
+    fprintf(stderr, "\nError: the runtime could not be linked into '%s'", module.getName().str().c_str());
+    return false;
+  }
+
+  for (const GlobalValue& value : runtime.global_values()) {
+    GlobalValue* module_value = module.getNamedValue(value.getName());
+    if (value.isDeclaration() || !value.hasExternalLinkage() || !module_value || module_value->isDeclaration() ||
+        defined_names.count(value.getName().str())) {
+      continue;
+    }
+
+    // the host has the one definition the code links against
+    module_value->setLinkage(GlobalValue::AvailableExternallyLinkage);
+    ++NumRuntimeDefinitions;
+  }
+
+  legacy::PassManager pass_manager;
+  pass_manager.add(createAlwaysInlinerPass());
+  // fold the constants and the branches the inlined code brought in
+  pass_manager.add(createInstructionCombiningPass());
+  pass_manager.add(createCFGSimplificationPass());
+  // then what is left of the runtime is only declared again
+  pass_manager.add(createEliminateAvailableExternallyPass());
+  pass_manager.run(module);
+
+  ++NumRuntimeModules;
+  return true;
+}
+}
@@ -0,0 +1,220 @@
+// Runtime of the JIT code. Besides being part of noname, this file is compiled
+// to bitcode (noname-runtime.bc) and embedded: its functions and constants are
+// linked into every JIT module, so they inline into the generated code. It must
+// only depend on the C library, and every definition must match its declaration
+// in noname-utils.h or noname-types.h.
+#include <stdio.h>
+#include <string.h>
+#include <new>
+
+namespace noname {
+
+//===----------------------------------------------------------------------===//
+// "Library" functions that can be "extern'd" from user code.
+//===----------------------------------------------------------------------===//
+
+/// putchard - putchar that takes a double and returns 0.
+extern "C" double putchard(double X) {
+  fputc((char)X, stderr);
+  return 0;
+}
+
+/// printd - printf that takes a double prints it as "%f\n", returning 0.
+extern "C" double printd(double X) {
+  fprintf(stderr, "%f\n", X);
+  return 0;
+}
+
+/// noname_pow_long - base^exponent by squaring, stored in result. Returns 0,
+/// leaving result untouched, when the power overflows a long or the exponent is
+/// negative (the power is not an integer).
+extern "C" int noname_pow_long(long base, long exponent, long* result) {
+  if (exponent < 0) {
+    return 0;
+  }
+
+  long value = 1;
+  while (exponent > 0) {
+    if ((exponent & 1) && __builtin_mul_overflow(value, base, &value)) {
+      return 0;
+    }
+
+    // the square is only needed (and its overflow only matters) when there
+    // are bits of the exponent left
+    exponent >>= 1;
+    if (exponent > 0 && __builtin_mul_overflow(base, base, &base)) {
+      return 0;
+    }
+  }
+
+  *result = value;
+  return 1;
+}
+
+// The numeric type tags of noname-types.h, from the narrowest to the widest
+// (noname-types.cc checks they still match)
+enum { NUMBER_CHAR = 36, NUMBER_SHORT, NUMBER_INT, NUMBER_FLOAT, NUMBER_LONG, NUMBER_DOUBLE };
+
+/// noname_numeric_promotion_table - result type of an arithmetic operation
+/// between two numbers, indexed by type - TYPE_CHAR. Narrow operands stay
+/// narrow; float and long meet in double, the only type holding both.
+extern "C" const int noname_numeric_promotion_table[6][6] = {
+    /*             char           short          int            float          long           double */
+    /* char   */ {NUMBER_CHAR,   NUMBER_SHORT,  NUMBER_INT,    NUMBER_FLOAT,  NUMBER_LONG,   NUMBER_DOUBLE},
+    /* short  */ {NUMBER_SHORT,  NUMBER_SHORT,  NUMBER_INT,    NUMBER_FLOAT,  NUMBER_LONG,   NUMBER_DOUBLE},
+    /* int    */ {NUMBER_INT,    NUMBER_INT,    NUMBER_INT,    NUMBER_FLOAT,  NUMBER_LONG,   NUMBER_DOUBLE},
+    /* float  */ {NUMBER_FLOAT,  NUMBER_FLOAT,  NUMBER_FLOAT,  NUMBER_FLOAT,  NUMBER_DOUBLE, NUMBER_DOUBLE},
+    /* long   */ {NUMBER_LONG,   NUMBER_LONG,   NUMBER_LONG,   NUMBER_DOUBLE, NUMBER_LONG,   NUMBER_DOUBLE},
+    /* double */ {NUMBER_DOUBLE, NUMBER_DOUBLE, NUMBER_DOUBLE, NUMBER_DOUBLE, NUMBER_DOUBLE, NUMBER_DOUBLE},
+};
+
+template <typename T>
+static T number_as(int type, const void* v) {
+  switch (type) {
+    case NUMBER_CHAR:
+      return (T) * (const char*)v;
+    case NUMBER_SHORT:
+      return (T) * (const short*)v;
+    case NUMBER_INT:
+      return (T) * (const int*)v;
+    case NUMBER_FLOAT:
+      return (T) * (const float*)v;
+    case NUMBER_LONG:
+      return (T) * (const long*)v;
+    default:
+      return (T) * (const double*)v;
+  }
+}
+
+// value in slot, or in a box of its own size when there is none
+template <typename T>
+static void* number_box(T value, void* slot) {
+  void* box = slot ? slot : new T;
+  memcpy(box, &value, sizeof(T));
+  return box;
+}
+
+// Narrow integers wrap like in C
+template <typename T>
+static void* narrow_op(int op, long lhs, long rhs, void* slot) {
+  switch (op) {
+    case '+':
+      return number_box((T)(lhs + rhs), slot);
+    case '-':
+      return number_box((T)(lhs - rhs), slot);
+    case '*':
+      return number_box((T)(lhs * rhs), slot);
+    case '/':
+      return rhs == 0 ? nullptr : number_box((T)(lhs / rhs), slot);
+  }
+  return nullptr;
+}
+
+// Longs never do: an overflow is left to the host, which computes a bigint
+static void* long_op(int op, long lhs, long rhs, void* slot) {
+  long result = 0;
+  switch (op) {
+    case '+':
+      return __builtin_add_overflow(lhs, rhs, &result) ? nullptr : number_box(result, slot);
+    case '-':
+      return __builtin_sub_overflow(lhs, rhs, &result) ? nullptr : number_box(result, slot);
+    case '*':
+      return __builtin_mul_overflow(lhs, rhs, &result) ? nullptr : number_box(result, slot);
+    case '/':
+      return rhs == 0 || (rhs == -1 && lhs == -__LONG_MAX__ - 1) ? nullptr : number_box(lhs / rhs, slot);
+  }
+  return nullptr;
+}
+
+template <typename T>
+static void* floating_op(int op, T lhs, T rhs, void* slot) {
+  switch (op) {
+    case '+':
+      return number_box((T)(lhs + rhs), slot);
+    case '-':
+      return number_box((T)(lhs - rhs), slot);
+    case '*':
+      return number_box((T)(lhs * rhs), slot);
+    case '/':
+      return number_box((T)(lhs / rhs), slot);
+  }
+  return nullptr;
+}
+
+/// noname_numeric_binary_op - lhs op rhs of two numbers of any numeric types,
+/// in the type of the promotion table, stored in slot (8 bytes) or, when slot
+/// is null, in a box of the size of the type. The type goes to result_type.
+/// Returns null, computing nothing, when the host has to: an operand is not a
+/// number, a long overflowed, an integer division would trap, or op is ^.
+/// Every binary expression whose types are not known at compile time shares
+/// it for the pairs of types it does not compile inline, so it is never
+/// inlined.
+extern "C" __attribute__((noinline)) void* noname_numeric_binary_op(int op, int lhs_type, const void* lhs_v, int rhs_type,
+                                                                      const void* rhs_v, void* slot, int* result_type) {
+  if (lhs_type < NUMBER_CHAR || lhs_type > NUMBER_DOUBLE || rhs_type < NUMBER_CHAR || rhs_type > NUMBER_DOUBLE) {
+    return nullptr;
+  }
+
+  int type = noname_numeric_promotion_table[lhs_type - NUMBER_CHAR][rhs_type - NUMBER_CHAR];
+  void* box = nullptr;
+  switch (type) {
+    case NUMBER_CHAR:
+      box = narrow_op<char>(op, number_as<long>(lhs_type, lhs_v), number_as<long>(rhs_type, rhs_v), slot);
+      break;
+    case NUMBER_SHORT:
+      box = narrow_op<short>(op, number_as<long>(lhs_type, lhs_v), number_as<long>(rhs_type, rhs_v), slot);
+      break;
+    case NUMBER_INT:
+      box = narrow_op<int>(op, number_as<long>(lhs_type, lhs_v), number_as<long>(rhs_type, rhs_v), slot);
+      break;
+    case NUMBER_LONG:
+      box = long_op(op, number_as<long>(lhs_type, lhs_v), number_as<long>(rhs_type, rhs_v), slot);
+      break;
+    case NUMBER_FLOAT:
+      box = floating_op<float>(op, number_as<float>(lhs_type, lhs_v), number_as<float>(rhs_type, rhs_v), slot);
+      break;
+    default:
+      box = floating_op<double>(op, number_as<double>(lhs_type, lhs_v), number_as<double>(rhs_type, rhs_v), slot);
+      break;
+  }
+
+  if (box) {
+    *result_type = type;
+  }
+  return box;
+}
+
+extern "C" void* get_copy_address_long(long value) {
+  long* out_value = new long;
+  memcpy(out_value, &value, sizeof(long));
+  return out_value;
+}
+extern "C" void* get_copy_address_int(int value) {
+  int* out_value = new int;
+  memcpy(out_value, &value, sizeof(int));
+  return out_value;
+}
+extern "C" void* get_copy_address_short(short value) {
+  short* out_value = new short;
+  memcpy(out_value, &value, sizeof(short));
+  return out_value;
+}
+extern "C" void* get_copy_address_char(char value) {
+  char* out_value = new char;
+  memcpy(out_value, &value, sizeof(char));
+  return out_value;
+}
+extern "C" void* get_copy_address_double(double value) {
+  double* out_value = new double;
+  memcpy(out_value, &value, sizeof(double));
+  return out_value;
+}
+extern "C" void* get_copy_address_float(float value) {
+  float* out_value = new float;
+  memcpy(out_value, &value, sizeof(float));
+  return out_value;
+}
+
+extern "C" const long noname_compare_false_value = 0;
+extern "C" const long noname_compare_true_value = 1;
+}
@@ -0,0 +1,519 @@
+#include "llvm/Object/ObjectFile.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "noname-snapshot.h"
+#include "noname-utils.h"
+#include "noname-types.h"
+#include "noname-jit.h"
+#include "noname-stats.h"
+#include "noname-profile.h"
+#include "noname-bytecode.h"
+#include "noname-globals.h"
+#include <stdio.h>
+#include <string.h>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace llvm;
+using namespace llvm::orc;
+
+namespace noname {
+
+void write_cursor();
+
+std::string restore_snapshot_file;
+
+static Statistic NumSnapshotsSaved("snapshot", "saved", "Number of session snapshots written");
+static Statistic NumSnapshotFunctions("snapshot", "functions", "Number of functions declared from restored snapshots");
+static Statistic NumSnapshotVariables("snapshot", "variables", "Number of variables declared from restored snapshots");
+static Statistic NumSnapshotObjects("snapshot", "objects", "Number of objects linked from restored snapshots");
+
+namespace {
+
+const char SNAPSHOT_MAGIC[4] = {'N', 'N', 'S', 'S'};
+// bump whenever the layout or the calling convention of the compiled code change
+const uint32_t SNAPSHOT_VERSION = 2;
+// objects are parsed in place, and object files want aligned buffers
+const size_t SNAPSHOT_OBJECT_ALIGNMENT = 16;
+
+// Followed by the target (triple, cpu, features), the functions (name, then
+// arguments as name and default value), the variables (name, value, whether it
+// was reassigned and the functions that folded it) and the objects (size and bytes, aligned). A value is its type tag and its bits, a
+// string or the sign and limbs of a bigint; type 0 is no value.
+struct SnapshotHeader {
+  char magic[4];
+  uint32_t version;
+  // of everything after the header
+  uint64_t payload_hash;
+  uint64_t payload_size;
+  uint64_t reserved;
+};
+
+const uint32_t NO_VALUE = 0;
+
+class SnapshotWriter {
+ private:
+  std::string payload;
+
+ public:
+  void u32(uint32_t value) { payload.append((const char*)&value, sizeof(value)); }
+  void u64(uint64_t value) { payload.append((const char*)&value, sizeof(value)); }
+  void str(StringRef value) {
+    u32(value.size());
+    payload.append(value.data(), value.size());
+  }
+
+  void value(const TaggedValue& value) {
+    switch (value.getType()) {
+      case TYPE_CHAR:
+      case TYPE_SHORT:
+      case TYPE_INT:
+      case TYPE_LONG: {
+        u32(value.getType());
+        u64((uint64_t)value.as<long>());
+        break;
+      }
+      case TYPE_FLOAT:
+      case TYPE_DOUBLE: {
+        double double_value = value.as<double>();
+        uint64_t bits = 0;
+        memcpy(&bits, &double_value, sizeof(bits));
+        u32(value.getType());
+        u64(bits);
+        break;
+      }
+      case TYPE_STRING:
+        u32(value.getType());
+        str(value.asString());
+        break;
+      case TYPE_BIGINT: {
+        BigInt bigint = value.asBigInt();
+        u32(value.getType());
+        u32(bigint.isNegative());
+        u32(bigint.getLimbs().size());
+        for (uint32_t limb : bigint.getLimbs()) {
+          u32(limb);
+        }
+        break;
+      }
+      default:
+        u32(NO_VALUE);
+        break;
+    }
+  }
+
+  void object(MemoryBufferRef object) {
+    u64(object.getBufferSize());
+    payload.resize(alignTo(sizeof(SnapshotHeader) + payload.size(), SNAPSHOT_OBJECT_ALIGNMENT) - sizeof(SnapshotHeader));
+    payload.append(object.getBufferStart(), object.getBufferSize());
+  }
+
+  bool writeTo(const std::string& file_path) {
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.payload_hash = stable_hash(STABLE_HASH_SEED, payload.data(), payload.size());
+    header.payload_size = payload.size();
+
+    FILE* file = fopen(file_path.c_str(), "wb");
+    if (!file) {
+      return false;
+    }
+
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   (payload.empty() || fwrite(payload.data(), payload.size(), 1, file) == 1);
+    return fclose(file) == 0 && written;
+  }
+};
+
+// Every read is checked against the end of the file
+class SnapshotReader {
+ private:
+  const char* data;
+  size_t size;
+  size_t offset;
+
+ public:
+  SnapshotReader(const char* data, size_t size) : data(data), size(size), offset(sizeof(SnapshotHeader)) {}
+
+  bool open() const {
+    if (size < sizeof(SnapshotHeader)) {
+      return false;
+    }
+
+    const SnapshotHeader* header = (const SnapshotHeader*)data;
+    return memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) == 0 && header->version == SNAPSHOT_VERSION &&
+           size - sizeof(SnapshotHeader) == header->payload_size &&
+           stable_hash(STABLE_HASH_SEED, data + sizeof(SnapshotHeader), header->payload_size) == header->payload_hash;
+  }
+
+  bool atEnd() const { return offset == size; }
+
+  bool u32(uint32_t& value) { return read(&value, sizeof(value)); }
+  bool u64(uint64_t& value) { return read(&value, sizeof(value)); }
+  bool str(StringRef& value) {
+    uint32_t length = 0;
+    if (!u32(length) || size - offset < length) {
+      return false;
+    }
+
+    value = StringRef(data + offset, length);
+    offset += length;
+    return true;
+  }
+
+  bool value(TaggedValue& value) {
+    uint32_t type = NO_VALUE;
+    if (!u32(type)) {
+      return false;
+    }
+
+    uint64_t bits = 0;
+    switch (type) {
+      case NO_VALUE:
+        value = TaggedValue();
+        return true;
+      case TYPE_CHAR:
+      case TYPE_SHORT:
+      case TYPE_INT:
+      case TYPE_LONG:
+      case TYPE_FLOAT:
+      case TYPE_DOUBLE:
+        if (!u64(bits)) {
+          return false;
+        }
+        value = number(type, bits);
+        return true;
+      case TYPE_STRING: {
+        StringRef string;
+        if (!str(string)) {
+          return false;
+        }
+        value = TaggedValue(string.str());
+        return true;
+      }
+      case TYPE_BIGINT: {
+        uint32_t negative = 0;
+        uint32_t limbs_count = 0;
+        if (!u32(negative) || !u32(limbs_count) || (size - offset) / sizeof(uint32_t) < limbs_count) {
+          return false;
+        }
+
+        std::vector<uint32_t> limbs(limbs_count);
+        read(limbs.data(), limbs_count * sizeof(uint32_t));
+        value = TaggedValue(BigInt(negative != 0, std::move(limbs)));
+        return true;
+      }
+      default:
+        return false;
+    }
+  }
+
+  bool object(StringRef& object) {
+    uint64_t object_size = 0;
+    if (!u64(object_size)) {
+      return false;
+    }
+
+    offset = alignTo(offset, SNAPSHOT_OBJECT_ALIGNMENT);
+    if (offset > size || size - offset < object_size) {
+      return false;
+    }
+
+    object = StringRef(data + offset, object_size);
+    offset += object_size;
+    return true;
+  }
+
+ private:
+  bool read(void* value, size_t value_size) {
+    if (size - offset < value_size) {
+      return false;
+    }
+
+    memcpy(value, data + offset, value_size);
+    offset += value_size;
+    return true;
+  }
+
+  static TaggedValue number(uint32_t type, uint64_t bits) {
+    double double_value = 0.0;
+    memcpy(&double_value, &bits, sizeof(double_value));
+    long long_value = (long)bits;
+
+    switch (type) {
+      case TYPE_DOUBLE:
+        return TaggedValue(double_value);
+      case TYPE_FLOAT:
+        return TaggedValue((float)double_value);
+      case TYPE_INT:
+        return TaggedValue((int)long_value);
+      case TYPE_SHORT:
+        return TaggedValue((short)long_value);
+      case TYPE_CHAR:
+        return TaggedValue((char)long_value);
+      default:
+        return TaggedValue(long_value);
+    }
+  }
+};
+
+struct SnapshotFunction {
+  StringRef name;
+  std::vector<std::pair<StringRef, TaggedValue>> args;
+};
+
+struct SnapshotVariable {
+  StringRef name;
+  TaggedValue value;
+  bool reassigned;
+  std::set<std::string> dependents;
+};
+
+// cpu and features matter as much as the triple: the objects may use any
+// instruction of the cpu they were compiled for
+void write_target(SnapshotWriter& writer) {
+  TargetMachine& target_machine = TheJIT->getTargetMachine();
+  writer.str(target_machine.getTargetTriple().str());
+  writer.str(target_machine.getTargetCPU());
+  writer.str(target_machine.getTargetFeatureString());
+}
+
+bool read_target(SnapshotReader& reader) {
+  TargetMachine& target_machine = TheJIT->getTargetMachine();
+  StringRef triple, cpu, features;
+  return reader.str(triple) && reader.str(cpu) && reader.str(features) &&
+         triple == target_machine.getTargetTriple().str() && cpu == target_machine.getTargetCPU() &&
+         features == target_machine.getTargetFeatureString();
+}
+
+ExpNode* default_value_node(const TaggedValue& value, ASTContext* context) {
+  switch (value.getType()) {
+    case TYPE_STRING:
+      return new StringExpNode(context, value.asString());
+    case TYPE_DOUBLE:
+      return new NumberExpNode(context, value.as<double>());
+    case TYPE_FLOAT:
+      return new NumberExpNode(context, value.as<float>());
+    case TYPE_INT:
+      return new NumberExpNode(context, value.as<int>());
+    case TYPE_SHORT:
+      return new NumberExpNode(context, value.as<short>());
+    case TYPE_CHAR:
+      return new NumberExpNode(context, value.as<char>());
+    case TYPE_LONG:
+      return new NumberExpNode(context, value.as<long>());
+    default:
+      // arguments only default to literals
+      return nullptr;
+  }
+}
+}
+
+bool save_snapshot(const std::string& file_path, ASTContext* context) {
+  if (noname::profile_mode == PROFILE_GENERATE) {
+    return false;
+  }
+
+  // every function defined so far has to be in a module the JIT compiled
+  if (noname::execution_tier == TIER_BYTECODE) {
+    bytecode_tier_up();
+  }
+  CreateNewModuleAndInitialize();
+
+  // restored, that code would read the memory of this process
+  if (TheJIT->hasHostAddresses()) {
+    return false;
+  }
+
+  SnapshotWriter writer;
+  write_target(writer);
+
+  const std::map<std::string, FunctionSignature*>& function_signatures = context->getFunctionSignatures();
+  writer.u32(function_signatures.size());
+  for (auto& function_signature : function_signatures) {
+    std::vector<FunctionArgument*>& args_defs = function_signature.second->getArgsDefs();
+
+    writer.str(function_signature.first);
+    writer.u32(args_defs.size());
+    for (FunctionArgument* arg : args_defs) {
+      writer.str(arg->getName());
+      writer.value(arg->getDefaultValue() ? arg->getDefaultValue()->getTaggedValue() : TaggedValue());
+    }
+  }
+
+  const std::map<std::string, NodeValue*>& variables = context->getVariables();
+  writer.u32(variables.size());
+  for (auto& variable : variables) {
+    NodeValue* node_value = variable.second;
+
+    writer.str(variable.first);
+    writer.value(node_value ? TaggedValue::borrowed(node_value->getType(), node_value->getRawValue()) : TaggedValue());
+
+    bool reassigned = false;
+    std::set<std::string> dependents;
+    global_variable_saved_state(variable.first, reassigned, dependents);
+    writer.u32(reassigned);
+    writer.u32(dependents.size());
+    for (const std::string& dependent : dependents) {
+      writer.str(dependent);
+    }
+  }
+
+  std::vector<MemoryBufferRef> objects = TheJIT->getSessionObjects();
+  writer.u32(objects.size());
+  for (MemoryBufferRef object : objects) {
+    writer.object(object);
+  }
+
+  if (!writer.writeTo(file_path)) {
+    return false;
+  }
+
+  ++NumSnapshotsSaved;
+  return true;
+}
+
+bool restore_snapshot(const std::string& file_path, ASTContext* context) {
+  ErrorOr<std::unique_ptr<MemoryBuffer>> file = MemoryBuffer::getFile(file_path, -1, false);
+  if (!file) {
+    return false;
+  }
+
+  // the whole file is read and checked before anything is restored
+  SnapshotReader reader((*file)->getBufferStart(), (*file)->getBufferSize());
+  if (!reader.open() || !read_target(reader)) {
+    return false;
+  }
+
+  uint32_t functions_count = 0;
+  if (!reader.u32(functions_count)) {
+    return false;
+  }
+
+  std::vector<SnapshotFunction> functions(functions_count);
+  for (SnapshotFunction& function : functions) {
+    uint32_t args_count = 0;
+    if (!reader.str(function.name) || !reader.u32(args_count)) {
+      return false;
+    }
+
+    for (uint32_t i = 0; i < args_count; ++i) {
+      StringRef arg_name;
+      TaggedValue default_value;
+      if (!reader.str(arg_name) || !reader.value(default_value)) {
+        return false;
+      }
+      function.args.emplace_back(arg_name, default_value);
+    }
+  }
+
+  uint32_t variables_count = 0;
+  if (!reader.u32(variables_count)) {
+    return false;
+  }
+
+  std::vector<SnapshotVariable> variables(variables_count);
+  for (SnapshotVariable& variable : variables) {
+    uint32_t reassigned = 0;
+    uint32_t dependents_count = 0;
+    if (!reader.str(variable.name) || !reader.value(variable.value) || !reader.u32(reassigned) ||
+        !reader.u32(dependents_count)) {
+      return false;
+    }
+
+    variable.reassigned = reassigned != 0;
+    for (uint32_t i = 0; i < dependents_count; ++i) {
+      StringRef dependent;
+      if (!reader.str(dependent)) {
+        return false;
+      }
+      variable.dependents.insert(dependent.str());
+    }
+  }
+
+  uint32_t objects_count = 0;
+  if (!reader.u32(objects_count)) {
+    return false;
+  }
+
+  std::vector<StringRef> objects(objects_count);
+  for (StringRef& object : objects) {
+    if (!reader.object(object)) {
+      return false;
+    }
+
+    Expected<std::unique_ptr<object::ObjectFile>> object_file =
+        object::ObjectFile::createObjectFile(MemoryBufferRef(object, file_path));
+    if (!object_file) {
+      consumeError(object_file.takeError());
+      return false;
+    }
+  }
+
+  if (!reader.atEnd()) {
+    return false;
+  }
+
+  // in the order they were compiled, so the newest definition of a function
+  // still wins
+  for (StringRef object : objects) {
+    if (!TheJIT->addObject(MemoryBuffer::getMemBuffer(object, file_path, false), true)) {
+      return false;
+    }
+    ++NumSnapshotObjects;
+  }
+
+  for (SnapshotFunction& function : functions) {
+    std::vector<FunctionArgument*> args_defs;
+    for (auto& arg : function.args) {
+      args_defs.push_back(new FunctionArgument(arg.first.str(), VoidTy, default_value_node(arg.second, context)));
+    }
+
+    context->storeFunctionSignature(function.name.str(),
+                                    new FunctionSignature(function.name.str(), args_defs, StructTy_struct_datatype_t));
+    ++NumSnapshotFunctions;
+  }
+
+  for (SnapshotVariable& variable : variables) {
+    context->storeVariable(variable.name.str(), variable.value.toNodeValue());
+    global_variable_restored(variable.name.str(), variable.reassigned, variable.dependents);
+    ++NumSnapshotVariables;
+  }
+
+  if (noname::debug >= 1) {
+    fprintf(stdout, "\n[snapshot '%s': %u functions, %u variables, %u objects]", file_path.c_str(), functions_count,
+            variables_count, objects_count);
+    fflush(stdout);
+  }
+
+  return true;
+}
+
+bool run_session_command(const char* line, int size) {
+  StringRef command = StringRef(line, size).trim();
+  if (command != ":save" && !command.startswith(":save ")) {
+    return false;
+  }
+
+  StringRef file_path = command.drop_front(sizeof(":save") - 1).trim();
+  if (file_path.empty()) {
+    fprintf(stderr, "\nError: usage is :save <file>");
+  } else if (noname::profile_mode == PROFILE_GENERATE) {
+    fprintf(stderr, "\nError: a session run with -profile-generate cannot be saved");
+  } else if (!save_snapshot(file_path.str(), context)) {
+    if (TheJIT->hasHostAddresses()) {
+      fprintf(stderr, "\nError: the session runs code pointing to addresses of this process, it cannot be saved");
+    } else {
+      fprintf(stderr, "\nError: could not save the session to '%s'", file_path.str().c_str());
+    }
+  }
+
+  write_cursor();
+  return true;
+}
+}
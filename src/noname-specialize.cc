@@ -0,0 +1,119 @@
+#include "noname-specialize.h"
+#include "noname-utils.h"
+#include "noname-types.h"
+#include "noname-stats.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+namespace noname {
+
+unsigned specialize_limit = 4;
+
+static Statistic NumSpecializeClones("specialize", "clones", "Number of specialized clones generated");
+static Statistic NumSpecializeHits("specialize", "hits", "Number of calls to a clone already generated in the module");
+static Statistic NumSpecializeCapped("specialize", "capped", "Number of calls not specialized because of -specialize-limit");
+
+static std::map<std::string, FunctionDefNode*> function_definitions;
+// constant patterns specialized so far, per function
+static std::map<std::string, std::set<std::string>> function_patterns;
+
+void specialize_register_function(FunctionDefNode* function_def_node) {
+  function_definitions[function_def_node->getName()] = function_def_node;
+}
+
+// "_" for an argument passed at run time, type and bits of the number otherwise
+static std::string constant_pattern(const TaggedValue& value) {
+  uint64_t bits = 0;
+  if (value.getType() == TYPE_DOUBLE || value.getType() == TYPE_FLOAT) {
+    double number = value.as<double>();
+    memcpy(&bits, &number, sizeof(bits));
+  } else {
+    bits = (uint64_t)value.as<long>();
+  }
+
+  char pattern[64];
+  snprintf(pattern, sizeof(pattern), "%dx%" PRIx64, value.getType(), bits);
+  return pattern;
+}
+
+Function* specialize_call(const std::string& callee, const std::vector<ExpNode*>& arg_nodes,
+                          std::vector<bool>& folded_args) {
+  if (!specialize_limit) {
+    return nullptr;
+  }
+
+  auto it_definition = function_definitions.find(callee);
+  if (it_definition == function_definitions.end()) {
+    return nullptr;
+  }
+
+  FunctionDefNode* function_def_node = it_definition->second;
+  // its context holds the values of the body being generated
+  if (is_function_being_generated(function_def_node) ||
+      function_def_node->getFunctionArguments().size() != arg_nodes.size()) {
+    return nullptr;
+  }
+
+  std::vector<TaggedValue> constants(arg_nodes.size());
+  std::string pattern;
+  bool any_constant = false;
+
+  for (size_t i = 0; i < arg_nodes.size(); i++) {
+    if (isa<NumberExpNode>(arg_nodes[i])) {
+      constants[i] = arg_nodes[i]->getTaggedValue();
+    }
+
+    pattern += constants[i].isDefined() ? "." + constant_pattern(constants[i]) : "._";
+    any_constant = any_constant || constants[i].isDefined();
+  }
+
+  if (!any_constant) {
+    return nullptr;
+  }
+
+  folded_args.clear();
+  for (const TaggedValue& constant : constants) {
+    folded_args.push_back(constant.isDefined());
+  }
+
+  std::string clone_name = callee + ".spec" + pattern;
+  Function* clone = TheModule->getFunction(clone_name);
+  if (clone) {
+    ++NumSpecializeHits;
+    return clone;
+  }
+
+  std::set<std::string>& patterns = function_patterns[callee];
+  if (!patterns.count(pattern) && patterns.size() >= specialize_limit) {
+    ++NumSpecializeCapped;
+    return nullptr;
+  }
+
+  std::vector<Constant*> constant_args;
+  for (size_t i = 0; i < constants.size(); i++) {
+    const std::string& arg_name = function_def_node->getFunctionArguments()[i]->getName();
+    constant_args.push_back(constants[i].isDefined() ? constant_datatype_codegen(constants[i], clone_name + "." + arg_name) : nullptr);
+  }
+
+  clone = function_def_node->codegen_specialization(clone_name, constant_args);
+  if (!clone) {
+    return nullptr;
+  }
+
+  if (noname::debug >= 1) {
+    fprintf(stdout, "\n[Specialized %s as %s]", callee.c_str(), clone_name.c_str());
+    fflush(stdout);
+  }
+
+  patterns.insert(pattern);
+  ++NumSpecializeClones;
+  return clone;
+}
+}
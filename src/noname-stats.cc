@@ -0,0 +1,40 @@
+#include "noname-stats.h"
+#include <string.h>
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+namespace noname {
+
+bool print_stats = false;
+
+// head of the intrusive list of registered statistics; zero-initialized before
+// any dynamic initializer runs so registration order across files is irrelevant
+static Statistic *statistics_head = nullptr;
+
+Statistic::Statistic(const char *group, const char *name, const char *desc)
+    : group(group), name(name), desc(desc), value(0), next(statistics_head) {
+  statistics_head = this;
+}
+
+void print_statistics(FILE *file) {
+  std::vector<Statistic *> statistics;
+  for (Statistic *statistic = statistics_head; statistic; statistic = statistic->getNext()) {
+    statistics.push_back(statistic);
+  }
+
+  std::sort(statistics.begin(), statistics.end(), [](const Statistic *s1, const Statistic *s2) {
+    int cmp = strcmp(s1->getGroup(), s2->getGroup());
+    return cmp != 0 ? cmp < 0 : strcmp(s1->getName(), s2->getName()) < 0;
+  });
+
+  fprintf(file, "\n===-------------------------------------------------------------------------===\n");
+  fprintf(file, "                          ... Statistics Collected ...\n");
+  fprintf(file, "===-------------------------------------------------------------------------===\n");
+
+  for (Statistic *statistic : statistics) {
+    fprintf(file, "%14lld %-12s - %s\n", (long long)statistic->getValue(), statistic->getGroup(), statistic->getDesc());
+  }
+  fflush(file);
+}
+}
@@ -1,6 +1,7 @@
 #include "noname-utils.h"
 #include "noname-types.h"
 #include "noname-jit.h"
+#include "noname-dedupe.h"
 #include <limits.h>
 #include <stdio.h>
 #include <algorithm>
@@ -83,6 +84,7 @@ ASTNode* new_top_level_exp_node(ExpNode* exp_node) {
     return function_def_node;
   }
 
+  DedupeRecording recording;
   Function* anonymous_function = (Function*)function_def_node->codegen();
 
   if (!anonymous_function) {
@@ -97,6 +99,7 @@ ASTNode* new_top_level_exp_node(ExpNode* exp_node) {
 
   TopLevelExpNode* top_level_exp_node =
       new TopLevelExpNode(top_level_context, exp_node, (CallExpNode*)call_exp_node, anonymous_function);
+  top_level_exp_node->setCallees(recording.getCallees());
 
   return top_level_exp_node;
 }
@@ -271,8 +274,11 @@ void* TopLevelExpNodeProcessorStrategy::process(ASTNode* node) {
 
     call_and_print_jit_symbol_value(stdout, result_type, ExprSymbol);
 
-    // Delete the anonymous expression module from the JIT.
-    TheJIT->removeModule(module_handle);
+    // Delete the anonymous expression module from the JIT, unless it is kept
+    // for the identical expressions that follow
+    if (!dedupe_keep_top_level(top_level_exp_node, module_handle, ExprSymbol.getAddress(), result_type)) {
+      TheJIT->removeModule(module_handle);
+    }
   }
 
   top_level_exp_node->release();
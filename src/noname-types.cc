@@ -1,6 +1,8 @@
 #include "noname-utils.h"
 #include "noname-types.h"
 #include "noname-jit.h"
+#include "noname-ast-file.h"
+#include "noname-globals.h"
 #include <limits.h>
 #include <stdio.h>
 #include <algorithm>
@@ -26,6 +28,7 @@ extern FILE *fin;
 namespace noname {
 
 int debug = 0;
+FPMode fp_mode = FP_MODE_STRICT;
 LLVMContext TheContext;
 IRBuilder<> Builder(TheContext);
 std::unique_ptr<Module> TheModule;
@@ -74,6 +77,7 @@ ProcessorStrategy *functionDefNodeProcessorStrategy;
 ProcessorStrategy *assignmentNodeProcessorStrategy;
 ProcessorStrategy *callNodeProcessorStrategy;
 ProcessorStrategy *importNodeProcessorStrategy;
+ProcessorStrategy *loopNodeProcessorStrategy;
 
 void InitializeNonameEnvironment() {
   if (initialized) {
@@ -232,6 +236,9 @@ void InitializeNonameEnvironment() {
   assignmentNodeProcessorStrategy = new AssignmentNodeProcessorStrategy();
   callNodeProcessorStrategy = new CallExpNodeProcessorStrategy();
   importNodeProcessorStrategy = new ImportNodeProcessorStrategy();
+  loopNodeProcessorStrategy = new LoopNodeProcessorStrategy();
+
+  register_host_symbols();
 
   initialized = true;
 }
@@ -249,6 +256,7 @@ void ReleaseNonameEnvironment() {
   delete assignmentNodeProcessorStrategy;
   delete callNodeProcessorStrategy;
   delete importNodeProcessorStrategy;
+  delete loopNodeProcessorStrategy;
 
   if (noname::debug >= 1) {
     fprintf(stderr, "\n[END OF PROGRAM]");
@@ -327,6 +335,8 @@ void print_node_value(FILE *file, NodeValue *node_value) {
       fprintf(file, "\n##########[print_node_value] %lf", *(double *)node_value->getRawValue());
     } else if (node_value->getType() == TYPE_STRING) {
       fprintf(file, "\n##########[print_node_value] %s", (*(std::string *)node_value->getRawValue()).c_str());
+    } else if (node_value->getType() == TYPE_BIGINT) {
+      fprintf(file, "\n##########[print_node_value] %s", ((BigInt *)node_value->getRawValue())->toString().c_str());
     } else {
       fprintf(file == stdout ? stderr : file, "\n##########[print_node_value] [WARN] could not print type %d", node_value->getType());
     }
@@ -341,6 +351,8 @@ void print_node_value(FILE *file, NodeValue *node_value) {
       fprintf(file, "%lf", *(double *)node_value->getRawValue());
     } else if (node_value->getType() == TYPE_STRING) {
       fprintf(file, "%s", (*(std::string *)node_value->getRawValue()).c_str());
+    } else if (node_value->getType() == TYPE_BIGINT) {
+      fprintf(file, "%s", ((BigInt *)node_value->getRawValue())->toString().c_str());
     } else {
       fprintf(file == stdout ? stderr : file, "[WARN] could not print type %d", node_value->getType());
     }
@@ -456,6 +468,10 @@ void print_jit_symbol_value(FILE *file, int result_type, void *result) {
       fprintf(file, "\n###########[call_and_print_jit_symbol_value] %c", *(char *)result);
       fflush(file);
 
+    } else if (result_type == TYPE_BIGINT) {
+      fprintf(file, "\n###########[call_and_print_jit_symbol_value] %s", ((BigInt *)result)->toString().c_str());
+      fflush(file);
+
     } else if (result_type == TYPE_DATATYPE) {
       fprintf(file, "\n###########[call_and_print_jit_symbol_value] %d", (*(datatype_t *)result).type);
       fflush(file);
@@ -495,6 +511,10 @@ void print_jit_symbol_value(FILE *file, int result_type, void *result) {
       fprintf(file, "%c", *(char *)result);
       fflush(file);
 
+    } else if (result_type == TYPE_BIGINT) {
+      fprintf(file, "%s", ((BigInt *)result)->toString().c_str());
+      fflush(file);
+
     } else if (result_type == TYPE_DATATYPE) {
       datatype_t datatype_result = *((datatype_t *)result);
       print_jit_symbol_value(file, datatype_result.type, datatype_result.v);
@@ -866,19 +886,52 @@ ImportNode *new_import(ASTContext *context, std::string filename) {
   return new_node;
 }
 
+TaggedValue ExpNode::getTaggedValue() const {
+  std::unique_ptr<NodeValue> node_value = getValue();
+
+  if (!node_value) {
+    return TaggedValue();
+  }
+
+  // copied: the NodeValue goes away with this frame
+  TaggedValue value = TaggedValue::borrowed(node_value->getType(), node_value->getRawValue());
+  if (value.getType() == TYPE_STRING) {
+    return TaggedValue(value.asString());
+  } else if (value.getType() == TYPE_BIGINT) {
+    return TaggedValue(value.asBigInt());
+  }
+  return value;
+}
+
 std::unique_ptr<NodeValue> StringExpNode::getValue() const {
   NodeValue *node = new NodeValue(value);
   return std::unique_ptr<NodeValue>(node);
 }
 
+TaggedValue StringExpNode::getTaggedValue() const { return TaggedValue::borrowed(TYPE_STRING, &value); }
+
 std::unique_ptr<NodeValue> VarExpNode::getValue() const {
   NodeValue *node = getContext()->getVariable(name);
 
   if (!node) {
     fprintf(stdout, "\n\n############ could not find %s on context %s \n\n", name.c_str(), getContext()->getName().c_str());
+    return std::unique_ptr<NodeValue>(nullptr);
   }
 
-  return std::unique_ptr<NodeValue>(node);
+  // the context keeps owning the variable; reading it (e.g. in every iteration
+  // of a loop) must not release it
+  return std::unique_ptr<NodeValue>(new NodeValue(*node));
+}
+
+TaggedValue VarExpNode::getTaggedValue() const {
+  NodeValue *node = getContext()->getVariable(name);
+
+  if (!node) {
+    fprintf(stdout, "\n\n############ could not find %s on context %s \n\n", name.c_str(), getContext()->getName().c_str());
+    return TaggedValue();
+  }
+
+  return TaggedValue::borrowed(node->getType(), node->getRawValue());
 }
 
 bool both_of_type(int lhs_type, int rhs_type, int type) { return lhs_type == type && rhs_type == type; }
@@ -897,60 +950,32 @@ bool match_to_types(NodeValue *lhs, NodeValue *rhs, int type1, int type2) {
   return lhs && rhs && match_to_types(lhs->getType(), rhs->getType(), type1, type2);
 }
 
+// The promotion table is the one of the runtime, which spells the tags out
+static_assert(TYPE_CHAR == 36 && TYPE_SHORT == 37 && TYPE_INT == 38 && TYPE_FLOAT == 39 && TYPE_LONG == 40 && TYPE_DOUBLE == 41,
+              "the numeric type tags of src/noname-runtime.cc no longer match");
+
 int get_adequate_result_type(NodeValue *lhs, NodeValue *rhs) {
-  if (any_of_type(lhs, rhs, TYPE_DOUBLE)) {
-    return TYPE_DOUBLE;
+  if (!lhs || !rhs) {
+    return 0;
   }
-  if (both_of_type(lhs, rhs, TYPE_FLOAT)) {
-    return TYPE_FLOAT;
-  }
-  if (match_to_types(lhs, rhs, TYPE_FLOAT, TYPE_LONG)) {
-    return TYPE_DOUBLE;
-  }
-  if (any_of_type(lhs, rhs, TYPE_FLOAT)) {
-    return TYPE_FLOAT;
-  }
-  if (any_of_type(lhs, rhs, TYPE_LONG)) {
-    return TYPE_LONG;
-  }
-  if (any_of_type(lhs, rhs, TYPE_INT)) {
-    return TYPE_INT;
-  }
-  if (any_of_type(lhs, rhs, TYPE_SHORT)) {
-    return TYPE_SHORT;
-  }
-  if (any_of_type(lhs, rhs, TYPE_CHAR)) {
-    return TYPE_CHAR;
-  }
-  return 0;
+  return get_adequate_result_type(lhs->getType(), rhs->getType());
 }
 
 int get_adequate_result_type(int lhs_type, int rhs_type) {
-  if (any_of_type(lhs_type, rhs_type, TYPE_DOUBLE)) {
-    return TYPE_DOUBLE;
-  }
-  if (both_of_type(lhs_type, rhs_type, TYPE_FLOAT)) {
-    return TYPE_FLOAT;
-  }
-  if (match_to_types(lhs_type, rhs_type, TYPE_FLOAT, TYPE_LONG)) {
-    return TYPE_DOUBLE;
-  }
-  if (any_of_type(lhs_type, rhs_type, TYPE_FLOAT)) {
-    return TYPE_FLOAT;
-  }
-  if (any_of_type(lhs_type, rhs_type, TYPE_LONG)) {
-    return TYPE_LONG;
-  }
-  if (any_of_type(lhs_type, rhs_type, TYPE_INT)) {
-    return TYPE_INT;
-  }
-  if (any_of_type(lhs_type, rhs_type, TYPE_SHORT)) {
-    return TYPE_SHORT;
+  // a bigint stays one with any integer and becomes a double with a float
+  if (lhs_type == TYPE_BIGINT || rhs_type == TYPE_BIGINT) {
+    int other_type = lhs_type == TYPE_BIGINT ? rhs_type : lhs_type;
+
+    if (other_type == TYPE_FLOAT || other_type == TYPE_DOUBLE) {
+      return TYPE_DOUBLE;
+    }
+    return other_type == TYPE_BIGINT || is_numeric_type(other_type) ? TYPE_BIGINT : 0;
   }
-  if (any_of_type(lhs_type, rhs_type, TYPE_CHAR)) {
-    return TYPE_CHAR;
+
+  if (!is_numeric_type(lhs_type) || !is_numeric_type(rhs_type)) {
+    return 0;
   }
-  return 0;
+  return noname_numeric_promotion_table[lhs_type - TYPE_CHAR][rhs_type - TYPE_CHAR];
 }
 
 void *ASTNodeProcessorStrategy::process(ASTNode *node) {
@@ -981,8 +1006,15 @@ void *ImportNodeProcessorStrategy::process(ASTNode *node) {
       }
     } else {
       imported_files.push_back(file_path);
-      read_from_file_import = true;
-      fin = opened_file;
+
+      // lib.nn.ast emitted from this very lib.nn saves parsing it again
+      uint64_t source_hash = 0;
+      if (hash_source_file(file_path, source_hash) && run_ast_file(std::string(file_path) + ".ast", source_hash)) {
+        fclose(opened_file);
+      } else {
+        read_from_file_import = true;
+        fin = opened_file;
+      }
     }
 
   } else {
@@ -1016,65 +1048,49 @@ std::unique_ptr<NodeValue> NumberExpNode::getValue() const {
   return std::unique_ptr<NodeValue>(node);
 }
 
+TaggedValue NumberExpNode::getTaggedValue() const { return TaggedValue::borrowed(type, value); }
+
+static size_t number_size(int type) {
+  if (type == TYPE_DOUBLE) {
+    return sizeof(double);
+  } else if (type == TYPE_LONG) {
+    return sizeof(long);
+  } else if (type == TYPE_INT) {
+    return sizeof(int);
+  } else if (type == TYPE_FLOAT) {
+    return sizeof(float);
+  } else if (type == TYPE_SHORT) {
+    return sizeof(short);
+  } else if (type == TYPE_CHAR) {
+    return sizeof(char);
+  }
+  return 0;
+}
+
+void NumberExpNode::canonicalize(std::string& out) const {
+  ExpNode::canonicalize(out);
+  canonical_append(out, (uint64_t)type);
+  canonical_append(out, value, number_size(type));
+}
+
 //===----------------------------------------------------------------------===//
 // Code Generation
 //===----------------------------------------------------------------------===//
 std::vector<Value *> NumberExpNode::codegen_elements(Error &error, llvm::BasicBlock *bb) const {
   std::vector<Value *> codegen;
-  std::unique_ptr<NodeValue> node(getValue());
 
-  if (!node) {
-    createError(error, "Invalid or undefined NodeValue");
-    return codegen;
-  }
-
-  ConstantInt *const_int32_type = ConstantInt::get(TheContext, APInt(32, type, true));
-
-  // struct datatype_t
-  AllocaInst *alloca_datatype = alloca_typed_var_codegen(TYPE_DATATYPE, bb);
-
-  codegen.push_back(alloca_datatype);
-  // codegen.push_back(alloca_value);
-
-  // typed value
-  Value *constant_value = node->constant_codegen(bb);
-
-  if (!constant_value) {
+  // The boxed value points to a read only global of the module instead of the
+  // stack frame: the datatype_t outlives the frame when it is returned or
+  // passed to a tail call. Values are never modified in place, so the global is
+  // shared by every evaluation; it goes away with its module and relocates with
+  // its object (snapshots, the precompiled prelude).
+  Constant *constant = constant_datatype_codegen(getTaggedValue(), "noname_literal");
+  if (!constant) {
     createError(error, "Invalid or undefined constant value");
     return codegen;
   }
 
-  // TODO: START HERE
-  // TODO: START HERE
-  // TODO: START HERE
-  // TODO: START HERE
-  // TODO: START HERE
-  // TODO: START HERE
-  // CallInst *malloc_ptr = push_back_ret(codegen, CallInst::Create(func__Znwm, const_int64_8, "call1", bb));
-  // CastInst *ptr_146 = push_back_ret(codegen, new BitCastInst(malloc_ptr, toLLVMPointerType(type), "", bb));
-  // push_back_ret(codegen, new StoreInst(constant_value, ptr_146, false, bb));
-  // CastInst *ptr_148 = push_back_ret(codegen, new BitCastInst(ptr_146, PointerTy_8, "", bb));
-
-  GetElementPtrInst *get_elem_ptr_v = push_back_ret(
-      codegen, GetElementPtrInst::Create(StructTy_struct_datatype_t, alloca_datatype, {const_int32_0, const_int32_1}, "v", bb));
-  GetElementPtrInst *get_elem_ptr_type = push_back_ret(
-      codegen, GetElementPtrInst::Create(StructTy_struct_datatype_t, alloca_datatype, {const_int32_0, const_int32_0}, "type", bb));
-
-  AllocaInst *alloca_value_typed = alloca_typed_var_codegen(type, bb);
-  codegen.push_back(store_typed_var_codegen(type, constant_value, alloca_value_typed, bb));
-
-  CastInst *cast_inst_untyped = new BitCastInst(alloca_value_typed, PointerTy_8, "cast_inst_untyped", bb);
-  codegen.push_back(cast_inst_untyped);
-
-  StoreInst *store_ptr_v = store_typed_var_codegen(TYPE_VOID_POINTER, cast_inst_untyped, get_elem_ptr_v, bb);
-  codegen.push_back(store_ptr_v);
-
-  StoreInst *store_ptr_type = store_typed_var_codegen(TYPE_INT, const_int32_type, get_elem_ptr_type, bb);
-  codegen.push_back(store_ptr_type);
-
-  LoadInst *load_inst_type = load_inst_codegen(TYPE_DATATYPE, alloca_datatype, bb);
-  codegen.push_back(load_inst_type);
-
+  codegen.push_back(constant);
   return codegen;
 }
 Value *NumberExpNode::codegen(llvm::BasicBlock *bb) {
@@ -1152,9 +1168,28 @@ void prepare(Error &error, VarExpNode_Data_t &data, std::vector<Value *> &codege
 std::vector<Value *> VarExpNode::codegen_elements(Error &error, llvm::BasicBlock *bb) const {
   std::vector<Value *> codegen;
 
+  // arguments and local variables live in stack slots (see
+  // FunctionDefNode::codegen and DeclarationNode::codegen_elements)
+  AllocaInst *var_alloca_datatype = getContext()->getAllocaInst(getName());
+  if (var_alloca_datatype) {
+    push_back_ret(codegen, load_inst_codegen(TYPE_DATATYPE, var_alloca_datatype, bb));
+    return codegen;
+  }
+
+  // top level variables are constants or slots of the host (see noname-globals.h)
+  Value *global_datatype = global_variable_codegen(getName(), bb);
+  if (global_datatype) {
+    codegen.push_back(global_datatype);
+    return codegen;
+  }
+
   VarExpNode_Data_t data;
   prepare(error, data, codegen, this, bb);
 
+  if (error.code()) {
+    return codegen;
+  }
+
   push_back_ret(codegen, store_typed_var_codegen(TYPE_DATATYPE, data.var_value, data.alloca_datatype, bb));
 
   // push_back_ret(codegen, store_typed_var_codegen(TYPE_DATATYPE, data.var_value, data.var_alloca_datatype, bb));